@@ -388,3 +388,57 @@ adminServerSetClientLimits(virNetServerPtr srv,
 
     return 0;
 }
+
+int
+adminServerGetMessagePoolStats(virNetServerPtr srv,
+                               virTypedParameterPtr *params,
+                               int *nparams,
+                               unsigned int flags)
+{
+    int ret = -1;
+    int maxparams = 0;
+    virTypedParameterPtr tmpparams = NULL;
+    virNetMessagePoolStats stats;
+
+    virCheckFlags(0, -1);
+
+    virNetServerGetMessagePoolStats(srv, &stats);
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MESSAGE_POOL_MSG_HITS,
+                                stats.msgHits) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MESSAGE_POOL_MSG_MISSES,
+                                stats.msgMisses) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MESSAGE_POOL_BUF_HITS,
+                                stats.bufHits) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddULLong(&tmpparams, nparams, &maxparams,
+                                VIR_SERVER_MESSAGE_POOL_BUF_MISSES,
+                                stats.bufMisses) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_MESSAGE_POOL_MSG_FREE,
+                              stats.nfreeMsgs) < 0)
+        goto cleanup;
+
+    if (virTypedParamsAddUInt(&tmpparams, nparams, &maxparams,
+                              VIR_SERVER_MESSAGE_POOL_BUF_FREE,
+                              stats.nfreeBufs) < 0)
+        goto cleanup;
+
+    *params = tmpparams;
+    tmpparams = NULL;
+    ret = 0;
+
+ cleanup:
+    virTypedParamsFree(tmpparams, *nparams);
+    return ret;
+}
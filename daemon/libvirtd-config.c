@@ -152,6 +152,7 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
     data->max_anonymous_clients = 20;
 
     data->prio_workers = 5;
+    data->io_workers = 0;
 
     data->max_requests = 20;
     data->max_client_requests = 5;
@@ -347,6 +348,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
 
     if (virConfGetValueUInt(conf, "prio_workers", &data->prio_workers) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "io_workers", &data->io_workers) < 0)
+        goto error;
 
     if (virConfGetValueUInt(conf, "max_requests", &data->max_requests) < 0)
         goto error;
@@ -380,6 +383,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         goto error;
     if (virConfGetValueString(conf, "log_outputs", &data->log_outputs) < 0)
         goto error;
+    if (virConfGetValueUInt(conf, "log_async_records", &data->log_async_records) < 0)
+        goto error;
 
     if (virConfGetValueInt(conf, "keepalive_interval", &data->keepalive_interval) < 0)
         goto error;
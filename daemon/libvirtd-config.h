@@ -70,6 +70,7 @@ struct daemonConfig {
     unsigned int max_anonymous_clients;
 
     unsigned int prio_workers;
+    unsigned int io_workers;
 
     unsigned int max_requests;
     unsigned int max_client_requests;
@@ -77,6 +78,7 @@ struct daemonConfig {
     unsigned int log_level;
     char *log_filters;
     char *log_outputs;
+    unsigned int log_async_records;
 
     unsigned int audit_level;
     bool audit_logging;
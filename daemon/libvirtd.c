@@ -1253,6 +1253,14 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* The writer thread wouldn't survive daemonizing, so only start
+     * it once we run in the final process */
+    if (config->log_async_records &&
+        virLogSetAsync(config->log_async_records) < 0) {
+        VIR_ERROR(_("Failed to enable asynchronous logging"));
+        goto cleanup;
+    }
+
     /* Ensure the rundir exists (on tmpfs on some systems) */
     if (privileged) {
         if (VIR_STRDUP_QUIET(run_dir, LOCALSTATEDIR "/run/libvirt") < 0) {
@@ -1309,6 +1317,11 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    if (virNetServerSetIOWorkers(srv, config->io_workers) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     if (!(dmn = virNetDaemonNew()) ||
         virNetDaemonAddServer(dmn, srv) < 0) {
         ret = VIR_DAEMON_ERR_INIT;
@@ -1533,5 +1546,8 @@ int main(int argc, char **argv) {
      * 'dmn' as a parameter are done, we can finally unref 'dmn' */
     virObjectUnref(dmn);
 
+    /* Flush any queued log messages */
+    ignore_value(virLogSetAsync(0));
+
     return ret;
 }
@@ -404,6 +404,62 @@ int virAdmServerSetClientLimits(virAdmServerPtr srv,
                                 int nparams,
                                 unsigned int flags);
 
+/* Message pool statistics */
+
+/**
+ * VIR_SERVER_MESSAGE_POOL_MSG_HITS:
+ * Macro for per-server message pool statistic: number of messages which
+ * were reused from the pool rather than allocated, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MESSAGE_POOL_MSG_HITS "msg_hits"
+
+/**
+ * VIR_SERVER_MESSAGE_POOL_MSG_MISSES:
+ * Macro for per-server message pool statistic: number of messages which
+ * had to be allocated because the pool was empty, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MESSAGE_POOL_MSG_MISSES "msg_misses"
+
+/**
+ * VIR_SERVER_MESSAGE_POOL_BUF_HITS:
+ * Macro for per-server message pool statistic: number of message buffers
+ * which were reused from the pool rather than allocated,
+ * as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MESSAGE_POOL_BUF_HITS "buf_hits"
+
+/**
+ * VIR_SERVER_MESSAGE_POOL_BUF_MISSES:
+ * Macro for per-server message pool statistic: number of message buffers
+ * which had to be allocated, as VIR_TYPED_PARAM_ULLONG.
+ */
+
+# define VIR_SERVER_MESSAGE_POOL_BUF_MISSES "buf_misses"
+
+/**
+ * VIR_SERVER_MESSAGE_POOL_MSG_FREE:
+ * Macro for per-server message pool statistic: number of idle messages
+ * currently held by the pool, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_MESSAGE_POOL_MSG_FREE "msg_free"
+
+/**
+ * VIR_SERVER_MESSAGE_POOL_BUF_FREE:
+ * Macro for per-server message pool statistic: number of idle message
+ * buffers currently held by the pool, as VIR_TYPED_PARAM_UINT.
+ */
+
+# define VIR_SERVER_MESSAGE_POOL_BUF_FREE "buf_free"
+
+int virAdmServerGetMessagePoolStats(virAdmServerPtr srv,
+                                    virTypedParameterPtr *params,
+                                    int *nparams,
+                                    unsigned int flags);
+
 int virAdmConnectGetLoggingOutputs(virAdmConnectPtr conn,
                                    char **outputs,
                                    unsigned int flags);
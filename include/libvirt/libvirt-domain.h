@@ -2042,6 +2042,9 @@ typedef enum {
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_SHUTOFF = VIR_CONNECT_LIST_DOMAINS_SHUTOFF,
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_OTHER = VIR_CONNECT_LIST_DOMAINS_OTHER,
 
+    VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED = 1 << 29, /* report stats from the
+                                                            latest background
+                                                            sample */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING = 1 << 30, /* include backing chain for block stats */
     VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS = 1U << 31, /* enforce requested stats */
 } virConnectGetAllDomainStatsFlags;
@@ -3427,6 +3430,24 @@ typedef enum {
  */
 # define VIR_DOMAIN_JOB_AUTO_CONVERGE_THROTTLE  "auto_converge_throttle"
 
+/**
+ * VIR_DOMAIN_JOB_TUNNEL_BYTES:
+ *
+ * virDomainGetJobStats field: number of bytes forwarded by libvirt
+ * through the tunnel of a tunnelled migration, as VIR_TYPED_PARAM_ULLONG.
+ * Only reported for completed migrations.
+ */
+# define VIR_DOMAIN_JOB_TUNNEL_BYTES             "tunnel_bytes"
+
+/**
+ * VIR_DOMAIN_JOB_TUNNEL_BPS:
+ *
+ * virDomainGetJobStats field: average throughput of the tunnel of a
+ * tunnelled migration in Bytes per second, as VIR_TYPED_PARAM_ULLONG.
+ * Only reported for completed migrations.
+ */
+# define VIR_DOMAIN_JOB_TUNNEL_BPS               "tunnel_bps"
+
 
 /**
  * virConnectDomainEventGenericCallback:
@@ -58,6 +58,7 @@
 #include "virnetdevmacvlan.h"
 #include "virhostdev.h"
 #include "virmdev.h"
+#include "virhashcode.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -82,6 +83,9 @@ struct _virDomainXMLOption {
 
     /* Private data for save image stored in snapshot XML */
     virSaveCookieCallbacks saveCookie;
+
+    /* Persist status changes as records appended to a journal */
+    bool statusJournal;
 };
 
 #define VIR_DOMAIN_DEF_FORMAT_COMMON_FLAGS             \
@@ -1166,6 +1170,25 @@ virDomainXMLOptionGetSaveCookie(virDomainXMLOptionPtr xmlopt)
 }
 
 
+/**
+ * virDomainXMLOptionSetStatusJournal:
+ * @xmlopt: XML parser configuration object
+ * @enable: whether to use the status journal
+ *
+ * When enabled, virDomainSaveStatus() only appends the part of the
+ * status XML which changed since the previous save to a per-domain
+ * journal instead of rewriting the whole status file each time. The
+ * journal is folded back into the status file when it grows too big
+ * and when the status is loaded.
+ */
+void
+virDomainXMLOptionSetStatusJournal(virDomainXMLOptionPtr xmlopt,
+                                   bool enable)
+{
+    xmlopt->statusJournal = enable;
+}
+
+
 void
 virBlkioDeviceArrayClear(virBlkioDevicePtr devices,
                          int ndevices)
@@ -3015,6 +3038,7 @@ static void virDomainObjDispose(void *obj)
         (dom->privateDataFreeFunc)(dom->privateData);
 
     virDomainSnapshotObjListFree(dom->snapshots);
+    VIR_FREE(dom->statusXML);
 }
 
 virDomainObjPtr
@@ -25750,6 +25774,363 @@ virDomainSaveConfig(const char *configDir,
     return ret;
 }
 
+/*
+ * The status journal lives next to the status file as <name>.journal.
+ * It starts with a header identifying the status XML it applies to:
+ *
+ *   libvirt-status-journal <length> <hash>
+ *
+ * followed by one record per save, each replacing everything between
+ * the first <prefix> and the last <suffix> bytes of the previous
+ * status XML with <length> bytes of data:
+ *
+ *   <prefix> <suffix> <length>
+ *   <data>
+ *
+ * The status directory lives on a tmpfs and only needs to survive
+ * a daemon restart, therefore records are not synced to disk.
+ */
+#define VIR_DOMAIN_STATUS_JOURNAL_MAGIC "libvirt-status-journal"
+#define VIR_DOMAIN_STATUS_JOURNAL_MAX (64 * 1024 * 1024)
+
+static char *
+virDomainStatusJournalFile(const char *dir,
+                           const char *name)
+{
+    char *ret;
+
+    ignore_value(virAsprintf(&ret, "%s/%s.journal", dir, name));
+    return ret;
+}
+
+
+static uint32_t
+virDomainStatusJournalHash(const char *xml,
+                           size_t len)
+{
+    return virHashCodeGen(xml, len, 0);
+}
+
+
+/*
+ * Rewrite the whole status file and start a new journal.
+ */
+static int
+virDomainStatusJournalCompact(const char *statusDir,
+                              virDomainObjPtr obj,
+                              char **xml)
+{
+    char *journalFile = NULL;
+    int ret = -1;
+
+    VIR_FREE(obj->statusXML);
+    obj->statusJournalSize = 0;
+
+    if (virDomainSaveXML(statusDir, obj->def, *xml) < 0)
+        goto cleanup;
+
+    if (!(journalFile = virDomainStatusJournalFile(statusDir, obj->def->name)))
+        goto cleanup;
+
+    if (unlink(journalFile) < 0 && errno != ENOENT) {
+        virReportSystemError(errno, _("cannot remove status journal '%s'"),
+                             journalFile);
+        goto cleanup;
+    }
+
+    obj->statusXML = *xml;
+    *xml = NULL;
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(journalFile);
+    return ret;
+}
+
+
+static int
+virDomainStatusJournalAppend(const char *statusDir,
+                             virDomainObjPtr obj,
+                             char **xml)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    const char *old = obj->statusXML;
+    const char *new = *xml;
+    size_t oldlen = strlen(old);
+    size_t newlen = strlen(new);
+    size_t prefix = 0;
+    size_t suffix = 0;
+    size_t len;
+    char *journalFile = NULL;
+    char *record = NULL;
+    char ebuf[1024];
+    int flags = O_WRONLY | O_APPEND | O_CREAT;
+    int fd = -1;
+    int ret = -1;
+
+    while (prefix < oldlen && prefix < newlen && old[prefix] == new[prefix])
+        prefix++;
+
+    if (prefix == oldlen && prefix == newlen) {
+        VIR_FREE(*xml);
+        return 0;
+    }
+
+    while (suffix < oldlen - prefix && suffix < newlen - prefix &&
+           old[oldlen - suffix - 1] == new[newlen - suffix - 1])
+        suffix++;
+
+    if (obj->statusJournalSize == 0) {
+        virBufferAsprintf(&buf, "%s %zu %08x\n",
+                          VIR_DOMAIN_STATUS_JOURNAL_MAGIC, oldlen,
+                          virDomainStatusJournalHash(old, oldlen));
+        flags |= O_TRUNC;
+    }
+
+    len = newlen - prefix - suffix;
+    virBufferAsprintf(&buf, "%zu %zu %zu\n", prefix, suffix, len);
+    virBufferAdd(&buf, new + prefix, len);
+    virBufferAddLit(&buf, "\n");
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    len = virBufferUse(&buf);
+    record = virBufferContentAndReset(&buf);
+
+    if (!(journalFile = virDomainStatusJournalFile(statusDir, obj->def->name)))
+        goto cleanup;
+
+    if ((fd = open(journalFile, flags, S_IRUSR | S_IWUSR)) < 0 ||
+        safewrite(fd, record, len) != (ssize_t) len ||
+        VIR_CLOSE(fd) < 0) {
+        /* A torn record is ignored on replay, but anything appended
+         * after it would be lost, so fall back to a full rewrite */
+        VIR_WARN("Failed to append to status journal '%s': %s",
+                 journalFile, virStrerror(errno, ebuf, sizeof(ebuf)));
+        VIR_FORCE_CLOSE(fd);
+        ret = virDomainStatusJournalCompact(statusDir, obj, xml);
+        goto cleanup;
+    }
+
+    obj->statusJournalSize += len;
+    VIR_FREE(obj->statusXML);
+    obj->statusXML = *xml;
+    *xml = NULL;
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(journalFile);
+    VIR_FREE(record);
+    return ret;
+}
+
+
+static int
+virDomainSaveStatusJournal(const char *statusDir,
+                           virDomainObjPtr obj,
+                           char **xml)
+{
+    /* Replaying the journal should never cost more than parsing the
+     * status XML twice */
+    if (!obj->statusXML ||
+        obj->statusJournalSize >= strlen(obj->statusXML))
+        return virDomainStatusJournalCompact(statusDir, obj, xml);
+
+    return virDomainStatusJournalAppend(statusDir, obj, xml);
+}
+
+
+static int
+virDomainStatusJournalParseNum(const char **cur,
+                               char sep,
+                               size_t *val)
+{
+    unsigned long long num;
+    char *end;
+
+    if (virStrToLong_ullp(*cur, &end, 10, &num) < 0 ||
+        *end != sep || num > SIZE_MAX)
+        return -1;
+
+    *val = num;
+    *cur = end + 1;
+    return 0;
+}
+
+
+/*
+ * Apply the records in @journal to @xml. Records which are truncated
+ * or don't match the current XML end the replay, leaving @xml as of
+ * the last complete save.
+ */
+static int
+virDomainStatusJournalApply(const char *journalFile,
+                            const char *journal,
+                            size_t journallen,
+                            char **xml)
+{
+    const char *cur = journal;
+    const char *end = journal + journallen;
+    size_t xmllen = strlen(*xml);
+    size_t baselen;
+    unsigned int hash;
+    char *hend;
+    size_t nrecords = 0;
+
+    if (!STRPREFIX(cur, VIR_DOMAIN_STATUS_JOURNAL_MAGIC " ") ||
+        (cur += strlen(VIR_DOMAIN_STATUS_JOURNAL_MAGIC " "),
+         virDomainStatusJournalParseNum(&cur, ' ', &baselen) < 0) ||
+        virStrToLong_uip(cur, &hend, 16, &hash) < 0 || *hend != '\n') {
+        VIR_WARN("Ignoring malformed status journal '%s'", journalFile);
+        return 0;
+    }
+    cur = hend + 1;
+
+    /* The status file was rewritten but removing the journal failed */
+    if (baselen != xmllen ||
+        hash != virDomainStatusJournalHash(*xml, xmllen)) {
+        VIR_WARN("Ignoring stale status journal '%s'", journalFile);
+        return 0;
+    }
+
+    while (cur < end) {
+        size_t prefix;
+        size_t suffix;
+        size_t len;
+        char *tmp;
+
+        if (virDomainStatusJournalParseNum(&cur, ' ', &prefix) < 0 ||
+            virDomainStatusJournalParseNum(&cur, ' ', &suffix) < 0 ||
+            virDomainStatusJournalParseNum(&cur, '\n', &len) < 0 ||
+            len >= (size_t) (end - cur) || cur[len] != '\n' ||
+            prefix > xmllen || suffix > xmllen - prefix) {
+            VIR_WARN("Ignoring truncated record %zu of status journal '%s'",
+                     nrecords, journalFile);
+            break;
+        }
+
+        if (VIR_ALLOC_N(tmp, prefix + len + suffix + 1) < 0)
+            return -1;
+
+        memcpy(tmp, *xml, prefix);
+        memcpy(tmp + prefix, cur, len);
+        memcpy(tmp + prefix + len, *xml + xmllen - suffix, suffix);
+        VIR_FREE(*xml);
+        *xml = tmp;
+        xmllen = prefix + len + suffix;
+
+        cur += len + 1;
+        nrecords++;
+    }
+
+    VIR_DEBUG("Replayed %zu records of status journal '%s'",
+              nrecords, journalFile);
+    return 0;
+}
+
+
+/**
+ * virDomainReplayStatusJournal:
+ * @statusDir: directory holding the status files
+ * @name: name of the domain
+ *
+ * Folds the status journal of domain @name, if there is one, into its
+ * status file so that the status file describes the domain exactly as
+ * it was last saved.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virDomainReplayStatusJournal(const char *statusDir,
+                             const char *name)
+{
+    char *journalFile = NULL;
+    char *statusFile = NULL;
+    char *journal = NULL;
+    char *status = NULL;
+    char *xml = NULL;
+    const char *root;
+    int journallen;
+    int ret = -1;
+
+    if (!(journalFile = virDomainStatusJournalFile(statusDir, name)))
+        goto cleanup;
+
+    if (!virFileExists(journalFile)) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!(statusFile = virDomainConfigFile(statusDir, name)))
+        goto cleanup;
+
+    if (virFileReadAll(statusFile, VIR_DOMAIN_STATUS_JOURNAL_MAX, &status) < 0 ||
+        (journallen = virFileReadAll(journalFile, VIR_DOMAIN_STATUS_JOURNAL_MAX,
+                                     &journal)) < 0)
+        goto cleanup;
+
+    /* Skip the warning comment added by virXMLSaveFile() */
+    if (!(root = strstr(status, "<domstatus")))
+        root = status;
+
+    if (VIR_STRDUP(xml, root) < 0 ||
+        virDomainStatusJournalApply(journalFile, journal, journallen, &xml) < 0)
+        goto cleanup;
+
+    if (virXMLSaveFile(statusFile,
+                       virXMLPickShellSafeComment(name, NULL), "edit",
+                       xml) < 0)
+        goto cleanup;
+
+    if (unlink(journalFile) < 0) {
+        virReportSystemError(errno, _("cannot remove status journal '%s'"),
+                             journalFile);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(journalFile);
+    VIR_FREE(statusFile);
+    VIR_FREE(journal);
+    VIR_FREE(status);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/**
+ * virDomainDropStatusJournal:
+ * @statusDir: directory holding the status files
+ * @obj: domain object
+ *
+ * Removes the status journal of @obj, to be called whenever its
+ * status file is removed.
+ */
+void
+virDomainDropStatusJournal(const char *statusDir,
+                           virDomainObjPtr obj)
+{
+    char ebuf[1024];
+    char *journalFile = NULL;
+
+    VIR_FREE(obj->statusXML);
+    obj->statusJournalSize = 0;
+
+    if (!(journalFile = virDomainStatusJournalFile(statusDir, obj->def->name)))
+        return;
+
+    if (unlink(journalFile) < 0 && errno != ENOENT && errno != ENOTDIR)
+        VIR_WARN("Failed to remove status journal '%s': %s",
+                 journalFile, virStrerror(errno, ebuf, sizeof(ebuf)));
+
+    VIR_FREE(journalFile);
+}
+
+
 int
 virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                     const char *statusDir,
@@ -25768,8 +26149,12 @@ virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
     if (!(xml = virDomainObjFormat(xmlopt, obj, caps, flags)))
         goto cleanup;
 
-    if (virDomainSaveXML(statusDir, obj->def, xml))
+    if (xmlopt->statusJournal && statusDir) {
+        if (virDomainSaveStatusJournal(statusDir, obj, &xml) < 0)
+            goto cleanup;
+    } else if (virDomainSaveXML(statusDir, obj->def, xml)) {
         goto cleanup;
+    }
 
     ret = 0;
  cleanup:
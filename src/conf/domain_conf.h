@@ -2477,6 +2477,9 @@ struct _virDomainObj {
 
     unsigned long long original_memlock; /* Original RLIMIT_MEMLOCK, zero if no
                                           * restore will be required later */
+
+    char *statusXML; /* status XML as of the last journaled save */
+    size_t statusJournalSize; /* bytes written to the status journal */
 };
 
 typedef bool (*virDomainObjListACLFilter)(virConnectPtr conn,
@@ -2605,6 +2608,9 @@ virDomainXMLOptionPtr virDomainXMLOptionNew(virDomainDefParserConfigPtr config,
 virSaveCookieCallbacksPtr
 virDomainXMLOptionGetSaveCookie(virDomainXMLOptionPtr xmlopt);
 
+void virDomainXMLOptionSetStatusJournal(virDomainXMLOptionPtr xmlopt,
+                                        bool enable);
+
 void virDomainNetGenerateMAC(virDomainXMLOptionPtr xmlopt, virMacAddrPtr mac);
 
 virDomainXMLNamespacePtr
@@ -3061,6 +3067,10 @@ int virDomainSaveStatus(virDomainXMLOptionPtr xmlopt,
                         const char *statusDir,
                         virDomainObjPtr obj,
                         virCapsPtr caps) ATTRIBUTE_RETURN_CHECK;
+int virDomainReplayStatusJournal(const char *statusDir,
+                                 const char *name);
+void virDomainDropStatusJournal(const char *statusDir,
+                                virDomainObjPtr obj);
 
 typedef void (*virDomainLoadConfigNotify)(virDomainObjPtr dom,
                                           int newDomain,
@@ -68,6 +68,7 @@ struct _virStorageVolDef {
 
     bool building;
     unsigned int in_use;
+    bool wiping; /* contents are being overwritten, don't read or refresh */
 
     virStorageVolSource source;
     virStorageSource target;
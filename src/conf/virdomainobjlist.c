@@ -30,8 +30,10 @@
 #include "snapshot_conf.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhostcpu.h"
 #include "virlog.h"
 #include "virstring.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -444,112 +446,202 @@ void virDomainObjListRemoveLocked(virDomainObjListPtr doms,
 }
 
 
-static virDomainObjPtr
-virDomainObjListLoadConfig(virDomainObjListPtr doms,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
-                           const char *configDir,
-                           const char *autostartDir,
-                           const char *name,
-                           virDomainLoadConfigNotify notify,
-                           void *opaque)
+/* Upper limit on the number of threads parsing domain XML files */
+#define VIR_DOMAIN_OBJ_LIST_LOAD_WORKERS_MAX 16
+
+/*
+ * A domain XML file to be loaded. Files are parsed in parallel, the
+ * results are then added to the list one by one in directory order.
+ */
+typedef struct _virDomainObjListLoadJob virDomainObjListLoadJob;
+typedef virDomainObjListLoadJob *virDomainObjListLoadJobPtr;
+struct _virDomainObjListLoadJob {
+    char *name;
+
+    /* results of parsing a persistent config */
+    virDomainDefPtr def;
+    int autostart;
+
+    /* result of parsing a status file */
+    virDomainObjPtr obj;
+};
+
+typedef struct _virDomainObjListLoadBatch virDomainObjListLoadBatch;
+typedef virDomainObjListLoadBatch *virDomainObjListLoadBatchPtr;
+struct _virDomainObjListLoadBatch {
+    const char *configDir;
+    const char *autostartDir;
+    bool liveStatus;
+    virCapsPtr caps;
+    virDomainXMLOptionPtr xmlopt;
+
+    virDomainObjListLoadJobPtr jobs;
+    size_t njobs;
+};
+
+
+static int
+virDomainObjListParseConfig(virDomainObjListLoadBatchPtr batch,
+                            virDomainObjListLoadJobPtr job)
 {
     char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
-    virDomainObjPtr dom;
-    int autostart;
-    virDomainDefPtr oldDef = NULL;
+    int ret = -1;
+
+    if ((configFile = virDomainConfigFile(batch->configDir, job->name)) == NULL)
+        goto cleanup;
+    if (!(job->def = virDomainDefParseFile(configFile, batch->caps,
+                                           batch->xmlopt, NULL,
+                                           VIR_DOMAIN_DEF_PARSE_INACTIVE |
+                                           VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                           VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
+        goto cleanup;
+
+    if ((autostartLink = virDomainConfigFile(batch->autostartDir,
+                                             job->name)) == NULL)
+        goto cleanup;
+
+    if ((job->autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (ret < 0) {
+        virDomainDefFree(job->def);
+        job->def = NULL;
+    }
+    VIR_FREE(configFile);
+    VIR_FREE(autostartLink);
+    return ret;
+}
+
+
+static int
+virDomainObjListParseStatus(virDomainObjListLoadBatchPtr batch,
+                            virDomainObjListLoadJobPtr job)
+{
+    char *statusFile = NULL;
+
+    if (virDomainReplayStatusJournal(batch->configDir, job->name) < 0)
+        return -1;
+
+    if ((statusFile = virDomainConfigFile(batch->configDir, job->name)) == NULL)
+        return -1;
+
+    job->obj = virDomainObjParseFile(statusFile, batch->caps, batch->xmlopt,
+                                     VIR_DOMAIN_DEF_PARSE_STATUS |
+                                     VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
+                                     VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
+                                     VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
+                                     VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE);
+    VIR_FREE(statusFile);
+
+    return job->obj ? 0 : -1;
+}
+
+
+static void
+virDomainObjListParseJob(virDomainObjListLoadBatchPtr batch,
+                         virDomainObjListLoadJobPtr job)
+{
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+    if (batch->liveStatus)
+        ignore_value(virDomainObjListParseStatus(batch, job));
+    else
+        ignore_value(virDomainObjListParseConfig(batch, job));
+}
+
 
-    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(configFile, caps, xmlopt, NULL,
-                                      VIR_DOMAIN_DEF_PARSE_INACTIVE |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
+static void
+virDomainObjListParseWorker(size_t idx, void *opaque)
+{
+    virDomainObjListLoadBatchPtr batch = opaque;
+
+    virDomainObjListParseJob(batch, &batch->jobs[idx]);
+}
+
+
+/*
+ * Parse all jobs of @batch, using a pool of up to one thread per
+ * host CPU when there is more than one file to parse.
+ */
+static void
+virDomainObjListParseJobs(virDomainObjListLoadBatchPtr batch)
+{
+    int ncpus = virHostCPUGetCount();
+    size_t nworkers;
 
-    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
+    nworkers = MIN(ncpus > 0 ? ncpus : 1, VIR_DOMAIN_OBJ_LIST_LOAD_WORKERS_MAX);
 
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
+    VIR_DEBUG("Parsing %zu files with up to %zu threads",
+              batch->njobs, nworkers);
 
-    if (!(dom = virDomainObjListAddLocked(doms, def, xmlopt, 0, &oldDef)))
-        goto error;
+    virThreadPoolRunBatch(NULL, nworkers, batch->njobs,
+                          virDomainObjListParseWorker, batch);
+}
 
-    dom->autostart = autostart;
+
+static virDomainObjPtr
+virDomainObjListAddConfig(virDomainObjListPtr doms,
+                          virDomainXMLOptionPtr xmlopt,
+                          virDomainObjListLoadJobPtr job,
+                          virDomainLoadConfigNotify notify,
+                          void *opaque)
+{
+    virDomainObjPtr dom;
+    virDomainDefPtr oldDef = NULL;
+
+    if (!(dom = virDomainObjListAddLocked(doms, job->def, xmlopt, 0, &oldDef)))
+        return NULL;
+    job->def = NULL;
+
+    dom->autostart = job->autostart;
 
     if (notify)
         (*notify)(dom, oldDef == NULL, opaque);
 
     virDomainDefFree(oldDef);
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     return dom;
-
- error:
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
-    virDomainDefFree(def);
-    return NULL;
 }
 
 
 static virDomainObjPtr
-virDomainObjListLoadStatus(virDomainObjListPtr doms,
-                           const char *statusDir,
-                           const char *name,
-                           virCapsPtr caps,
-                           virDomainXMLOptionPtr xmlopt,
-                           virDomainLoadConfigNotify notify,
-                           void *opaque)
+virDomainObjListAddStatus(virDomainObjListPtr doms,
+                          virDomainObjListLoadJobPtr job,
+                          virDomainLoadConfigNotify notify,
+                          void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
+    virDomainObjPtr obj = job->obj;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(statusFile, caps, xmlopt,
-                                      VIR_DOMAIN_DEF_PARSE_STATUS |
-                                      VIR_DOMAIN_DEF_PARSE_ACTUAL_NET |
-                                      VIR_DOMAIN_DEF_PARSE_PCI_ORIG_STATES |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_OSTYPE_CHECKS |
-                                      VIR_DOMAIN_DEF_PARSE_SKIP_VALIDATE)))
-        goto error;
-
     virUUIDFormat(obj->def->uuid, uuidstr);
 
     if (virHashLookup(doms->objs, uuidstr) != NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected domain %s already exists"),
                        obj->def->name);
-        goto error;
+        return NULL;
     }
 
     if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
-        goto error;
+        return NULL;
 
     if (virHashAddEntry(doms->objsName, obj->def->name, obj) < 0) {
         virHashRemoveEntry(doms->objs, uuidstr);
-        goto error;
+        return NULL;
     }
 
     /* Since domain is in two hash tables, increment the
      * reference counter */
     virObjectRef(obj);
+    job->obj = NULL;
 
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
-
- error:
-    virObjectUnref(obj);
-    VIR_FREE(statusFile);
-    return NULL;
 }
 
 
@@ -565,6 +657,16 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
 {
     DIR *dir;
     struct dirent *entry;
+    virDomainObjListLoadBatch batch = {
+        .configDir = configDir,
+        .autostartDir = autostartDir,
+        .liveStatus = !!liveStatus,
+        .caps = caps,
+        .xmlopt = xmlopt,
+    };
+    virDomainObjListLoadJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t i;
     int ret = -1;
     int rc;
 
@@ -573,43 +675,51 @@ virDomainObjListLoadAllConfigs(virDomainObjListPtr doms,
     if ((rc = virDirOpenIfExists(&dir, configDir)) <= 0)
         return rc;
 
-    virObjectLock(doms);
-
     while ((ret = virDirRead(dir, &entry, configDir)) > 0) {
-        virDomainObjPtr dom;
+        virDomainObjListLoadJob job = { 0 };
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainObjListLoadStatus(doms,
-                                             configDir,
-                                             entry->d_name,
-                                             caps,
-                                             xmlopt,
-                                             notify,
-                                             opaque);
-        else
-            dom = virDomainObjListLoadConfig(doms,
-                                             caps,
-                                             xmlopt,
-                                             configDir,
-                                             autostartDir,
-                                             entry->d_name,
-                                             notify,
-                                             opaque);
+        if (VIR_STRDUP(job.name, entry->d_name) < 0 ||
+            VIR_APPEND_ELEMENT(jobs, njobs, job) < 0) {
+            VIR_FREE(job.name);
+            ret = -1;
+            break;
+        }
+    }
+
+    VIR_DIR_CLOSE(dir);
+
+    /* Parsing doesn't touch the list, so it's done without the lock */
+    batch.jobs = jobs;
+    batch.njobs = njobs;
+    virDomainObjListParseJobs(&batch);
+
+    virObjectLock(doms);
+
+    for (i = 0; i < njobs; i++) {
+        virDomainObjPtr dom = NULL;
+
+        if (jobs[i].obj)
+            dom = virDomainObjListAddStatus(doms, &jobs[i], notify, opaque);
+        else if (jobs[i].def)
+            dom = virDomainObjListAddConfig(doms, xmlopt, &jobs[i],
+                                            notify, opaque);
+
         if (dom) {
             if (!liveStatus)
                 dom->persistent = 1;
             virObjectUnlock(dom);
         }
+
+        virObjectUnref(jobs[i].obj);
+        virDomainDefFree(jobs[i].def);
+        VIR_FREE(jobs[i].name);
     }
 
-    VIR_DIR_CLOSE(dir);
     virObjectUnlock(doms);
+    VIR_FREE(jobs);
     return ret;
 }
 
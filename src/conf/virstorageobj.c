@@ -44,6 +44,12 @@ virStoragePoolObjFree(virStoragePoolObjPtr obj)
         return;
 
     virStoragePoolObjClearVols(obj);
+    virHashFree(obj->volumesByName);
+    virHashFree(obj->volumesByKey);
+    virHashFree(obj->volumesByPath);
+
+    if (obj->privateDataFreeFunc)
+        (obj->privateDataFreeFunc)(obj->privateData);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -141,10 +147,162 @@ virStoragePoolSourceFindDuplicateDevices(virStoragePoolObjPtr obj,
 }
 
 
+static int
+virStoragePoolObjIndexVolEntry(virHashTablePtr table,
+                               const char *name,
+                               virStorageVolDefPtr voldef)
+{
+    /* Volumes sharing a path with one indexed earlier stay shadowed
+     * by it, as with the linear lookup */
+    if (!name || virHashLookup(table, name))
+        return 0;
+
+    return virHashAddEntry(table, name, voldef);
+}
+
+
+static void
+virStoragePoolObjUnindexVolEntry(virHashTablePtr table,
+                                 const char *name,
+                                 virStorageVolDefPtr voldef)
+{
+    if (name && virHashLookup(table, name) == voldef)
+        ignore_value(virHashRemoveEntry(table, name));
+}
+
+
+static int
+virStoragePoolObjIndexVol(virStoragePoolObjPtr obj,
+                          virStorageVolDefPtr voldef)
+{
+    if (virStoragePoolObjIndexVolEntry(obj->volumesByName,
+                                       voldef->name, voldef) < 0 ||
+        virStoragePoolObjIndexVolEntry(obj->volumesByKey,
+                                       voldef->key, voldef) < 0 ||
+        virStoragePoolObjIndexVolEntry(obj->volumesByPath,
+                                       voldef->target.path, voldef) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+virStoragePoolObjUnindexVol(virStoragePoolObjPtr obj,
+                            virStorageVolDefPtr voldef)
+{
+    virStoragePoolObjUnindexVolEntry(obj->volumesByName,
+                                     voldef->name, voldef);
+    virStoragePoolObjUnindexVolEntry(obj->volumesByKey,
+                                     voldef->key, voldef);
+    virStoragePoolObjUnindexVolEntry(obj->volumesByPath,
+                                     voldef->target.path, voldef);
+}
+
+
+/**
+ * virStoragePoolObjAddVol:
+ * @obj: locked storage pool object
+ * @voldef: volume definition
+ *
+ * Appends @voldef to the volumes of @obj and indexes it for
+ * virStorageVolDefFindByName, virStorageVolDefFindByKey and
+ * virStorageVolDefFindByPath. Its name, key and target path must
+ * therefore be filled in already and must not change for as long
+ * as the volume is part of the pool. Names and keys have to be
+ * unique within the pool, while a volume whose target path is
+ * already taken is only found by that path once the volume that
+ * took it first is removed.
+ *
+ * On success @obj owns @voldef.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr obj,
+                        virStorageVolDefPtr voldef)
+{
+    if (voldef->name && virHashLookup(obj->volumesByName, voldef->name)) {
+        virReportError(VIR_ERR_STORAGE_VOL_EXIST,
+                       _("volume '%s' already exists in pool '%s'"),
+                       voldef->name, obj->def->name);
+        return -1;
+    }
+
+    if (voldef->key && virHashLookup(obj->volumesByKey, voldef->key)) {
+        virReportError(VIR_ERR_STORAGE_VOL_EXIST,
+                       _("volume with key '%s' already exists in pool '%s'"),
+                       voldef->key, obj->def->name);
+        return -1;
+    }
+
+    if (virStoragePoolObjIndexVol(obj, voldef) < 0)
+        goto error;
+
+    if (VIR_APPEND_ELEMENT_COPY(obj->volumes.objs,
+                                obj->volumes.count, voldef) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    virStoragePoolObjUnindexVol(obj, voldef);
+    return -1;
+}
+
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @obj: locked storage pool object
+ * @voldef: volume definition
+ *
+ * Removes @voldef from the volumes of @obj and its indexes. The
+ * caller becomes responsible for freeing @voldef.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr obj,
+                           virStorageVolDefPtr voldef)
+{
+    size_t i;
+
+    virStoragePoolObjUnindexVol(obj, voldef);
+
+    for (i = 0; i < obj->volumes.count; i++) {
+        if (obj->volumes.objs[i] == voldef) {
+            VIR_DELETE_ELEMENT(obj->volumes.objs, i, obj->volumes.count);
+            break;
+        }
+    }
+
+    /* Let the first volume whose path was shadowed by @voldef take
+     * its place */
+    if (!voldef->target.path)
+        return;
+
+    for (i = 0; i < obj->volumes.count; i++) {
+        virStorageVolDefPtr vol = obj->volumes.objs[i];
+
+        if (STREQ_NULLABLE(vol->target.path, voldef->target.path)) {
+            ignore_value(virStoragePoolObjIndexVolEntry(obj->volumesByPath,
+                                                        vol->target.path,
+                                                        vol));
+            break;
+        }
+    }
+}
+
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr obj)
 {
     size_t i;
+
+    if (obj->volumesByName) {
+        virHashRemoveAll(obj->volumesByName);
+        virHashRemoveAll(obj->volumesByKey);
+        virHashRemoveAll(obj->volumesByPath);
+    }
+
     for (i = 0; i < obj->volumes.count; i++)
         virStorageVolDefFree(obj->volumes.objs[i]);
 
@@ -157,13 +315,7 @@ virStorageVolDefPtr
 virStorageVolDefFindByKey(virStoragePoolObjPtr obj,
                           const char *key)
 {
-    size_t i;
-
-    for (i = 0; i < obj->volumes.count; i++)
-        if (STREQ(obj->volumes.objs[i]->key, key))
-            return obj->volumes.objs[i];
-
-    return NULL;
+    return virHashLookup(obj->volumesByKey, key);
 }
 
 
@@ -171,13 +323,7 @@ virStorageVolDefPtr
 virStorageVolDefFindByPath(virStoragePoolObjPtr obj,
                            const char *path)
 {
-    size_t i;
-
-    for (i = 0; i < obj->volumes.count; i++)
-        if (STREQ(obj->volumes.objs[i]->target.path, path))
-            return obj->volumes.objs[i];
-
-    return NULL;
+    return virHashLookup(obj->volumesByPath, path);
 }
 
 
@@ -185,13 +331,7 @@ virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr obj,
                            const char *name)
 {
-    size_t i;
-
-    for (i = 0; i < obj->volumes.count; i++)
-        if (STREQ(obj->volumes.objs[i]->name, name))
-            return obj->volumes.objs[i];
-
-    return NULL;
+    return virHashLookup(obj->volumesByName, name);
 }
 
 
@@ -321,6 +461,14 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
         VIR_FREE(obj);
         return NULL;
     }
+
+    if (!(obj->volumesByName = virHashCreate(50, NULL)) ||
+        !(obj->volumesByKey = virHashCreate(50, NULL)) ||
+        !(obj->volumesByPath = virHashCreate(50, NULL))) {
+        virStoragePoolObjFree(obj);
+        return NULL;
+    }
+
     virStoragePoolObjLock(obj);
     obj->active = 0;
 
@@ -23,6 +23,7 @@
 # include "internal.h"
 
 # include "storage_conf.h"
+# include "virhash.h"
 
 typedef struct _virStoragePoolObj virStoragePoolObj;
 typedef virStoragePoolObj *virStoragePoolObjPtr;
@@ -40,6 +41,17 @@ struct _virStoragePoolObj {
     virStoragePoolDefPtr newDef;
 
     virStorageVolDefList volumes;
+
+    /* Indexes into @volumes by name, key and target path. They don't
+     * own the volume definitions and are only to be updated through
+     * virStoragePoolObjAddVol and virStoragePoolObjRemoveVol. */
+    virHashTablePtr volumesByName;
+    virHashTablePtr volumesByKey;
+    virHashTablePtr volumesByPath;
+
+    /* Data kept by the storage backend across pool refreshes */
+    void *privateData;
+    void (*privateDataFreeFunc)(void *);
 };
 
 typedef struct _virStoragePoolObjList virStoragePoolObjList;
@@ -105,6 +117,14 @@ virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr obj,
                            const char *name);
 
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr obj,
+                        virStorageVolDefPtr voldef);
+
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr obj,
+                           virStorageVolDefPtr voldef);
+
 void
 virStoragePoolObjClearVols(virStoragePoolObjPtr obj);
 
@@ -1241,3 +1241,46 @@ virAdmConnectSetLoggingFilters(virAdmConnectPtr conn,
     virDispatchError(NULL);
     return -1;
 }
+
+/**
+ * virAdmServerGetMessagePoolStats:
+ * @srv: a valid server object reference
+ * @params: pointer to a list of statistics
+ *          (return value, allocated automatically)
+ * @nparams: pointer to number of parameters returned in @params
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Retrieve statistics of the pool @srv recycles RPC messages and their
+ * buffers through. These include:
+ *  - number of messages and buffers reused from the pool,
+ *  - number of messages and buffers that had to be allocated instead,
+ *  - number of idle messages and buffers currently held by the pool.
+ *
+ * Returns 0 on success, allocating @params to size returned in @nparams, or
+ * -1 in case of an error. Caller is responsible for deallocating @params.
+ */
+int
+virAdmServerGetMessagePoolStats(virAdmServerPtr srv,
+                                virTypedParameterPtr *params,
+                                int *nparams,
+                                unsigned int flags)
+{
+    int ret = -1;
+
+    VIR_DEBUG("srv=%p, params=%p, nparams=%p, flags=%x",
+              srv, params, nparams, flags);
+    virResetLastError();
+
+    virCheckAdmServerGoto(srv, error);
+    virCheckNonNullArgGoto(params, error);
+    virCheckNonNullArgGoto(nparams, error);
+
+    if ((ret = remoteAdminServerGetMessagePoolStats(srv, params,
+                                                    nparams, flags)) < 0)
+        goto error;
+
+    return ret;
+ error:
+    virDispatchError(NULL);
+    return -1;
+}
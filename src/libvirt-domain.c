@@ -11119,6 +11119,19 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  *     "state.state" - state of the VM, returned as int from virDomainState enum
  *     "state.reason" - reason for entering given state, returned as int from
  *                      virDomain*Reason enum corresponding to given state.
+ *     "state.job.waits" - number of APIs which had to wait for another API
+ *                         working with the domain, as unsigned long long.
+ *     "state.job.wait_time" - total time the APIs spent waiting, in
+ *                             milliseconds, as unsigned long long.
+ *     "state.events.pending" - number of QEMU events queued for the domain
+ *                              and not handled yet, as unsigned long long.
+ *     "state.events.handled" - number of QEMU events handled so far, as
+ *                              unsigned long long.
+ *     "state.events.wait_time" - total time the handled events spent
+ *                                queued, in milliseconds, as
+ *                                unsigned long long.
+ *     "state.events.wait_max" - longest time a single event spent queued,
+ *                               in milliseconds, as unsigned long long.
  *
  * VIR_DOMAIN_STATS_CPU_TOTAL:
  *     Return CPU statistics and usage information. The typed parameter keys
@@ -11299,6 +11312,20 @@ virConnectGetDomainCapabilities(virConnectPtr conn,
  * fields for offline domains if the statistics are meaningful only for a
  * running domain.
  *
+ * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED as @flags returns the
+ * statistics the hypervisor gathered in the background instead of querying
+ * the domains, which is cheaper and doesn't wait for busy domains. Such
+ * records contain an additional field:
+ *
+ *     "sample.age" - how long ago the statistics were gathered, in
+ *                    milliseconds, as unsigned long long.
+ *
+ * Domains which were not sampled yet, such as inactive ones, are reported
+ * with the statistics available without talking to the hypervisor and
+ * without the "sample.age" field. The flag is rejected if the hypervisor
+ * doesn't sample statistics in the background and can't be combined with
+ * VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING.
+ *
  * Similarly to virConnectListAllDomains, @flags can contain various flags to
  * filter the list of domains to provide stats for.
  *
@@ -11383,6 +11410,9 @@ virConnectGetAllDomainStats(virConnectPtr conn,
  * fields for offline domains if the statistics are meaningful only for a
  * running domain.
  *
+ * VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED works the same way as
+ * described in virConnectGetAllDomainStats.
+ *
  * Note that any of the domain list filtering flags in @flags may be rejected
  * by this function.
  *
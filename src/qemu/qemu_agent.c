@@ -687,7 +687,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -702,7 +702,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering EOF callback");
@@ -713,7 +713,7 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         virObjectUnref(mon);
         VIR_DEBUG("Triggering error callback");
@@ -818,7 +818,7 @@ qemuAgentNotifyCloseLocked(qemuAgentPtr mon)
          * wake him up. No message will arrive anyway. */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 }
@@ -861,6 +861,29 @@ void qemuAgentClose(qemuAgentPtr mon)
 
 #define QEMU_AGENT_WAIT_TIME 5
 
+/* Waits for @mon->notify until @then, or forever if @then is 0.
+ * Returns 0 on wakeup, -2 on timeout, -1 on other errors. */
+static int
+qemuAgentWaitNotify(qemuAgentPtr mon,
+                    unsigned long long then)
+{
+    if ((then && virCondWaitUntil(&mon->notify, &mon->parent.lock, then) < 0) ||
+        (!then && virCondWait(&mon->notify, &mon->parent.lock) < 0)) {
+        if (errno == ETIMEDOUT) {
+            virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
+                           _("Guest agent not available for now"));
+            return -2;
+        }
+
+        virReportSystemError(errno, "%s",
+                             _("Unable to wait on agent monitor condition"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * qemuAgentSend:
  * @mon: Monitor
@@ -868,7 +891,8 @@ void qemuAgentClose(qemuAgentPtr mon)
  * @seconds: number of seconds to wait for the result, it can be either
  *           -2, -1, 0 or positive.
  *
- * Send @msg to agent @mon. If @seconds is equal to
+ * Send @msg to agent @mon, after the messages other threads are sending
+ * to the agent at the same time. If @seconds is equal to
  * VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK(-2), this function will block forever
  * waiting for the result. The value of
  * VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT(-1) means use default timeout value
@@ -885,6 +909,7 @@ static int qemuAgentSend(qemuAgentPtr mon,
                          int seconds)
 {
     int ret = -1;
+    int rc;
     unsigned long long then = 0;
 
     /* Check whether qemu quit unexpectedly */
@@ -904,21 +929,24 @@ static int qemuAgentSend(qemuAgentPtr mon,
         then = now + seconds * 1000ull;
     }
 
+    /* Threads holding a shared job may use the agent at the same time,
+     * their messages are sent one after another */
+    while (mon->msg) {
+        if ((rc = qemuAgentWaitNotify(mon, then)) < 0)
+            return rc;
+
+        if (mon->lastError.code != VIR_ERR_OK) {
+            virSetError(&mon->lastError);
+            return -1;
+        }
+    }
+
     mon->msg = msg;
     qemuAgentUpdateWatch(mon);
 
     while (!mon->msg->finished) {
-        if ((then && virCondWaitUntil(&mon->notify, &mon->parent.lock, then) < 0) ||
-            (!then && virCondWait(&mon->notify, &mon->parent.lock) < 0)) {
-            if (errno == ETIMEDOUT) {
-                virReportError(VIR_ERR_AGENT_UNRESPONSIVE, "%s",
-                               _("Guest agent not available for now"));
-                ret = -2;
-            } else {
-                virReportSystemError(errno, "%s",
-                                     _("Unable to wait on agent monitor "
-                                       "condition"));
-            }
+        if ((rc = qemuAgentWaitNotify(mon, then)) < 0) {
+            ret = rc;
             goto cleanup;
         }
     }
@@ -935,6 +963,7 @@ static int qemuAgentSend(qemuAgentPtr mon,
  cleanup:
     mon->msg = NULL;
     qemuAgentUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
@@ -1256,7 +1285,7 @@ void qemuAgentNotifyEvent(qemuAgentPtr mon,
         /* somebody waiting for this event, wake him up. */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
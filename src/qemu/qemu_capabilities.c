@@ -25,6 +25,7 @@
 
 #include "qemu_capabilities.h"
 #include "viralloc.h"
+#include "viratomic.h"
 #include "vircrypto.h"
 #include "virlog.h"
 #include "virerror.h"
@@ -958,6 +959,51 @@ virQEMUCapsFindBinaryForArch(virArch hostarch,
     return ret;
 }
 
+/* Distro specific names of the binary used for native guests */
+static const char *const virQEMUCapsKVMBinaries[] = {
+    "/usr/libexec/qemu-kvm", /* RHEL */
+    "qemu-kvm", /* Fedora */
+    "kvm", /* Debian/Ubuntu */
+};
+
+/*
+ * Loads or probes the capabilities of all emulator binaries
+ * virQEMUCapsInitGuest may look at in parallel, so that a cold cache
+ * doesn't mean probing one binary after another.
+ */
+static void
+virQEMUCapsPrefetch(virFileCachePtr cache,
+                    virArch hostarch)
+{
+    char **binaries = NULL;
+    size_t nbinaries = 0;
+    char *binary;
+    size_t i;
+
+    for (i = 0; i < VIR_ARCH_LAST; i++) {
+        if (!(binary = virQEMUCapsFindBinaryForArch(hostarch, i)))
+            continue;
+        if (VIR_APPEND_ELEMENT(binaries, nbinaries, binary) < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(virQEMUCapsKVMBinaries); i++) {
+        if (!(binary = virFindFileInPath(virQEMUCapsKVMBinaries[i])))
+            continue;
+        if (VIR_APPEND_ELEMENT(binaries, nbinaries, binary) < 0)
+            goto cleanup;
+    }
+
+    ignore_value(virFileCachePrefetch(cache, (const char *const *) binaries,
+                                      nbinaries));
+
+ cleanup:
+    /* Failures are not fatal, binaries are looked up one by one later */
+    virResetLastError();
+    virStringListFreeCount(binaries, nbinaries);
+}
+
+
 static int
 virQEMUCapsInitGuest(virCapsPtr caps,
                      virFileCachePtr cache,
@@ -991,29 +1037,27 @@ virQEMUCapsInitGuest(virCapsPtr caps,
      *  - hostarch and guestarch are both ppc64*
      */
     if (virQEMUCapsGuestIsNative(hostarch, guestarch)) {
-        const char *kvmbins[] = {
-            "/usr/libexec/qemu-kvm", /* RHEL */
-            "qemu-kvm", /* Fedora */
-            "kvm", /* Debian/Ubuntu */
-            NULL,
-        };
-
-        /* x86 32-on-64 can be used with qemu-system-i386 and
-         * qemu-system-x86_64, so if we don't find a specific kvm binary,
-         * we can just fall back to the host arch native binary and
-         * everything works fine.
-         *
-         * arm is different in that 32-on-64 _only_ works with
-         * qemu-system-aarch64. So we have to add it to the kvmbins list
-         */
-        if (hostarch == VIR_ARCH_AARCH64 && guestarch == VIR_ARCH_ARMV7L)
-            kvmbins[3] = "qemu-system-aarch64";
-
-        for (i = 0; i < ARRAY_CARDINALITY(kvmbins); ++i) {
-            if (!kvmbins[i])
-                continue;
+        for (i = 0; i <= ARRAY_CARDINALITY(virQEMUCapsKVMBinaries); ++i) {
+            const char *kvmbinName;
+
+            /* x86 32-on-64 can be used with qemu-system-i386 and
+             * qemu-system-x86_64, so if we don't find a specific kvm
+             * binary, we can just fall back to the host arch native
+             * binary and everything works fine.
+             *
+             * arm is different in that 32-on-64 _only_ works with
+             * qemu-system-aarch64. So we have to try it after the
+             * kvm binaries
+             */
+            if (i < ARRAY_CARDINALITY(virQEMUCapsKVMBinaries))
+                kvmbinName = virQEMUCapsKVMBinaries[i];
+            else if (hostarch == VIR_ARCH_AARCH64 &&
+                     guestarch == VIR_ARCH_ARMV7L)
+                kvmbinName = "qemu-system-aarch64";
+            else
+                break;
 
-            kvmbin = virFindFileInPath(kvmbins[i]);
+            kvmbin = virFindFileInPath(kvmbinName);
 
             if (!kvmbin)
                 continue;
@@ -1215,6 +1259,8 @@ virQEMUCapsInit(virFileCachePtr cache)
     virCapabilitiesAddHostMigrateTransport(caps, "tcp");
     virCapabilitiesAddHostMigrateTransport(caps, "rdma");
 
+    virQEMUCapsPrefetch(cache, hostarch);
+
     /* QEMU can support pretty much every arch that exists,
      * so just probe for them all - we gracefully fail
      * if a qemu-system-$ARCH binary can't be found
@@ -4926,7 +4972,9 @@ virQEMUCapsInitQMPCommandNew(char *binary,
                              gid_t runGid,
                              char **qmperr)
 {
+    static int lastProbeID;
     virQEMUCapsInitQMPCommandPtr cmd = NULL;
+    int probeID = virAtomicIntInc(&lastProbeID);
 
     if (VIR_ALLOC(cmd) < 0)
         goto error;
@@ -4939,10 +4987,11 @@ virQEMUCapsInitQMPCommandNew(char *binary,
     cmd->qmperr = qmperr;
 
     /* the ".sock" sufix is important to avoid a possible clash with a qemu
-     * domain called "capabilities"
+     * domain called "capabilities". Several binaries may be probed at the
+     * same time, each of them gets its own socket and pidfile.
      */
-    if (virAsprintf(&cmd->monpath, "%s/%s", libDir,
-                    "capabilities.monitor.sock") < 0)
+    if (virAsprintf(&cmd->monpath, "%s/capabilities.%d.monitor.sock",
+                    libDir, probeID) < 0)
         goto error;
     if (virAsprintf(&cmd->monarg, "unix:%s,server,nowait", cmd->monpath) < 0)
         goto error;
@@ -4953,7 +5002,8 @@ virQEMUCapsInitQMPCommandNew(char *binary,
      * -daemonize we need QEMU to be allowed to create them, rather
      * than libvirtd. So we're using libDir which QEMU can write to
      */
-    if (virAsprintf(&cmd->pidfile, "%s/%s", libDir, "capabilities.pidfile") < 0)
+    if (virAsprintf(&cmd->pidfile, "%s/capabilities.%d.pidfile",
+                    libDir, probeID) < 0)
         goto error;
 
     virPidFileForceCleanupPath(cmd->pidfile);
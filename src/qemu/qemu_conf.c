@@ -314,6 +314,10 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
     cfg->securityDefaultConfined = true;
     cfg->securityRequireConfined = false;
 
+    cfg->statsJobTimeout = 5000;
+    cfg->eventWorkers = 4;
+    cfg->autostartWorkers = 1;
+
     cfg->keepAliveInterval = 5;
     cfg->keepAliveCount = 5;
     cfg->seccompSandbox = -1;
@@ -394,6 +398,7 @@ static void virQEMUDriverConfigDispose(void *obj)
     VIR_FREE(cfg->dumpImageFormat);
     VIR_FREE(cfg->snapshotImageFormat);
     VIR_FREE(cfg->autoDumpPath);
+    virStringListFree(cfg->autostartGroups);
 
     virStringListFree(cfg->securityDriverNames);
 
@@ -720,6 +725,18 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     if (virConfGetValueBool(conf, "auto_start_bypass_cache", &cfg->autoStartBypassCache) < 0)
         goto cleanup;
+    if (virConfGetValueUInt(conf, "autostart_workers", &cfg->autostartWorkers) < 0)
+        goto cleanup;
+    if (cfg->autostartWorkers == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("autostart_workers must be greater than 0"));
+        goto cleanup;
+    }
+    if (virConfGetValueStringList(conf, "autostart_groups", false,
+                                  &cfg->autostartGroups) < 0)
+        goto cleanup;
+    if (virConfGetValueBool(conf, "status_journal", &cfg->statusJournal) < 0)
+        goto cleanup;
 
     if (virConfGetValueStringList(conf, "hugetlbfs_mount", true,
                                   &hugetlbfs) < 0)
@@ -803,6 +820,28 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     if (virConfGetValueUInt(conf, "max_queued", &cfg->maxQueuedJobs) < 0)
         goto cleanup;
 
+    if (virConfGetValueUInt(conf, "stats_workers", &cfg->statsWorkers) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_job_timeout", &cfg->statsJobTimeout) < 0)
+        goto cleanup;
+    if (virConfGetValueUInt(conf, "stats_sample_interval",
+                            &cfg->statsSampleInterval) < 0)
+        goto cleanup;
+    if ((cfg->statsWorkers || cfg->statsSampleInterval) &&
+        !cfg->statsJobTimeout) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("stats_job_timeout must be greater than 0"));
+        goto cleanup;
+    }
+
+    if (virConfGetValueUInt(conf, "event_workers", &cfg->eventWorkers) < 0)
+        goto cleanup;
+    if (cfg->eventWorkers == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                       _("event_workers must be greater than 0"));
+        goto cleanup;
+    }
+
     if (virConfGetValueInt(conf, "keepalive_interval", &cfg->keepAliveInterval) < 0)
         goto cleanup;
     if (virConfGetValueUInt(conf, "keepalive_count", &cfg->keepAliveCount) < 0)
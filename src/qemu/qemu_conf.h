@@ -67,6 +67,10 @@ typedef virQEMUDriver *virQEMUDriverPtr;
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+/* Private to qemu_driver.c */
+typedef struct _qemuDomainStatsSampler qemuDomainStatsSampler;
+typedef qemuDomainStatsSampler *qemuDomainStatsSamplerPtr;
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -170,6 +174,12 @@ struct _virQEMUDriverConfig {
 
     unsigned int maxQueuedJobs;
 
+    unsigned int statsWorkers;
+    unsigned int statsJobTimeout;
+    unsigned int statsSampleInterval;
+
+    unsigned int eventWorkers;
+
     char **securityDriverNames;
     bool securityDefaultConfined;
     bool securityRequireConfined;
@@ -181,6 +191,9 @@ struct _virQEMUDriverConfig {
     char *autoDumpPath;
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
+    unsigned int autostartWorkers;
+    char **autostartGroups;
+    bool statusJournal;
 
     char *lockManagerName;
 
@@ -213,9 +226,22 @@ struct _virQEMUDriver {
      * then lockless thereafter */
     virQEMUDriverConfigPtr config;
 
-    /* Immutable pointer, self-locking APIs */
+    /* Immutable pointer, self-locking APIs. Handles the per-domain
+     * queues of process events, see qemuProcessEventSubmit */
     virThreadPoolPtr workerPool;
 
+    /* Protects the process event queues of all domains and nevents */
+    virMutex eventLock;
+    size_t nevents;
+
+    /* Immutable pointer, self-locking APIs. NULL unless
+     * stats_workers is set */
+    virThreadPoolPtr statsPool;
+
+    /* Immutable pointer, self-locking APIs. NULL unless
+     * stats_sample_interval is set */
+    qemuDomainStatsSamplerPtr statsSampler;
+
     /* Atomic increment only */
     int lastvmid;
 
@@ -583,6 +583,15 @@ qemuDomainJobInfoToParams(qemuDomainJobInfoPtr jobInfo,
                              stats->cpu_throttle_percentage) < 0)
         goto error;
 
+    if (jobInfo->tunnelBytes &&
+        (virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                 VIR_DOMAIN_JOB_TUNNEL_BYTES,
+                                 jobInfo->tunnelBytes) < 0 ||
+         virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                 VIR_DOMAIN_JOB_TUNNEL_BPS,
+                                 jobInfo->tunnelBps) < 0))
+        goto error;
+
     *type = jobInfo->type;
     *params = par;
     *nparams = npar;
@@ -1732,10 +1741,126 @@ qemuDomainObjPrivateFree(void *data)
 
     virCPUDefFree(priv->origCPU);
 
+    /* Every queued event holds a reference on the domain */
+    VIR_FREE(priv->events);
+
     VIR_FREE(priv);
 }
 
 
+/* Events waiting longer than this (in ms) are reported as warnings */
+#define QEMU_PROCESS_EVENT_SLOW 5000
+
+/**
+ * qemuProcessEventSubmit:
+ * @driver: qemu driver
+ * @processEvent: event to handle, holding a reference on its domain
+ *
+ * Queues @processEvent to be handled by driver->workerPool. Events of
+ * one domain are handled one after another in the order they were
+ * submitted, events of different domains may be handled concurrently.
+ *
+ * On success, the ownership of @processEvent passes to the worker.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuProcessEventSubmit(virQEMUDriverPtr driver,
+                       struct qemuProcessEvent *processEvent)
+{
+    virDomainObjPtr vm = processEvent->vm;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int ret = -1;
+
+    if (virTimeMillisNow(&processEvent->queued) < 0)
+        return -1;
+
+    virMutexLock(&driver->eventLock);
+
+    if (VIR_APPEND_ELEMENT_COPY(priv->events, priv->nevents, processEvent) < 0)
+        goto cleanup;
+
+    /* Only one job per domain is in the pool at any time, the worker
+     * handling it drains the domain's queue */
+    if (!priv->eventsScheduled) {
+        virObjectRef(vm);
+        if (virThreadPoolSendJob(driver->workerPool, 0, vm) < 0) {
+            virObjectUnref(vm);
+            VIR_DELETE_ELEMENT(priv->events, priv->nevents - 1, priv->nevents);
+            goto cleanup;
+        }
+        priv->eventsScheduled = true;
+    }
+
+    driver->nevents++;
+    VIR_DEBUG("Queued event %d for domain %s, %zu events pending "
+              "(%zu for all domains)",
+              processEvent->eventType, vm->def->name,
+              priv->nevents, driver->nevents);
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&driver->eventLock);
+    return ret;
+}
+
+
+/**
+ * qemuProcessEventNext:
+ * @driver: qemu driver
+ * @vm: domain object
+ *
+ * Takes the oldest event queued for @vm. Called by the worker handling
+ * the domain's events. Once the queue is empty, the domain is no longer
+ * considered scheduled and the next qemuProcessEventSubmit will hand it
+ * to a worker again.
+ *
+ * Returns the event, or NULL if there is none left.
+ */
+struct qemuProcessEvent *
+qemuProcessEventNext(virQEMUDriverPtr driver,
+                     virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuProcessEvent *processEvent = NULL;
+    unsigned long long now;
+    unsigned long long waited = 0;
+
+    virMutexLock(&driver->eventLock);
+
+    if (priv->nevents == 0) {
+        priv->eventsScheduled = false;
+        goto cleanup;
+    }
+
+    processEvent = priv->events[0];
+    VIR_DELETE_ELEMENT(priv->events, 0, priv->nevents);
+    driver->nevents--;
+
+    if (virTimeMillisNow(&now) == 0 && now > processEvent->queued)
+        waited = now - processEvent->queued;
+
+    priv->eventsHandled++;
+    priv->eventsWaitTime += waited;
+    priv->eventsWaitMax = MAX(priv->eventsWaitMax, waited);
+
+    VIR_DEBUG("Handling event %d for domain %s after %llu ms, "
+              "%zu events pending (%zu for all domains)",
+              processEvent->eventType, vm->def->name, waited,
+              priv->nevents, driver->nevents);
+
+    if (waited >= QEMU_PROCESS_EVENT_SLOW)
+        VIR_WARN("Event %d for domain %s waited %llu ms to be handled, "
+                 "%zu events are pending for all domains",
+                 processEvent->eventType, vm->def->name, waited,
+                 driver->nevents);
+
+ cleanup:
+    virMutexUnlock(&driver->eventLock);
+    return processEvent;
+}
+
+
 static void
 qemuDomainObjPrivateXMLFormatVcpus(virBufferPtr buf,
                                    virDomainDefPtr def)
@@ -3821,23 +3946,53 @@ qemuDomainJobAllowed(qemuDomainObjPrivatePtr priv, qemuDomainJob job)
 /* Give up waiting for mutex after 30 seconds */
 #define QEMU_JOB_WAIT_TIME (1000ull * 30)
 
+/*
+ * Whether a new job has to wait for the jobs which are running. Shared
+ * jobs run along with each other but let any other waiting job go
+ * first so that a stream of queries can't starve it.
+ */
+static bool
+qemuDomainObjJobBusy(qemuDomainObjPrivatePtr priv,
+                     bool shared)
+{
+    if (priv->job.active)
+        return true;
+
+    if (shared)
+        return priv->job.waiters > 0;
+
+    return priv->job.nshared > 0;
+}
+
 /*
  * obj must be locked before calling
+ *
+ * @timeout is the maximum time in milliseconds to wait for
+ * the job, 0 means QEMU_JOB_WAIT_TIME
+ *
+ * If @shared is true, a QEMU_JOB_QUERY @job is started which can run
+ * along with other shared jobs.
  */
 static int ATTRIBUTE_NONNULL(1)
 qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               qemuDomainJob job,
-                              qemuDomainAsyncJob asyncJob)
+                              qemuDomainAsyncJob asyncJob,
+                              bool shared,
+                              unsigned long long timeout)
 {
     qemuDomainObjPrivatePtr priv = obj->privateData;
     unsigned long long now;
     unsigned long long then;
+    unsigned long long queued;
     bool nested = job == QEMU_JOB_ASYNC_NESTED;
     bool async = job == QEMU_JOB_ASYNC;
+    bool contended = false;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     const char *blocker = NULL;
     int ret = -1;
+    int rc = 0;
+    int saved_errno;
     unsigned long long duration = 0;
     unsigned long long asyncDuration = 0;
     const char *jobStr;
@@ -3847,10 +4002,13 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     else
         jobStr = qemuDomainJobTypeToString(job);
 
-    VIR_DEBUG("Starting %s: %s (vm=%p name=%s, current job=%s async=%s)",
-              async ? "async job" : "job", jobStr, obj, obj->def->name,
+    VIR_DEBUG("Starting %s: %s (vm=%p name=%s, current job=%s async=%s "
+              "shared=%u)",
+              async ? "async job" : shared ? "shared job" : "job",
+              jobStr, obj, obj->def->name,
               qemuDomainJobTypeToString(priv->job.active),
-              qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+              qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+              priv->job.nshared);
 
     if (virTimeMillisNow(&now) < 0) {
         virObjectUnref(cfg);
@@ -3858,7 +4016,8 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     }
 
     priv->jobs_queued++;
-    then = now + QEMU_JOB_WAIT_TIME;
+    queued = now;
+    then = now + (timeout ? timeout : QEMU_JOB_WAIT_TIME);
 
  retry:
     if (cfg->maxQueuedJobs &&
@@ -3868,24 +4027,54 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
 
     while (!nested && !qemuDomainNestedJobAllowed(priv, job)) {
         VIR_DEBUG("Waiting for async job (vm=%p name=%s)", obj, obj->def->name);
+        contended = true;
         if (virCondWaitUntil(&priv->job.asyncCond, &obj->parent.lock, then) < 0)
             goto error;
     }
 
-    while (priv->job.active) {
+    if (!shared)
+        priv->job.waiters++;
+
+    while (qemuDomainObjJobBusy(priv, shared)) {
         VIR_DEBUG("Waiting for job (vm=%p name=%s)", obj, obj->def->name);
-        if (virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then) < 0)
-            goto error;
+        contended = true;
+        if ((rc = virCondWaitUntil(&priv->job.cond, &obj->parent.lock, then)) < 0)
+            break;
     }
 
+    if (!shared) {
+        /* shared jobs could be waiting just for us */
+        saved_errno = errno;
+        if (--priv->job.waiters == 0)
+            virCondBroadcast(&priv->job.cond);
+        errno = saved_errno;
+    }
+
+    if (rc < 0)
+        goto error;
+
     /* No job is active but a new async job could have been started while obj
      * was unlocked, so we need to recheck it. */
     if (!nested && !qemuDomainNestedJobAllowed(priv, job))
         goto retry;
 
-    qemuDomainObjResetJob(priv);
-
     ignore_value(virTimeMillisNow(&now));
+    if (contended) {
+        priv->job.contended++;
+        priv->job.waitTime += now - queued;
+    }
+
+    if (shared) {
+        VIR_DEBUG("Started shared job: %s (async=%s vm=%p name=%s)",
+                  qemuDomainJobTypeToString(job),
+                  qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                  obj, obj->def->name);
+        priv->job.nshared++;
+        virObjectUnref(cfg);
+        return 0;
+    }
+
+    qemuDomainObjResetJob(priv);
 
     if (job != QEMU_JOB_ASYNC) {
         VIR_DEBUG("Started job: %s (async=%s vm=%p name=%s)",
@@ -3917,7 +4106,13 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
     return 0;
 
  error:
+    saved_errno = errno;
     ignore_value(virTimeMillisNow(&now));
+    if (contended) {
+        priv->job.contended++;
+        priv->job.waitTime += now - queued;
+    }
+    errno = saved_errno;
     if (priv->job.active && priv->job.started)
         duration = now - priv->job.started;
     if (priv->job.asyncJob && priv->job.asyncStarted)
@@ -3987,12 +4182,37 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           qemuDomainJob job)
 {
     if (qemuDomainObjBeginJobInternal(driver, obj, job,
-                                      QEMU_ASYNC_JOB_NONE) < 0)
+                                      QEMU_ASYNC_JOB_NONE, false, 0) < 0)
         return -1;
     else
         return 0;
 }
 
+/*
+ * obj must be locked before calling
+ *
+ * Starts a QEMU_JOB_QUERY job which, unlike the one started by
+ * qemuDomainObjBeginJob, runs along with other shared jobs on the same
+ * domain. Their monitor and agent commands are sent one after another.
+ * It may only be used by APIs which don't change the domain.
+ *
+ * @timeout is the maximum time in milliseconds to wait for the job,
+ * 0 means the default.
+ *
+ * Successful calls must be followed by EndSharedJob eventually.
+ *
+ * Returns 0 on success, -2 if the job could not be acquired in
+ * time or due to max_queued limit, -1 on other errors.
+ */
+int
+qemuDomainObjBeginSharedJob(virQEMUDriverPtr driver,
+                            virDomainObjPtr obj,
+                            unsigned long long timeout)
+{
+    return qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_QUERY,
+                                         QEMU_ASYNC_JOB_NONE, true, timeout);
+}
+
 int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                virDomainObjPtr obj,
                                qemuDomainAsyncJob asyncJob,
@@ -4001,7 +4221,7 @@ int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
     qemuDomainObjPrivatePtr priv;
 
     if (qemuDomainObjBeginJobInternal(driver, obj, QEMU_JOB_ASYNC,
-                                      asyncJob) < 0)
+                                      asyncJob, false, 0) < 0)
         return -1;
 
     priv = obj->privateData;
@@ -4029,7 +4249,7 @@ qemuDomainObjBeginNestedJob(virQEMUDriverPtr driver,
 
     return qemuDomainObjBeginJobInternal(driver, obj,
                                          QEMU_JOB_ASYNC_NESTED,
-                                         QEMU_ASYNC_JOB_NONE);
+                                         QEMU_ASYNC_JOB_NONE, false, 0);
 }
 
 
@@ -4055,7 +4275,30 @@ qemuDomainObjEndJob(virQEMUDriverPtr driver, virDomainObjPtr obj)
     qemuDomainObjResetJob(priv);
     if (qemuDomainTrackJob(job))
         qemuDomainObjSaveJob(driver, obj);
-    virCondSignal(&priv->job.cond);
+    /* several shared jobs may be waiting */
+    virCondBroadcast(&priv->job.cond);
+}
+
+/*
+ * obj must be locked and have a reference before calling
+ *
+ * To be called after completing the work associated with the
+ * earlier qemuDomainObjBeginSharedJob() call
+ */
+void
+qemuDomainObjEndSharedJob(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                          virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    priv->jobs_queued--;
+
+    VIR_DEBUG("Stopping shared job (async=%s vm=%p name=%s shared=%u)",
+              qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+              obj, obj->def->name, priv->job.nshared);
+
+    if (--priv->job.nshared == 0)
+        virCondBroadcast(&priv->job.cond);
 }
 
 void
@@ -4122,7 +4365,10 @@ qemuDomainObjEnterMonitorInternal(virQEMUDriverPtr driver,
               priv->mon, obj, obj->def->name);
     virObjectLock(priv->mon);
     virObjectRef(priv->mon);
-    ignore_value(virTimeMillisNow(&priv->monStart));
+    /* Threads holding a shared job may be inside the monitor at the
+     * same time, keep the time the first one of them entered */
+    if (priv->monUsers++ == 0)
+        ignore_value(virTimeMillisNow(&priv->monStart));
     virObjectUnlock(obj);
 
     return 0;
@@ -4144,7 +4390,8 @@ qemuDomainObjExitMonitorInternal(virQEMUDriverPtr driver,
     VIR_DEBUG("Exited monitor (mon=%p vm=%p name=%s)",
               priv->mon, obj, obj->def->name);
 
-    priv->monStart = 0;
+    if (--priv->monUsers == 0)
+        priv->monStart = 0;
     if (!hasRefs)
         priv->mon = NULL;
 
@@ -4205,6 +4452,61 @@ qemuDomainObjEnterMonitorAsync(virQEMUDriverPtr driver,
 }
 
 
+/*
+ * obj must be locked before calling
+ *
+ * Fills @info with the state of the control interface of @obj, that is
+ * whether a job or a monitor command is currently running on it.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainObjGetControlInfo(virDomainObjPtr obj,
+                            virDomainControlInfoPtr info)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    memset(info, 0, sizeof(*info));
+
+    if (priv->monError) {
+        info->state = VIR_DOMAIN_CONTROL_ERROR;
+        info->details = VIR_DOMAIN_CONTROL_ERROR_REASON_MONITOR;
+        return 0;
+    }
+
+    /* Shared jobs don't set job.active, they only count in job.nshared */
+    if (!priv->job.active && priv->job.nshared == 0 && priv->monUsers == 0) {
+        info->state = VIR_DOMAIN_CONTROL_OK;
+        return 0;
+    }
+
+    if (virTimeMillisNow(&info->stateTime) < 0)
+        return -1;
+
+    if (priv->job.current) {
+        info->state = VIR_DOMAIN_CONTROL_JOB;
+        info->stateTime -= priv->job.current->started;
+    } else if (priv->monStart > 0) {
+        info->state = VIR_DOMAIN_CONTROL_OCCUPIED;
+        info->stateTime -= priv->monStart;
+    } else if (priv->job.active) {
+        /* At this point the domain has an active job, but monitor was
+         * not entered and the domain object lock is not held thus we
+         * are stuck in the job forever due to a programming error.
+         */
+        info->state = VIR_DOMAIN_CONTROL_ERROR;
+        info->details = VIR_DOMAIN_CONTROL_ERROR_REASON_INTERNAL;
+        info->stateTime = 0;
+    } else {
+        /* shared jobs outside of the monitor don't block anything */
+        info->state = VIR_DOMAIN_CONTROL_OK;
+        info->stateTime = 0;
+    }
+
+    return 0;
+}
+
+
 /*
  * obj must be locked before calling
  *
@@ -6672,7 +6974,7 @@ qemuDomainUpdateCurrentMemorySize(virQEMUDriverPtr driver,
     /* Don't delay if someone's using the monitor, just use existing most
      * recent data instead */
     if (qemuDomainJobAllowed(priv, QEMU_JOB_QUERY)) {
-        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
             return -1;
 
         if (!virDomainObjIsActive(vm)) {
@@ -6687,7 +6989,7 @@ qemuDomainUpdateCurrentMemorySize(virQEMUDriverPtr driver,
             ret = -1;
 
  endjob:
-        qemuDomainObjEndJob(driver, vm);
+        qemuDomainObjEndSharedJob(driver, vm);
 
         if (ret < 0)
             return -1;
@@ -119,6 +119,9 @@ struct _qemuDomainJobInfo {
                             source and the beginning of Finish phase on the
                             destination. */
     bool timeDeltaSet;
+    /* Data forwarded through the tunnel of a tunnelled migration */
+    unsigned long long tunnelBytes;
+    unsigned long long tunnelBps;
     /* Raw values from QEMU */
     qemuMonitorMigrationStats stats;
 };
@@ -129,6 +132,11 @@ struct qemuDomainJobObj {
     unsigned long long owner;           /* Thread id which set current job */
     const char *ownerAPI;               /* The API which owns the job */
     unsigned long long started;         /* When the current job started */
+    unsigned int nshared;               /* Number of shared query jobs */
+    unsigned int waiters;               /* Jobs other than shared ones waiting
+                                         * for @cond, they go first */
+    unsigned long long contended;       /* Number of jobs which had to wait */
+    unsigned long long waitTime;        /* Time jobs spent waiting, in ms */
 
     virCond asyncCond;                  /* Use to coordinate with async jobs */
     qemuDomainAsyncJob asyncJob;        /* Currently active async job */
@@ -227,7 +235,8 @@ struct _qemuDomainObjPrivate {
     virDomainChrSourceDefPtr monConfig;
     bool monJSON;
     bool monError;
-    unsigned long long monStart;
+    unsigned long long monStart; /* when the earliest monitor user entered */
+    size_t monUsers; /* threads inside the monitor, see shared jobs */
 
     qemuAgentPtr agent;
     bool agentError;
@@ -302,6 +311,15 @@ struct _qemuDomainObjPrivate {
 
     /* If true virtlogd is used as stdio handler for character devices. */
     bool chardevStdioLogd;
+
+    /* Process events waiting to be handled, in order of arrival, and
+     * whether a worker is handling them. Protected by driver->eventLock */
+    struct qemuProcessEvent **events;
+    size_t nevents;
+    bool eventsScheduled;
+    unsigned long long eventsHandled;   /* Number of events taken by workers */
+    unsigned long long eventsWaitTime;  /* Time they spent queued, in ms */
+    unsigned long long eventsWaitMax;   /* Longest time one spent queued */
 };
 
 # define QEMU_DOMAIN_PRIVATE(vm)	\
@@ -421,8 +439,16 @@ struct qemuProcessEvent {
     int action;
     int status;
     void *data;
+    unsigned long long queued; /* time the event was submitted, in ms */
 };
 
+int qemuProcessEventSubmit(virQEMUDriverPtr driver,
+                           struct qemuProcessEvent *processEvent)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+struct qemuProcessEvent *qemuProcessEventNext(virQEMUDriverPtr driver,
+                                              virDomainObjPtr vm)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 typedef struct _qemuDomainLogContext qemuDomainLogContext;
 typedef qemuDomainLogContext *qemuDomainLogContextPtr;
 
@@ -452,6 +478,10 @@ int qemuDomainObjBeginJob(virQEMUDriverPtr driver,
                           virDomainObjPtr obj,
                           qemuDomainJob job)
     ATTRIBUTE_RETURN_CHECK;
+int qemuDomainObjBeginSharedJob(virQEMUDriverPtr driver,
+                                virDomainObjPtr obj,
+                                unsigned long long timeout)
+    ATTRIBUTE_RETURN_CHECK;
 int qemuDomainObjBeginAsyncJob(virQEMUDriverPtr driver,
                                virDomainObjPtr obj,
                                qemuDomainAsyncJob asyncJob,
@@ -464,6 +494,8 @@ int qemuDomainObjBeginNestedJob(virQEMUDriverPtr driver,
 
 void qemuDomainObjEndJob(virQEMUDriverPtr driver,
                          virDomainObjPtr obj);
+void qemuDomainObjEndSharedJob(virQEMUDriverPtr driver,
+                               virDomainObjPtr obj);
 void qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver,
                               virDomainObjPtr obj);
 void qemuDomainObjAbortAsyncJob(virDomainObjPtr obj);
@@ -492,6 +524,10 @@ int qemuDomainObjEnterMonitorAsync(virQEMUDriverPtr driver,
                                    qemuDomainAsyncJob asyncJob)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+int qemuDomainObjGetControlInfo(virDomainObjPtr obj,
+                                virDomainControlInfoPtr info)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 
 qemuAgentPtr qemuDomainObjEnterAgent(virDomainObjPtr obj)
     ATTRIBUTE_NONNULL(1);
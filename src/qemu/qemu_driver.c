@@ -41,6 +41,7 @@
 #include <sys/ioctl.h>
 #include <sys/un.h>
 #include <byteswap.h>
+#include <fnmatch.h>
 
 
 #include "qemu_driver.h"
@@ -137,7 +138,11 @@ VIR_LOG_INIT("qemu.qemu_driver");
 
 #define QEMU_NB_BANDWIDTH_PARAM 7
 
-static void qemuProcessEventHandler(void *data, void *opaque);
+static void qemuProcessEventWorker(void *data, void *opaque);
+static void qemuDomainGetStatsPoolHandler(void *data, void *opaque);
+static int qemuDomainStatsSamplerStart(virQEMUDriverPtr driver,
+                                       unsigned int interval);
+static void qemuDomainStatsSamplerStop(virQEMUDriverPtr driver);
 
 static int qemuStateCleanup(void);
 
@@ -186,6 +191,9 @@ static virNWFilterCallbackDriver qemuCallbackDriver = {
 struct qemuAutostartData {
     virQEMUDriverPtr driver;
     virConnectPtr conn;
+
+    /* Domains of the group which is being started */
+    virDomainObjPtr *vms;
 };
 
 
@@ -269,6 +277,11 @@ qemuAutostartDomain(virDomainObjPtr vm,
     virResetLastError();
     if (vm->autostart &&
         !virDomainObjIsActive(vm)) {
+        unsigned long long start = 0;
+        unsigned long long end = 0;
+
+        ignore_value(virTimeMillisNow(&start));
+
         if (qemuProcessBeginJob(data->driver, vm,
                                 VIR_DOMAIN_JOB_OPERATION_START) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -282,6 +295,10 @@ qemuAutostartDomain(virDomainObjPtr vm,
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Failed to autostart VM '%s': %s"),
                            vm->def->name, virGetLastErrorMessage());
+        } else {
+            ignore_value(virTimeMillisNow(&end));
+            VIR_INFO("Autostarted VM '%s' in %llu ms",
+                     vm->def->name, end - start);
         }
 
         qemuProcessEndJob(data->driver, vm);
@@ -295,6 +312,43 @@ qemuAutostartDomain(virDomainObjPtr vm,
 }
 
 
+static void
+qemuAutostartWorker(size_t idx,
+                    void *opaque)
+{
+    struct qemuAutostartData *data = opaque;
+
+    qemuAutostartDomain(data->vms[idx], data);
+}
+
+
+/* Returns the index of the first of @groups matching the domain @name,
+ * or the number of @groups if none matches. */
+static size_t
+qemuAutostartDomainGroup(const char *name,
+                         char **groups)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; groups && groups[i]; i++) {
+        char **patterns = virStringSplit(groups[i], ",", 0);
+        bool match = false;
+
+        for (j = 0; patterns && patterns[j] && !match; j++) {
+            virTrimSpaces(patterns[j], NULL);
+            match = fnmatch(patterns[j], name, 0) == 0;
+        }
+
+        virStringListFree(patterns);
+        if (match)
+            break;
+    }
+
+    return i;
+}
+
+
 static void
 qemuAutostartDomains(virQEMUDriverPtr driver)
 {
@@ -306,10 +360,62 @@ qemuAutostartDomains(virQEMUDriverPtr driver)
      */
     virConnectPtr conn = virConnectOpen(cfg->uri);
     /* Ignoring NULL conn which is mostly harmless here */
-    struct qemuAutostartData data = { driver, conn };
+    struct qemuAutostartData data;
+    size_t ngroups = virStringListLength((const char * const *) cfg->autostartGroups);
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    size_t *groups = NULL;
+    virDomainObjPtr *groupvms = NULL;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    size_t i;
+    size_t g;
 
-    virDomainObjListForEach(driver->domains, qemuAutostartDomain, &data);
+    memset(&data, 0, sizeof(data));
+    data.driver = driver;
+    data.conn = conn;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms, NULL,
+                                VIR_CONNECT_LIST_DOMAINS_AUTOSTART) < 0 ||
+        VIR_ALLOC_N(groups, nvms) < 0 ||
+        VIR_ALLOC_N(groupvms, nvms) < 0) {
+        VIR_ERROR(_("Failed to autostart domains: %s"),
+                  virGetLastErrorMessage());
+        goto cleanup;
+    }
 
+    for (i = 0; i < nvms; i++) {
+        virObjectLock(vms[i]);
+        groups[i] = qemuAutostartDomainGroup(vms[i]->def->name,
+                                             cfg->autostartGroups);
+        virObjectUnlock(vms[i]);
+    }
+
+    ignore_value(virTimeMillisNow(&start));
+
+    /* domains not matching any group form the last one */
+    for (g = 0; g <= ngroups; g++) {
+        size_t ngroupvms = 0;
+
+        for (i = 0; i < nvms; i++) {
+            if (groups[i] == g)
+                groupvms[ngroupvms++] = vms[i];
+        }
+
+        data.vms = groupvms;
+        virThreadPoolRunBatch(NULL, cfg->autostartWorkers, ngroupvms,
+                              qemuAutostartWorker, &data);
+    }
+
+    ignore_value(virTimeMillisNow(&end));
+    if (nvms)
+        VIR_INFO("Autostart of %zu VMs finished in %llu ms",
+                 nvms, end - start);
+
+ cleanup:
+    VIR_FREE(groupvms);
+    VIR_FREE(groups);
+    virObjectListFreeCount(vms, nvms);
     virObjectUnref(conn);
     virObjectUnref(cfg);
 }
@@ -640,6 +746,14 @@ qemuStateInitialize(bool privileged,
         return -1;
     }
 
+    if (virMutexInit(&qemu_driver->eventLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        virMutexDestroy(&qemu_driver->lock);
+        VIR_FREE(qemu_driver);
+        return -1;
+    }
+
     qemu_driver->inhibitCallback = callback;
     qemu_driver->inhibitOpaque = opaque;
 
@@ -864,6 +978,8 @@ qemuStateInitialize(bool privileged,
     if (!(qemu_driver->xmlopt = virQEMUDriverCreateXMLConf(qemu_driver)))
         goto error;
 
+    virDomainXMLOptionSetStatusJournal(qemu_driver->xmlopt, cfg->statusJournal);
+
     /* If hugetlbfs is present, then we need to create a sub-directory within
      * it, since we can't assume the root mount point has permissions that
      * will let our spawned QEMU instances use it. */
@@ -930,10 +1046,22 @@ qemuStateInitialize(bool privileged,
 
     qemuProcessReconnectAll(conn, qemu_driver);
 
-    qemu_driver->workerPool = virThreadPoolNew(0, 1, 0, qemuProcessEventHandler, qemu_driver);
+    qemu_driver->workerPool = virThreadPoolNew(0, cfg->eventWorkers, 0,
+                                               qemuProcessEventWorker,
+                                               qemu_driver);
     if (!qemu_driver->workerPool)
         goto error;
 
+    if (cfg->statsWorkers &&
+        !(qemu_driver->statsPool = virThreadPoolNewFull(0, cfg->statsWorkers, 0,
+                                                        NULL, "qemuDomainGetStats",
+                                                        NULL)))
+        goto error;
+
+    if (cfg->statsSampleInterval &&
+        qemuDomainStatsSamplerStart(qemu_driver, cfg->statsSampleInterval) < 0)
+        goto error;
+
     virObjectUnref(conn);
 
     virNWFilterRegisterCallbackDriver(&qemuCallbackDriver);
@@ -1077,7 +1205,9 @@ qemuStateCleanup(void)
         return -1;
 
     virNWFilterUnRegisterCallbackDriver(&qemuCallbackDriver);
+    qemuDomainStatsSamplerStop(qemu_driver);
     virThreadPoolFree(qemu_driver->workerPool);
+    virThreadPoolFree(qemu_driver->statsPool);
     virObjectUnref(qemu_driver->config);
     virObjectUnref(qemu_driver->hostdevMgr);
     virHashFree(qemu_driver->sharedDevices);
@@ -1107,6 +1237,7 @@ qemuStateCleanup(void)
 
     virLockManagerPluginUnref(qemu_driver->lockManager);
 
+    virMutexDestroy(&qemu_driver->eventLock);
     virMutexDestroy(&qemu_driver->lock);
     VIR_FREE(qemu_driver);
 
@@ -2707,7 +2838,6 @@ qemuDomainGetControlInfo(virDomainPtr dom,
                           unsigned int flags)
 {
     virDomainObjPtr vm;
-    qemuDomainObjPrivatePtr priv;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -2724,36 +2854,8 @@ qemuDomainGetControlInfo(virDomainPtr dom,
         goto cleanup;
     }
 
-    priv = vm->privateData;
-
-    memset(info, 0, sizeof(*info));
-
-    if (priv->monError) {
-        info->state = VIR_DOMAIN_CONTROL_ERROR;
-        info->details = VIR_DOMAIN_CONTROL_ERROR_REASON_MONITOR;
-    } else if (priv->job.active) {
-        if (virTimeMillisNow(&info->stateTime) < 0)
-            goto cleanup;
-        if (priv->job.current) {
-            info->state = VIR_DOMAIN_CONTROL_JOB;
-            info->stateTime -= priv->job.current->started;
-        } else {
-            if (priv->monStart > 0) {
-                info->state = VIR_DOMAIN_CONTROL_OCCUPIED;
-                info->stateTime -= priv->monStart;
-            } else {
-                /* At this point the domain has an active job, but monitor was
-                 * not entered and the domain object lock is not held thus we
-                 * are stuck in the job forever due to a programming error.
-                 */
-                info->state = VIR_DOMAIN_CONTROL_ERROR;
-                info->details = VIR_DOMAIN_CONTROL_ERROR_REASON_INTERNAL;
-                info->stateTime = 0;
-            }
-        }
-    } else {
-        info->state = VIR_DOMAIN_CONTROL_OK;
-    }
+    if (qemuDomainObjGetControlInfo(vm, info) < 0)
+        goto cleanup;
 
     ret = 0;
 
@@ -4734,11 +4836,11 @@ processMonitorEOFEvent(virQEMUDriverPtr driver,
 }
 
 
-static void qemuProcessEventHandler(void *data, void *opaque)
+static void
+qemuProcessEventHandler(virQEMUDriverPtr driver,
+                        struct qemuProcessEvent *processEvent)
 {
-    struct qemuProcessEvent *processEvent = data;
     virDomainObjPtr vm = processEvent->vm;
-    virQEMUDriverPtr driver = opaque;
 
     VIR_DEBUG("vm=%p, event=%d", vm, processEvent->eventType);
 
@@ -4780,6 +4882,25 @@ static void qemuProcessEventHandler(void *data, void *opaque)
 }
 
 
+/*
+ * Thread pool job handling the queued process events of one domain.
+ * Events of the domain submitted while this runs are handled here too,
+ * which keeps them ordered without blocking other domains.
+ */
+static void
+qemuProcessEventWorker(void *data, void *opaque)
+{
+    virDomainObjPtr vm = data;
+    virQEMUDriverPtr driver = opaque;
+    struct qemuProcessEvent *processEvent;
+
+    while ((processEvent = qemuProcessEventNext(driver, vm)))
+        qemuProcessEventHandler(driver, processEvent);
+
+    virObjectUnref(vm);
+}
+
+
 static int
 qemuDomainSetVcpusAgent(virDomainObjPtr vm,
                         unsigned int nvcpus)
@@ -11287,12 +11408,12 @@ qemuDomainMemoryStats(virDomainPtr dom,
     if (virDomainMemoryStatsEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
         goto cleanup;
 
     ret = qemuDomainMemoryStatsInternal(driver, vm, stats, nr_stats);
 
-    qemuDomainObjEndJob(driver, vm);
+    qemuDomainObjEndSharedJob(driver, vm);
 
  cleanup:
     virDomainObjEndAPI(&vm);
@@ -11634,7 +11755,7 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     if (virDomainGetBlockInfoEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
-    if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+    if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
         goto cleanup;
 
     if (!(disk = virDomainDiskByName(vm->def, path, false))) {
@@ -11727,7 +11848,7 @@ qemuDomainGetBlockInfo(virDomainPtr dom,
     ret = 0;
 
  endjob:
-    qemuDomainObjEndJob(driver, vm);
+    qemuDomainObjEndSharedJob(driver, vm);
  cleanup:
     VIR_FREE(alias);
     virHashFree(stats);
@@ -12923,7 +13044,7 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
                              "the source host"));
             return -1;
         }
-        if (qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) < 0)
+        if (qemuDomainObjBeginSharedJob(driver, vm, 0) < 0)
             return -1;
     }
 
@@ -12961,7 +13082,7 @@ qemuDomainGetJobStatsInternal(virQEMUDriverPtr driver,
 
  cleanup:
     if (fetch)
-        qemuDomainObjEndJob(driver, vm);
+        qemuDomainObjEndSharedJob(driver, vm);
     return ret;
 }
 
@@ -19055,12 +19176,18 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
 
 
 static int
-qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+qemuDomainGetStatsState(virQEMUDriverPtr driver,
                         virDomainObjPtr dom,
                         virDomainStatsRecordPtr record,
                         int *maxparams,
                         unsigned int privflags ATTRIBUTE_UNUSED)
 {
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned long long eventsPending;
+    unsigned long long eventsHandled;
+    unsigned long long eventsWaitTime;
+    unsigned long long eventsWaitMax;
+
     if (virTypedParamsAddInt(&record->params,
                              &record->nparams,
                              maxparams,
@@ -19075,6 +19202,55 @@ qemuDomainGetStatsState(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
                              dom->state.reason) < 0)
         return -1;
 
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.job.waits",
+                                priv->job.contended) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.job.wait_time",
+                                priv->job.waitTime) < 0)
+        return -1;
+
+    virMutexLock(&driver->eventLock);
+    eventsPending = priv->nevents;
+    eventsHandled = priv->eventsHandled;
+    eventsWaitTime = priv->eventsWaitTime;
+    eventsWaitMax = priv->eventsWaitMax;
+    virMutexUnlock(&driver->eventLock);
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.events.pending",
+                                eventsPending) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.events.handled",
+                                eventsHandled) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.events.wait_time",
+                                eventsWaitTime) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(&record->params,
+                                &record->nparams,
+                                maxparams,
+                                "state.events.wait_max",
+                                eventsWaitMax) < 0)
+        return -1;
+
     return 0;
 }
 
@@ -19746,17 +19922,18 @@ struct qemuDomainGetStatsWorker {
     qemuDomainGetStatsFunc func;
     unsigned int stats;
     bool monitor;
+    const char *prefix; /* of the names of all the fields @func adds */
 };
 
 static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
-    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
-    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
-    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
-    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, true },
-    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
-    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
-    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false },
-    { NULL, 0, false }
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false, "state." },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false, "cpu." },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true, "balloon." },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, true, "vcpu." },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false, "net." },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true, "block." },
+    { qemuDomainGetStatsPerf, VIR_DOMAIN_STATS_PERF, false, "perf." },
+    { NULL, 0, false, NULL }
 };
 
 
@@ -19802,30 +19979,95 @@ qemuDomainGetStatsNeedMonitor(unsigned int stats)
 }
 
 
+/*
+ * Sends all the monitor queries the workers for @stats are going to do
+ * in a single batch, the workers then get the replies without waiting
+ * on QEMU again. Failing to do so is not fatal, the workers just talk
+ * to QEMU on their own.
+ *
+ * Returns true if replies were prefetched.
+ */
+static bool
+qemuDomainGetStatsPrefetch(virQEMUDriverPtr driver,
+                           virDomainObjPtr dom,
+                           unsigned int stats)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    unsigned int flags = 0;
+    int rc;
+
+    if (!priv->monJSON)
+        return false;
+
+    if (stats & VIR_DOMAIN_STATS_BLOCK) {
+        flags |= QEMU_MONITOR_PREFETCH_BLOCK;
+        if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_QUERY_NAMED_BLOCK_NODES))
+            flags |= QEMU_MONITOR_PREFETCH_BLOCK_NODES;
+    }
+
+    /* see qemuDomainRefreshVcpuHalted */
+    if (stats & VIR_DOMAIN_STATS_VCPU &&
+        dom->def->virtType != VIR_DOMAIN_VIRT_QEMU)
+        flags |= QEMU_MONITOR_PREFETCH_CPUS;
+
+    /* see qemuDomainMemoryStatsInternal */
+    if (stats & VIR_DOMAIN_STATS_BALLOON &&
+        dom->def->memballoon &&
+        dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_VIRTIO)
+        flags |= QEMU_MONITOR_PREFETCH_BALLOON;
+
+    if (!flags)
+        return false;
+
+    qemuDomainObjEnterMonitor(driver, dom);
+    rc = qemuMonitorPrefetch(priv->mon, dom->def->memballoon, flags);
+    if (qemuDomainObjExitMonitor(driver, dom) < 0)
+        return false;
+
+    if (rc < 0) {
+        virResetLastError();
+        return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Gathers the @stats of @dom into a new @record. If @conn is NULL the
+ * record isn't associated with any domain.
+ */
 static int
-qemuDomainGetStats(virConnectPtr conn,
+qemuDomainGetStats(virQEMUDriverPtr driver,
+                   virConnectPtr conn,
                    virDomainObjPtr dom,
                    unsigned int stats,
                    virDomainStatsRecordPtr *record,
                    unsigned int flags)
 {
+    qemuDomainObjPrivatePtr priv = dom->privateData;
     int maxparams = 0;
     virDomainStatsRecordPtr tmp;
+    bool prefetched = false;
     size_t i;
     int ret = -1;
 
     if (VIR_ALLOC(tmp) < 0)
         goto cleanup;
 
+    if (HAVE_JOB(flags) && virDomainObjIsActive(dom))
+        prefetched = qemuDomainGetStatsPrefetch(driver, dom, stats);
+
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
         if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            if (qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, tmp,
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, tmp,
                                                   &maxparams, flags) < 0)
                 goto cleanup;
         }
     }
 
-    if (!(tmp->dom = virGetDomain(conn, dom->def->name,
+    if (conn &&
+        !(tmp->dom = virGetDomain(conn, dom->def->name,
                                   dom->def->uuid, dom->def->id)))
         goto cleanup;
 
@@ -19834,6 +20076,9 @@ qemuDomainGetStats(virConnectPtr conn,
     ret = 0;
 
  cleanup:
+    if (prefetched && priv->mon)
+        qemuMonitorPrefetchClear(priv->mon);
+
     if (tmp) {
         virTypedParamsFree(tmp->params, tmp->nparams);
         VIR_FREE(tmp);
@@ -19843,6 +20088,582 @@ qemuDomainGetStats(virConnectPtr conn,
 }
 
 
+/**
+ * qemuDomainGetStatsOne:
+ * @driver: qemu driver
+ * @conn: connection, may be NULL
+ * @vm: locked domain object
+ * @stats: requested stats groups
+ * @privflags: QEMU_DOMAIN_STATS_HAVE_JOB if a job is needed
+ * @flags: VIR_CONNECT_GET_ALL_DOMAINS_STATS_* flags
+ * @jobTimeout: how long to wait for the job in milliseconds
+ * @record: filled with the stats record
+ *
+ * Gathers the stats of a single domain. If @jobTimeout is 0, the default
+ * job timeout applies and the stats which don't require a job are still
+ * gathered if the job can't be acquired. Otherwise the domain is skipped
+ * and @record is set to NULL when the job can't be acquired in time.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuDomainGetStatsOne(virQEMUDriverPtr driver,
+                      virConnectPtr conn,
+                      virDomainObjPtr vm,
+                      unsigned int stats,
+                      unsigned int privflags,
+                      unsigned int flags,
+                      unsigned long long jobTimeout,
+                      virDomainStatsRecordPtr *record)
+{
+    unsigned int domflags = 0;
+    int rc;
+    int ret = -1;
+
+    *record = NULL;
+
+    if (HAVE_JOB(privflags)) {
+        rc = qemuDomainObjBeginSharedJob(driver, vm, jobTimeout);
+        if (rc == -2 && jobTimeout) {
+            VIR_WARN("Skipping stats of busy domain %s", vm->def->name);
+            virResetLastError();
+            return 0;
+        }
+
+        if (rc == 0)
+            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
+        /* else: without a job it's still possible to gather some data */
+    }
+
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
+        domflags |= QEMU_DOMAIN_STATS_BACKING;
+    if (qemuDomainGetStats(driver, conn, vm, stats, record, domflags) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (HAVE_JOB(domflags))
+        qemuDomainObjEndSharedJob(driver, vm);
+
+    return ret;
+}
+
+
+typedef struct _qemuDomainGetStatsBatch qemuDomainGetStatsBatch;
+typedef qemuDomainGetStatsBatch *qemuDomainGetStatsBatchPtr;
+struct _qemuDomainGetStatsBatch {
+    virQEMUDriverPtr driver;
+    virConnectPtr conn;
+    unsigned int stats;
+    unsigned int privflags;
+    unsigned int flags;
+    unsigned long long jobTimeout;
+
+    /* all indexed the same way as @vms */
+    virDomainObjPtr *vms;
+    virDomainStatsRecordPtr *records;
+    virErrorPtr *errors;
+};
+
+
+static void
+qemuDomainGetStatsBatchWorker(size_t idx,
+                              void *opaque)
+{
+    qemuDomainGetStatsBatchPtr batch = opaque;
+    virDomainObjPtr vm = batch->vms[idx];
+    int rc;
+
+    virObjectLock(vm);
+    rc = qemuDomainGetStatsOne(batch->driver, batch->conn, vm, batch->stats,
+                               batch->privflags, batch->flags,
+                               batch->jobTimeout, &batch->records[idx]);
+    virObjectUnlock(vm);
+
+    if (rc < 0)
+        batch->errors[idx] = virSaveLastError();
+    virResetLastError();
+}
+
+
+/**
+ * qemuDomainGetStatsParallel:
+ *
+ * Gathers the stats of @vms using the stats thread pool. Domains whose
+ * job can't be acquired within stats_job_timeout are skipped. The record
+ * of vms[i] is stored in tmpstats[i], or NULL if the domain was skipped,
+ * even on failure.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuDomainGetStatsParallel(virQEMUDriverPtr driver,
+                           virConnectPtr conn,
+                           virDomainObjPtr *vms,
+                           size_t nvms,
+                           unsigned int stats,
+                           unsigned int privflags,
+                           unsigned int flags,
+                           virDomainStatsRecordPtr *tmpstats)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainGetStatsBatch batch;
+    size_t i;
+    int ret = -1;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.driver = driver;
+    batch.conn = conn;
+    batch.stats = stats;
+    batch.privflags = privflags;
+    batch.flags = flags;
+    batch.jobTimeout = cfg->statsJobTimeout;
+    batch.vms = vms;
+    batch.records = tmpstats;
+
+    if (VIR_ALLOC_N(batch.errors, nvms) < 0)
+        goto cleanup;
+
+    virThreadPoolRunBatch(driver->statsPool, 0, nvms,
+                          qemuDomainGetStatsBatchWorker, &batch);
+
+    /* records of a failed batch are freed by the caller along with
+     * @tmpstats */
+    for (i = 0; i < nvms; i++) {
+        if (batch.errors[i]) {
+            virSetError(batch.errors[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; batch.errors && i < nvms; i++)
+        virFreeError(batch.errors[i]);
+    VIR_FREE(batch.errors);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+/*
+ * The stats sampler gathers the stats of all running domains every
+ * stats_sample_interval seconds into a new qemuDomainStatsSample which
+ * then replaces the previous one. A sample is never modified once it's
+ * published so readers only need to hold a reference to it, they don't
+ * lock nor wait for any domain.
+ */
+typedef struct _qemuDomainStatsSampleEntry qemuDomainStatsSampleEntry;
+typedef qemuDomainStatsSampleEntry *qemuDomainStatsSampleEntryPtr;
+struct _qemuDomainStatsSampleEntry {
+    unsigned long long timestamp; /* when the stats were gathered */
+    virTypedParameterPtr params;
+    int nparams;
+};
+
+typedef struct _qemuDomainStatsSample qemuDomainStatsSample;
+typedef qemuDomainStatsSample *qemuDomainStatsSamplePtr;
+struct _qemuDomainStatsSample {
+    virObject parent;
+
+    /* qemuDomainStatsSampleEntry of each domain by UUID string */
+    virHashTablePtr entries;
+};
+
+struct _qemuDomainStatsSampler {
+    virThread thread;
+    unsigned long long interval; /* in milliseconds */
+
+    virMutex lock;
+    virCond cond;
+    bool quit;
+    qemuDomainStatsSamplePtr sample; /* latest sample, NULL at first */
+};
+
+static virClassPtr qemuDomainStatsSampleClass;
+
+static void
+qemuDomainStatsSampleDispose(void *obj)
+{
+    qemuDomainStatsSamplePtr sample = obj;
+
+    virHashFree(sample->entries);
+}
+
+
+static int
+qemuDomainStatsSampleOnceInit(void)
+{
+    if (!(qemuDomainStatsSampleClass = virClassNew(virClassForObject(),
+                                                   "qemuDomainStatsSample",
+                                                   sizeof(qemuDomainStatsSample),
+                                                   qemuDomainStatsSampleDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(qemuDomainStatsSample)
+
+
+static void
+qemuDomainStatsSampleEntryFree(void *payload,
+                               const void *name ATTRIBUTE_UNUSED)
+{
+    qemuDomainStatsSampleEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virTypedParamsFree(entry->params, entry->nparams);
+    VIR_FREE(entry);
+}
+
+
+/*
+ * Stores the stats of @vm in @sample, taking them from @record, or from
+ * @prev if the domain was skipped. Takes ownership of @record.
+ */
+static int
+qemuDomainStatsSampleAdd(qemuDomainStatsSamplePtr sample,
+                         qemuDomainStatsSamplePtr prev,
+                         virDomainObjPtr vm,
+                         virDomainStatsRecordPtr record,
+                         unsigned long long timestamp)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    qemuDomainStatsSampleEntryPtr entry = NULL;
+    qemuDomainStatsSampleEntryPtr old = NULL;
+    int ret = -1;
+
+    virObjectLock(vm);
+    virUUIDFormat(vm->def->uuid, uuidstr);
+    virObjectUnlock(vm);
+
+    if (!record && !(prev && (old = virHashLookup(prev->entries, uuidstr)))) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC(entry) < 0)
+        goto cleanup;
+
+    if (record) {
+        entry->timestamp = timestamp;
+        entry->params = record->params;
+        entry->nparams = record->nparams;
+        record->params = NULL;
+        record->nparams = 0;
+    } else {
+        entry->timestamp = old->timestamp;
+        if (virTypedParamsCopy(&entry->params, old->params, old->nparams) < 0)
+            goto cleanup;
+        entry->nparams = old->nparams;
+    }
+
+    if (virHashAddEntry(sample->entries, uuidstr, entry) < 0)
+        goto cleanup;
+    entry = NULL;
+
+    ret = 0;
+
+ cleanup:
+    qemuDomainStatsSampleEntryFree(entry, NULL);
+    if (record) {
+        virTypedParamsFree(record->params, record->nparams);
+        VIR_FREE(record);
+    }
+    return ret;
+}
+
+
+/*
+ * Gathers all the stats of all running domains. Domains which are too
+ * busy to be queried keep their stats from @prev.
+ *
+ * Returns the new sample or NULL on error.
+ */
+static qemuDomainStatsSamplePtr
+qemuDomainStatsSampleNew(virQEMUDriverPtr driver,
+                         qemuDomainStatsSamplePtr prev)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainStatsSamplePtr sample = NULL;
+    qemuDomainStatsSamplePtr ret = NULL;
+    virDomainObjPtr *vms = NULL;
+    size_t nvms = 0;
+    virDomainStatsRecordPtr *records = NULL;
+    unsigned int stats = 0;
+    unsigned long long now;
+    size_t i;
+    int rc = 0;
+
+    if (!(sample = virObjectNew(qemuDomainStatsSampleClass)))
+        goto cleanup;
+
+    if (virDomainObjListCollect(driver->domains, NULL, &vms, &nvms, NULL,
+                                VIR_CONNECT_LIST_DOMAINS_ACTIVE) < 0)
+        goto cleanup;
+
+    if (!(sample->entries = virHashCreate(nvms,
+                                          qemuDomainStatsSampleEntryFree)) ||
+        VIR_ALLOC_N(records, nvms) < 0)
+        goto cleanup;
+
+    ignore_value(qemuDomainGetStatsCheckSupport(&stats, false));
+
+    if (driver->statsPool && nvms > 1) {
+        rc = qemuDomainGetStatsParallel(driver, NULL, vms, nvms, stats,
+                                        QEMU_DOMAIN_STATS_HAVE_JOB, 0,
+                                        records);
+    } else {
+        for (i = 0; i < nvms && rc == 0; i++) {
+            virObjectLock(vms[i]);
+            rc = qemuDomainGetStatsOne(driver, NULL, vms[i], stats,
+                                       QEMU_DOMAIN_STATS_HAVE_JOB, 0,
+                                       cfg->statsJobTimeout, &records[i]);
+            virObjectUnlock(vms[i]);
+        }
+    }
+
+    /* the domains which weren't sampled keep their previous stats */
+    if (rc < 0) {
+        VIR_WARN("Failed to sample domain stats: %s",
+                 virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nvms; i++) {
+        rc = qemuDomainStatsSampleAdd(sample, prev, vms[i], records[i], now);
+        records[i] = NULL;
+        if (rc < 0)
+            goto cleanup;
+    }
+
+    ret = sample;
+    sample = NULL;
+
+ cleanup:
+    for (i = 0; records && i < nvms; i++) {
+        if (records[i]) {
+            virTypedParamsFree(records[i]->params, records[i]->nparams);
+            VIR_FREE(records[i]);
+        }
+    }
+    VIR_FREE(records);
+    virObjectListFreeCount(vms, nvms);
+    virObjectUnref(sample);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+
+static void
+qemuDomainStatsSamplerThread(void *opaque)
+{
+    virQEMUDriverPtr driver = opaque;
+    qemuDomainStatsSamplerPtr sampler = driver->statsSampler;
+    qemuDomainStatsSamplePtr sample;
+    qemuDomainStatsSamplePtr prev;
+    unsigned long long deadline;
+
+    virMutexLock(&sampler->lock);
+    while (!sampler->quit) {
+        prev = virObjectRef(sampler->sample);
+        virMutexUnlock(&sampler->lock);
+
+        if (virTimeMillisNow(&deadline) < 0)
+            deadline = 0;
+        deadline += sampler->interval;
+
+        if (!(sample = qemuDomainStatsSampleNew(driver, prev))) {
+            VIR_WARN("Failed to sample domain stats: %s",
+                     virGetLastErrorMessage());
+            virResetLastError();
+        }
+        virObjectUnref(prev);
+
+        virMutexLock(&sampler->lock);
+        if (sample) {
+            virObjectUnref(sampler->sample);
+            sampler->sample = sample;
+        }
+
+        while (!sampler->quit) {
+            if (virCondWaitUntil(&sampler->cond, &sampler->lock, deadline) < 0)
+                break;
+        }
+    }
+    virMutexUnlock(&sampler->lock);
+}
+
+
+static int
+qemuDomainStatsSamplerStart(virQEMUDriverPtr driver,
+                            unsigned int interval)
+{
+    qemuDomainStatsSamplerPtr sampler;
+
+    if (qemuDomainStatsSampleInitialize() < 0)
+        return -1;
+
+    if (VIR_ALLOC(sampler) < 0)
+        return -1;
+
+    sampler->interval = interval * 1000ULL;
+
+    if (virMutexInit(&sampler->lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        VIR_FREE(sampler);
+        return -1;
+    }
+
+    if (virCondInit(&sampler->cond) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize condition"));
+        goto error;
+    }
+
+    driver->statsSampler = sampler;
+    if (virThreadCreate(&sampler->thread, true,
+                        qemuDomainStatsSamplerThread, driver) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create stats sampler thread"));
+        driver->statsSampler = NULL;
+        virCondDestroy(&sampler->cond);
+        goto error;
+    }
+
+    return 0;
+
+ error:
+    virMutexDestroy(&sampler->lock);
+    VIR_FREE(sampler);
+    return -1;
+}
+
+
+static void
+qemuDomainStatsSamplerStop(virQEMUDriverPtr driver)
+{
+    qemuDomainStatsSamplerPtr sampler = driver->statsSampler;
+
+    if (!sampler)
+        return;
+
+    virMutexLock(&sampler->lock);
+    sampler->quit = true;
+    virCondSignal(&sampler->cond);
+    virMutexUnlock(&sampler->lock);
+
+    virThreadJoin(&sampler->thread);
+    driver->statsSampler = NULL;
+
+    virObjectUnref(sampler->sample);
+    virCondDestroy(&sampler->cond);
+    virMutexDestroy(&sampler->lock);
+    VIR_FREE(sampler);
+}
+
+
+/* Returns a reference to the latest sample of @sampler, or NULL if the
+ * first one is not finished yet. */
+static qemuDomainStatsSamplePtr
+qemuDomainStatsSamplerGet(qemuDomainStatsSamplerPtr sampler)
+{
+    qemuDomainStatsSamplePtr sample;
+
+    virMutexLock(&sampler->lock);
+    sample = virObjectRef(sampler->sample);
+    virMutexUnlock(&sampler->lock);
+
+    return sample;
+}
+
+
+/*
+ * Fills @record with the @stats of @vm found in @sample along with the
+ * age of the sample. Domains missing in @sample get the stats which can
+ * be gathered without a job instead.
+ */
+static int
+qemuDomainGetStatsSampled(virQEMUDriverPtr driver,
+                          virConnectPtr conn,
+                          qemuDomainStatsSamplePtr sample,
+                          virDomainObjPtr vm,
+                          unsigned int stats,
+                          virDomainStatsRecordPtr *record)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    qemuDomainStatsSampleEntryPtr entry = NULL;
+    virDomainStatsRecordPtr tmp = NULL;
+    unsigned long long now;
+    int maxparams;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    virUUIDFormat(vm->def->uuid, uuidstr);
+    if (sample)
+        entry = virHashLookup(sample->entries, uuidstr);
+
+    if (!entry)
+        return qemuDomainGetStats(driver, conn, vm, stats, record, 0);
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (VIR_ALLOC(tmp) < 0 ||
+        VIR_ALLOC_N(tmp->params, entry->nparams + 1) < 0)
+        goto cleanup;
+    maxparams = entry->nparams + 1;
+
+    for (i = 0; i < entry->nparams; i++) {
+        virTypedParameterPtr param = &entry->params[i];
+
+        for (j = 0; qemuDomainGetStatsWorkers[j].func; j++) {
+            if (stats & qemuDomainGetStatsWorkers[j].stats &&
+                STRPREFIX(param->field, qemuDomainGetStatsWorkers[j].prefix))
+                break;
+        }
+
+        if (!qemuDomainGetStatsWorkers[j].func)
+            continue;
+
+        tmp->params[tmp->nparams] = *param;
+        if (param->type == VIR_TYPED_PARAM_STRING &&
+            VIR_STRDUP(tmp->params[tmp->nparams].value.s, param->value.s) < 0)
+            goto cleanup;
+        tmp->nparams++;
+    }
+
+    if (virTypedParamsAddULLong(&tmp->params, &tmp->nparams, &maxparams,
+                                "sample.age",
+                                now > entry->timestamp ?
+                                now - entry->timestamp : 0) < 0)
+        goto cleanup;
+
+    if (!(tmp->dom = virGetDomain(conn, vm->def->name,
+                                  vm->def->uuid, vm->def->id)))
+        goto cleanup;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+ cleanup:
+    if (tmp) {
+        virTypedParamsFree(tmp->params, tmp->nparams);
+        VIR_FREE(tmp);
+    }
+    return ret;
+}
+
+
 static int
 qemuConnectGetAllDomainStats(virConnectPtr conn,
                              virDomainPtr *doms,
@@ -19856,12 +20677,13 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     virDomainObjPtr vm;
     size_t nvms;
     virDomainStatsRecordPtr *tmpstats = NULL;
+    qemuDomainStatsSamplePtr sample = NULL;
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
     int nstats = 0;
     size_t i;
+    int rc;
     int ret = -1;
     unsigned int privflags = 0;
-    unsigned int domflags = 0;
     unsigned int lflags = flags & (VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                                    VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE);
@@ -19869,12 +20691,23 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     virCheckFlags(VIR_CONNECT_LIST_DOMAINS_FILTERS_ACTIVE |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_PERSISTENT |
                   VIR_CONNECT_LIST_DOMAINS_FILTERS_STATE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING |
                   VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS, -1);
 
+    VIR_EXCLUSIVE_FLAGS_RET(VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED,
+                            VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING, -1);
+
     if (virConnectGetAllDomainStatsEnsureACL(conn) < 0)
         return -1;
 
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED &&
+        !driver->statsSampler) {
+        virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
+                       _("domain stats sampling is disabled"));
+        return -1;
+    }
+
     if (qemuDomainGetStatsCheckSupport(&stats, enforce) < 0)
         return -1;
 
@@ -19896,35 +20729,54 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     if (qemuDomainGetStatsNeedMonitor(stats))
         privflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
 
-    for (i = 0; i < nvms; i++) {
-        virDomainStatsRecordPtr tmp = NULL;
-        domflags = 0;
-        vm = vms[i];
+    if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED) {
+        sample = qemuDomainStatsSamplerGet(driver->statsSampler);
 
-        virObjectLock(vm);
+        for (i = 0; i < nvms; i++) {
+            vm = vms[i];
 
-        if (HAVE_JOB(privflags) &&
-            qemuDomainObjBeginJob(driver, vm, QEMU_JOB_QUERY) == 0)
-            domflags |= QEMU_DOMAIN_STATS_HAVE_JOB;
-        /* else: without a job it's still possible to gather some data */
+            virObjectLock(vm);
+            rc = qemuDomainGetStatsSampled(driver, conn, sample, vm, stats,
+                                           &tmpstats[nstats]);
+            virObjectUnlock(vm);
 
-        if (flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING)
-            domflags |= QEMU_DOMAIN_STATS_BACKING;
-        if (qemuDomainGetStats(conn, vm, stats, &tmp, domflags) < 0) {
-            if (HAVE_JOB(domflags) && vm)
-                qemuDomainObjEndJob(driver, vm);
+            if (rc < 0)
+                goto cleanup;
 
-            virObjectUnlock(vm);
-            goto cleanup;
+            nstats++;
         }
+    } else if (driver->statsPool && nvms > 1) {
+        rc = qemuDomainGetStatsParallel(driver, conn, vms, nvms, stats,
+                                        privflags, flags, tmpstats);
 
-        if (tmp)
-            tmpstats[nstats++] = tmp;
+        /* skipped domains leave holes in @tmpstats */
+        for (i = 0; i < nvms; i++) {
+            virDomainStatsRecordPtr tmp = tmpstats[i];
 
-        if (HAVE_JOB(domflags))
-            qemuDomainObjEndJob(driver, vm);
+            tmpstats[i] = NULL;
+            if (tmp)
+                tmpstats[nstats++] = tmp;
+        }
 
-        virObjectUnlock(vm);
+        if (rc < 0)
+            goto cleanup;
+    } else {
+        for (i = 0; i < nvms; i++) {
+            virDomainStatsRecordPtr tmp = NULL;
+
+            vm = vms[i];
+
+            virObjectLock(vm);
+            rc = qemuDomainGetStatsOne(driver, conn, vm, stats, privflags,
+                                       flags, 0, &tmp);
+            virObjectUnlock(vm);
+
+            if (rc < 0)
+                goto cleanup;
+
+            if (tmp)
+                tmpstats[nstats++] = tmp;
+        }
     }
 
     *retStats = tmpstats;
@@ -19935,6 +20787,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
  cleanup:
     virDomainStatsRecordListFree(tmpstats);
     virObjectListFreeCount(vms, nvms);
+    virObjectUnref(sample);
 
     return ret;
 }
@@ -51,6 +51,7 @@
 #include "virtime.h"
 #include "locking/domain_lock.h"
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetprotocol.h"
 #include "virstoragefile.h"
 #include "viruri.h"
 #include "virhook.h"
@@ -1581,17 +1582,24 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver,
             return rv;
 
         if (events) {
+            /* MIGRATION events update the job status and wake us up,
+             * no need to ask QEMU until migration finishes */
             if (virDomainObjWait(vm) < 0) {
                 jobInfo->type = VIR_DOMAIN_JOB_FAILED;
                 return -2;
             }
         } else {
-            /* Poll every 50ms for progress & to allow cancellation */
-            struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
-
-            virObjectUnlock(vm);
-            nanosleep(&ts, NULL);
-            virObjectLock(vm);
+            /* Poll every 50ms for progress. Waiting on the domain
+             * condition rather than sleeping lets cancellation, I/O
+             * errors or a lost destination connection be noticed
+             * right away. */
+            unsigned long long now;
+
+            if (virTimeMillisNow(&now) < 0 ||
+                virDomainObjWaitUntil(vm, now + 50) < 0) {
+                jobInfo->type = VIR_DOMAIN_JOB_FAILED;
+                return -2;
+            }
         }
     }
 
@@ -3335,7 +3343,24 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
+/* Data read from QEMU in one go starts at TUNNEL_SEND_BUF_SIZE and
+ * doubles whenever a read fills the whole buffer, up to the largest
+ * stream packet accepted by any destination daemon. */
 #define TUNNEL_SEND_BUF_SIZE 65536
+#define TUNNEL_SEND_BUF_MAX VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+
+/* Number of buffers passed between the thread reading from QEMU and
+ * the one sending to the stream, i.e., the number of packets that can
+ * be read ahead while a previous one is still being sent */
+#define TUNNEL_SEND_BUFS 4
+
+typedef struct _qemuMigrationIOBuffer qemuMigrationIOBuffer;
+typedef qemuMigrationIOBuffer *qemuMigrationIOBufferPtr;
+struct _qemuMigrationIOBuffer {
+    char *data;
+    size_t size;
+    size_t len;
+};
 
 typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
 typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
@@ -3346,21 +3371,177 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* Sends the data read by @thread to @st */
+    virThread sendThread;
+    virError sendErr;
+
+    /* Protects the fields below, @cond is signalled whenever
+     * a buffer is filled or emptied or the state changes */
+    virMutex lock;
+    virCond cond;
+    qemuMigrationIOBuffer bufs[TUNNEL_SEND_BUFS];
+    size_t first; /* oldest buffer waiting to be sent */
+    size_t nfilled;
+    bool eof; /* everything was read, finish the stream once sent */
+    bool quit; /* stop sending, one of the threads failed */
+
+    /* Statistics, only accessed by @thread until it's joined */
+    size_t readSize;
+    unsigned long long bytes;
+    unsigned long long started;
+    unsigned long long finished;
 };
 
+
+static void
+qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+    qemuMigrationIOBufferPtr buf;
+
+    virMutexLock(&data->lock);
+
+    for (;;) {
+        while (data->nfilled == 0 && !data->eof && !data->quit)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+
+        if (data->quit)
+            goto cleanup;
+
+        if (data->nfilled == 0)
+            break;
+
+        buf = &data->bufs[data->first];
+
+        /* The buffer is not touched by the reader until it's released */
+        virMutexUnlock(&data->lock);
+        if (virStreamSend(data->st, buf->data, buf->len) < 0)
+            goto error;
+        virMutexLock(&data->lock);
+
+        data->first = (data->first + 1) % TUNNEL_SEND_BUFS;
+        data->nfilled--;
+        virCondSignal(&data->cond);
+    }
+
+    virMutexUnlock(&data->lock);
+
+    if (virStreamFinish(data->st) < 0)
+        goto error;
+
+    return;
+
+ error:
+    virMutexLock(&data->lock);
+    virCopyLastError(&data->sendErr);
+    virResetLastError();
+    data->quit = true;
+    virCondSignal(&data->cond);
+
+ cleanup:
+    virMutexUnlock(&data->lock);
+}
+
+
+/*
+ * Sets @buf to a buffer to read data from QEMU into, waiting for one
+ * to be sent if all of them are full, or to NULL if sending failed.
+ *
+ * Returns 0 on success, -1 if the buffer could not be allocated.
+ */
+static int
+qemuMigrationIOGetBuffer(qemuMigrationIOThreadPtr data,
+                         qemuMigrationIOBufferPtr *buf)
+{
+    *buf = NULL;
+
+    virMutexLock(&data->lock);
+
+    while (data->nfilled == TUNNEL_SEND_BUFS && !data->quit)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+
+    if (!data->quit)
+        *buf = &data->bufs[(data->first + data->nfilled) % TUNNEL_SEND_BUFS];
+
+    virMutexUnlock(&data->lock);
+
+    if (*buf && (*buf)->size < data->readSize) {
+        if (VIR_REALLOC_N((*buf)->data, data->readSize) < 0)
+            return -1;
+        (*buf)->size = data->readSize;
+    }
+
+    return 0;
+}
+
+
+static void
+qemuMigrationIOPutBuffer(qemuMigrationIOThreadPtr data,
+                         qemuMigrationIOBufferPtr buf,
+                         size_t len)
+{
+    virMutexLock(&data->lock);
+    buf->len = len;
+    data->nfilled++;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    data->bytes += len;
+
+    if (len == data->readSize && data->readSize < TUNNEL_SEND_BUF_MAX)
+        data->readSize = MIN(data->readSize * 2, TUNNEL_SEND_BUF_MAX);
+}
+
+
+/*
+ * Stops the sending thread, either after it sends all remaining data
+ * and finishes the stream, or right away if @quit is true.
+ */
+static void
+qemuMigrationIOStopSending(qemuMigrationIOThreadPtr data,
+                           bool quit)
+{
+    virMutexLock(&data->lock);
+    if (quit)
+        data->quit = true;
+    else
+        data->eof = true;
+    virCondSignal(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+    ignore_value(virTimeMillisNow(&data->finished));
+}
+
+
+/*
+ * Forwards data read from QEMU to the stream. Reading and sending
+ * are done in separate threads so that the next packets can be read
+ * from QEMU while the previous ones are still being sent.
+ */
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
+    bool sending = false;
+    size_t i;
 
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
+    data->readSize = TUNNEL_SEND_BUF_SIZE;
+    ignore_value(virTimeMillisNow(&data->started));
+
+    if (virThreadCreate(&data->sendThread, true,
+                        qemuMigrationIOSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration tunnel thread"));
         goto abrt;
+    }
+    sending = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -3409,12 +3590,20 @@ static void qemuMigrationIOFunc(void *arg)
         }
 
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
-            int nbytes;
+            qemuMigrationIOBufferPtr buf;
+            ssize_t nbytes;
+
+            if (qemuMigrationIOGetBuffer(data, &buf) < 0)
+                goto abrt;
+            if (!buf)
+                goto error;
+
+            do {
+                nbytes = read(data->sock, buf->data, data->readSize);
+            } while (nbytes < 0 && errno == EINTR);
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                qemuMigrationIOPutBuffer(data, buf, nbytes);
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -3426,13 +3615,16 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
-    if (virStreamFinish(data->st) < 0)
+    qemuMigrationIOStopSending(data, false);
+    sending = false;
+    if (data->sendErr.code != VIR_ERR_OK)
         goto error;
 
-    VIR_FORCE_CLOSE(data->sock);
-    VIR_FREE(buffer);
+    VIR_DEBUG("Migration tunnel sent %llu bytes in %llu ms",
+              data->bytes, data->finished - data->started);
 
-    return;
+    VIR_FORCE_CLOSE(data->sock);
+    goto cleanup;
 
  abrt:
     err = virSaveLastError();
@@ -3440,6 +3632,10 @@ static void qemuMigrationIOFunc(void *arg)
         virFreeError(err);
         err = NULL;
     }
+    if (sending) {
+        qemuMigrationIOStopSending(data, true);
+        sending = false;
+    }
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -3447,13 +3643,24 @@ static void qemuMigrationIOFunc(void *arg)
     }
 
  error:
+    if (sending)
+        qemuMigrationIOStopSending(data, true);
+
+    /* A failure to send is the primary error */
+    if (data->sendErr.code != VIR_ERR_OK)
+        virSetError(&data->sendErr);
+
     /* Let the source qemu know that the transfer cant continue anymore.
      * Don't copy the error for EPIPE as destination has the actual error. */
     VIR_FORCE_CLOSE(data->sock);
     if (!virLastErrorIsSystemErrno(EPIPE))
         virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
+
+ cleanup:
+    virResetError(&data->sendErr);
+    for (i = 0; i < TUNNEL_SEND_BUFS; i++)
+        VIR_FREE(data->bufs[i].data);
 }
 
 
@@ -3473,6 +3680,21 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
+    if (virMutexInit(&io->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(io);
+        goto error;
+    }
+
+    if (virCondInit(&io->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition"));
+        virMutexDestroy(&io->lock);
+        VIR_FREE(io);
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
@@ -3483,6 +3705,9 @@ qemuMigrationStartTunnel(virStreamPtr st,
                         io) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to create migration thread"));
+        virCondDestroy(&io->cond);
+        virMutexDestroy(&io->lock);
+        VIR_FREE(io);
         goto error;
     }
 
@@ -3491,12 +3716,17 @@ qemuMigrationStartTunnel(virStreamPtr st,
  error:
     VIR_FORCE_CLOSE(wakeupFD[0]);
     VIR_FORCE_CLOSE(wakeupFD[1]);
-    VIR_FREE(io);
     return NULL;
 }
 
+/*
+ * Stops the tunnel. If @jobInfo is not NULL, the amount of data sent
+ * through the tunnel and the achieved throughput are stored in it.
+ */
 static int
-qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
+qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io,
+                        bool error,
+                        qemuDomainJobInfoPtr jobInfo)
 {
     int rv = -1;
     char stop = error ? 1 : 0;
@@ -3510,6 +3740,13 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
 
     virThreadJoin(&io->thread);
 
+    if (jobInfo) {
+        jobInfo->tunnelBytes = io->bytes;
+        if (io->finished > io->started)
+            jobInfo->tunnelBps = io->bytes * 1000 /
+                                 (io->finished - io->started);
+    }
+
     /* Forward error from the IO thread, to this thread */
     if (io->err.code != VIR_ERR_OK) {
         if (error)
@@ -3525,6 +3762,8 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
  cleanup:
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    virCondDestroy(&io->cond);
+    virMutexDestroy(&io->lock);
     VIR_FREE(io);
     return rv;
 }
@@ -3879,7 +4118,9 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     virObjectUnref(cfg);
 
     if (spec->fwdType != MIGRATION_FWD_DIRECT) {
-        if (iothread && qemuMigrationStopTunnel(iothread, ret < 0) < 0)
+        if (iothread &&
+            qemuMigrationStopTunnel(iothread, ret < 0,
+                                    priv->job.completed) < 0)
             ret = -1;
     }
     VIR_FORCE_CLOSE(fd);
@@ -55,6 +55,21 @@ VIR_LOG_INIT("qemu.qemu_monitor");
 #define DEBUG_IO 0
 #define DEBUG_RAW_IO 0
 
+/* Minimum free space in the receive buffer before reading */
+#define QEMU_MONITOR_BUFFER_MIN 4096
+
+/* Receive buffers larger than this are released once drained */
+#define QEMU_MONITOR_BUFFER_KEEP (64 * 1024)
+
+typedef struct _qemuMonitorPrefetchSet qemuMonitorPrefetchSet;
+typedef qemuMonitorPrefetchSet *qemuMonitorPrefetchSetPtr;
+struct _qemuMonitorPrefetchSet {
+    unsigned long long thread;
+    char **cmds;
+    char **replies;
+    size_t ncmds;
+};
+
 struct _qemuMonitor {
     virObjectLockable parent;
 
@@ -81,11 +96,24 @@ struct _qemuMonitor {
     qemuMonitorMessagePtr msg;
 
     /* Buffer incoming data ready for Text/QMP monitor
-     * code to process & find message boundaries */
+     * code to process & find message boundaries. Data
+     * not processed yet lives in [bufferStart, bufferOffset),
+     * bytes before bufferScanned are known not to contain
+     * the end of a QMP message. */
+    size_t bufferStart;
+    size_t bufferScanned;
     size_t bufferOffset;
     size_t bufferLength;
     char *buffer;
 
+    qemuMonitorIOStats stats;
+
+    /* Replies to commands sent ahead of time by qemuMonitorPrefetch,
+     * one set per thread sharing the monitor, each only handed out
+     * to the thread which requested it */
+    qemuMonitorPrefetchSetPtr prefetch;
+    size_t nprefetch;
+
     /* If anything went wrong, this will be fed back
      * the next monitor msg */
     virError lastError;
@@ -315,12 +343,72 @@ qemuMonitorEscapeNonPrintable(const char *text)
 #endif
 
 
+static void
+qemuMonitorPrefetchSetClear(qemuMonitorPrefetchSetPtr set)
+{
+    virStringListFreeCount(set->cmds, set->ncmds);
+    virStringListFreeCount(set->replies, set->ncmds);
+    set->cmds = NULL;
+    set->replies = NULL;
+    set->ncmds = 0;
+}
+
+
+/* Returns the prefetched replies of the calling thread, or NULL */
+static qemuMonitorPrefetchSetPtr
+qemuMonitorPrefetchFind(qemuMonitorPtr mon,
+                        size_t *idx)
+{
+    unsigned long long thread = virThreadSelfID();
+    size_t i;
+
+    for (i = 0; i < mon->nprefetch; i++) {
+        if (mon->prefetch[i].thread == thread) {
+            if (idx)
+                *idx = i;
+            return &mon->prefetch[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* Drops the prefetched replies of the calling thread */
+static void
+qemuMonitorPrefetchRemove(qemuMonitorPtr mon)
+{
+    qemuMonitorPrefetchSetPtr set;
+    size_t idx;
+
+    if (!(set = qemuMonitorPrefetchFind(mon, &idx)))
+        return;
+
+    qemuMonitorPrefetchSetClear(set);
+    VIR_DELETE_ELEMENT(mon->prefetch, idx, mon->nprefetch);
+}
+
+
+static void
+qemuMonitorPrefetchReset(qemuMonitorPtr mon)
+{
+    size_t i;
+
+    for (i = 0; i < mon->nprefetch; i++)
+        qemuMonitorPrefetchSetClear(&mon->prefetch[i]);
+    VIR_FREE(mon->prefetch);
+    mon->nprefetch = 0;
+}
+
+
 static void
 qemuMonitorDispose(void *obj)
 {
     qemuMonitorPtr mon = obj;
 
-    VIR_DEBUG("mon=%p", mon);
+    VIR_DEBUG("mon=%p rxBytes=%llu rxReallocs=%llu rxMaxReply=%zu",
+              mon, mon->stats.rxBytes, mon->stats.rxReallocs,
+              mon->stats.rxMaxReply);
     if (mon->cb && mon->cb->destroy)
         (mon->cb->destroy)(mon, mon->vm, mon->callbackOpaque);
     virObjectUnref(mon->vm);
@@ -330,6 +418,7 @@ qemuMonitorDispose(void *obj)
     VIR_FREE(mon->buffer);
     virJSONValueFree(mon->options);
     VIR_FREE(mon->balloonpath);
+    qemuMonitorPrefetchReset(mon);
 }
 
 
@@ -415,36 +504,54 @@ static int
 qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
+    char *data;
+    size_t avail;
     qemuMonitorMessagePtr msg = NULL;
 
     /* See if there's a message & whether its ready for its reply
-     * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
+     * ie whether its completed writing all its data. Replies to
+     * a batch of commands may arrive while the rest of the batch
+     * is still being written */
+    if (mon->msg &&
+        (mon->msg->txOffset == mon->msg->txLength || mon->msg->rxExpected))
         msg = mon->msg;
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
-    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer ?
+                                               mon->buffer + mon->bufferStart :
+                                               "");
+    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"),
+              (int)(mon->bufferOffset - mon->bufferStart),
+              mon->msg, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
-    VIR_DEBUG("Process %d", (int)mon->bufferOffset);
+    VIR_DEBUG("Process %d", (int)(mon->bufferOffset - mon->bufferStart));
 # endif
 #endif
 
+    data = mon->buffer + mon->bufferStart;
+    avail = mon->bufferOffset - mon->bufferStart;
+
     PROBE(QEMU_MONITOR_IO_PROCESS,
-          "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
+          "mon=%p buf=%s len=%zu", mon, data, avail);
 
-    if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
-    else
-        len = qemuMonitorTextIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
+    if (mon->json) {
+        /* QMP messages are terminated by a newline, don't bother
+         * parsing anything until one arrives. This avoids rescanning
+         * large replies on every read while they trickle in. */
+        if (!memchr(mon->buffer + mon->bufferScanned, '\n',
+                    mon->bufferOffset - mon->bufferScanned)) {
+            mon->bufferScanned = mon->bufferOffset;
+            return 0;
+        }
+
+        len = qemuMonitorJSONIOProcess(mon, data, avail, msg);
+    } else {
+        len = qemuMonitorTextIOProcess(mon, data, avail, msg);
+    }
 
     if (len < 0)
         return -1;
@@ -452,15 +559,25 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     if (len && mon->waitGreeting)
         mon->waitGreeting = false;
 
-    if (len < mon->bufferOffset) {
-        memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
-        mon->bufferOffset -= len;
-    } else {
+    if ((size_t) len > mon->stats.rxMaxReply)
+        mon->stats.rxMaxReply = len;
+
+    /* Consumed data is dropped lazily by moving the start of the
+     * buffer, it's only compacted when more room is needed. */
+    if (len < avail) {
+        mon->bufferStart += len;
+        /* All complete messages were consumed */
+        mon->bufferScanned = mon->bufferOffset;
+    } else if (mon->bufferLength > QEMU_MONITOR_BUFFER_KEEP) {
         VIR_FREE(mon->buffer);
+        mon->bufferStart = mon->bufferScanned = 0;
         mon->bufferOffset = mon->bufferLength = 0;
+    } else if (mon->buffer) {
+        mon->bufferStart = mon->bufferScanned = mon->bufferOffset = 0;
+        mon->buffer[0] = '\0';
     }
 #if DEBUG_IO
-    VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
+    VIR_DEBUG("Process done %d used %d", (int)avail - len, len);
 #endif
     if (msg && msg->finished)
         virCondBroadcast(&mon->notify);
@@ -561,6 +678,44 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
 }
 
 
+/*
+ * Make sure there are at least QEMU_MONITOR_BUFFER_MIN bytes
+ * available at the end of the receive buffer. Already processed
+ * data is dropped first, the buffer is only enlarged if that
+ * doesn't free enough room. The size doubles on each growth so
+ * that receiving a large reply takes a logarithmic number of
+ * reallocations.
+ */
+static int
+qemuMonitorIOReserve(qemuMonitorPtr mon)
+{
+    size_t used = mon->bufferOffset - mon->bufferStart;
+    size_t newLength;
+
+    if (mon->bufferLength - mon->bufferOffset >= QEMU_MONITOR_BUFFER_MIN)
+        return 0;
+
+    if (mon->bufferStart > 0) {
+        memmove(mon->buffer, mon->buffer + mon->bufferStart, used);
+        mon->bufferScanned -= mon->bufferStart;
+        mon->bufferOffset = used;
+        mon->bufferStart = 0;
+        mon->buffer[used] = '\0';
+
+        if (mon->bufferLength - mon->bufferOffset >= QEMU_MONITOR_BUFFER_MIN)
+            return 0;
+    }
+
+    newLength = MAX(mon->bufferLength * 2, QEMU_MONITOR_BUFFER_MIN);
+    if (VIR_REALLOC_N(mon->buffer, newLength) < 0)
+        return -1;
+    mon->bufferLength = newLength;
+    mon->stats.rxReallocs++;
+
+    return 0;
+}
+
+
 /*
  * Called when the monitor has incoming data to read
  * Call this function while holding the monitor lock.
@@ -570,21 +725,18 @@ qemuMonitorIOWrite(qemuMonitorPtr mon)
 static int
 qemuMonitorIORead(qemuMonitorPtr mon)
 {
-    size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
-    if (avail < 1024) {
-        if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0)
-            return -1;
-        mon->bufferLength += 1024;
-        avail += 1024;
-    }
-
     /* Read as much as we can get into our buffer,
        until we block on EAGAIN, or hit EOF */
-    while (avail > 1) {
+    for (;;) {
+        size_t avail;
         int got;
+
+        if (qemuMonitorIOReserve(mon) < 0)
+            return -1;
+
+        avail = mon->bufferLength - mon->bufferOffset;
         got = read(mon->fd,
                    mon->buffer + mon->bufferOffset,
                    avail - 1);
@@ -600,13 +752,18 @@ qemuMonitorIORead(qemuMonitorPtr mon)
             break;
 
         ret += got;
-        avail -= got;
+        mon->stats.rxBytes += got;
         mon->bufferOffset += got;
         mon->buffer[mon->bufferOffset] = '\0';
+
+        /* A short read means the socket is drained */
+        if ((size_t) got < avail - 1)
+            break;
     }
 
 #if DEBUG_IO
-    VIR_DEBUG("Now read %d bytes of data", (int)mon->bufferOffset);
+    VIR_DEBUG("Now read %d bytes of data",
+              (int)(mon->bufferOffset - mon->bufferStart));
 #endif
 
     return ret;
@@ -756,7 +913,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
          * then wakeup that waiter */
         if (mon->msg && !mon->msg->finished) {
             mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+            virCondBroadcast(&mon->notify);
         }
     }
 
@@ -770,7 +927,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
         (eofNotify)(mon, vm, mon->callbackOpaque);
@@ -780,7 +937,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque)
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         virObjectUnlock(mon);
         VIR_DEBUG("Triggering error callback");
         (errorNotify)(mon, vm, mon->callbackOpaque);
@@ -1017,7 +1174,7 @@ qemuMonitorClose(qemuMonitorPtr mon)
             }
         }
         mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
     }
 
     /* Propagate existing monitor error in case the current thread has no
@@ -1055,6 +1212,21 @@ qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
+    /* Threads holding a shared job may use the monitor at the same
+     * time, their messages are sent one after another */
+    while (mon->msg) {
+        if (virCondWait(&mon->notify, &mon->parent.lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to wait on monitor condition"));
+            return -1;
+        }
+
+        if (mon->lastError.code != VIR_ERR_OK) {
+            virSetError(&mon->lastError);
+            return -1;
+        }
+    }
+
     mon->msg = msg;
     qemuMonitorUpdateWatch(mon);
 
@@ -1082,6 +1254,7 @@ qemuMonitorSend(qemuMonitorPtr mon,
  cleanup:
     mon->msg = NULL;
     qemuMonitorUpdateWatch(mon);
+    virCondBroadcast(&mon->notify);
 
     return ret;
 }
@@ -1653,6 +1826,132 @@ qemuMonitorEmitBlockThreshold(qemuMonitorPtr mon,
 }
 
 
+/**
+ * qemuMonitorGetIOStats:
+ * @mon: monitor object
+ * @stats: filled with the receive statistics
+ *
+ * Copies the counters describing data received from @mon so far.
+ */
+void
+qemuMonitorGetIOStats(qemuMonitorPtr mon,
+                      qemuMonitorIOStatsPtr stats)
+{
+    virObjectLock(mon);
+    *stats = mon->stats;
+    virObjectUnlock(mon);
+}
+
+
+/**
+ * qemuMonitorPrefetch:
+ * @mon: monitor object
+ * @balloon: memory balloon of the domain, used with
+ *           QEMU_MONITOR_PREFETCH_BALLOON
+ * @flags: bitwise-OR of qemuMonitorPrefetchFlags
+ *
+ * Sends the query commands selected by @flags to QEMU back-to-back and
+ * waits for all of their replies at once. The replies are kept until
+ * the calling thread issues the very same commands through the usual
+ * APIs, which then return without talking to QEMU, or until
+ * qemuMonitorPrefetchClear is called.
+ *
+ * This allows gathering several kinds of statistics with a single
+ * round-trip to QEMU. Callers must hold a job on the domain so that
+ * nothing changes between the prefetch and the use of the replies.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMonitorPrefetch(qemuMonitorPtr mon,
+                    virDomainMemballoonDefPtr balloon,
+                    unsigned int flags)
+{
+    VIR_DEBUG("balloon=%p flags=0x%x", balloon, flags);
+
+    QEMU_CHECK_MONITOR_JSON(mon);
+
+    if (flags & QEMU_MONITOR_PREFETCH_BALLOON)
+        qemuMonitorInitBalloonObjectPath(mon, balloon);
+
+    return qemuMonitorJSONPrefetch(mon, mon->balloonpath, flags);
+}
+
+
+/**
+ * qemuMonitorPrefetchClear:
+ * @mon: monitor object
+ *
+ * Drops the replies from qemuMonitorPrefetch which weren't used. Replies
+ * prefetched by another thread sharing the monitor are kept.
+ */
+void
+qemuMonitorPrefetchClear(qemuMonitorPtr mon)
+{
+    virObjectLock(mon);
+    qemuMonitorPrefetchRemove(mon);
+    virObjectUnlock(mon);
+}
+
+
+/* Takes ownership of @cmds and @replies, both having @ncmds entries.
+ * They replace any replies prefetched earlier by the calling thread. */
+void
+qemuMonitorSetPrefetched(qemuMonitorPtr mon,
+                         char **cmds,
+                         char **replies,
+                         size_t ncmds)
+{
+    qemuMonitorPrefetchSet set = {
+        .thread = virThreadSelfID(),
+        .cmds = cmds,
+        .replies = replies,
+        .ncmds = ncmds,
+    };
+
+    qemuMonitorPrefetchRemove(mon);
+
+    /* Without the replies the commands are simply sent again */
+    if (VIR_APPEND_ELEMENT_QUIET(mon->prefetch, mon->nprefetch, set) < 0)
+        qemuMonitorPrefetchSetClear(&set);
+}
+
+
+bool
+qemuMonitorHasPrefetched(qemuMonitorPtr mon)
+{
+    return !!qemuMonitorPrefetchFind(mon, NULL);
+}
+
+
+/* Returns the prefetched reply to @cmd, which the caller must free,
+ * or NULL if there is none */
+char *
+qemuMonitorTakePrefetched(qemuMonitorPtr mon,
+                          const char *cmd)
+{
+    qemuMonitorPrefetchSetPtr set;
+    char *reply;
+    size_t i;
+
+    if (!(set = qemuMonitorPrefetchFind(mon, NULL)))
+        return NULL;
+
+    for (i = 0; i < set->ncmds; i++) {
+        if (!set->replies[i] ||
+            STRNEQ_NULLABLE(set->cmds[i], cmd))
+            continue;
+
+        reply = set->replies[i];
+        set->replies[i] = NULL;
+        VIR_DEBUG("Using prefetched reply to '%s'", cmd);
+        return reply;
+    }
+
+    return NULL;
+}
+
+
 int
 qemuMonitorSetCapabilities(qemuMonitorPtr mon)
 {
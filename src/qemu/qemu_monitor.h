@@ -60,6 +60,15 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* If true the JSON monitor stores a successful reply
+     * undecoded in rxBuffer instead of rxObject */
+    bool rxRaw;
+    /* Used by the JSON monitor for a batch of commands sent at once:
+     * the undecoded replies in the order they arrived. The message is
+     * finished once rxExpected replies were received */
+    char **rxReplies;
+    size_t nrxReplies;
+    size_t rxExpected;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
@@ -305,6 +314,31 @@ void qemuMonitorClose(qemuMonitorPtr mon);
 
 virErrorPtr qemuMonitorLastError(qemuMonitorPtr mon);
 
+typedef struct _qemuMonitorIOStats qemuMonitorIOStats;
+typedef qemuMonitorIOStats *qemuMonitorIOStatsPtr;
+struct _qemuMonitorIOStats {
+    unsigned long long rxBytes; /* bytes received from the monitor */
+    unsigned long long rxReallocs; /* receive buffer reallocations */
+    size_t rxMaxReply; /* largest chunk of data processed at once */
+};
+
+void qemuMonitorGetIOStats(qemuMonitorPtr mon,
+                           qemuMonitorIOStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+typedef enum {
+    QEMU_MONITOR_PREFETCH_BLOCK = 1 << 0, /* query-blockstats, query-block */
+    QEMU_MONITOR_PREFETCH_BLOCK_NODES = 1 << 1, /* query-named-block-nodes */
+    QEMU_MONITOR_PREFETCH_CPUS = 1 << 2, /* query-cpus */
+    QEMU_MONITOR_PREFETCH_BALLOON = 1 << 3, /* query-balloon, guest-stats */
+} qemuMonitorPrefetchFlags;
+
+int qemuMonitorPrefetch(qemuMonitorPtr mon,
+                        virDomainMemballoonDefPtr balloon,
+                        unsigned int flags);
+void qemuMonitorPrefetchClear(qemuMonitorPtr mon)
+    ATTRIBUTE_NONNULL(1);
+
 int qemuMonitorSetCapabilities(qemuMonitorPtr mon);
 
 int qemuMonitorSetLink(qemuMonitorPtr mon,
@@ -316,6 +350,16 @@ int qemuMonitorSetLink(qemuMonitorPtr mon,
 char *qemuMonitorNextCommandID(qemuMonitorPtr mon);
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg);
+void qemuMonitorSetPrefetched(qemuMonitorPtr mon,
+                              char **cmds,
+                              char **replies,
+                              size_t ncmds)
+    ATTRIBUTE_NONNULL(1);
+char *qemuMonitorTakePrefetched(qemuMonitorPtr mon,
+                                const char *cmd)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+bool qemuMonitorHasPrefetched(qemuMonitorPtr mon)
+    ATTRIBUTE_NONNULL(1);
 virJSONValuePtr qemuMonitorGetOptions(qemuMonitorPtr mon)
     ATTRIBUTE_NONNULL(1);
 void qemuMonitorSetOptions(qemuMonitorPtr mon, virJSONValuePtr options)
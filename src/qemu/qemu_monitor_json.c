@@ -182,6 +182,111 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
     return 0;
 }
 
+typedef enum {
+    QEMU_MONITOR_JSON_LINE_UNKNOWN = 0,
+    QEMU_MONITOR_JSON_LINE_GREETING,
+    QEMU_MONITOR_JSON_LINE_EVENT,
+    QEMU_MONITOR_JSON_LINE_ERROR,
+    QEMU_MONITOR_JSON_LINE_REPLY,
+} qemuMonitorJSONLineType;
+
+
+/* Classifies the line by its first well known top level key and tells
+ * the parser to stop there, so that the rest of a possibly huge reply
+ * is not lexed just to find out what it is */
+static int
+qemuMonitorJSONClassifyKey(qemuMonitorJSONLineType *cls,
+                           const char *key)
+{
+    if (STREQ(key, "QMP"))
+        *cls = QEMU_MONITOR_JSON_LINE_GREETING;
+    else if (STREQ(key, "event"))
+        *cls = QEMU_MONITOR_JSON_LINE_EVENT;
+    else if (STREQ(key, "error"))
+        *cls = QEMU_MONITOR_JSON_LINE_ERROR;
+    else if (STREQ(key, "return"))
+        *cls = QEMU_MONITOR_JSON_LINE_REPLY;
+    else
+        return 0;
+
+    return VIR_JSON_STREAM_STOP;
+}
+
+
+static int
+qemuMonitorJSONClassifyStart(const char *key,
+                             size_t depth,
+                             virJSONType type,
+                             void *opaque)
+{
+    if (depth == 0)
+        return type == VIR_JSON_TYPE_OBJECT ? 0 : VIR_JSON_STREAM_STOP;
+
+    /* only the top level keys are interesting */
+    if (qemuMonitorJSONClassifyKey(opaque, key) == VIR_JSON_STREAM_STOP)
+        return VIR_JSON_STREAM_STOP;
+
+    return VIR_JSON_STREAM_SKIP;
+}
+
+
+static int
+qemuMonitorJSONClassifyValue(const char *key,
+                             size_t depth,
+                             virJSONType type ATTRIBUTE_UNUSED,
+                             const char *value ATTRIBUTE_UNUSED,
+                             void *opaque)
+{
+    /* a scalar document isn't an object */
+    if (depth == 0)
+        return VIR_JSON_STREAM_STOP;
+
+    return qemuMonitorJSONClassifyKey(opaque, key);
+}
+
+
+static const virJSONStreamCallbacks qemuMonitorJSONClassifyCallbacks = {
+    .start = qemuMonitorJSONClassifyStart,
+    .value = qemuMonitorJSONClassifyValue,
+};
+
+
+static qemuMonitorJSONLineType
+qemuMonitorJSONClassifyLine(const char *line)
+{
+    qemuMonitorJSONLineType cls = QEMU_MONITOR_JSON_LINE_UNKNOWN;
+
+    if (virJSONValueStreamParse(line, &qemuMonitorJSONClassifyCallbacks,
+                                &cls) < 0) {
+        virResetLastError();
+        return QEMU_MONITOR_JSON_LINE_UNKNOWN;
+    }
+
+    return cls;
+}
+
+
+/* Checks whether @line is a successful command reply without
+ * building the JSON tree for it. */
+static bool
+qemuMonitorJSONIsPlainReply(const char *line)
+{
+    return qemuMonitorJSONClassifyLine(line) == QEMU_MONITOR_JSON_LINE_REPLY;
+}
+
+
+/* Checks whether @line is a reply to a command, successful or not,
+ * without building the JSON tree for it. */
+static bool
+qemuMonitorJSONIsReply(const char *line)
+{
+    qemuMonitorJSONLineType cls = qemuMonitorJSONClassifyLine(line);
+
+    return cls == QEMU_MONITOR_JSON_LINE_REPLY ||
+        cls == QEMU_MONITOR_JSON_LINE_ERROR;
+}
+
+
 int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                              const char *line,
@@ -192,6 +297,35 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 
     VIR_DEBUG("Line [%s]", line);
 
+    /* Replies to a batch of commands are kept as they are, each of
+     * them is decoded later by the command it belongs to */
+    if (msg && msg->rxExpected && qemuMonitorJSONIsReply(line)) {
+        char *reply;
+
+        PROBE(QEMU_MONITOR_RECV_REPLY,
+              "mon=%p reply=%s", mon, line);
+        if (VIR_STRDUP(reply, line) < 0 ||
+            VIR_APPEND_ELEMENT(msg->rxReplies, msg->nrxReplies, reply) < 0) {
+            VIR_FREE(reply);
+            return -1;
+        }
+        if (msg->nrxReplies == msg->rxExpected)
+            msg->finished = 1;
+        return 0;
+    }
+
+    /* The caller will decode the reply on its own, there's no
+     * point in building the JSON tree here */
+    if (msg && msg->rxRaw && qemuMonitorJSONIsPlainReply(line)) {
+        PROBE(QEMU_MONITOR_RECV_REPLY,
+              "mon=%p reply=%s", mon, line);
+        if (VIR_STRDUP(msg->rxBuffer, line) < 0)
+            return -1;
+        msg->rxLength = strlen(line);
+        msg->finished = 1;
+        return 0;
+    }
+
     if (!(obj = virJSONValueFromString(line)))
         goto cleanup;
 
@@ -231,7 +365,7 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
 }
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
                              qemuMonitorMessagePtr msg)
 {
@@ -243,17 +377,13 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
 
         if (nl) {
             int got = nl - (data + used);
-            char *line;
-            if (VIR_STRNDUP(line, data + used, got) < 0)
+
+            /* The line is parsed in place, the buffer is owned by
+             * the monitor and the data is discarded once consumed */
+            *nl = '\0';
+            if (qemuMonitorJSONIOProcessLine(mon, data + used, msg) < 0)
                 return -1;
             used += got + strlen(LINE_ENDING);
-            line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
-                VIR_FREE(line);
-                return -1;
-            }
-
-            VIR_FREE(line);
         } else {
             break;
         }
@@ -264,19 +394,27 @@ int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
 }
 
 static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
-                             virJSONValuePtr cmd,
-                             int scm_fd,
-                             virJSONValuePtr *reply)
+qemuMonitorJSONCommandSend(qemuMonitorPtr mon,
+                           virJSONValuePtr cmd,
+                           int scm_fd,
+                           qemuMonitorMessagePtr msg)
 {
     int ret = -1;
-    qemuMonitorMessage msg;
     char *cmdstr = NULL;
     char *id = NULL;
+    char *line = NULL;
 
-    *reply = NULL;
+    /* The reply may have been sent along with others already */
+    if (qemuMonitorHasPrefetched(mon) && scm_fd == -1) {
+        if (!(cmdstr = virJSONValueToString(cmd, false)))
+            goto cleanup;
 
-    memset(&msg, 0, sizeof(msg));
+        if ((line = qemuMonitorTakePrefetched(mon, cmdstr))) {
+            ret = qemuMonitorJSONIOProcessLine(mon, line, msg);
+            goto cleanup;
+        }
+        VIR_FREE(cmdstr);
+    }
 
     if (virJSONValueObjectHasKey(cmd, "execute") == 1) {
         if (!(id = qemuMonitorNextCommandID(mon)))
@@ -290,38 +428,136 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
 
     if (!(cmdstr = virJSONValueToString(cmd, false)))
         goto cleanup;
-    if (virAsprintf(&msg.txBuffer, "%s\r\n", cmdstr) < 0)
+    if (virAsprintf(&msg->txBuffer, "%s\r\n", cmdstr) < 0)
         goto cleanup;
-    msg.txLength = strlen(msg.txBuffer);
-    msg.txFD = scm_fd;
+    msg->txLength = strlen(msg->txBuffer);
+    msg->txFD = scm_fd;
 
     VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
-    ret = qemuMonitorSend(mon, &msg);
+    ret = qemuMonitorSend(mon, msg);
 
-    VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
-              ret, msg.rxObject);
+    VIR_DEBUG("Receive command reply ret=%d rxObject=%p rxBuffer=%p",
+              ret, msg->rxObject, msg->rxBuffer);
 
+ cleanup:
+    VIR_FREE(id);
+    VIR_FREE(cmdstr);
+    VIR_FREE(line);
+    VIR_FREE(msg->txBuffer);
 
-    if (ret == 0) {
-        if (!msg.rxObject) {
+    return ret;
+}
+
+
+/**
+ * qemuMonitorJSONCommandBatch:
+ * @mon: monitor object
+ * @cmds: commands to execute
+ * @ncmds: number of commands in @cmds
+ * @replies: filled with the undecoded replies, in the order of @cmds
+ *
+ * Writes all @cmds to the monitor at once and waits until every one of
+ * them was replied to. QEMU executes commands in the order it receives
+ * them, so the N-th reply belongs to the N-th command. A command ID is
+ * appended to each of @cmds.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            virJSONValuePtr *cmds,
+                            size_t ncmds,
+                            char ***replies)
+{
+    qemuMonitorMessage msg;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *cmdstr = NULL;
+    char *id = NULL;
+    size_t i;
+    int ret = -1;
+
+    *replies = NULL;
+
+    memset(&msg, 0, sizeof(msg));
+
+    for (i = 0; i < ncmds; i++) {
+        if (!(id = qemuMonitorNextCommandID(mon)))
+            goto cleanup;
+        if (virJSONValueObjectAppendString(cmds[i], "id", id) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Missing monitor reply object"));
-            ret = -1;
-        } else {
-            *reply = msg.rxObject;
+                           _("Unable to append command 'id' string"));
+            goto cleanup;
         }
+        VIR_FREE(id);
+
+        if (!(cmdstr = virJSONValueToString(cmds[i], false)))
+            goto cleanup;
+        virBufferAsprintf(&buf, "%s\r\n", cmdstr);
+        VIR_FREE(cmdstr);
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        goto cleanup;
+
+    msg.txLength = virBufferUse(&buf);
+    msg.txBuffer = virBufferContentAndReset(&buf);
+    msg.txFD = -1;
+    msg.rxExpected = ncmds;
+
+    VIR_DEBUG("Send batch of %zu commands", ncmds);
+
+    if (qemuMonitorSend(mon, &msg) < 0)
+        goto cleanup;
+
+    if (msg.nrxReplies != ncmds) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("expected %zu replies to command batch, got %zu"),
+                       ncmds, msg.nrxReplies);
+        goto cleanup;
     }
 
+    *replies = msg.rxReplies;
+    msg.rxReplies = NULL;
+    msg.nrxReplies = 0;
+    ret = 0;
+
  cleanup:
+    virBufferFreeAndReset(&buf);
     VIR_FREE(id);
     VIR_FREE(cmdstr);
     VIR_FREE(msg.txBuffer);
-
+    virStringListFreeCount(msg.rxReplies, msg.nrxReplies);
     return ret;
 }
 
 
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    qemuMonitorMessage msg;
+
+    *reply = NULL;
+
+    memset(&msg, 0, sizeof(msg));
+
+    if (qemuMonitorJSONCommandSend(mon, cmd, scm_fd, &msg) < 0)
+        return -1;
+
+    if (!msg.rxObject) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        return -1;
+    }
+
+    *reply = msg.rxObject;
+    return 0;
+}
+
+
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
                        virJSONValuePtr cmd,
@@ -330,6 +566,7 @@ qemuMonitorJSONCommand(qemuMonitorPtr mon,
     return qemuMonitorJSONCommandWithFd(mon, cmd, -1, reply);
 }
 
+
 /* Ignoring OOM in this method, since we're already reporting
  * a more important error
  *
@@ -429,6 +666,166 @@ qemuMonitorJSONHasError(virJSONValuePtr reply,
 }
 
 
+struct qemuMonitorJSONReplyStream {
+    const virJSONStreamCallbacks *cb;
+    void *opaque;
+    bool inReturn;
+    bool haveReturn;
+};
+
+
+static int
+qemuMonitorJSONReplyStreamStart(const char *key,
+                                size_t depth,
+                                virJSONType type,
+                                void *opaque)
+{
+    struct qemuMonitorJSONReplyStream *stream = opaque;
+    int rc = 0;
+
+    if (depth == 0)
+        return 0;
+
+    if (depth == 1) {
+        if (STRNEQ(key, "return"))
+            return VIR_JSON_STREAM_SKIP;
+        stream->haveReturn = true;
+        key = NULL;
+    }
+
+    if (stream->cb->start &&
+        (rc = stream->cb->start(key, depth - 1, type, stream->opaque)) < 0)
+        return -1;
+
+    if (depth == 1 && rc == 0)
+        stream->inReturn = true;
+
+    return rc;
+}
+
+
+static int
+qemuMonitorJSONReplyStreamEnd(size_t depth,
+                              virJSONType type,
+                              void *opaque)
+{
+    struct qemuMonitorJSONReplyStream *stream = opaque;
+    int rc = 0;
+
+    if (depth == 0)
+        return 0;
+
+    if (stream->cb->end &&
+        (rc = stream->cb->end(depth - 1, type, stream->opaque)) < 0)
+        return -1;
+
+    /* nothing past the 'return' member is of any interest */
+    if (depth == 1) {
+        stream->inReturn = false;
+        return VIR_JSON_STREAM_STOP;
+    }
+
+    return rc;
+}
+
+
+static int
+qemuMonitorJSONReplyStreamValue(const char *key,
+                                size_t depth,
+                                virJSONType type,
+                                const char *value,
+                                void *opaque)
+{
+    struct qemuMonitorJSONReplyStream *stream = opaque;
+
+    if (depth == 1) {
+        if (STRNEQ(key, "return"))
+            return 0;
+        stream->haveReturn = true;
+        key = NULL;
+    }
+
+    if (stream->cb->value)
+        return stream->cb->value(key, depth - 1, type, value, stream->opaque);
+
+    return 0;
+}
+
+
+static const virJSONStreamCallbacks qemuMonitorJSONReplyStreamCallbacks = {
+    .start = qemuMonitorJSONReplyStreamStart,
+    .end = qemuMonitorJSONReplyStreamEnd,
+    .value = qemuMonitorJSONReplyStreamValue,
+};
+
+
+/**
+ * qemuMonitorJSONCommandStream:
+ * @mon: monitor object
+ * @cmd: command to execute
+ * @cb: callbacks to decode the reply with
+ * @opaque: data passed to @cb
+ * @reply: filled with the reply if it was not decoded by @cb
+ *
+ * Executes @cmd and feeds the 'return' member of a successful reply into
+ * @cb without building the JSON tree for it. The depth passed to @cb is
+ * relative to the 'return' member. Error replies are parsed as usual and
+ * passed back in @reply so that callers can inspect them.
+ *
+ * Returns 0 on success (with @reply set to NULL if @cb consumed the reply),
+ * -1 on error.
+ */
+static int
+qemuMonitorJSONCommandStream(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             const virJSONStreamCallbacks *cb,
+                             void *opaque,
+                             virJSONValuePtr *reply)
+{
+    qemuMonitorMessage msg;
+    struct qemuMonitorJSONReplyStream stream = { cb, opaque, false, false };
+    int ret = -1;
+
+    *reply = NULL;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.rxRaw = true;
+
+    if (qemuMonitorJSONCommandSend(mon, cmd, -1, &msg) < 0)
+        goto cleanup;
+
+    if (msg.rxObject) {
+        *reply = msg.rxObject;
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!msg.rxBuffer) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Missing monitor reply object"));
+        goto cleanup;
+    }
+
+    if (virJSONValueStreamParse(msg.rxBuffer,
+                                &qemuMonitorJSONReplyStreamCallbacks,
+                                &stream) < 0)
+        goto cleanup;
+
+    if (!stream.haveReturn) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unexpected reply to command %s"),
+                       qemuMonitorJSONCommandName(cmd));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(msg.rxBuffer);
+    return ret;
+}
+
+
 /* Top-level commands and nested transaction list elements share a
  * common structure for everything except the dictionary names.  */
 static virJSONValuePtr ATTRIBUTE_SENTINEL
@@ -1196,6 +1593,70 @@ qemuMonitorJSONHumanCommandWithFd(qemuMonitorPtr mon,
 }
 
 
+int
+qemuMonitorJSONPrefetch(qemuMonitorPtr mon,
+                        const char *balloonpath,
+                        unsigned int flags)
+{
+    virJSONValuePtr cmds[6] = { NULL };
+    char **keys = NULL;
+    char **replies = NULL;
+    size_t ncmds = 0;
+    size_t i;
+    int ret = -1;
+
+    /* The commands must be built exactly the way the functions which
+     * use the replies build them */
+    if (flags & QEMU_MONITOR_PREFETCH_BLOCK) {
+        cmds[ncmds++] = qemuMonitorJSONMakeCommand("query-blockstats", NULL);
+        cmds[ncmds++] = qemuMonitorJSONMakeCommand("query-block", NULL);
+    }
+
+    if (flags & QEMU_MONITOR_PREFETCH_BLOCK_NODES)
+        cmds[ncmds++] = qemuMonitorJSONMakeCommand("query-named-block-nodes",
+                                                   NULL);
+
+    if (flags & QEMU_MONITOR_PREFETCH_CPUS)
+        cmds[ncmds++] = qemuMonitorJSONMakeCommand("query-cpus", NULL);
+
+    if (flags & QEMU_MONITOR_PREFETCH_BALLOON) {
+        cmds[ncmds++] = qemuMonitorJSONMakeCommand("query-balloon", NULL);
+        if (balloonpath)
+            cmds[ncmds++] = qemuMonitorJSONMakeCommand("qom-get",
+                                                       "s:path", balloonpath,
+                                                       "s:property", "guest-stats",
+                                                       NULL);
+    }
+
+    if (ncmds == 0)
+        return 0;
+
+    if (VIR_ALLOC_N(keys, ncmds) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (!cmds[i] ||
+            !(keys[i] = virJSONValueToString(cmds[i], false)))
+            goto cleanup;
+    }
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, ncmds, &replies) < 0)
+        goto cleanup;
+
+    qemuMonitorSetPrefetched(mon, keys, replies, ncmds);
+    keys = NULL;
+    replies = NULL;
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ncmds; i++)
+        virJSONValueFree(cmds[i]);
+    virStringListFreeCount(keys, ncmds);
+    virStringListFreeCount(replies, ncmds);
+    return ret;
+}
+
+
 int
 qemuMonitorJSONSetCapabilities(qemuMonitorPtr mon)
 {
@@ -1410,57 +1871,102 @@ int qemuMonitorJSONSystemReset(qemuMonitorPtr mon)
  *    {...}
  *  ]
  */
+struct qemuMonitorJSONQueryCPUsParser {
+    struct qemuMonitorQueryCpusEntry *cpus;
+    size_t ncpus;
+    bool array;
+};
+
+
 static int
-qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
-                              struct qemuMonitorQueryCpusEntry **entries,
-                              size_t *nentries)
+qemuMonitorJSONQueryCPUsAddEntry(struct qemuMonitorJSONQueryCPUsParser *parser)
 {
-    struct qemuMonitorQueryCpusEntry *cpus = NULL;
-    int ret = -1;
-    size_t i;
-    ssize_t ncpus;
+    if (VIR_EXPAND_N(parser->cpus, parser->ncpus, 1) < 0)
+        return -1;
 
-    if ((ncpus = virJSONValueArraySize(data)) <= 0)
-        return -2;
+    parser->cpus[parser->ncpus - 1].qemu_id = -1;
+    return 0;
+}
 
-    if (VIR_ALLOC_N(cpus, ncpus) < 0)
-        goto cleanup;
 
-    for (i = 0; i < ncpus; i++) {
-        virJSONValuePtr entry = virJSONValueArrayGet(data, i);
-        int cpuid = -1;
-        int thread = 0;
-        bool halted = false;
-        const char *qom_path;
-        if (!entry) {
-            ret = -2;
-            goto cleanup;
-        }
+static int
+qemuMonitorJSONQueryCPUsStart(const char *key ATTRIBUTE_UNUSED,
+                              size_t depth,
+                              virJSONType type,
+                              void *opaque)
+{
+    struct qemuMonitorJSONQueryCPUsParser *parser = opaque;
 
-        /* Some older qemu versions don't report the thread_id so treat this as
-         * non-fatal, simply returning no data */
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "CPU", &cpuid));
-        ignore_value(virJSONValueObjectGetNumberInt(entry, "thread_id", &thread));
-        ignore_value(virJSONValueObjectGetBoolean(entry, "halted", &halted));
-        qom_path = virJSONValueObjectGetString(entry, "qom_path");
-
-        cpus[i].qemu_id = cpuid;
-        cpus[i].tid = thread;
-        cpus[i].halted = halted;
-        if (VIR_STRDUP(cpus[i].qom_path, qom_path) < 0)
-            goto cleanup;
+    if (depth == 0) {
+        if (type != VIR_JSON_TYPE_ARRAY)
+            return VIR_JSON_STREAM_SKIP;
+        parser->array = true;
+        return 0;
     }
 
-    VIR_STEAL_PTR(*entries, cpus);
-    *nentries = ncpus;
-    ret = 0;
+    if (depth == 1) {
+        if (qemuMonitorJSONQueryCPUsAddEntry(parser) < 0)
+            return -1;
+        if (type == VIR_JSON_TYPE_OBJECT)
+            return 0;
+    }
 
- cleanup:
-    qemuMonitorQueryCpusFree(cpus, ncpus);
-    return ret;
+    /* nested data of the entries is not interesting */
+    return VIR_JSON_STREAM_SKIP;
+}
+
+
+static int
+qemuMonitorJSONQueryCPUsValue(const char *key,
+                              size_t depth,
+                              virJSONType type,
+                              const char *value,
+                              void *opaque)
+{
+    struct qemuMonitorJSONQueryCPUsParser *parser = opaque;
+    struct qemuMonitorQueryCpusEntry *cpu;
+
+    if (depth == 1)
+        return qemuMonitorJSONQueryCPUsAddEntry(parser);
+
+    if (depth != 2)
+        return 0;
+
+    cpu = &parser->cpus[parser->ncpus - 1];
+
+    /* Some older qemu versions don't report the thread_id so treat this as
+     * non-fatal, simply returning no data */
+    if (type == VIR_JSON_TYPE_NUMBER) {
+        if (STREQ(key, "CPU")) {
+            if (virStrToLong_i(value, NULL, 10, &cpu->qemu_id) < 0)
+                cpu->qemu_id = -1;
+        } else if (STREQ(key, "thread_id")) {
+            int thread;
+
+            if (virStrToLong_i(value, NULL, 10, &thread) == 0)
+                cpu->tid = thread;
+        }
+    } else if (type == VIR_JSON_TYPE_BOOLEAN) {
+        if (STREQ(key, "halted"))
+            cpu->halted = STREQ(value, "true");
+    } else if (type == VIR_JSON_TYPE_STRING) {
+        if (STREQ(key, "qom_path")) {
+            VIR_FREE(cpu->qom_path);
+            if (VIR_STRDUP(cpu->qom_path, value) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
 }
 
 
+static const virJSONStreamCallbacks qemuMonitorJSONQueryCPUsCallbacks = {
+    .start = qemuMonitorJSONQueryCPUsStart,
+    .value = qemuMonitorJSONQueryCPUsValue,
+};
+
+
 /**
  * qemuMonitorJSONQueryCPUs:
  *
@@ -1470,7 +1976,8 @@ qemuMonitorJSONExtractCPUInfo(virJSONValuePtr data,
  *
  * Queries qemu for cpu-related information. Failure to execute the command or
  * extract results does not produce an error as libvirt can continue without
- * this information.
+ * this information. The reply is decoded without building the JSON tree
+ * as it gets large on guests with many vCPUs.
  *
  * Returns 0 on success, -1 on a fatal error (oom ...) and -2 if the
  * query failed gracefully.
@@ -1484,25 +1991,37 @@ qemuMonitorJSONQueryCPUs(qemuMonitorPtr mon,
     int ret = -1;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-cpus", NULL);
     virJSONValuePtr reply = NULL;
-    virJSONValuePtr data;
+    struct qemuMonitorJSONQueryCPUsParser parser = { NULL, 0, false };
 
     if (!cmd)
         return -1;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandStream(mon, cmd,
+                                     &qemuMonitorJSONQueryCPUsCallbacks,
+                                     &parser, &reply) < 0)
         goto cleanup;
 
-    if (force && qemuMonitorJSONCheckError(cmd, reply) < 0)
+    /* an error reply is the only one which is not decoded by the parser */
+    if (reply) {
+        if (force && qemuMonitorJSONCheckError(cmd, reply) < 0)
+            goto cleanup;
+
+        ret = -2;
         goto cleanup;
+    }
 
-    if (!(data = virJSONValueObjectGetArray(reply, "return"))) {
+    if (!parser.array || parser.ncpus == 0) {
         ret = -2;
         goto cleanup;
     }
 
-    ret = qemuMonitorJSONExtractCPUInfo(data, entries, nentries);
+    VIR_STEAL_PTR(*entries, parser.cpus);
+    *nentries = parser.ncpus;
+    parser.ncpus = 0;
+    ret = 0;
 
  cleanup:
+    qemuMonitorQueryCpusFree(parser.cpus, parser.ncpus);
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -1661,13 +2180,48 @@ qemuMonitorJSONUpdateVideoVram64Size(qemuMonitorPtr mon,
 }
 
 
+static int
+qemuMonitorJSONGetBalloonInfoStart(const char *key ATTRIBUTE_UNUSED,
+                                   size_t depth,
+                                   virJSONType type,
+                                   void *opaque ATTRIBUTE_UNUSED)
+{
+    if (depth == 0 && type == VIR_JSON_TYPE_OBJECT)
+        return 0;
+    return VIR_JSON_STREAM_SKIP;
+}
+
+
+static int
+qemuMonitorJSONGetBalloonInfoValue(const char *key,
+                                   size_t depth,
+                                   virJSONType type,
+                                   const char *value,
+                                   void *opaque)
+{
+    unsigned long long *mem = opaque;
+
+    if (depth == 1 && type == VIR_JSON_TYPE_NUMBER &&
+        STREQ(key, "actual") &&
+        virStrToLong_ull(value, NULL, 10, mem) < 0)
+        *mem = -1ULL;
+
+    return 0;
+}
+
+
+static const virJSONStreamCallbacks qemuMonitorJSONGetBalloonInfoCallbacks = {
+    .start = qemuMonitorJSONGetBalloonInfoStart,
+    .value = qemuMonitorJSONGetBalloonInfoValue,
+};
+
+
 int
 qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
                               unsigned long long *currmem)
 {
     int ret = -1;
-    virJSONValuePtr data;
-    unsigned long long mem;
+    unsigned long long mem = -1ULL;
     virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-balloon",
                                                      NULL);
     virJSONValuePtr reply = NULL;
@@ -1677,23 +2231,25 @@ qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
     if (!cmd)
         return -1;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandStream(mon, cmd,
+                                     &qemuMonitorJSONGetBalloonInfoCallbacks,
+                                     &mem, &reply) < 0)
         goto cleanup;
 
-    /* See if balloon soft-failed */
-    if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
-        qemuMonitorJSONHasError(reply, "KVMMissingCap")) {
-        ret = 0;
-        goto cleanup;
-    }
-
-    /* See if any other fatal error occurred */
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
-        goto cleanup;
+    if (reply) {
+        /* See if balloon soft-failed */
+        if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
+            qemuMonitorJSONHasError(reply, "KVMMissingCap")) {
+            ret = 0;
+            goto cleanup;
+        }
 
-    data = virJSONValueObjectGetObject(reply, "return");
+        /* See if any other fatal error occurred */
+        if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+            goto cleanup;
+    }
 
-    if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
+    if (mem == -1ULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("info balloon reply was missing balloon data"));
         goto cleanup;
@@ -1728,22 +2284,117 @@ qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
  * The 'last-update' value could be used in the future in order to determine
  * rates and/or whether data has been collected since a previous cycle.
  * It's currently unused.
+ *
+ * The values are picked up while parsing the reply and reported in the
+ * order of the table below regardless of their order in the reply.
  */
-#define GET_BALLOON_STATS(OBJECT, FIELD, TAG, DIVISOR)                        \
-    if (virJSONValueObjectHasKey(OBJECT, FIELD) &&                            \
-       (got < nr_stats)) {                                                    \
-        if (virJSONValueObjectGetNumberUlong(OBJECT, FIELD, &mem) < 0) {      \
-            VIR_DEBUG("Failed to get '%s' value", FIELD);                     \
-        } else {                                                              \
-            /* Not being collected? No point in providing bad data */         \
-            if (mem != -1UL) {                                                \
-                stats[got].tag = TAG;                                         \
-                stats[got].val = mem / DIVISOR;                               \
-                got++;                                                        \
-            }                                                                 \
-        }                                                                     \
+static const struct {
+    const char *field;
+    int tag;
+    unsigned int divisor;
+    bool stats; /* member of the 'stats' object rather than of the reply */
+} qemuMonitorJSONBalloonStats[] = {
+    { "stat-swap-in", VIR_DOMAIN_MEMORY_STAT_SWAP_IN, 1024, true },
+    { "stat-swap-out", VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, 1024, true },
+    { "stat-major-faults", VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, 1, true },
+    { "stat-minor-faults", VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, 1, true },
+    { "stat-free-memory", VIR_DOMAIN_MEMORY_STAT_UNUSED, 1024, true },
+    { "stat-total-memory", VIR_DOMAIN_MEMORY_STAT_AVAILABLE, 1024, true },
+    { "stat-available-memory", VIR_DOMAIN_MEMORY_STAT_USABLE, 1024, true },
+    { "last-update", VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, 1, false },
+};
+
+struct qemuMonitorJSONBalloonStatsParser {
+    bool haveStats;
+    bool inStats;
+    bool present[ARRAY_CARDINALITY(qemuMonitorJSONBalloonStats)];
+    unsigned long long values[ARRAY_CARDINALITY(qemuMonitorJSONBalloonStats)];
+};
+
+
+static int
+qemuMonitorJSONBalloonStatsStart(const char *key,
+                                 size_t depth,
+                                 virJSONType type,
+                                 void *opaque)
+{
+    struct qemuMonitorJSONBalloonStatsParser *parser = opaque;
+
+    if (depth == 0)
+        return type == VIR_JSON_TYPE_OBJECT ? 0 : 1;
+
+    if (depth == 1 && STREQ(key, "stats")) {
+        parser->haveStats = true;
+        if (type == VIR_JSON_TYPE_OBJECT) {
+            parser->inStats = true;
+            return 0;
+        }
+    }
+
+    return VIR_JSON_STREAM_SKIP;
+}
+
+
+static int
+qemuMonitorJSONBalloonStatsEnd(size_t depth,
+                               virJSONType type ATTRIBUTE_UNUSED,
+                               void *opaque)
+{
+    struct qemuMonitorJSONBalloonStatsParser *parser = opaque;
+
+    if (depth == 1)
+        parser->inStats = false;
+
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONBalloonStatsValue(const char *key,
+                                 size_t depth,
+                                 virJSONType type,
+                                 const char *value,
+                                 void *opaque)
+{
+    struct qemuMonitorJSONBalloonStatsParser *parser = opaque;
+    bool stats;
+    size_t i;
+
+    if (depth == 1 && STREQ(key, "stats"))
+        parser->haveStats = true;
+
+    if (depth == 2 && parser->inStats)
+        stats = true;
+    else if (depth == 1)
+        stats = false;
+    else
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(qemuMonitorJSONBalloonStats); i++) {
+        if (qemuMonitorJSONBalloonStats[i].stats != stats ||
+            STRNEQ(qemuMonitorJSONBalloonStats[i].field, key))
+            continue;
+
+        if (type != VIR_JSON_TYPE_NUMBER ||
+            virStrToLong_ull(value, NULL, 10, &parser->values[i]) < 0) {
+            VIR_DEBUG("Failed to get '%s' value", key);
+            break;
+        }
+
+        parser->present[i] = true;
+        break;
     }
 
+    return 0;
+}
+
+
+static const virJSONStreamCallbacks qemuMonitorJSONBalloonStatsCallbacks = {
+    .start = qemuMonitorJSONBalloonStatsStart,
+    .end = qemuMonitorJSONBalloonStatsEnd,
+    .value = qemuMonitorJSONBalloonStatsValue,
+};
+
 
 int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                                   char *balloonpath,
@@ -1754,9 +2405,12 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
     virJSONValuePtr cmd = NULL;
     virJSONValuePtr reply = NULL;
     virJSONValuePtr data;
-    virJSONValuePtr statsdata;
+    struct qemuMonitorJSONBalloonStatsParser parser;
     unsigned long long mem;
     int got = 0;
+    size_t i;
+
+    memset(&parser, 0, sizeof(parser));
 
     ret = qemuMonitorJSONGetBalloonInfo(mon, &mem);
     if (ret == 1 && (got < nr_stats)) {
@@ -1774,54 +2428,52 @@ int qemuMonitorJSONGetMemoryStats(qemuMonitorPtr mon,
                                            NULL)))
         goto cleanup;
 
-    if (qemuMonitorJSONCommand(mon, cmd, &reply) < 0)
+    if (qemuMonitorJSONCommandStream(mon, cmd,
+                                     &qemuMonitorJSONBalloonStatsCallbacks,
+                                     &parser, &reply) < 0)
         goto cleanup;
 
-    if ((data = virJSONValueObjectGetObject(reply, "error"))) {
-        const char *klass = virJSONValueObjectGetString(data, "class");
-        const char *desc = virJSONValueObjectGetString(data, "desc");
+    if (reply) {
+        if ((data = virJSONValueObjectGetObject(reply, "error"))) {
+            const char *klass = virJSONValueObjectGetString(data, "class");
+            const char *desc = virJSONValueObjectGetString(data, "desc");
 
-        if (STREQ_NULLABLE(klass, "GenericError") &&
-            STREQ_NULLABLE(desc, "guest hasn't updated any stats yet")) {
-            virReportError(VIR_ERR_OPERATION_INVALID, "%s",
-                           _("the guest hasn't updated any stats yet"));
-            goto cleanup;
+            if (STREQ_NULLABLE(klass, "GenericError") &&
+                STREQ_NULLABLE(desc, "guest hasn't updated any stats yet")) {
+                virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                               _("the guest hasn't updated any stats yet"));
+                goto cleanup;
+            }
         }
+
+        if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+            goto cleanup;
     }
 
-    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+    if (!parser.haveStats) {
+        VIR_DEBUG("data does not include 'stats'");
         goto cleanup;
+    }
 
-    data = virJSONValueObjectGetObject(reply, "return");
+    for (i = 0; i < ARRAY_CARDINALITY(qemuMonitorJSONBalloonStats); i++) {
+        if (!parser.present[i] || got >= nr_stats)
+            continue;
 
-    if (!(statsdata = virJSONValueObjectGet(data, "stats"))) {
-        VIR_DEBUG("data does not include 'stats'");
-        goto cleanup;
+        /* Not being collected? No point in providing bad data */
+        if (parser.values[i] == -1UL)
+            continue;
+
+        stats[got].tag = qemuMonitorJSONBalloonStats[i].tag;
+        stats[got].val = parser.values[i] / qemuMonitorJSONBalloonStats[i].divisor;
+        got++;
     }
 
-    GET_BALLOON_STATS(statsdata, "stat-swap-in",
-                      VIR_DOMAIN_MEMORY_STAT_SWAP_IN, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-swap-out",
-                      VIR_DOMAIN_MEMORY_STAT_SWAP_OUT, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-major-faults",
-                      VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT, 1);
-    GET_BALLOON_STATS(statsdata, "stat-minor-faults",
-                      VIR_DOMAIN_MEMORY_STAT_MINOR_FAULT, 1);
-    GET_BALLOON_STATS(statsdata, "stat-free-memory",
-                      VIR_DOMAIN_MEMORY_STAT_UNUSED, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-total-memory",
-                      VIR_DOMAIN_MEMORY_STAT_AVAILABLE, 1024);
-    GET_BALLOON_STATS(statsdata, "stat-available-memory",
-                      VIR_DOMAIN_MEMORY_STAT_USABLE, 1024);
-    GET_BALLOON_STATS(data, "last-update",
-                      VIR_DOMAIN_MEMORY_STAT_LAST_UPDATE, 1);
     ret = got;
  cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
 }
-#undef GET_BALLOON_STATS
 
 
 /*
@@ -1989,78 +2641,6 @@ int qemuMonitorJSONGetBlockInfo(qemuMonitorPtr mon,
 }
 
 
-static int
-qemuMonitorJSONGetOneBlockStatsInfo(virJSONValuePtr dev,
-                                    const char *dev_name,
-                                    int depth,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
-{
-    qemuBlockStatsPtr bstats = NULL;
-    virJSONValuePtr stats;
-    virJSONValuePtr parent;
-    virJSONValuePtr parentstats;
-    int ret = -1;
-    int nstats = 0;
-    char *entry_name = qemuDomainStorageAlias(dev_name, depth);
-    virJSONValuePtr backing;
-
-    if (!entry_name)
-        goto cleanup;
-    if (VIR_ALLOC(bstats) < 0)
-        goto cleanup;
-
-    if ((stats = virJSONValueObjectGetObject(dev, "stats")) == NULL) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("blockstats stats entry was not "
-                         "in expected format"));
-        goto cleanup;
-    }
-
-#define QEMU_MONITOR_BLOCK_STAT_GET(NAME, VAR, MANDATORY)                      \
-    if (MANDATORY || virJSONValueObjectHasKey(stats, NAME)) {                  \
-        nstats++;                                                              \
-        if (virJSONValueObjectGetNumberLong(stats, NAME, &VAR) < 0) {          \
-            virReportError(VIR_ERR_INTERNAL_ERROR,                             \
-                           _("cannot read %s statistic"), NAME);               \
-            goto cleanup;                                                      \
-        }                                                                      \
-    }
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_bytes", bstats->rd_bytes, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_bytes", bstats->wr_bytes, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_operations", bstats->rd_req, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_operations", bstats->wr_req, true);
-    QEMU_MONITOR_BLOCK_STAT_GET("rd_total_time_ns", bstats->rd_total_times, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("wr_total_time_ns", bstats->wr_total_times, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("flush_operations", bstats->flush_req, false);
-    QEMU_MONITOR_BLOCK_STAT_GET("flush_total_time_ns", bstats->flush_total_times, false);
-#undef QEMU_MONITOR_BLOCK_STAT_GET
-
-    if ((parent = virJSONValueObjectGetObject(dev, "parent")) &&
-        (parentstats = virJSONValueObjectGetObject(parent, "stats"))) {
-        if (virJSONValueObjectGetNumberUlong(parentstats, "wr_highest_offset",
-                                             &bstats->wr_highest_offset) == 0)
-            bstats->wr_highest_offset_valid = true;
-    }
-
-    if (virHashAddEntry(hash, entry_name, bstats) < 0)
-        goto cleanup;
-    bstats = NULL;
-
-    if (backingChain &&
-        (backing = virJSONValueObjectGetObject(dev, "backing")) &&
-        qemuMonitorJSONGetOneBlockStatsInfo(backing, dev_name, depth + 1,
-                                            hash, true) < 0)
-        goto cleanup;
-
-    ret = nstats;
- cleanup:
-    VIR_FREE(bstats);
-    VIR_FREE(entry_name);
-    return ret;
-}
-
-
 virJSONValuePtr
 qemuMonitorJSONQueryBlockstats(qemuMonitorPtr mon)
 {
@@ -2090,52 +2670,387 @@ qemuMonitorJSONQueryBlockstats(qemuMonitorPtr mon)
 }
 
 
-int
-qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
-                                    virHashTablePtr hash,
-                                    bool backingChain)
+/*
+ * query-blockstats replies grow with the number of disks and the length of
+ * their backing chains, so they are decoded directly from the parser events:
+ *
+ * [{"device": "drive-virtio-disk0",
+ *   "stats": {"rd_bytes": 28505088, "wr_bytes": 2845696, ...},
+ *   "parent": {"stats": {"wr_highest_offset": 5256018944, ...}},
+ *   "backing": {"stats": {...}, "parent": {...}, "backing": {...}}},
+ *  {...}
+ * ]
+ */
+static const struct {
+    const char *name;
+    size_t offset;
+    bool mandatory;
+} qemuMonitorJSONBlockStatsFields[] = {
+    { "rd_bytes", offsetof(qemuBlockStats, rd_bytes), true },
+    { "wr_bytes", offsetof(qemuBlockStats, wr_bytes), true },
+    { "rd_operations", offsetof(qemuBlockStats, rd_req), true },
+    { "wr_operations", offsetof(qemuBlockStats, wr_req), true },
+    { "rd_total_time_ns", offsetof(qemuBlockStats, rd_total_times), false },
+    { "wr_total_time_ns", offsetof(qemuBlockStats, wr_total_times), false },
+    { "flush_operations", offsetof(qemuBlockStats, flush_req), false },
+    { "flush_total_time_ns", offsetof(qemuBlockStats, flush_total_times), false },
+};
+
+typedef enum {
+    QEMU_MONITOR_JSON_BLOCK_STATS_NODE, /* device entry or its backing image */
+    QEMU_MONITOR_JSON_BLOCK_STATS_STATS,
+    QEMU_MONITOR_JSON_BLOCK_STATS_PARENT,
+    QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS,
+} qemuMonitorJSONBlockStatsContext;
+
+struct qemuMonitorJSONBlockStatsFrame {
+    qemuMonitorJSONBlockStatsContext context;
+    size_t level; /* position in the backing chain */
+};
+
+struct qemuMonitorJSONBlockStatsLevel {
+    qemuBlockStatsPtr stats;
+    bool haveStats;
+    int nstats;
+    bool fields[ARRAY_CARDINALITY(qemuMonitorJSONBlockStatsFields)];
+};
+
+struct qemuMonitorJSONBlockStatsParser {
+    virHashTablePtr hash;
+    bool backingChain;
+    int nstats;
+
+    bool array;
+    char *device;
+
+    /* backing chain of the current device entry */
+    struct qemuMonitorJSONBlockStatsLevel *levels;
+    size_t nlevels;
+
+    /* open containers of the current device entry indexed by depth */
+    struct qemuMonitorJSONBlockStatsFrame *frames;
+    size_t nframes;
+};
+
+
+static void
+qemuMonitorJSONBlockStatsParserReset(struct qemuMonitorJSONBlockStatsParser *parser)
 {
-    int ret = -1;
-    int nstats = 0;
-    int rc;
     size_t i;
-    virJSONValuePtr devices;
 
-    if (!(devices = qemuMonitorJSONQueryBlockstats(mon)))
+    for (i = 0; i < parser->nlevels; i++)
+        VIR_FREE(parser->levels[i].stats);
+    VIR_FREE(parser->levels);
+    parser->nlevels = 0;
+    VIR_FREE(parser->device);
+}
+
+
+static int
+qemuMonitorJSONBlockStatsPush(struct qemuMonitorJSONBlockStatsParser *parser,
+                              size_t depth,
+                              qemuMonitorJSONBlockStatsContext context,
+                              size_t level)
+{
+    if (depth >= parser->nframes &&
+        VIR_EXPAND_N(parser->frames, parser->nframes,
+                     depth + 1 - parser->nframes) < 0)
         return -1;
 
-    for (i = 0; i < virJSONValueArraySize(devices); i++) {
-        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
-        const char *dev_name;
+    parser->frames[depth].context = context;
+    parser->frames[depth].level = level;
+
+    if (context == QEMU_MONITOR_JSON_BLOCK_STATS_NODE) {
+        if (level >= parser->nlevels &&
+            VIR_EXPAND_N(parser->levels, parser->nlevels,
+                         level + 1 - parser->nlevels) < 0)
+            return -1;
+
+        if (!parser->levels[level].stats &&
+            VIR_ALLOC(parser->levels[level].stats) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONBlockStatsStat(struct qemuMonitorJSONBlockStatsLevel *level,
+                              const char *key,
+                              virJSONType type,
+                              const char *value)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(qemuMonitorJSONBlockStatsFields); i++) {
+        long long *var;
+
+        if (STRNEQ(qemuMonitorJSONBlockStatsFields[i].name, key))
+            continue;
+
+        var = (long long *)((char *)level->stats +
+                            qemuMonitorJSONBlockStatsFields[i].offset);
+
+        if (type != VIR_JSON_TYPE_NUMBER ||
+            virStrToLong_ll(value, NULL, 10, var) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot read %s statistic"), key);
+            return -1;
+        }
+
+        if (!level->fields[i]) {
+            level->fields[i] = true;
+            level->nstats++;
+        }
+        break;
+    }
+
+    return 0;
+}
 
-        if (!dev || dev->type != VIR_JSON_TYPE_OBJECT) {
+
+static int
+qemuMonitorJSONBlockStatsStart(const char *key,
+                               size_t depth,
+                               virJSONType type,
+                               void *opaque)
+{
+    struct qemuMonitorJSONBlockStatsParser *parser = opaque;
+    struct qemuMonitorJSONBlockStatsFrame *frame;
+
+    if (depth == 0) {
+        if (type != VIR_JSON_TYPE_ARRAY)
+            return VIR_JSON_STREAM_SKIP;
+        parser->array = true;
+        return 0;
+    }
+
+    if (depth == 1) {
+        if (type != VIR_JSON_TYPE_OBJECT) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                            _("blockstats device entry was not "
                              "in expected format"));
-            goto cleanup;
+            return -1;
+        }
+
+        qemuMonitorJSONBlockStatsParserReset(parser);
+        if (qemuMonitorJSONBlockStatsPush(parser, depth,
+                                          QEMU_MONITOR_JSON_BLOCK_STATS_NODE,
+                                          0) < 0)
+            return -1;
+        return 0;
+    }
+
+    frame = &parser->frames[depth - 1];
+
+    if (type != VIR_JSON_TYPE_OBJECT) {
+        /* a known statistic which is not a number */
+        if (frame->context == QEMU_MONITOR_JSON_BLOCK_STATS_STATS &&
+            qemuMonitorJSONBlockStatsStat(&parser->levels[frame->level],
+                                          key, type, NULL) < 0)
+            return -1;
+        return VIR_JSON_STREAM_SKIP;
+    }
+
+    switch (frame->context) {
+    case QEMU_MONITOR_JSON_BLOCK_STATS_NODE:
+        if (STREQ(key, "stats")) {
+            parser->levels[frame->level].haveStats = true;
+            return qemuMonitorJSONBlockStatsPush(parser, depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_STATS,
+                                                 frame->level);
+        }
+
+        if (STREQ(key, "parent"))
+            return qemuMonitorJSONBlockStatsPush(parser, depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_PARENT,
+                                                 frame->level);
+
+        if (STREQ(key, "backing") && parser->backingChain)
+            return qemuMonitorJSONBlockStatsPush(parser, depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_NODE,
+                                                 frame->level + 1);
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_PARENT:
+        if (STREQ(key, "stats"))
+            return qemuMonitorJSONBlockStatsPush(parser, depth,
+                                                 QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS,
+                                                 frame->level);
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_STATS:
+    case QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS:
+        break;
+    }
+
+    return VIR_JSON_STREAM_SKIP;
+}
+
+
+static int
+qemuMonitorJSONBlockStatsValue(const char *key,
+                               size_t depth,
+                               virJSONType type,
+                               const char *value,
+                               void *opaque)
+{
+    struct qemuMonitorJSONBlockStatsParser *parser = opaque;
+    struct qemuMonitorJSONBlockStatsFrame *frame;
+    qemuBlockStatsPtr stats;
+
+    if (depth == 1) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats device entry was not "
+                         "in expected format"));
+        return -1;
+    }
+
+    if (depth < 2)
+        return 0;
+
+    frame = &parser->frames[depth - 1];
+
+    switch (frame->context) {
+    case QEMU_MONITOR_JSON_BLOCK_STATS_NODE:
+        if (depth == 2 && type == VIR_JSON_TYPE_STRING &&
+            STREQ(key, "device")) {
+            VIR_FREE(parser->device);
+            if (VIR_STRDUP(parser->device, value) < 0)
+                return -1;
         }
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_STATS:
+        return qemuMonitorJSONBlockStatsStat(&parser->levels[frame->level],
+                                             key, type, value);
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_PARENT_STATS:
+        stats = parser->levels[frame->level].stats;
+        if (type == VIR_JSON_TYPE_NUMBER &&
+            STREQ(key, "wr_highest_offset") &&
+            virStrToLong_ull(value, NULL, 10, &stats->wr_highest_offset) == 0)
+            stats->wr_highest_offset_valid = true;
+        break;
+
+    case QEMU_MONITOR_JSON_BLOCK_STATS_PARENT:
+        break;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONBlockStatsEnd(size_t depth,
+                             virJSONType type ATTRIBUTE_UNUSED,
+                             void *opaque)
+{
+    struct qemuMonitorJSONBlockStatsParser *parser = opaque;
+    char *entry_name = NULL;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    /* the device name may come after the stats so the entries are added
+     * only once the whole device entry was parsed */
+    if (depth != 1)
+        return 0;
+
+    if (!parser->device) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("blockstats device entry was not "
+                         "in expected format"));
+        goto cleanup;
+    }
 
-        if (!(dev_name = virJSONValueObjectGetString(dev, "device"))) {
+    for (i = 0; i < parser->nlevels; i++) {
+        struct qemuMonitorJSONBlockStatsLevel *level = &parser->levels[i];
+
+        if (!level->haveStats) {
             virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("blockstats device entry was not "
+                           _("blockstats stats entry was not "
                              "in expected format"));
             goto cleanup;
         }
 
-        rc = qemuMonitorJSONGetOneBlockStatsInfo(dev, dev_name, 0, hash,
-                                                 backingChain);
+        for (j = 0; j < ARRAY_CARDINALITY(qemuMonitorJSONBlockStatsFields); j++) {
+            if (qemuMonitorJSONBlockStatsFields[j].mandatory &&
+                !level->fields[j]) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("cannot read %s statistic"),
+                               qemuMonitorJSONBlockStatsFields[j].name);
+                goto cleanup;
+            }
+        }
 
-        if (rc < 0)
+        if (!(entry_name = qemuDomainStorageAlias(parser->device, i)))
             goto cleanup;
 
-        if (rc > nstats)
-            nstats = rc;
+        if (virHashAddEntry(parser->hash, entry_name, level->stats) < 0)
+            goto cleanup;
+        level->stats = NULL;
+        VIR_FREE(entry_name);
     }
 
-    ret = nstats;
+    if (parser->levels[0].nstats > parser->nstats)
+        parser->nstats = parser->levels[0].nstats;
+
+    ret = 0;
 
  cleanup:
-    virJSONValueFree(devices);
+    VIR_FREE(entry_name);
+    qemuMonitorJSONBlockStatsParserReset(parser);
+    return ret;
+}
+
+
+static const virJSONStreamCallbacks qemuMonitorJSONBlockStatsCallbacks = {
+    .start = qemuMonitorJSONBlockStatsStart,
+    .end = qemuMonitorJSONBlockStatsEnd,
+    .value = qemuMonitorJSONBlockStatsValue,
+};
+
+
+int
+qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                    virHashTablePtr hash,
+                                    bool backingChain)
+{
+    int ret = -1;
+    virJSONValuePtr cmd;
+    virJSONValuePtr reply = NULL;
+    struct qemuMonitorJSONBlockStatsParser parser;
+
+    memset(&parser, 0, sizeof(parser));
+    parser.hash = hash;
+    parser.backingChain = backingChain;
+
+    if (!(cmd = qemuMonitorJSONMakeCommand("query-blockstats", NULL)))
+        return -1;
+
+    if (qemuMonitorJSONCommandStream(mon, cmd,
+                                     &qemuMonitorJSONBlockStatsCallbacks,
+                                     &parser, &reply) < 0)
+        goto cleanup;
+
+    if (reply && qemuMonitorJSONCheckError(cmd, reply) < 0)
+        goto cleanup;
+
+    if (!parser.array) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("query-blockstats reply was missing device list"));
+        goto cleanup;
+    }
+
+    ret = parser.nstats;
+
+ cleanup:
+    qemuMonitorJSONBlockStatsParserReset(&parser);
+    VIR_FREE(parser.frames);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
     return ret;
 }
 
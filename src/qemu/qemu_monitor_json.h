@@ -37,7 +37,7 @@ int qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                                  qemuMonitorMessagePtr msg);
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
+                             char *data,
                              size_t len,
                              qemuMonitorMessagePtr msg);
 
@@ -48,6 +48,10 @@ int qemuMonitorJSONHumanCommandWithFd(qemuMonitorPtr mon,
 
 int qemuMonitorJSONSetCapabilities(qemuMonitorPtr mon);
 
+int qemuMonitorJSONPrefetch(qemuMonitorPtr mon,
+                            const char *balloonpath,
+                            unsigned int flags);
+
 int qemuMonitorJSONStartCPUs(qemuMonitorPtr mon,
                              virConnectPtr conn);
 int qemuMonitorJSONStopCPUs(qemuMonitorPtr mon);
@@ -107,6 +107,8 @@ qemuProcessRemoveDomainStatus(virQEMUDriverPtr driver,
                  vm->def->name, virStrerror(errno, ebuf, sizeof(ebuf)));
     VIR_FREE(file);
 
+    virDomainDropStatusJournal(cfg->stateDir, vm);
+
     if (priv->pidfile &&
         unlink(priv->pidfile) < 0 &&
         errno != ENOENT)
@@ -301,7 +303,7 @@ qemuProcessHandleMonitorEOF(qemuMonitorPtr mon,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         VIR_FREE(processEvent);
         goto cleanup;
@@ -894,7 +896,7 @@ qemuProcessHandleWatchdog(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
              * deleted before handling watchdog event is finished.
              */
             virObjectRef(vm);
-            if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+            if (qemuProcessEventSubmit(driver, processEvent) < 0) {
                 if (!virObjectUnref(vm))
                     vm = NULL;
                 VIR_FREE(processEvent);
@@ -1015,7 +1017,7 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
         processEvent->status = status;
 
         virObjectRef(vm);
-        if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+        if (qemuProcessEventSubmit(driver, processEvent) < 0) {
             ignore_value(virObjectUnref(vm));
             goto error;
         }
@@ -1330,7 +1332,7 @@ qemuProcessHandleGuestPanic(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
      * deleted before handling guest panic event is finished.
      */
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuProcessEventSubmit(driver, processEvent) < 0) {
         if (!virObjectUnref(vm))
             vm = NULL;
         VIR_FREE(processEvent);
@@ -1373,7 +1375,7 @@ qemuProcessHandleDeviceDeleted(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         goto error;
     }
@@ -1522,7 +1524,7 @@ qemuProcessHandleNicRxFilterChanged(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         goto error;
     }
@@ -1565,7 +1567,7 @@ qemuProcessHandleSerialChanged(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     processEvent->vm = vm;
 
     virObjectRef(vm);
-    if (virThreadPoolSendJob(driver->workerPool, 0, processEvent) < 0) {
+    if (qemuProcessEventSubmit(driver, processEvent) < 0) {
         ignore_value(virObjectUnref(vm));
         goto error;
     }
@@ -30,11 +30,61 @@
 #include "virfile.h"
 #include "virutil.h"
 #include "virstring.h"
+#include "virobject.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 
 VIR_LOG_INIT("rpc.netmessage");
 
+/* Buffer sizes the pool keeps freelists for. The first one fits the
+ * length word plus most calls and replies, the second one is what
+ * virNetMessageEncodeHeader asks for. Anything larger than the last
+ * class is allocated and freed directly. */
+static const size_t virNetMessagePoolBufferSizes[] = {
+    4096,
+    VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX,
+};
+
+#define VIR_NET_MESSAGE_POOL_NCLASSES ARRAY_CARDINALITY(virNetMessagePoolBufferSizes)
+
+typedef struct _virNetMessagePoolBuffers virNetMessagePoolBuffers;
+struct _virNetMessagePoolBuffers {
+    size_t nbufs;
+    char **bufs;
+};
+
+struct _virNetMessagePool {
+    virObjectLockable parent;
+
+    size_t maxFree;
+
+    size_t nmsgs;
+    virNetMessagePtr msgs;  /* Freelist linked through msg->next */
+
+    virNetMessagePoolBuffers buffers[VIR_NET_MESSAGE_POOL_NCLASSES];
+
+    unsigned long long msgHits;
+    unsigned long long msgMisses;
+    unsigned long long bufHits;
+    unsigned long long bufMisses;
+};
+
+static virClassPtr virNetMessagePoolClass;
+static void virNetMessagePoolDispose(void *obj);
+
+static int virNetMessagePoolOnceInit(void)
+{
+    if (!(virNetMessagePoolClass = virClassNew(virClassForObjectLockable(),
+                                               "virNetMessagePool",
+                                               sizeof(virNetMessagePool),
+                                               virNetMessagePoolDispose)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virNetMessagePool)
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -49,6 +99,248 @@ virNetMessagePtr virNetMessageNew(bool tracked)
 }
 
 
+/**
+ * virNetMessagePoolNew:
+ * @maxFree: maximum number of idle messages and idle buffers per size
+ *           class the pool holds on to
+ *
+ * Create a pool recycling messages and their buffers. Messages taken
+ * from the pool with virNetMessagePoolGet go back to it when they are
+ * passed to virNetMessageFree.
+ *
+ * Returns the new pool or NULL on error.
+ */
+virNetMessagePoolPtr
+virNetMessagePoolNew(size_t maxFree)
+{
+    virNetMessagePoolPtr pool;
+    size_t i;
+
+    if (virNetMessagePoolInitialize() < 0)
+        return NULL;
+
+    if (!(pool = virObjectLockableNew(virNetMessagePoolClass)))
+        return NULL;
+
+    pool->maxFree = maxFree;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_NCLASSES; i++) {
+        if (VIR_ALLOC_N(pool->buffers[i].bufs, maxFree) < 0)
+            goto error;
+    }
+
+    return pool;
+
+ error:
+    virObjectUnref(pool);
+    return NULL;
+}
+
+
+static void
+virNetMessagePoolDispose(void *obj)
+{
+    virNetMessagePoolPtr pool = obj;
+    size_t i, j;
+
+    while (pool->msgs) {
+        virNetMessagePtr msg = pool->msgs;
+        pool->msgs = msg->next;
+        VIR_FREE(msg);
+    }
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_NCLASSES; i++) {
+        for (j = 0; j < pool->buffers[i].nbufs; j++)
+            VIR_FREE(pool->buffers[i].bufs[j]);
+        VIR_FREE(pool->buffers[i].bufs);
+    }
+}
+
+
+/**
+ * virNetMessagePoolGet:
+ * @pool: the message pool
+ * @tracked: whether the message is tracked
+ *
+ * Like virNetMessageNew, but reuse an idle message from @pool if there
+ * is one. The message keeps a reference on @pool until it is freed.
+ *
+ * Returns the message or NULL on error.
+ */
+virNetMessagePtr
+virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                     bool tracked)
+{
+    virNetMessagePtr msg;
+
+    virObjectLock(pool);
+    if ((msg = pool->msgs)) {
+        pool->msgs = msg->next;
+        pool->nmsgs--;
+        pool->msgHits++;
+        msg->next = NULL;
+    } else {
+        pool->msgMisses++;
+    }
+    virObjectUnlock(pool);
+
+    if (!msg && VIR_ALLOC(msg) < 0)
+        return NULL;
+
+    msg->tracked = tracked;
+    msg->pool = virObjectRef(pool);
+    VIR_DEBUG("msg=%p tracked=%d pool=%p", msg, tracked, pool);
+
+    return msg;
+}
+
+
+static void
+virNetMessagePoolPut(virNetMessagePoolPtr pool,
+                     virNetMessagePtr msg)
+{
+    memset(msg, 0, sizeof(*msg));
+
+    virObjectLock(pool);
+    if (pool->nmsgs < pool->maxFree) {
+        msg->next = pool->msgs;
+        pool->msgs = msg;
+        pool->nmsgs++;
+        msg = NULL;
+    }
+    virObjectUnlock(pool);
+
+    VIR_FREE(msg);
+}
+
+
+static char *
+virNetMessagePoolGetBuffer(virNetMessagePoolPtr pool,
+                           size_t len,
+                           size_t *alloc)
+{
+    virNetMessagePoolBuffers *list = NULL;
+    char *buf = NULL;
+    size_t i;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_NCLASSES; i++) {
+        if (len <= virNetMessagePoolBufferSizes[i]) {
+            list = &pool->buffers[i];
+            len = virNetMessagePoolBufferSizes[i];
+            break;
+        }
+    }
+
+    virObjectLock(pool);
+    if (list && list->nbufs) {
+        buf = list->bufs[--list->nbufs];
+        pool->bufHits++;
+    } else {
+        pool->bufMisses++;
+    }
+    virObjectUnlock(pool);
+
+    if (!buf && VIR_ALLOC_N(buf, len) < 0)
+        return NULL;
+
+    *alloc = len;
+    return buf;
+}
+
+
+static void
+virNetMessagePoolPutBuffer(virNetMessagePoolPtr pool,
+                           char *buf,
+                           size_t alloc)
+{
+    virNetMessagePoolBuffers *list = NULL;
+    size_t i;
+
+    if (!buf)
+        return;
+
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_NCLASSES; i++) {
+        if (alloc == virNetMessagePoolBufferSizes[i]) {
+            list = &pool->buffers[i];
+            break;
+        }
+    }
+
+    if (list) {
+        virObjectLock(pool);
+        if (list->nbufs < pool->maxFree) {
+            list->bufs[list->nbufs++] = buf;
+            buf = NULL;
+        }
+        virObjectUnlock(pool);
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/**
+ * virNetMessagePoolGetStats:
+ * @pool: the message pool
+ * @stats: filled in with the current counters of @pool
+ */
+void
+virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                          virNetMessagePoolStatsPtr stats)
+{
+    size_t i;
+
+    virObjectLock(pool);
+    stats->msgHits = pool->msgHits;
+    stats->msgMisses = pool->msgMisses;
+    stats->bufHits = pool->bufHits;
+    stats->bufMisses = pool->bufMisses;
+    stats->nfreeMsgs = pool->nmsgs;
+    stats->nfreeBufs = 0;
+    for (i = 0; i < VIR_NET_MESSAGE_POOL_NCLASSES; i++)
+        stats->nfreeBufs += pool->buffers[i].nbufs;
+    virObjectUnlock(pool);
+}
+
+
+/**
+ * virNetMessageResizeBuffer:
+ * @msg: the message
+ * @len: required buffer size
+ *
+ * Make sure the buffer of @msg is at least @len bytes long, keeping
+ * its current contents. Pooled messages only ever grow their buffer,
+ * others are reallocated to exactly @len bytes. It is up to the caller
+ * to update bufferLength.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetMessageResizeBuffer(virNetMessagePtr msg,
+                          size_t len)
+{
+    char *buf;
+    size_t alloc;
+
+    if (!msg->pool)
+        return VIR_REALLOC_N(msg->buffer, len);
+
+    if (len <= msg->bufferAlloc)
+        return 0;
+
+    if (!(buf = virNetMessagePoolGetBuffer(msg->pool, len, &alloc)))
+        return -1;
+
+    if (msg->buffer)
+        memcpy(buf, msg->buffer, msg->bufferAlloc);
+    virNetMessagePoolPutBuffer(msg->pool, msg->buffer, msg->bufferAlloc);
+
+    msg->buffer = buf;
+    msg->bufferAlloc = alloc;
+    return 0;
+}
+
+
 void
 virNetMessageClearPayload(virNetMessagePtr msg)
 {
@@ -63,19 +355,27 @@ virNetMessageClearPayload(virNetMessagePtr msg)
 
     msg->bufferOffset = 0;
     msg->bufferLength = 0;
-    VIR_FREE(msg->buffer);
+    if (msg->pool) {
+        virNetMessagePoolPutBuffer(msg->pool, msg->buffer, msg->bufferAlloc);
+        msg->buffer = NULL;
+        msg->bufferAlloc = 0;
+    } else {
+        VIR_FREE(msg->buffer);
+    }
 }
 
 
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
+    virNetMessagePoolPtr pool = msg->pool;
 
     VIR_DEBUG("msg=%p nfds=%zu", msg, msg->nfds);
 
     virNetMessageClearPayload(msg);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
+    msg->pool = pool;
 }
 
 
@@ -90,7 +390,15 @@ void virNetMessageFree(virNetMessagePtr msg)
         msg->cb(msg, msg->opaque);
 
     virNetMessageClearPayload(msg);
-    VIR_FREE(msg);
+
+    if (msg->pool) {
+        virNetMessagePoolPtr pool = msg->pool;
+
+        virNetMessagePoolPut(pool, msg);
+        virObjectUnref(pool);
+    } else {
+        VIR_FREE(msg);
+    }
 }
 
 void virNetMessageQueuePush(virNetMessagePtr *queue, virNetMessagePtr msg)
@@ -154,7 +462,7 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     /* Extend our declared buffer length and carry
        on reading the header + payload */
     msg->bufferLength += len;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
         goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
@@ -231,7 +539,7 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     unsigned int len = 0;
 
     msg->bufferLength = VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
         return ret;
     msg->bufferOffset = 0;
 
@@ -370,7 +678,7 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
 
         msg->bufferLength = newlen + VIR_NET_MESSAGE_LEN_MAX;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
             goto error;
 
         xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
@@ -454,7 +762,7 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
 
         msg->bufferLength = msg->bufferOffset + len;
 
-        if (VIR_REALLOC_N(msg->buffer, msg->bufferLength) < 0)
+        if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
             return -1;
 
         VIR_DEBUG("Increased message buffer length = %zu", msg->bufferLength);
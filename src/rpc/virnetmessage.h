@@ -29,6 +29,12 @@ typedef struct virNetMessageError *virNetMessageErrorPtr;
 typedef struct _virNetMessage virNetMessage;
 typedef virNetMessage *virNetMessagePtr;
 
+typedef struct _virNetMessagePool virNetMessagePool;
+typedef virNetMessagePool *virNetMessagePoolPtr;
+
+typedef struct _virNetMessagePoolStats virNetMessagePoolStats;
+typedef virNetMessagePoolStats *virNetMessagePoolStatsPtr;
+
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
 struct _virNetMessage {
@@ -38,6 +44,9 @@ struct _virNetMessage {
                   /* Maximum   VIR_NET_MESSAGE_MAX     + VIR_NET_MESSAGE_LEN_MAX */
     size_t bufferLength;
     size_t bufferOffset;
+    size_t bufferAlloc; /* Real size of buffer, only tracked if pool != NULL */
+
+    virNetMessagePoolPtr pool; /* Pool the message and its buffer recycle into */
 
     virNetMessageHeader header;
 
@@ -51,9 +60,30 @@ struct _virNetMessage {
     virNetMessagePtr next;
 };
 
+struct _virNetMessagePoolStats {
+    unsigned long long msgHits;   /* Messages served from the freelist */
+    unsigned long long msgMisses; /* Messages that had to be allocated */
+    unsigned long long bufHits;   /* Buffers served from the freelists */
+    unsigned long long bufMisses; /* Buffers that had to be allocated */
+    size_t nfreeMsgs;             /* Messages currently on the freelist */
+    size_t nfreeBufs;             /* Buffers currently on the freelists */
+};
+
 
 virNetMessagePtr virNetMessageNew(bool tracked);
 
+virNetMessagePoolPtr virNetMessagePoolNew(size_t maxFree);
+virNetMessagePtr virNetMessagePoolGet(virNetMessagePoolPtr pool,
+                                      bool tracked)
+    ATTRIBUTE_NONNULL(1);
+void virNetMessagePoolGetStats(virNetMessagePoolPtr pool,
+                               virNetMessagePoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
+int virNetMessageResizeBuffer(virNetMessagePtr msg,
+                              size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 void virNetMessageClearPayload(virNetMessagePtr msg);
 
 void virNetMessageClear(virNetMessagePtr);
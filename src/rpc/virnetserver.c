@@ -36,6 +36,9 @@
 
 VIR_LOG_INIT("rpc.netserver");
 
+/* Idle messages (and buffers of each size) kept around for reuse */
+#define VIR_NET_SERVER_MESSAGE_POOL_MAX 64
+
 
 typedef struct _virNetServerJob virNetServerJob;
 typedef virNetServerJob *virNetServerJobPtr;
@@ -53,6 +56,16 @@ struct _virNetServer {
 
     virThreadPoolPtr workers;
 
+    /* Recycled messages and buffers shared by all clients */
+    virNetMessagePoolPtr msgPool;
+
+    /* Threads running client socket I/O, each with a single worker.
+     * Clients are assigned to them round robin. If there are none,
+     * I/O runs in the event loop thread. */
+    size_t nioWorkers;
+    virThreadPoolPtr *ioWorkers;
+    size_t nextIOWorker;
+
     char *mdnsGroupName;
     virNetServerMDNSPtr mdns;
     virNetServerMDNSGroupPtr mdnsGroup;
@@ -182,6 +195,14 @@ static void virNetServerHandleJob(void *jobOpaque, void *opaque)
     VIR_FREE(job);
 }
 
+static void virNetServerHandleIOJob(void *jobOpaque,
+                                    void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetServerClientPtr client = jobOpaque;
+
+    virNetServerClientDispatchIO(client);
+}
+
 static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
                                           virNetMessagePtr msg,
                                           void *opaque)
@@ -278,6 +299,14 @@ int virNetServerAddClient(virNetServerPtr srv,
 {
     virObjectLock(srv);
 
+    if (srv->nioWorkers) {
+        virNetServerClientSetIOWorker(client,
+                                      srv->ioWorkers[srv->nextIOWorker]);
+        srv->nextIOWorker = (srv->nextIOWorker + 1) % srv->nioWorkers;
+    }
+
+    virNetServerClientSetMessagePool(client, srv->msgPool);
+
     if (virNetServerClientInit(client) < 0)
         goto error;
 
@@ -366,6 +395,9 @@ virNetServerPtr virNetServerNew(const char *name,
                                           srv)))
         goto error;
 
+    if (!(srv->msgPool = virNetMessagePoolNew(VIR_NET_SERVER_MESSAGE_POOL_MAX)))
+        goto error;
+
     if (VIR_STRDUP(srv->name, name) < 0)
         goto error;
 
@@ -725,6 +757,66 @@ int virNetServerAddProgram(virNetServerPtr srv,
     return -1;
 }
 
+/**
+ * virNetServerSetIOWorkers:
+ * @srv: the server
+ * @nioWorkers: number of I/O threads
+ *
+ * Run socket I/O, TLS record processing and message framing of the
+ * clients of @srv in @nioWorkers threads instead of the event loop
+ * thread. Each client is bound to one of the threads for its whole
+ * lifetime. This must be called before any client is added.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virNetServerSetIOWorkers(virNetServerPtr srv,
+                         size_t nioWorkers)
+{
+    int ret = -1;
+    virThreadPoolPtr *workers = NULL;
+    size_t i;
+
+    virObjectLock(srv);
+
+    if (srv->nioWorkers || srv->nclients) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("I/O workers can only be set up once "
+                         "and before clients are added"));
+        goto cleanup;
+    }
+
+    if (nioWorkers == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(workers, nioWorkers) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nioWorkers; i++) {
+        if (!(workers[i] = virThreadPoolNew(1, 1, 0,
+                                            virNetServerHandleIOJob,
+                                            srv)))
+            goto cleanup;
+    }
+
+    srv->ioWorkers = workers;
+    srv->nioWorkers = nioWorkers;
+    workers = NULL;
+    ret = 0;
+
+ cleanup:
+    if (workers) {
+        for (i = 0; i < nioWorkers; i++)
+            virThreadPoolFree(workers[i]);
+        VIR_FREE(workers);
+    }
+    virObjectUnlock(srv);
+    return ret;
+}
+
+
 #if WITH_GNUTLS
 int virNetServerSetTLSContext(virNetServerPtr srv,
                               virNetTLSContextPtr tls)
@@ -774,12 +866,26 @@ void virNetServerDispose(void *obj)
         virObjectUnref(srv->programs[i]);
     VIR_FREE(srv->programs);
 
+    /* Clients may outlive the server, so they must not keep using the
+     * I/O workers, nor hold on to references of jobs which never run */
+    if (srv->nioWorkers) {
+        for (i = 0; i < srv->nclients; i++)
+            virNetServerClientSetIOWorker(srv->clients[i], NULL);
+        for (i = 0; i < srv->nioWorkers; i++)
+            virThreadPoolFree(srv->ioWorkers[i]);
+        for (i = 0; i < srv->nclients; i++)
+            virNetServerClientDropIOJob(srv->clients[i]);
+    }
+    VIR_FREE(srv->ioWorkers);
+
     for (i = 0; i < srv->nclients; i++) {
         virNetServerClientClose(srv->clients[i]);
         virObjectUnref(srv->clients[i]);
     }
     VIR_FREE(srv->clients);
 
+    virObjectUnref(srv->msgPool);
+
     VIR_FREE(srv->mdnsGroupName);
     virNetServerMDNSFree(srv->mdns);
 }
@@ -933,6 +1039,13 @@ virNetServerSetThreadPoolParameters(virNetServerPtr srv,
     return ret;
 }
 
+void
+virNetServerGetMessagePoolStats(virNetServerPtr srv,
+                                virNetMessagePoolStatsPtr stats)
+{
+    virNetMessagePoolGetStats(srv->msgPool, stats);
+}
+
 size_t
 virNetServerGetMaxClients(virNetServerPtr srv)
 {
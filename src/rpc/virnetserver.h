@@ -71,6 +71,9 @@ int virNetServerAddClient(virNetServerPtr srv,
 int virNetServerAddProgram(virNetServerPtr srv,
                            virNetServerProgramPtr prog);
 
+int virNetServerSetIOWorkers(virNetServerPtr srv,
+                             size_t nioWorkers);
+
 # if WITH_GNUTLS
 int virNetServerSetTLSContext(virNetServerPtr srv,
                               virNetTLSContextPtr tls);
@@ -116,6 +119,9 @@ size_t virNetServerGetCurrentClients(virNetServerPtr srv);
 size_t virNetServerGetMaxUnauthClients(virNetServerPtr srv);
 size_t virNetServerGetCurrentUnauthClients(virNetServerPtr srv);
 
+void virNetServerGetMessagePoolStats(virNetServerPtr srv,
+                                     virNetMessagePoolStatsPtr stats);
+
 int virNetServerSetClientLimits(virNetServerPtr srv,
                                 long long int maxClients,
                                 long long int maxClientsUnauth);
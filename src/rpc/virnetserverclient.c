@@ -105,6 +105,17 @@ struct _virNetServerClient
     /* Zero or many messages waiting for transmit
      * back to client, including async events */
     virNetMessagePtr tx;
+    /* Optional pool that receive buffers are
+     * drawn from and recycled into */
+    virNetMessagePoolPtr msgPool;
+
+    /* Optional thread that socket I/O, TLS and
+     * message framing is offloaded to, instead of
+     * running in the event loop thread. While a job
+     * is pending, the socket is not watched */
+    virThreadPoolPtr ioWorker;
+    bool ioPending;
+    int ioEvents;
 
     /* Filters to capture messages that would otherwise
      * end up on the 'dx' queue */
@@ -143,6 +154,7 @@ VIR_ONCE_GLOBAL_INIT(virNetServerClient)
 static void virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque);
 static void virNetServerClientUpdateEvent(virNetServerClientPtr client);
 static void virNetServerClientDispatchRead(virNetServerClientPtr client);
+static void virNetServerClientQueueIO(virNetServerClientPtr client, int events);
 static int virNetServerClientSendMessageLocked(virNetServerClientPtr client,
                                                virNetMessagePtr msg);
 
@@ -237,6 +249,10 @@ static void virNetServerClientUpdateEvent(virNetServerClientPtr client)
     if (!client->sock)
         return;
 
+    /* The I/O worker updates the event once it's done */
+    if (client->ioPending)
+        return;
+
     mode = virNetServerClientCalculateHandleMode(client);
 
     virNetSocketUpdateIOCallback(client->sock, mode);
@@ -302,6 +318,33 @@ void virNetServerClientRemoveFilter(virNetServerClientPtr client,
 }
 
 
+/*
+ * Allocate a new message ready to read the length word of the
+ * next incoming call into. Called with the client locked.
+ */
+static virNetMessagePtr
+virNetServerClientNewRxMessage(virNetServerClientPtr client)
+{
+    virNetMessagePtr msg;
+
+    if (client->msgPool)
+        msg = virNetMessagePoolGet(client->msgPool, true);
+    else
+        msg = virNetMessageNew(true);
+
+    if (!msg)
+        return NULL;
+
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+
 #ifdef WITH_GNUTLS
 /* Check the client's access. */
 static int
@@ -348,8 +391,12 @@ static void virNetServerClientSockTimerFunc(int timer,
     virEventUpdateTimeout(timer, -1);
     /* Although client->rx != NULL when this timer is enabled, it might have
      * changed since the client was unlocked in the meantime. */
-    if (client->rx)
-        virNetServerClientDispatchRead(client);
+    if (client->rx) {
+        if (client->ioWorker)
+            virNetServerClientQueueIO(client, VIR_EVENT_HANDLE_READABLE);
+        else
+            virNetServerClientDispatchRead(client);
+    }
     virObjectUnlock(client);
 }
 
@@ -389,10 +436,7 @@ virNetServerClientNewInternal(unsigned long long id,
         goto error;
 
     /* Prepare one for packet receive */
-    if (!(client->rx = virNetMessageNew(true)))
-        goto error;
-    client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-    if (VIR_ALLOC_N(client->rx->buffer, client->rx->bufferLength) < 0)
+    if (!(client->rx = virNetServerClientNewRxMessage(client)))
         goto error;
     client->nrequests = 1;
 
@@ -903,6 +947,68 @@ void virNetServerClientSetDispatcher(virNetServerClientPtr client,
 }
 
 
+/*
+ * Make socket I/O of @client run in @worker rather than in the
+ * event loop thread. Must be called before the client is initialized.
+ * Passing NULL stops queueing new I/O jobs to the worker, which is
+ * needed before the worker is freed.
+ */
+void virNetServerClientSetIOWorker(virNetServerClientPtr client,
+                                   virThreadPoolPtr worker)
+{
+    virObjectLock(client);
+    client->ioWorker = worker;
+    virObjectUnlock(client);
+}
+
+
+/*
+ * To be called once the I/O worker of @client was detached with
+ * virNetServerClientSetIOWorker and freed. An I/O job which was
+ * still queued then will never run, so drop the reference it held
+ * and let the event loop watch the socket again.
+ */
+void virNetServerClientDropIOJob(virNetServerClientPtr client)
+{
+    bool pending;
+
+    virObjectLock(client);
+    pending = client->ioPending;
+    client->ioPending = false;
+    client->ioEvents = 0;
+    if (pending)
+        virNetServerClientUpdateEvent(client);
+    virObjectUnlock(client);
+
+    if (pending)
+        virObjectUnref(client);
+}
+
+
+/*
+ * Make @client draw buffers for incoming calls from @pool.
+ * The receive message allocated when the client was created
+ * is swapped for a pooled one as long as nothing was read
+ * into it yet; any other message is left alone.
+ */
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool)
+{
+    virNetMessagePtr msg;
+
+    virObjectLock(client);
+    virObjectUnref(client->msgPool);
+    client->msgPool = virObjectRef(pool);
+
+    if (client->rx && !client->rx->pool && client->rx->bufferOffset == 0 &&
+        (msg = virNetServerClientNewRxMessage(client))) {
+        virNetMessageFree(client->rx);
+        client->rx = msg;
+    }
+    virObjectUnlock(client);
+}
+
+
 const char *virNetServerClientLocalAddrStringSASL(virNetServerClientPtr client)
 {
     if (!client->sock)
@@ -947,6 +1053,7 @@ void virNetServerClientDispose(void *obj)
     virObjectUnref(client->tls);
     virObjectUnref(client->tlsCtxt);
 #endif
+    virObjectUnref(client->msgPool);
     virObjectUnref(client->sock);
 }
 
@@ -1275,17 +1382,10 @@ static void virNetServerClientDispatchRead(virNetServerClientPtr client)
 
         /* Possibly need to create another receive buffer */
         if (client->nrequests < client->nrequests_max) {
-            if (!(client->rx = virNetMessageNew(true))) {
+            if (!(client->rx = virNetServerClientNewRxMessage(client)))
                 client->wantClose = true;
-            } else {
-                client->rx->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                if (VIR_ALLOC_N(client->rx->buffer,
-                                client->rx->bufferLength) < 0) {
-                    client->wantClose = true;
-                } else {
-                    client->nrequests++;
-                }
-            }
+            else
+                client->nrequests++;
         }
         virNetServerClientUpdateEvent(client);
     }
@@ -1382,7 +1482,7 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                     /* Ready to recv more messages */
                     virNetMessageClear(msg);
                     msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
-                    if (VIR_ALLOC_N(msg->buffer, msg->bufferLength) < 0) {
+                    if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0) {
                         virNetMessageFree(msg);
                         return;
                     }
@@ -1428,19 +1528,12 @@ virNetServerClientDispatchHandshake(virNetServerClientPtr client)
 }
 #endif
 
+/*
+ * @client: a locked client object
+ */
 static void
-virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
+virNetServerClientHandleEvents(virNetServerClientPtr client, int events)
 {
-    virNetServerClientPtr client = opaque;
-
-    virObjectLock(client);
-
-    if (client->sock != sock) {
-        virNetSocketRemoveIOCallback(sock);
-        virObjectUnlock(client);
-        return;
-    }
-
     if (events & (VIR_EVENT_HANDLE_WRITABLE |
                   VIR_EVENT_HANDLE_READABLE)) {
 #if WITH_GNUTLS
@@ -1465,6 +1558,85 @@ virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
     if (events & (VIR_EVENT_HANDLE_ERROR |
                   VIR_EVENT_HANDLE_HANGUP))
         client->wantClose = true;
+}
+
+
+/*
+ * @client: a locked client object
+ *
+ * Hand @events over to the client's I/O worker. The socket is not
+ * watched until the worker has processed them, so there is never
+ * more than one job per client and I/O stays ordered.
+ */
+static void
+virNetServerClientQueueIO(virNetServerClientPtr client, int events)
+{
+    client->ioEvents |= events;
+    if (client->ioPending)
+        return;
+
+    virNetSocketUpdateIOCallback(client->sock, 0);
+
+    virObjectRef(client);
+    if (virThreadPoolSendJob(client->ioWorker, 0, client) < 0) {
+        virObjectUnref(client);
+        client->ioEvents = 0;
+        client->wantClose = true;
+        return;
+    }
+    client->ioPending = true;
+}
+
+
+/**
+ * virNetServerClientDispatchIO:
+ * @client: the client
+ *
+ * Process socket events queued for @client. Called from the I/O
+ * worker thread the client was assigned to, it consumes the
+ * reference taken when the job was queued.
+ */
+void
+virNetServerClientDispatchIO(virNetServerClientPtr client)
+{
+    int events;
+
+    virObjectLock(client);
+
+    events = client->ioEvents;
+    client->ioEvents = 0;
+    client->ioPending = false;
+
+    /* The event loop thread may be closing the client */
+    if (client->sock && !client->wantClose)
+        virNetServerClientHandleEvents(client, events);
+
+    /* Re-arm the socket watch. This also wakes up the event loop
+     * so that it notices if the client wants to be closed. */
+    virNetServerClientUpdateEvent(client);
+
+    virObjectUnlock(client);
+    virObjectUnref(client);
+}
+
+
+static void
+virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
+{
+    virNetServerClientPtr client = opaque;
+
+    virObjectLock(client);
+
+    if (client->sock != sock) {
+        virNetSocketRemoveIOCallback(sock);
+        virObjectUnlock(client);
+        return;
+    }
+
+    if (client->ioWorker)
+        virNetServerClientQueueIO(client, events);
+    else
+        virNetServerClientHandleEvents(client, events);
 
     virObjectUnlock(client);
 }
@@ -29,6 +29,7 @@
 # include "virnetmessage.h"
 # include "virobject.h"
 # include "virjson.h"
+# include "virthreadpool.h"
 
 typedef struct _virNetServerClient virNetServerClient;
 typedef virNetServerClient *virNetServerClientPtr;
@@ -122,6 +123,12 @@ void virNetServerClientSetCloseHook(virNetServerClientPtr client,
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque);
+void virNetServerClientSetMessagePool(virNetServerClientPtr client,
+                                      virNetMessagePoolPtr pool);
+void virNetServerClientSetIOWorker(virNetServerClientPtr client,
+                                   virThreadPoolPtr worker);
+void virNetServerClientDropIOJob(virNetServerClientPtr client);
+void virNetServerClientDispatchIO(virNetServerClientPtr client);
 void virNetServerClientClose(virNetServerClientPtr client);
 bool virNetServerClientIsClosed(virNetServerClientPtr client);
 
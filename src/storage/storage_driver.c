@@ -1630,18 +1630,10 @@ static void
 storageVolRemoveFromPool(virStoragePoolObjPtr obj,
                          virStorageVolDefPtr voldef)
 {
-    size_t i;
-
-    for (i = 0; i < obj->volumes.count; i++) {
-        if (obj->volumes.objs[i] == voldef) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     voldef->name, obj->def->name);
-            virStorageVolDefFree(voldef);
-
-            VIR_DELETE_ELEMENT(obj->volumes.objs, i, obj->volumes.count);
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             voldef->name, obj->def->name);
+    virStoragePoolObjRemoveVol(obj, voldef);
+    virStorageVolDefFree(voldef);
 }
 
 
@@ -1815,21 +1807,19 @@ storageVolCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(obj->volumes.objs,
-                      obj->volumes.count + 1) < 0)
-        goto cleanup;
-
     /* Wipe any key the user may have suggested, as volume creation
      * will generate the canonical key.  */
     VIR_FREE(voldef->key);
     if (backend->createVol(pool->conn, obj, voldef) < 0)
         goto cleanup;
 
-    obj->volumes.objs[obj->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(obj, voldef) < 0)
+        goto cleanup;
+
     newvol = virGetStorageVol(pool->conn, obj->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!newvol) {
-        obj->volumes.count--;
+        virStoragePoolObjRemoveVol(obj, voldef);
         goto cleanup;
     }
 
@@ -2014,11 +2004,15 @@ storageVolCreateXMLFrom(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    if (backend->refreshVol &&
-        backend->refreshVol(pool->conn, obj, voldefsrc) < 0)
+    if (voldefsrc->wiping) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is being wiped."),
+                       voldefsrc->name);
         goto cleanup;
+    }
 
-    if (VIR_REALLOC_N(obj->volumes.objs, obj->volumes.count + 1) < 0)
+    if (backend->refreshVol &&
+        backend->refreshVol(pool->conn, obj, voldefsrc) < 0)
         goto cleanup;
 
     /* 'Define' the new volume so we get async progress reporting.
@@ -2037,11 +2031,13 @@ storageVolCreateXMLFrom(virStoragePoolPtr pool,
 
     memcpy(shadowvol, voldef, sizeof(*voldef));
 
-    obj->volumes.objs[obj->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(obj, voldef) < 0)
+        goto cleanup;
+
     newvol = virGetStorageVol(pool->conn, obj->def->name, voldef->name,
                               voldef->key, NULL, NULL);
     if (!newvol) {
-        obj->volumes.count--;
+        virStoragePoolObjRemoveVol(obj, voldef);
         goto cleanup;
     }
 
@@ -2135,6 +2131,13 @@ storageVolDownload(virStorageVolPtr vol,
         goto cleanup;
     }
 
+    if (voldef->wiping) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is being wiped."),
+                       voldef->name);
+        goto cleanup;
+    }
+
     if (!backend->downloadVol) {
         virReportError(VIR_ERR_NO_SUPPORT, "%s",
                        _("storage pool doesn't support volume download"));
@@ -2456,6 +2459,7 @@ storageVolWipePattern(virStorageVolPtr vol,
     virStorageBackendPtr backend;
     virStoragePoolObjPtr obj = NULL;
     virStorageVolDefPtr voldef = NULL;
+    int rc;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -2493,7 +2497,25 @@ storageVolWipePattern(virStorageVolPtr vol,
         goto cleanup;
     }
 
-    if (backend->wipeVol(vol->conn, obj, voldef, algorithm, flags) < 0)
+    /* Wiping can take hours, so drop the pool lock meanwhile. Being in
+     * use keeps the volume from being modified and the wiping flag
+     * keeps it from being read while it's half wiped */
+    obj->asyncjobs++;
+    voldef->in_use++;
+    voldef->wiping = true;
+    virStoragePoolObjUnlock(obj);
+
+    rc = backend->wipeVol(vol->conn, obj, voldef, algorithm, flags);
+
+    storageDriverLock();
+    virStoragePoolObjLock(obj);
+    storageDriverUnlock();
+
+    voldef->wiping = false;
+    voldef->in_use--;
+    obj->asyncjobs--;
+
+    if (rc < 0)
         goto cleanup;
 
     if (backend->refreshVol &&
@@ -2534,6 +2556,13 @@ storageVolGetInfoFlags(virStorageVolPtr vol,
     if (virStorageVolGetInfoFlagsEnsureACL(vol->conn, obj->def, voldef) < 0)
         goto cleanup;
 
+    if (voldef->wiping) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is being wiped."),
+                       voldef->name);
+        goto cleanup;
+    }
+
     if (backend->refreshVol &&
         backend->refreshVol(vol->conn, obj, voldef) < 0)
         goto cleanup;
@@ -2578,6 +2607,13 @@ storageVolGetXMLDesc(virStorageVolPtr vol,
     if (virStorageVolGetXMLDescEnsureACL(vol->conn, obj->def, voldef) < 0)
         goto cleanup;
 
+    if (voldef->wiping) {
+        virReportError(VIR_ERR_OPERATION_INVALID,
+                       _("volume '%s' is being wiped."),
+                       voldef->name);
+        goto cleanup;
+    }
+
     if (backend->refreshVol &&
         backend->refreshVol(vol->conn, obj, voldef) < 0)
         goto cleanup;
@@ -50,6 +50,10 @@
 # include <linux/btrfs.h>
 #endif
 
+#if HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+
 #include "datatypes.h"
 #include "virerror.h"
 #include "viralloc.h"
@@ -68,6 +72,7 @@
 #include "virstring.h"
 #include "virxml.h"
 #include "virfdstream.h"
+#include "virthreadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -77,25 +82,256 @@ VIR_LOG_INIT("storage.storage_util");
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
 /*
- * Perform the O(1) btrfs clone operation, if possible.
+ * Perform the O(1) clone operation, if possible. This shares the
+ * extents of @src_fd with @dest_fd on filesystems supporting reflinks
+ * (btrfs, XFS, OCFS2).
  * Upon success, return 0.  Otherwise, return -1 and set errno.
  */
-#if HAVE_LINUX_BTRFS_H
+#if defined(__linux__) && defined(FICLONE)
+static inline int
+reflinkCloneFile(int dest_fd, int src_fd)
+{
+    return ioctl(dest_fd, FICLONE, src_fd);
+}
+#elif HAVE_LINUX_BTRFS_H
 static inline int
-btrfsCloneFile(int dest_fd, int src_fd)
+reflinkCloneFile(int dest_fd, int src_fd)
 {
     return ioctl(dest_fd, BTRFS_IOC_CLONE, src_fd);
 }
 #else
 static inline int
-btrfsCloneFile(int dest_fd ATTRIBUTE_UNUSED,
-               int src_fd ATTRIBUTE_UNUSED)
+reflinkCloneFile(int dest_fd ATTRIBUTE_UNUSED,
+                 int src_fd ATTRIBUTE_UNUSED)
 {
     errno = ENOTSUP;
     return -1;
 }
 #endif
 
+
+/*
+ * Copy up to @len bytes in the kernel, without bouncing them through
+ * userspace. Filesystems may share the extents instead of copying.
+ * Returns the number of bytes copied, or -1 with errno set.
+ */
+#if HAVE_SYS_SYSCALL_H && defined(SYS_copy_file_range)
+static ssize_t
+storageBackendCopyFileRange(int src_fd, off_t *src_off,
+                            int dest_fd, off_t *dest_off,
+                            size_t len)
+{
+    loff_t in = *src_off;
+    loff_t out = *dest_off;
+    ssize_t ret;
+
+    if ((ret = syscall(SYS_copy_file_range, src_fd, &in,
+                       dest_fd, &out, len, 0)) > 0) {
+        *src_off = in;
+        *dest_off = out;
+    }
+
+    return ret;
+}
+#else
+static ssize_t
+storageBackendCopyFileRange(int src_fd ATTRIBUTE_UNUSED,
+                            off_t *src_off ATTRIBUTE_UNUSED,
+                            int dest_fd ATTRIBUTE_UNUSED,
+                            off_t *dest_off ATTRIBUTE_UNUSED,
+                            size_t len ATTRIBUTE_UNUSED)
+{
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+
+/*
+ * Returns true if all @len bytes of @buf are zero. After checking the
+ * first 16 bytes, the buffer is compared with itself shifted by 16
+ * bytes, which lets memcmp use its vectorized implementation without
+ * the need for a separate buffer of zeroes.
+ */
+static bool
+storageBackendBufferIsZero(const char *buf,
+                           size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len && i < 16; i++) {
+        if (buf[i])
+            return false;
+    }
+
+    if (len <= 16)
+        return true;
+
+    return memcmp(buf, buf + 16, len - 16) == 0;
+}
+
+
+/*
+ * Find the first data extent of @fd at or after @offset and before
+ * @end. On return [@data, @hole) is the extent, or @data == @end if
+ * there's no more data. If the file doesn't support SEEK_DATA, the
+ * whole remaining range is treated as data.
+ *
+ * Returns 0 on success, -1 with errno set on error.
+ */
+static int
+storageBackendFindData(int fd,
+                       off_t offset,
+                       off_t end,
+                       off_t *data,
+                       off_t *hole)
+{
+    *data = offset;
+    *hole = end;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if ((*data = lseek(fd, offset, SEEK_DATA)) < 0) {
+        if (errno == ENXIO) {
+            /* in a trailing hole */
+            *data = end;
+            return 0;
+        }
+        if (errno == EINVAL || errno == ENOTSUP || errno == ENOSYS) {
+            *data = offset;
+            return 0;
+        }
+        return -1;
+    }
+
+    if (*data >= end) {
+        *data = end;
+        return 0;
+    }
+
+    if ((*hole = lseek(fd, *data, SEEK_HOLE)) < 0)
+        return -1;
+
+    if (*hole > end)
+        *hole = end;
+#endif
+
+    return 0;
+}
+
+
+/*
+ * Copy @len bytes at @src_off in @inputfd to @dest_off in @fd. If
+ * @kernel_copy is set, the kernel copy is tried first and disabled
+ * through @kernel_copy once it turns out to be unsupported for this pair
+ * of files. Otherwise the data is read into @buf and written in blocks of
+ * @wbytes, skipping blocks of zeroes if @want_sparse.
+ *
+ * Returns 0 on success, -errno on error.
+ */
+static int
+storageBackendCopyRange(virStorageVolDefPtr vol,
+                        virStorageVolDefPtr inputvol,
+                        int inputfd,
+                        int fd,
+                        off_t src_off,
+                        off_t dest_off,
+                        off_t len,
+                        char *buf,
+                        size_t rbytes,
+                        size_t wbytes,
+                        bool want_sparse,
+                        bool *kernel_copy)
+{
+    while (len > 0 && *kernel_copy) {
+        ssize_t copied = storageBackendCopyFileRange(inputfd, &src_off,
+                                                     fd, &dest_off,
+                                                     MIN(len, SSIZE_MAX));
+
+        if (copied > 0) {
+            len -= copied;
+            continue;
+        }
+
+        if (copied < 0 && errno == EINTR)
+            continue;
+
+        if (copied == 0 || errno == ENOSYS || errno == EXDEV ||
+            errno == EINVAL || errno == EOPNOTSUPP || errno == ENOTSUP ||
+            errno == EBADF) {
+            VIR_DEBUG("Kernel copy from '%s' to '%s' unavailable, "
+                      "copying through userspace",
+                      inputvol->target.path, vol->target.path);
+            *kernel_copy = false;
+            break;
+        }
+
+        virReportSystemError(errno,
+                             _("failed copying from '%s' to '%s'"),
+                             inputvol->target.path, vol->target.path);
+        return -errno;
+    }
+
+    if (len == 0)
+        return 0;
+
+    if (lseek(inputfd, src_off, SEEK_SET) < 0) {
+        virReportSystemError(errno,
+                             _("cannot seek in file '%s'"),
+                             inputvol->target.path);
+        return -errno;
+    }
+
+    while (len > 0) {
+        ssize_t amtread;
+        size_t offset;
+
+        if ((amtread = saferead(inputfd, buf, MIN(len, rbytes))) <= 0) {
+            if (amtread == 0)
+                errno = EIO;
+            virReportSystemError(errno,
+                                 _("failed reading from file '%s'"),
+                                 inputvol->target.path);
+            return -errno;
+        }
+
+        for (offset = 0; offset < (size_t) amtread; offset += wbytes) {
+            size_t interval = MIN(wbytes, amtread - offset);
+
+            if (want_sparse &&
+                storageBackendBufferIsZero(buf + offset, interval))
+                continue;
+
+            if (lseek(fd, dest_off + offset, SEEK_SET) < 0 ||
+                safewrite(fd, buf + offset, interval) < 0) {
+                virReportSystemError(errno,
+                                     _("failed writing to file '%s'"),
+                                     vol->target.path);
+                return -errno;
+            }
+        }
+
+        src_off += amtread;
+        dest_off += amtread;
+        len -= amtread;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Copy the contents of @inputvol to @fd starting at its current
+ * position, up to *@total bytes, and decrease *@total by the amount
+ * copied. Only the data extents of @inputvol are copied; holes are
+ * skipped if @want_sparse, and filled with zeroes otherwise. Without
+ * @want_sparse the extents are copied in the kernel where possible.
+ * copy_file_range() would allocate the blocks of zeroes inside the
+ * extents on filesystems which can't share them, so sparse copies skip
+ * those blocks in userspace instead. With @reflink_copy the whole file
+ * is cloned.
+ *
+ * Returns 0 on success, -errno on error.
+ */
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -105,14 +341,15 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           bool reflink_copy)
 {
     int inputfd = -1;
-    int amtread = -1;
     int ret = 0;
     size_t rbytes = READ_BLOCK_SIZE_DEFAULT;
     int wbytes = 0;
-    int interval;
-    char *zerobuf = NULL;
     char *buf = NULL;
     struct stat st;
+    bool kernel_copy = !want_sparse;
+    off_t dest_start;
+    off_t end;
+    off_t pos;
 
     if ((inputfd = open(inputvol->target.path, O_RDONLY)) < 0) {
         ret = -errno;
@@ -131,68 +368,86 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     if (wbytes < WRITE_BLOCK_SIZE_DEFAULT)
         wbytes = WRITE_BLOCK_SIZE_DEFAULT;
 
-    if (VIR_ALLOC_N(zerobuf, wbytes) < 0) {
+    if (VIR_ALLOC_N(buf, rbytes) < 0) {
         ret = -errno;
         goto cleanup;
     }
 
-    if (VIR_ALLOC_N(buf, rbytes) < 0) {
+    if ((end = lseek(inputfd, 0, SEEK_END)) < 0 ||
+        (dest_start = lseek(fd, 0, SEEK_CUR)) < 0) {
         ret = -errno;
+        virReportSystemError(errno, "%s",
+                             _("cannot determine copy range"));
         goto cleanup;
     }
+    if ((unsigned long long) end > *total)
+        end = *total;
 
     if (reflink_copy) {
-        if (btrfsCloneFile(fd, inputfd) < 0) {
+        if (reflinkCloneFile(fd, inputfd) < 0) {
             ret = -errno;
             virReportSystemError(errno,
                                  _("failed to clone files from '%s'"),
                                  inputvol->target.path);
             goto cleanup;
         } else {
-            VIR_DEBUG("btrfs clone finished.");
+            VIR_DEBUG("reflink clone finished.");
+            *total -= end;
             goto cleanup;
         }
     }
 
-    while (amtread != 0) {
-        int amtleft;
-
-        if (*total < rbytes)
-            rbytes = *total;
+    for (pos = 0; pos < end;) {
+        off_t data;
+        off_t hole;
 
-        if ((amtread = saferead(inputfd, buf, rbytes)) < 0) {
+        if (storageBackendFindData(inputfd, pos, end, &data, &hole) < 0) {
             ret = -errno;
             virReportSystemError(errno,
-                                 _("failed reading from file '%s'"),
+                                 _("cannot find data in file '%s'"),
                                  inputvol->target.path);
             goto cleanup;
         }
-        *total -= amtread;
 
-        /* Loop over amt read in 512 byte increments, looking for sparse
-         * blocks */
-        amtleft = amtread;
-        do {
-            interval = ((wbytes > amtleft) ? amtleft : wbytes);
-            int offset = amtread - amtleft;
+        /* Unless the target is sparse, the hole has to be written */
+        if (data > pos && !want_sparse) {
+            memset(buf, 0, rbytes);
+            while (pos < data) {
+                size_t len = MIN(data - pos, rbytes);
 
-            if (want_sparse && memcmp(buf+offset, zerobuf, interval) == 0) {
-                if (lseek(fd, interval, SEEK_CUR) < 0) {
+                if (lseek(fd, dest_start + pos, SEEK_SET) < 0 ||
+                    safewrite(fd, buf, len) < 0) {
                     ret = -errno;
                     virReportSystemError(errno,
-                                         _("cannot extend file '%s'"),
+                                         _("failed writing to file '%s'"),
                                          vol->target.path);
                     goto cleanup;
                 }
-            } else if (safewrite(fd, buf+offset, interval) < 0) {
-                ret = -errno;
-                virReportSystemError(errno,
-                                     _("failed writing to file '%s'"),
-                                     vol->target.path);
-                goto cleanup;
-
+                pos += len;
             }
-        } while ((amtleft -= interval) > 0);
+        }
+        pos = data;
+
+        if (pos == end)
+            break;
+
+        if ((ret = storageBackendCopyRange(vol, inputvol, inputfd, fd,
+                                           pos, dest_start + pos, hole - pos,
+                                           buf, rbytes, wbytes, want_sparse,
+                                           &kernel_copy)) < 0)
+            goto cleanup;
+
+        pos = hole;
+    }
+
+    *total -= end;
+
+    if (lseek(fd, dest_start + end, SEEK_SET) < 0) {
+        ret = -errno;
+        virReportSystemError(errno,
+                             _("cannot extend file '%s'"),
+                             vol->target.path);
+        goto cleanup;
     }
 
     if (fdatasync(fd) < 0) {
@@ -215,7 +470,6 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
  cleanup:
     VIR_FORCE_CLOSE(inputfd);
 
-    VIR_FREE(zerobuf);
     VIR_FREE(buf);
 
     return ret;
@@ -2514,21 +2768,302 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
+/* Size of the chunks handed out to the threads writing zeroes */
+#define VIR_STORAGE_WIPE_CHUNK (4 * 1024 * 1024)
+
+/* Upper bound on the number of threads writing zeroes */
+#define VIR_STORAGE_WIPE_WORKERS 4
+
+/* Alignment required for writing with O_DIRECT */
+#define VIR_STORAGE_WIPE_ALIGN 4096
+
+typedef struct _storageBackendWipeData storageBackendWipeData;
+typedef storageBackendWipeData *storageBackendWipeDataPtr;
+struct _storageBackendWipeData {
+    const char *path;
+    unsigned long long start;
+    unsigned long long end;
+    size_t chunk;
+    bool direct;
+
+    virMutex lock;
+    unsigned long long next; /* start of the next chunk to write */
+    unsigned long long done; /* number of bytes written so far */
+    unsigned int percent;    /* last progress reported */
+    int err;                 /* errno of the first failed write */
+    unsigned long long errpos;
+};
+
+typedef struct _storageBackendWipeWorker storageBackendWipeWorker;
+typedef storageBackendWipeWorker *storageBackendWipeWorkerPtr;
+struct _storageBackendWipeWorker {
+    virThread thread;
+    int fd;
+    storageBackendWipeDataPtr data;
+};
+
+
+/*
+ * Let the kernel zero @len bytes of @fd starting at @start: block
+ * devices are discarded if discarded blocks are known to read back as
+ * zeroes, or zeroed with BLKZEROOUT otherwise, files get the range
+ * converted to unwritten extents or punched out. A punched out range of
+ * a fully allocated file is allocated again.
+ *
+ * Returns true if the range was zeroed, false if the caller has to
+ * write the zeroes itself.
+ */
+static bool
+storageBackendWipeOffload(const char *path ATTRIBUTE_UNUSED,
+                          int fd ATTRIBUTE_UNUSED,
+                          const struct stat *st ATTRIBUTE_UNUSED,
+                          unsigned long long start ATTRIBUTE_UNUSED,
+                          unsigned long long len ATTRIBUTE_UNUSED)
+{
+#if defined(__linux__) && defined(BLKZEROOUT)
+    if (S_ISBLK(st->st_mode)) {
+        uint64_t range[2] = { start, len };
+        char ebuf[1024];
+
+        /* The ioctls only work on whole sectors */
+        if (start % 512 || len % 512)
+            return false;
+
+# if defined(BLKDISCARD) && defined(BLKDISCARDZEROES)
+        {
+            unsigned int zeroes = 0;
+
+            if (ioctl(fd, BLKDISCARDZEROES, &zeroes) == 0 && zeroes &&
+                ioctl(fd, BLKDISCARD, range) == 0) {
+                VIR_DEBUG("Discarded %llu bytes of '%s'", len, path);
+                return true;
+            }
+        }
+# endif
+
+        if (ioctl(fd, BLKZEROOUT, range) == 0) {
+            VIR_DEBUG("Zeroed out %llu bytes of '%s'", len, path);
+            return true;
+        }
+
+        VIR_DEBUG("Cannot zero out '%s', writing zeroes: %s",
+                  path, virStrerror(errno, ebuf, sizeof(ebuf)));
+        return false;
+    }
+#endif
+
+#if HAVE_FALLOCATE - 0
+    if (S_ISREG(st->st_mode)) {
+        char ebuf[1024];
+
+# ifdef FALLOC_FL_ZERO_RANGE
+        if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                      start, len) == 0) {
+            VIR_DEBUG("Zeroed range of %llu bytes of '%s'", len, path);
+            return true;
+        }
+# endif
+# ifdef FALLOC_FL_PUNCH_HOLE
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      start, len) == 0) {
+            /* Don't turn a preallocated volume into a sparse one */
+            if ((unsigned long long) st->st_blocks * 512 <
+                (unsigned long long) st->st_size) {
+                VIR_DEBUG("Punched hole of %llu bytes in '%s'", len, path);
+                return true;
+            }
+            if (fallocate(fd, FALLOC_FL_KEEP_SIZE, start, len) == 0) {
+                VIR_DEBUG("Punched and reallocated %llu bytes of '%s'",
+                          len, path);
+                return true;
+            }
+        }
+# endif
+        VIR_DEBUG("Cannot deallocate range of '%s', writing zeroes: %s",
+                  path, virStrerror(errno, ebuf, sizeof(ebuf)));
+    }
+#endif
+
+    return false;
+}
+
+
+static void
+storageBackendWipeWorkerRun(void *opaque)
+{
+    storageBackendWipeWorkerPtr worker = opaque;
+    storageBackendWipeDataPtr data = worker->data;
+    char *buf = NULL;
+    unsigned long long pos;
+    size_t len;
+    int err = 0;
+
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign((void **) &buf, VIR_STORAGE_WIPE_ALIGN, data->chunk) != 0)
+        buf = NULL;
+    else
+        memset(buf, 0, data->chunk);
+#else
+    ignore_value(VIR_ALLOC_N_QUIET(buf, data->chunk));
+#endif
+
+    for (;;) {
+        virMutexLock(&data->lock);
+        if (!buf && !data->err) {
+            data->err = ENOMEM;
+            data->errpos = data->next;
+        }
+        if (data->err || data->next >= data->end) {
+            virMutexUnlock(&data->lock);
+            break;
+        }
+        pos = data->next;
+        len = MIN(data->chunk, data->end - pos);
+        data->next += len;
+        virMutexUnlock(&data->lock);
+
+        if (lseek(worker->fd, pos, SEEK_SET) < 0 ||
+            safewrite(worker->fd, buf, len) < 0)
+            err = errno;
+
+        virMutexLock(&data->lock);
+        if (err) {
+            if (!data->err) {
+                data->err = err;
+                data->errpos = pos;
+            }
+        } else {
+            unsigned int percent;
+
+            data->done += len;
+            percent = data->done * 100 / (data->end - data->start);
+            if (percent / 10 > data->percent / 10) {
+                VIR_DEBUG("Wiped %llu of %llu bytes of '%s'",
+                          data->done, data->end - data->start, data->path);
+                data->percent = percent;
+            }
+        }
+        virMutexUnlock(&data->lock);
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/*
+ * Write zeroes over @len bytes of @path starting at @start with up to
+ * VIR_STORAGE_WIPE_WORKERS threads, each writing whole chunks through
+ * its own file descriptor. Page cache is bypassed if the range is
+ * suitably aligned and @path supports it, so that wiping large volumes
+ * doesn't evict everybody else's data and the number of writes in
+ * flight stays bounded by the number of threads.
+ */
+static int
+storageBackendWipeWrite(const char *path,
+                        unsigned long long start,
+                        unsigned long long len)
+{
+    storageBackendWipeData data;
+    storageBackendWipeWorkerPtr workers = NULL;
+    size_t nworkers;
+    size_t nthreads = 0;
+    size_t i;
+    char ebuf[1024];
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    data.path = path;
+    data.start = start;
+    data.end = start + len;
+    data.next = start;
+    data.chunk = VIR_STORAGE_WIPE_CHUNK;
+#if HAVE_POSIX_MEMALIGN
+    data.direct = O_DIRECT &&
+        start % VIR_STORAGE_WIPE_ALIGN == 0 &&
+        len % VIR_STORAGE_WIPE_ALIGN == 0;
+#endif
+
+    if (len == 0)
+        return 0;
+
+    if (virMutexInit(&data.lock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("cannot initialize mutex"));
+        return -1;
+    }
+
+    nworkers = MIN(VIR_STORAGE_WIPE_WORKERS, VIR_DIV_UP(len, data.chunk));
+    if (VIR_ALLOC_N(workers, nworkers) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nworkers; i++)
+        workers[i].fd = -1;
+
+    for (i = 0; i < nworkers; i++) {
+        workers[i].data = &data;
+
+        if (data.direct &&
+            (workers[i].fd = open(path, O_WRONLY | O_DIRECT)) < 0) {
+            VIR_DEBUG("Cannot open '%s' with O_DIRECT: %s",
+                      path, virStrerror(errno, ebuf, sizeof(ebuf)));
+            data.direct = false;
+        }
+
+        if (workers[i].fd < 0 &&
+            (workers[i].fd = open(path, O_WRONLY)) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to open storage volume with path '%s'"),
+                                 path);
+            goto cleanup;
+        }
+    }
+
+    VIR_DEBUG("Writing zeroes over %llu bytes of '%s' with %zu threads%s",
+              len, path, nworkers, data.direct ? " bypassing page cache" : "");
+
+    /* The calling thread does the work of the last one */
+    for (i = 0; i + 1 < nworkers; i++) {
+        if (virThreadCreate(&workers[i].thread, true,
+                            storageBackendWipeWorkerRun, &workers[i]) < 0) {
+            VIR_WARN("Failed to start wipe thread: %s",
+                     virStrerror(errno, ebuf, sizeof(ebuf)));
+            break;
+        }
+        nthreads++;
+    }
+
+    storageBackendWipeWorkerRun(&workers[nworkers - 1]);
+
+    for (i = 0; i < nthreads; i++)
+        virThreadJoin(&workers[i].thread);
+
+    if (data.err) {
+        virReportSystemError(data.err,
+                             _("Failed to write zeroes at offset %llu of "
+                               "storage volume with path '%s'"),
+                             data.errpos, path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; workers && i < nworkers; i++)
+        VIR_FORCE_CLOSE(workers[i].fd);
+    VIR_FREE(workers);
+    virMutexDestroy(&data.lock);
+    return ret;
+}
+
+
 static int
 storageBackendWipeLocal(const char *path,
                         int fd,
+                        const struct stat *st,
                         unsigned long long wipe_len,
-                        size_t writebuf_length,
                         bool zero_end)
 {
-    int ret = -1, written = 0;
-    unsigned long long remaining = 0;
     off_t size;
-    size_t write_size = 0;
-    char *writebuf = NULL;
-
-    if (VIR_ALLOC_N(writebuf, writebuf_length) < 0)
-        goto cleanup;
 
     if (!zero_end) {
         if ((size = lseek(fd, 0, SEEK_SET)) < 0) {
@@ -2536,7 +3071,7 @@ storageBackendWipeLocal(const char *path,
                                  _("Failed to seek to the start in volume "
                                    "with path '%s'"),
                                  path);
-            goto cleanup;
+            return -1;
         }
     } else {
         if ((size = lseek(fd, -wipe_len, SEEK_END)) < 0) {
@@ -2544,43 +3079,26 @@ storageBackendWipeLocal(const char *path,
                                  _("Failed to seek to %llu bytes to the end "
                                    "in volume with path '%s'"),
                                  wipe_len, path);
-            goto cleanup;
+            return -1;
         }
     }
 
     VIR_DEBUG("wiping start: %zd len: %llu", (ssize_t) size, wipe_len);
 
-    remaining = wipe_len;
-    while (remaining > 0) {
-
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, path);
-
-            goto cleanup;
-        }
-
-        remaining -= written;
-    }
+    if (!storageBackendWipeOffload(path, fd, st, size, wipe_len) &&
+        storageBackendWipeWrite(path, size, wipe_len) < 0)
+        return -1;
 
     if (fdatasync(fd) < 0) {
         virReportSystemError(errno,
                              _("cannot sync data to volume with path '%s'"),
                              path);
-        goto cleanup;
+        return -1;
     }
 
-    VIR_DEBUG("Wrote %llu bytes to volume with path '%s'", wipe_len, path);
+    VIR_DEBUG("Wiped %llu bytes of volume with path '%s'", wipe_len, path);
 
-    ret = 0;
-
- cleanup:
-    VIR_FREE(writebuf);
-    return ret;
+    return 0;
 }
 
 
@@ -2663,7 +3181,7 @@ storageBackendVolWipeLocalFile(const char *path,
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = storageBackendVolZeroSparseFileLocal(path, st.st_size, fd);
         } else {
-            ret = storageBackendWipeLocal(path, fd, allocation, st.st_blksize,
+            ret = storageBackendWipeLocal(path, fd, &st, allocation,
                                           zero_end);
         }
         if (ret < 0)
@@ -3403,6 +3921,7 @@ storageBackendProbeTarget(virStorageSourcePtr target,
                           virStorageEncryptionPtr *encryption)
 {
     int backingStoreFormat;
+    bool backingStoreFaked = false;
     int fd = -1;
     int ret = -1;
     int rc;
@@ -3468,6 +3987,7 @@ storageBackendProbeTarget(virStorageSourcePtr target,
                  * disable the whole storage pool, making it unavailable for
                  * even maintenance. */
                 target->backingStore->format = VIR_STORAGE_FILE_RAW;
+                backingStoreFaked = true;
                 virReportError(VIR_ERR_INTERNAL_ERROR,
                                _("cannot probe backing volume format: %s"),
                                target->backingStore->path);
@@ -3479,8 +3999,9 @@ storageBackendProbeTarget(virStorageSourcePtr target,
 
     target->format = meta->format;
 
-    /* Default to success below this point */
-    ret = 0;
+    /* Default to success below this point, but let the caller know
+     * the format of the backing store was made up */
+    ret = backingStoreFaked ? -3 : 0;
 
     if (meta->capacity)
         target->capacity = meta->capacity;
@@ -3516,9 +4037,207 @@ storageBackendProbeTarget(virStorageSourcePtr target,
 }
 
 
+/* Upper bound on the number of threads probing volume headers
+ * during a refresh of a local pool */
+#define VIR_STORAGE_BACKEND_LOCAL_PROBE_WORKERS 8
+
+/* Probe results of a regular file in a local pool, reused by the
+ * next refresh if the file wasn't touched in the meantime */
+typedef struct _virStorageBackendLocalCacheEntry virStorageBackendLocalCacheEntry;
+typedef virStorageBackendLocalCacheEntry *virStorageBackendLocalCacheEntryPtr;
+struct _virStorageBackendLocalCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+
+    int type; /* virStorageVolType */
+    virStorageSourcePtr target;
+};
+
+typedef struct _virStorageBackendLocalVol virStorageBackendLocalVol;
+typedef virStorageBackendLocalVol *virStorageBackendLocalVolPtr;
+struct _virStorageBackendLocalVol {
+    virStorageVolDefPtr def;
+    struct stat sb;
+    bool cacheable; /* @sb is valid and describes a regular file */
+    bool probe;     /* @def wasn't filled in from the cache */
+
+    /* Outcome of storageBackendProbeTarget */
+    int rc;
+    virErrorPtr err;
+};
+
+static void
+virStorageBackendLocalCacheEntryFree(void *payload,
+                                     const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageBackendLocalCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+
+    virStorageSourceFree(entry->target);
+    VIR_FREE(entry);
+}
+
+
+static void
+virStorageBackendLocalCacheFree(void *opaque)
+{
+    virHashFree(opaque);
+}
+
+
+static bool
+virStorageBackendLocalCacheEntryMatch(virStorageBackendLocalCacheEntryPtr entry,
+                                      virStorageVolDefPtr vol,
+                                      const struct stat *sb)
+{
+    struct timespec mtime = get_stat_mtime(sb);
+    struct timespec ctime = get_stat_ctime(sb);
+
+    return entry->dev == sb->st_dev &&
+        entry->ino == sb->st_ino &&
+        entry->size == sb->st_size &&
+        entry->mtime.tv_sec == mtime.tv_sec &&
+        entry->mtime.tv_nsec == mtime.tv_nsec &&
+        entry->ctime.tv_sec == ctime.tv_sec &&
+        entry->ctime.tv_nsec == ctime.tv_nsec &&
+        STREQ_NULLABLE(entry->target->path, vol->target.path);
+}
+
+
+static virStorageBackendLocalCacheEntryPtr
+virStorageBackendLocalCacheEntryNew(virStorageVolDefPtr vol,
+                                    const struct stat *sb)
+{
+    virStorageBackendLocalCacheEntryPtr entry;
+
+    if (VIR_ALLOC(entry) < 0)
+        return NULL;
+
+    if (!(entry->target = virStorageSourceCopy(&vol->target, true))) {
+        VIR_FREE(entry);
+        return NULL;
+    }
+
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->size = sb->st_size;
+    entry->mtime = get_stat_mtime(sb);
+    entry->ctime = get_stat_ctime(sb);
+    entry->type = vol->type;
+
+    return entry;
+}
+
+
+/* Fills in @vol from @entry. Returns 0 on success, -1 on error. */
+static int
+virStorageBackendLocalCacheEntryApply(virStorageBackendLocalCacheEntryPtr entry,
+                                      virStorageVolDefPtr vol)
+{
+    virStorageSourcePtr target;
+
+    if (!(target = virStorageSourceCopy(entry->target, true)))
+        return -1;
+
+    virStorageSourceClear(&vol->target);
+    vol->target = *target;
+    VIR_FREE(target);
+    vol->type = entry->type;
+
+    return 0;
+}
+
+
+static void
+virStorageBackendLocalProbeVol(virStorageBackendLocalVolPtr item)
+{
+    virStorageVolDefPtr vol = item->def;
+
+    item->rc = storageBackendProbeTarget(&vol->target,
+                                         &vol->target.encryption);
+    if (item->rc == -2)
+        return;
+
+    if (item->rc < 0 && item->rc != -3) {
+        item->err = virSaveLastError();
+        return;
+    }
+
+    /* On -3 the backing file is currently unavailable, its format is not
+     * explicitly specified, the probe to auto detect the format failed:
+     * continue with faked RAW format, since AUTO will break
+     * virStorageVolTargetDefFormat() generating the line
+     * <format type='...'/>. */
+
+    /* directory based volume */
+    if (vol->target.format == VIR_STORAGE_FILE_DIR)
+        vol->type = VIR_STORAGE_VOL_DIR;
+
+    if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
+        vol->type = VIR_STORAGE_VOL_PLOOP;
+
+    if (vol->target.backingStore) {
+        ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
+                                                       vol->target.backingStore,
+                                                       false,
+                                                       VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
+        /* If this failed, the backing file is currently unavailable,
+         * the capacity, allocation, owner, group and mode are unknown.
+         * An error message was raised, but we just continue. */
+    }
+}
+
+
+static void
+virStorageBackendLocalProbeWorker(size_t idx,
+                                  void *opaque)
+{
+    virStorageBackendLocalVolPtr items = opaque;
+
+    if (!items[idx].probe)
+        return;
+
+    virStorageBackendLocalProbeVol(&items[idx]);
+    virResetLastError();
+}
+
+
+/* Probes the headers of all @items that weren't filled in from the
+ * cache, using up to VIR_STORAGE_BACKEND_LOCAL_PROBE_WORKERS threads */
+static void
+virStorageBackendLocalProbeVols(virStorageBackendLocalVolPtr items,
+                                size_t nitems)
+{
+    size_t nprobe = 0;
+    size_t i;
+
+    for (i = 0; i < nitems; i++) {
+        if (items[i].probe)
+            nprobe++;
+    }
+
+    if (nprobe == 0)
+        return;
+
+    virThreadPoolRunBatch(NULL,
+                          MIN(nprobe, VIR_STORAGE_BACKEND_LOCAL_PROBE_WORKERS),
+                          nitems, virStorageBackendLocalProbeWorker, items);
+}
+
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * Regular files whose device, inode, size, mtime and ctime didn't
+ * change since the previous refresh are filled in from the results
+ * of that refresh; the headers of all other files are probed in
+ * parallel.
  */
 int
 virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
@@ -3530,6 +4249,12 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     struct stat statbuf;
     virStorageVolDefPtr vol = NULL;
     virStorageSourcePtr target = NULL;
+    virHashTablePtr cache = pool->privateData;
+    virHashTablePtr newcache = NULL;
+    virStorageBackendLocalVolPtr items = NULL;
+    size_t nitems = 0;
+    size_t nhits = 0;
+    size_t i;
     int direrr;
     int fd = -1, ret = -1;
 
@@ -3537,7 +4262,8 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         goto cleanup;
 
     while ((direrr = virDirRead(dir, &ent, pool->def->target.path)) > 0) {
-        int err;
+        virStorageBackendLocalVol item;
+        virStorageBackendLocalCacheEntryPtr entry;
 
         if (virStringHasControlChars(ent->d_name)) {
             VIR_WARN("Ignoring file with control characters under '%s'",
@@ -3545,6 +4271,8 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
             continue;
         }
 
+        memset(&item, 0, sizeof(item));
+
         if (VIR_ALLOC(vol) < 0)
             goto cleanup;
 
@@ -3561,49 +4289,86 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
         if (VIR_STRDUP(vol->key, vol->target.path) < 0)
             goto cleanup;
 
-        if ((err = storageBackendProbeTarget(&vol->target,
-                                             &vol->target.encryption)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (err == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-            } else {
+        item.cacheable = stat(vol->target.path, &item.sb) == 0 &&
+            S_ISREG(item.sb.st_mode);
+        item.probe = true;
+
+        if (item.cacheable && cache &&
+            (entry = virHashLookup(cache, vol->name)) &&
+            virStorageBackendLocalCacheEntryMatch(entry, vol, &item.sb)) {
+            if (virStorageBackendLocalCacheEntryApply(entry, vol) < 0)
                 goto cleanup;
+            item.probe = false;
+            nhits++;
+
+            /* Only the header of the volume itself is known to be
+             * unchanged, the cached capacity and allocation of its
+             * backing file may be stale */
+            if (vol->target.backingStore) {
+                ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
+                                                               vol->target.backingStore,
+                                                               false,
+                                                               VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
+                virResetLastError();
             }
         }
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (vol->target.format == VIR_STORAGE_FILE_PLOOP)
-            vol->type = VIR_STORAGE_VOL_PLOOP;
-
-        if (vol->target.backingStore) {
-            ignore_value(storageBackendUpdateVolTargetInfo(VIR_STORAGE_VOL_FILE,
-                                                           vol->target.backingStore,
-                                                           false,
-                                                           VIR_STORAGE_VOL_OPEN_DEFAULT, 0));
-            /* If this failed, the backing file is currently unavailable,
-             * the capacity, allocation, owner, group and mode are unknown.
-             * An error message was raised, but we just continue. */
-        }
-
-        if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
+        item.def = vol;
+        if (VIR_APPEND_ELEMENT(items, nitems, item) < 0)
             goto cleanup;
+        vol = NULL;
     }
     if (direrr < 0)
         goto cleanup;
     VIR_DIR_CLOSE(dir);
-    vol = NULL;
+
+    virStorageBackendLocalProbeVols(items, nitems);
+
+    VIR_DEBUG("Refreshed %zu volumes of pool '%s', %zu unchanged",
+              nitems, pool->def->name, nhits);
+
+    if (!(newcache = virHashCreate(nitems + 1,
+                                   virStorageBackendLocalCacheEntryFree)))
+        goto cleanup;
+
+    for (i = 0; i < nitems; i++) {
+        virStorageBackendLocalVolPtr item = &items[i];
+
+        if (item->probe && item->rc == -2) {
+            /* Silently ignore non-regular files,
+             * eg 'lost+found', dangling symbolic link */
+            continue;
+        }
+
+        if (item->probe && item->rc < 0 && item->rc != -3) {
+            virSetError(item->err);
+            goto cleanup;
+        }
+
+        /* A probe returning -3 faked the format as the backing file
+         * was unavailable, don't keep that past the next refresh */
+        if (item->cacheable && (!item->probe || item->rc == 0)) {
+            virStorageBackendLocalCacheEntryPtr entry;
+
+            if (!(entry = virStorageBackendLocalCacheEntryNew(item->def,
+                                                              &item->sb)))
+                goto cleanup;
+
+            if (virHashAddEntry(newcache, item->def->name, entry) < 0) {
+                virStorageBackendLocalCacheEntryFree(entry, NULL);
+                goto cleanup;
+            }
+        }
+
+        if (virStoragePoolObjAddVol(pool, item->def) < 0)
+            goto cleanup;
+        item->def = NULL;
+    }
+
+    virHashFree(cache);
+    pool->privateData = newcache;
+    pool->privateDataFreeFunc = virStorageBackendLocalCacheFree;
+    newcache = NULL;
 
     if (VIR_ALLOC(target))
         goto cleanup;
@@ -3651,6 +4416,12 @@ virStorageBackendRefreshLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     VIR_DIR_CLOSE(dir);
     VIR_FORCE_CLOSE(fd);
     virStorageVolDefFree(vol);
+    for (i = 0; i < nitems; i++) {
+        virStorageVolDefFree(items[i].def);
+        virFreeError(items[i].err);
+    }
+    VIR_FREE(items);
+    virHashFree(newcache);
     virStorageSourceFree(target);
     if (ret < 0)
         virStoragePoolObjClearVols(pool);
@@ -3782,10 +4553,19 @@ virStorageBackendSCSINewLun(virStoragePoolObjPtr pool,
     if (!(vol->key = virStorageBackendSCSISerial(vol->target.path)))
         goto cleanup;
 
+    /* The same LUN reached through another path reports the same
+     * serial, only the first one found makes it into the pool */
+    if (virStorageVolDefFindByKey(pool, vol->key)) {
+        VIR_DEBUG("Skipping '%s', volume with key '%s' already exists",
+                  devpath, vol->key);
+        retval = -2;
+        goto cleanup;
+    }
+
     pool->def->capacity += vol->target.capacity;
     pool->def->allocation += vol->target.allocation;
 
-    if (VIR_APPEND_ELEMENT(pool->volumes.objs, pool->volumes.count, vol) < 0)
+    if (virStoragePoolObjAddVol(pool, vol) < 0)
         goto cleanup;
 
     vol = NULL;
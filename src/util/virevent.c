@@ -25,8 +25,10 @@
 
 #include "virevent.h"
 #include "vireventpoll.h"
+#include "vireventepoll.h"
 #include "virlog.h"
 #include "virerror.h"
+#include "virutil.h"
 
 #include <stdlib.h>
 
@@ -39,6 +41,9 @@ static virEventAddTimeoutFunc addTimeoutImpl;
 static virEventUpdateTimeoutFunc updateTimeoutImpl;
 static virEventRemoveTimeoutFunc removeTimeoutImpl;
 
+/* Iteration function of the registered default implementation */
+static int (*runOnceImpl)(void) = virEventPollRunOnce;
+
 
 /*****************************************************
  *
@@ -250,6 +255,12 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  * not have a need to integrate with an external event
  * loop impl.
  *
+ * On platforms supporting it, an implementation based on
+ * epoll() is used instead, whose per iteration cost does not
+ * grow with the number of registered file handles and timers.
+ * Setting the LIBVIRT_EVENT_IMPL environment variable to "poll"
+ * forces use of the poll() based implementation.
+ *
  * For proper event handling, it is important that the event implementation
  * is registered before a connection to the Hypervisor is opened.
  *
@@ -264,10 +275,32 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  */
 int virEventRegisterDefaultImpl(void)
 {
+    const char *impl = virGetEnvBlockSUID("LIBVIRT_EVENT_IMPL");
+
     VIR_DEBUG("registering default event implementation");
 
     virResetLastError();
 
+    if (virEventEpollAvailable() && STRNEQ_NULLABLE(impl, "poll")) {
+        if (virEventEpollInit() == 0) {
+            VIR_DEBUG("using epoll event implementation");
+            virEventRegisterImpl(
+                virEventEpollAddHandle,
+                virEventEpollUpdateHandle,
+                virEventEpollRemoveHandle,
+                virEventEpollAddTimeout,
+                virEventEpollUpdateTimeout,
+                virEventEpollRemoveTimeout
+                );
+            runOnceImpl = virEventEpollRunOnce;
+            return 0;
+        }
+
+        VIR_WARN("Unable to initialize epoll event implementation, "
+                 "falling back to poll: %s", virGetLastErrorMessage());
+        virResetLastError();
+    }
+
     if (virEventPollInit() < 0) {
         virDispatchError(NULL);
         return -1;
@@ -281,6 +314,7 @@ int virEventRegisterDefaultImpl(void)
         virEventPollUpdateTimeout,
         virEventPollRemoveTimeout
         );
+    runOnceImpl = virEventPollRunOnce;
 
     return 0;
 }
@@ -311,7 +345,7 @@ int virEventRunDefaultImpl(void)
     VIR_DEBUG("running default event implementation");
     virResetLastError();
 
-    if (virEventPollRunOnce() < 0) {
+    if (runOnceImpl() < 0) {
         virDispatchError(NULL);
         return -1;
     }
@@ -0,0 +1,1156 @@
+/*
+ * vireventepoll.c: epoll based event loop for monitoring file handles
+ *
+ * Copyright (C) 2007 Daniel P. Berrange
+ * Copyright (C) 2007-2017 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Unlike the poll() implementation, which rebuilds the pollfd array
+ * and scans every registration on each wakeup, this implementation
+ * keeps file handle registrations persistent in the kernel and keeps
+ * enabled timers in a binary min-heap ordered by expiry time. The
+ * cost of a wakeup is thus proportional to the number of ready file
+ * handles and expired timers, not to the number registered.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
+#include "virthread.h"
+#include "virlog.h"
+#include "vireventepoll.h"
+#include "viralloc.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "virutil.h"
+#include "virfile.h"
+#include "virerror.h"
+#include "virprobe.h"
+#include "virtime.h"
+
+#define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+VIR_LOG_INIT("util.eventepoll");
+
+#if HAVE_SYS_EPOLL_H
+
+/* Maximum number of ready file handles fetched by a single
+ * epoll_wait() call. Any further ready handles are level
+ * triggered and will be reported by the next iteration */
+# define EVENT_EPOLL_MAX_EVENTS 128
+
+/* Allocate extra slots for fd table and timer heap in this multiple */
+# define EVENT_ALLOC_EXTENT 10
+
+typedef struct _virEventEpollHandle virEventEpollHandle;
+typedef virEventEpollHandle *virEventEpollHandlePtr;
+
+typedef struct _virEventEpollTimeout virEventEpollTimeout;
+typedef virEventEpollTimeout *virEventEpollTimeoutPtr;
+
+typedef struct _virEventEpollFD virEventEpollFD;
+typedef virEventEpollFD *virEventEpollFDPtr;
+
+/* State for a single file handle being monitored */
+struct _virEventEpollHandle {
+    int watch;
+    int fd;
+    int events; /* virEventHandleType bitset */
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    virEventEpollHandlePtr next; /* next handle watching the same fd */
+    virEventEpollHandlePtr nextDeleted; /* next handle waiting for purge */
+};
+
+/* State for a single timer being generated */
+struct _virEventEpollTimeout {
+    int timer;
+    int frequency;
+    unsigned long long expiresAt;
+    virEventTimeoutCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    size_t heapIndex; /* only valid if inHeap is true */
+    bool inHeap;
+    virEventEpollTimeoutPtr nextDeleted; /* next timer waiting for purge */
+};
+
+/* State for a single file descriptor, shared by all of
+ * the handles watching it */
+struct _virEventEpollFD {
+    virEventEpollHandlePtr handles;
+    int events; /* native events registered with the kernel */
+    bool nonpollable; /* epoll refused the fd, eg regular file */
+};
+
+/* State for the main event loop */
+struct virEventEpollLoop {
+    virMutex lock;
+    int running;
+    virThread leader;
+    int wakeupfd[2];
+    int epollfd;
+
+    /* Indexed by file descriptor number */
+    size_t nfds;
+    virEventEpollFDPtr fds;
+    size_t nnonpollable;
+
+    virHashTablePtr handles; /* watch -> virEventEpollHandlePtr */
+    virEventEpollHandlePtr deletedHandles;
+
+    virHashTablePtr timeouts; /* timer -> virEventEpollTimeoutPtr */
+    virEventEpollTimeoutPtr deletedTimeouts;
+    size_t ntimeouts; /* registered timers, including those not yet purged */
+
+    /* Min-heap of enabled timers ordered by expiresAt */
+    size_t nheap;
+    size_t heapAlloc;
+    virEventEpollTimeoutPtr *heap;
+
+    /* Scratch space for collecting expired timers, sized like heap */
+    size_t expiredAlloc;
+    virEventEpollTimeoutPtr *expired;
+};
+
+/* Only have one event loop */
+static struct virEventEpollLoop eventLoop = { .epollfd = -1 };
+
+/* Unique ID for the next FD watch to be registered */
+static int nextWatch = 1;
+
+/* Unique ID for the next timer to be registered */
+static int nextTimer = 1;
+
+static int virEventEpollInterruptLocked(void);
+
+
+static int
+virEventEpollToNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        ret |= EPOLLIN;
+    if (events & VIR_EVENT_HANDLE_WRITABLE)
+        ret |= EPOLLOUT;
+    if (events & VIR_EVENT_HANDLE_ERROR)
+        ret |= EPOLLERR;
+    if (events & VIR_EVENT_HANDLE_HANGUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+
+static int
+virEventEpollFromNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= VIR_EVENT_HANDLE_READABLE;
+    if (events & EPOLLOUT)
+        ret |= VIR_EVENT_HANDLE_WRITABLE;
+    if (events & EPOLLERR)
+        ret |= VIR_EVENT_HANDLE_ERROR;
+    if (events & EPOLLHUP)
+        ret |= VIR_EVENT_HANDLE_HANGUP;
+    return ret;
+}
+
+
+static uint32_t
+virEventEpollIDCode(const void *name, uint32_t seed)
+{
+    int id = (int)(intptr_t)name;
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+
+
+static bool
+virEventEpollIDEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+
+
+static void *
+virEventEpollIDCopy(const void *name)
+{
+    return (void *)name;
+}
+
+
+/*
+ * Recompute the set of events wanted by all live handles
+ * watching @fd and push it to the kernel. If @force is true
+ * the kernel registration is refreshed even if the event set
+ * did not change, which covers the case where @fd was closed
+ * (dropping its registration) and the number reused.
+ */
+static int
+virEventEpollUpdateFDLocked(int fd, bool force)
+{
+    virEventEpollFDPtr ent = &eventLoop.fds[fd];
+    virEventEpollHandlePtr h;
+    struct epoll_event ev;
+    int events = 0;
+    int op;
+    int rc;
+
+    for (h = ent->handles; h; h = h->next) {
+        if (!h->deleted)
+            events |= h->events;
+    }
+    events = virEventEpollToNativeEvents(events);
+
+    if (ent->nonpollable) {
+        if (!ent->events && events)
+            eventLoop.nnonpollable++;
+        else if (ent->events && !events)
+            eventLoop.nnonpollable--;
+        ent->events = events;
+        return 0;
+    }
+
+    if (events == ent->events && !force)
+        return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+
+    if (events == 0) {
+        /* The fd may already be closed, in which case the kernel
+         * has dropped the registration for us */
+        if (ent->events &&
+            epoll_ctl(eventLoop.epollfd, EPOLL_CTL_DEL, fd, &ev) < 0)
+            EVENT_DEBUG("Ignoring failure to remove fd %d: %d", fd, errno);
+        ent->events = 0;
+        return 0;
+    }
+
+    op = ent->events && !force ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    rc = epoll_ctl(eventLoop.epollfd, op, fd, &ev);
+    if (rc < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+        rc = epoll_ctl(eventLoop.epollfd, EPOLL_CTL_ADD, fd, &ev);
+    else if (rc < 0 && op == EPOLL_CTL_ADD && errno == EEXIST)
+        rc = epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, fd, &ev);
+
+    if (rc < 0 && errno == EPERM) {
+        /* Regular files and directories can't be used with epoll,
+         * but poll() always reports them as ready, so emulate that */
+        EVENT_DEBUG("fd %d does not support epoll, treating as always ready",
+                    fd);
+        ent->nonpollable = true;
+        ent->events = events;
+        eventLoop.nnonpollable++;
+        return 0;
+    }
+
+    if (rc < 0) {
+        virReportSystemError(errno,
+                             _("Unable to update epoll events for fd %d"),
+                             fd);
+        return -1;
+    }
+
+    ent->events = events;
+    return 0;
+}
+
+
+/*
+ * Register a callback for monitoring file handle events.
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason handles are only ever appended to the
+ * per-fd list and never freed outside the cleanup pass.
+ * Appending also keeps the callbacks for one fd running in
+ * the order they were registered in, like with poll().
+ *
+ * The handle must be removed before @fd is closed. epoll
+ * tracks the open file rather than the fd number, so if a
+ * duplicate of @fd stays open, a closed @fd would keep its
+ * registration and report events under its old number.
+ */
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff)
+{
+    virEventEpollHandlePtr h = NULL;
+    virEventEpollHandlePtr live;
+    virEventEpollHandlePtr *tail;
+    virEventEpollFDPtr ent;
+    int watch = -1;
+
+    if (fd < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Invalid file descriptor %d"), fd);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (fd >= eventLoop.nfds) {
+        size_t want = fd + 1 - eventLoop.nfds;
+        EVENT_DEBUG("Used %zu fd slots, adding at least %zu more",
+                    eventLoop.nfds, want);
+        if (VIR_EXPAND_N(eventLoop.fds, eventLoop.nfds,
+                         MAX(want, EVENT_ALLOC_EXTENT)) < 0)
+            goto cleanup;
+    }
+
+    ent = &eventLoop.fds[fd];
+    for (live = ent->handles; live; live = live->next) {
+        if (!live->deleted)
+            break;
+    }
+
+    /* With no live handles left, the fd number may have been closed
+     * and reused since the handles were removed, so forget what was
+     * learned about the old file and let the forced update below
+     * retry EPOLL_CTL_ADD on the new one */
+    if (!live && ent->nonpollable) {
+        if (ent->events)
+            eventLoop.nnonpollable--;
+        ent->nonpollable = false;
+        ent->events = 0;
+    }
+
+    if (VIR_ALLOC(h) < 0)
+        goto cleanup;
+
+    h->watch = nextWatch;
+    h->fd = fd;
+    h->events = events;
+    h->cb = cb;
+    h->ff = ff;
+    h->opaque = opaque;
+
+    if (virHashAddEntry(eventLoop.handles,
+                        (void *)(intptr_t)h->watch, h) < 0)
+        goto cleanup;
+
+    tail = &ent->handles;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = h;
+
+    if (virEventEpollUpdateFDLocked(fd, true) < 0) {
+        *tail = NULL;
+        virHashRemoveEntry(eventLoop.handles, (void *)(intptr_t)h->watch);
+        goto cleanup;
+    }
+
+    watch = nextWatch++;
+    h = NULL;
+
+    virEventEpollInterruptLocked();
+
+    PROBE(EVENT_POLL_ADD_HANDLE,
+          "watch=%d fd=%d events=%d cb=%p opaque=%p ff=%p",
+          watch, fd, events, cb, opaque, ff);
+
+ cleanup:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(h);
+    return watch;
+}
+
+
+void virEventEpollUpdateHandle(int watch, int events)
+{
+    virEventEpollHandlePtr h;
+    PROBE(EVENT_POLL_UPDATE_HANDLE,
+          "watch=%d events=%d",
+          watch, events);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid update watch %d", watch);
+        return;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(h = virHashLookup(eventLoop.handles, (void *)(intptr_t)watch))) {
+        virMutexUnlock(&eventLoop.lock);
+        VIR_WARN("Got update for non-existent handle watch %d", watch);
+        return;
+    }
+
+    h->events = events;
+    if (virEventEpollUpdateFDLocked(h->fd, false) < 0)
+        VIR_WARN("Unable to update events for handle watch %d", watch);
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+}
+
+
+/*
+ * Unregister a callback from a file handle
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag on the handle.
+ * Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveHandle(int watch)
+{
+    virEventEpollHandlePtr h;
+    PROBE(EVENT_POLL_REMOVE_HANDLE,
+          "watch=%d",
+          watch);
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid remove watch %d", watch);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(h = virHashSteal(eventLoop.handles, (void *)(intptr_t)watch))) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+
+    EVENT_DEBUG("mark delete %d %d", h->watch, h->fd);
+    h->deleted = true;
+    h->nextDeleted = eventLoop.deletedHandles;
+    eventLoop.deletedHandles = h;
+    ignore_value(virEventEpollUpdateFDLocked(h->fd, false));
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+}
+
+
+static void
+virEventEpollHeapSwap(size_t a, size_t b)
+{
+    virEventEpollTimeoutPtr tmp = eventLoop.heap[a];
+
+    eventLoop.heap[a] = eventLoop.heap[b];
+    eventLoop.heap[b] = tmp;
+    eventLoop.heap[a]->heapIndex = a;
+    eventLoop.heap[b]->heapIndex = b;
+}
+
+
+static void
+virEventEpollHeapSiftUp(size_t idx)
+{
+    while (idx > 0) {
+        size_t parent = (idx - 1) / 2;
+
+        if (eventLoop.heap[parent]->expiresAt <= eventLoop.heap[idx]->expiresAt)
+            break;
+        virEventEpollHeapSwap(parent, idx);
+        idx = parent;
+    }
+}
+
+
+static void
+virEventEpollHeapSiftDown(size_t idx)
+{
+    while (true) {
+        size_t child = idx * 2 + 1;
+
+        if (child >= eventLoop.nheap)
+            break;
+        if (child + 1 < eventLoop.nheap &&
+            eventLoop.heap[child + 1]->expiresAt < eventLoop.heap[child]->expiresAt)
+            child++;
+        if (eventLoop.heap[idx]->expiresAt <= eventLoop.heap[child]->expiresAt)
+            break;
+        virEventEpollHeapSwap(idx, child);
+        idx = child;
+    }
+}
+
+
+/* The heap has room reserved for every registered timer,
+ * so inserting can never fail */
+static void
+virEventEpollHeapInsert(virEventEpollTimeoutPtr t)
+{
+    t->heapIndex = eventLoop.nheap++;
+    t->inHeap = true;
+    eventLoop.heap[t->heapIndex] = t;
+    virEventEpollHeapSiftUp(t->heapIndex);
+}
+
+
+static void
+virEventEpollHeapRemove(virEventEpollTimeoutPtr t)
+{
+    size_t idx = t->heapIndex;
+
+    if (!t->inHeap)
+        return;
+
+    t->inHeap = false;
+    eventLoop.nheap--;
+    if (idx == eventLoop.nheap)
+        return;
+
+    eventLoop.heap[idx] = eventLoop.heap[eventLoop.nheap];
+    eventLoop.heap[idx]->heapIndex = idx;
+    virEventEpollHeapSiftUp(idx);
+    virEventEpollHeapSiftDown(eventLoop.heap[idx]->heapIndex);
+}
+
+
+/* Reposition @t after its expiry time changed, adding it to
+ * or removing it from the heap when it is enabled or disabled */
+static void
+virEventEpollHeapUpdate(virEventEpollTimeoutPtr t)
+{
+    if (t->frequency < 0) {
+        virEventEpollHeapRemove(t);
+    } else if (!t->inHeap) {
+        virEventEpollHeapInsert(t);
+    } else {
+        virEventEpollHeapSiftUp(t->heapIndex);
+        virEventEpollHeapSiftDown(t->heapIndex);
+    }
+}
+
+
+/*
+ * Register a callback for a timer event
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+{
+    virEventEpollTimeoutPtr t = NULL;
+    unsigned long long now;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    virMutexLock(&eventLoop.lock);
+    if (VIR_RESIZE_N(eventLoop.heap, eventLoop.heapAlloc,
+                     eventLoop.ntimeouts, 1) < 0 ||
+        VIR_RESIZE_N(eventLoop.expired, eventLoop.expiredAlloc,
+                     eventLoop.ntimeouts, 1) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC(t) < 0)
+        goto cleanup;
+
+    t->timer = nextTimer;
+    t->frequency = frequency;
+    t->cb = cb;
+    t->ff = ff;
+    t->opaque = opaque;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+
+    if (virHashAddEntry(eventLoop.timeouts,
+                        (void *)(intptr_t)t->timer, t) < 0)
+        goto cleanup;
+
+    eventLoop.ntimeouts++;
+    if (frequency >= 0)
+        virEventEpollHeapInsert(t);
+
+    ret = nextTimer++;
+    t = NULL;
+    virEventEpollInterruptLocked();
+
+    PROBE(EVENT_POLL_ADD_TIMEOUT,
+          "timer=%d frequency=%d cb=%p opaque=%p ff=%p",
+          ret, frequency, cb, opaque, ff);
+
+ cleanup:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(t);
+    return ret;
+}
+
+
+void virEventEpollUpdateTimeout(int timer, int frequency)
+{
+    virEventEpollTimeoutPtr t;
+    unsigned long long now;
+    PROBE(EVENT_POLL_UPDATE_TIMEOUT,
+          "timer=%d frequency=%d",
+          timer, frequency);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid update timer %d", timer);
+        return;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    virMutexLock(&eventLoop.lock);
+    if (!(t = virHashLookup(eventLoop.timeouts, (void *)(intptr_t)timer))) {
+        virMutexUnlock(&eventLoop.lock);
+        VIR_WARN("Got update for non-existent timer %d", timer);
+        return;
+    }
+
+    t->frequency = frequency;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+    VIR_DEBUG("Set timer freq=%d expires=%llu", frequency, t->expiresAt);
+    virEventEpollHeapUpdate(t);
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+}
+
+
+/*
+ * Unregister a callback for a timer
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag on the timer.
+ * Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveTimeout(int timer)
+{
+    virEventEpollTimeoutPtr t;
+    PROBE(EVENT_POLL_REMOVE_TIMEOUT,
+          "timer=%d",
+          timer);
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid remove timer %d", timer);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(t = virHashSteal(eventLoop.timeouts, (void *)(intptr_t)timer))) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+
+    t->deleted = true;
+    virEventEpollHeapRemove(t);
+    t->nextDeleted = eventLoop.deletedTimeouts;
+    eventLoop.deletedTimeouts = t;
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+}
+
+
+/* Look at the head of the timer heap to determine when
+ * the first timer will expire.
+ * @timeout: filled with expiry time of soonest timer, or -1 if
+ *           no timeout is pending
+ * returns: 0 on success, -1 on error
+ */
+static int virEventEpollCalculateTimeout(int *timeout)
+{
+    unsigned long long then;
+    unsigned long long now;
+
+    if (eventLoop.nnonpollable > 0) {
+        EVENT_DEBUG("%zu always ready handles, not blocking",
+                    eventLoop.nnonpollable);
+        *timeout = 0;
+        return 0;
+    }
+
+    if (eventLoop.nheap == 0) {
+        EVENT_DEBUG("%s", "No timeout is pending");
+        *timeout = -1;
+        return 0;
+    }
+
+    then = eventLoop.heap[0]->expiresAt;
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    EVENT_DEBUG("Schedule timeout then=%llu now=%llu", then, now);
+    if (then <= now)
+        *timeout = 0;
+    else
+        *timeout = ((then - now) > INT_MAX) ? INT_MAX : (then - now);
+
+    EVENT_DEBUG("Timeout at %llu due in %d ms", then, *timeout);
+    return 0;
+}
+
+
+/* Walk the part of the heap whose timers expire no later
+ * than @limit, which is exactly the subtrees rooted at
+ * expired nodes */
+static void
+virEventEpollCollectExpired(size_t idx,
+                            unsigned long long limit,
+                            size_t *nexpired)
+{
+    if (idx >= eventLoop.nheap ||
+        eventLoop.heap[idx]->expiresAt > limit)
+        return;
+
+    eventLoop.expired[(*nexpired)++] = eventLoop.heap[idx];
+    virEventEpollCollectExpired(idx * 2 + 1, limit, nexpired);
+    virEventEpollCollectExpired(idx * 2 + 2, limit, nexpired);
+}
+
+
+static int
+virEventEpollTimeoutCompare(const void *a, const void *b)
+{
+    const virEventEpollTimeout *ta = *(const virEventEpollTimeout **)a;
+    const virEventEpollTimeout *tb = *(const virEventEpollTimeout **)b;
+
+    return ta->timer - tb->timer;
+}
+
+
+/*
+ * Invoke the user supplied callback for each timer whose
+ * expiry time is met, and schedule the next timeout. Does
+ * not try to 'catch up' on time if the actual expiry time
+ * was later than the requested time.
+ *
+ * The set of expired timers is snapshotted before dispatching
+ * so that timers registered or re-armed by a callback are not
+ * run until the next iteration, and must skip any timers
+ * marked as deleted meanwhile. Like with the poll() impl,
+ * timers are dispatched in the order they were registered.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchTimeouts(void)
+{
+    unsigned long long now;
+    size_t nexpired = 0;
+    size_t i;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    /* Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    virEventEpollCollectExpired(0, now + 20, &nexpired);
+    if (nexpired > 1)
+        qsort(eventLoop.expired, nexpired, sizeof(*eventLoop.expired),
+              virEventEpollTimeoutCompare);
+    VIR_DEBUG("Dispatch %zu", nexpired);
+
+    for (i = 0; i < nexpired; i++) {
+        virEventEpollTimeoutPtr t = eventLoop.expired[i];
+        virEventTimeoutCallback cb;
+        void *opaque;
+        int timer;
+
+        /* An earlier callback may have deleted or re-armed it */
+        if (t->deleted || t->frequency < 0 || t->expiresAt > now + 20)
+            continue;
+
+        cb = t->cb;
+        timer = t->timer;
+        opaque = t->opaque;
+        t->expiresAt = now + t->frequency;
+        virEventEpollHeapUpdate(t);
+
+        PROBE(EVENT_POLL_DISPATCH_TIMEOUT,
+              "timer=%d",
+              timer);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+    return 0;
+}
+
+
+/* Invoke the callback of every live handle watching @fd
+ * which is interested in the events reported in @revents.
+ * Handles registered after @lastWatch was allocated are
+ * skipped, since they were added by a callback */
+static void
+virEventEpollDispatchFD(int fd, int revents, int lastWatch)
+{
+    virEventEpollHandlePtr h;
+
+    for (h = eventLoop.fds[fd].handles; h; h = h->next) {
+        virEventHandleCallback cb;
+        void *opaque;
+        int watch;
+        int hEvents;
+
+        if (h->deleted || h->events == 0 || h->watch >= lastWatch) {
+            EVENT_DEBUG("Skip w=%d f=%d d=%d", h->watch, h->fd, h->deleted);
+            continue;
+        }
+
+        hEvents = virEventEpollFromNativeEvents(revents) &
+            (h->events | VIR_EVENT_HANDLE_ERROR | VIR_EVENT_HANDLE_HANGUP);
+        if (!hEvents)
+            continue;
+
+        cb = h->cb;
+        watch = h->watch;
+        opaque = h->opaque;
+        PROBE(EVENT_POLL_DISPATCH_HANDLE,
+              "watch=%d events=%d",
+              watch, hEvents);
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(watch, fd, hEvents, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+}
+
+
+/* Iterate over the file handles reported ready by epoll_wait()
+ * and dispatch the handles watching them.
+ *
+ * This method must cope with new handles being registered
+ * by a callback, and must skip any handles marked as deleted.
+ */
+static void virEventEpollDispatchHandles(int nevents,
+                                         struct epoll_event *events)
+{
+    int lastWatch = nextWatch;
+    size_t i;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (i = 0; i < nevents; i++) {
+        int fd = events[i].data.fd;
+
+        if (fd >= eventLoop.nfds)
+            continue;
+        virEventEpollDispatchFD(fd, events[i].events, lastWatch);
+    }
+
+    if (eventLoop.nnonpollable == 0)
+        return;
+
+    /* Files that epoll refused are always ready, like with poll() */
+    for (i = 0; i < eventLoop.nfds; i++) {
+        if (!eventLoop.fds[i].nonpollable || !eventLoop.fds[i].events)
+            continue;
+        virEventEpollDispatchFD(i, eventLoop.fds[i].events & (EPOLLIN | EPOLLOUT),
+                                lastWatch);
+    }
+}
+
+
+/* Used post dispatch to actually free any timers that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupTimeouts(void)
+{
+    virEventEpollTimeoutPtr t;
+
+    while ((t = eventLoop.deletedTimeouts)) {
+        eventLoop.deletedTimeouts = t->nextDeleted;
+        eventLoop.ntimeouts--;
+
+        PROBE(EVENT_POLL_PURGE_TIMEOUT,
+              "timer=%d",
+              t->timer);
+        if (t->ff) {
+            virFreeCallback ff = t->ff;
+            void *opaque = t->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            ff(opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(t);
+    }
+}
+
+
+/* Used post dispatch to actually free any handles that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupHandles(void)
+{
+    virEventEpollHandlePtr h;
+
+    while ((h = eventLoop.deletedHandles)) {
+        virEventEpollFDPtr ent = &eventLoop.fds[h->fd];
+        virEventEpollHandlePtr *prev = &ent->handles;
+
+        eventLoop.deletedHandles = h->nextDeleted;
+
+        while (*prev != h)
+            prev = &(*prev)->next;
+        *prev = h->next;
+
+        if (!ent->handles && ent->nonpollable) {
+            if (ent->events)
+                eventLoop.nnonpollable--;
+            ent->nonpollable = false;
+            ent->events = 0;
+        }
+
+        PROBE(EVENT_POLL_PURGE_HANDLE,
+              "watch=%d",
+              h->watch);
+        if (h->ff) {
+            virFreeCallback ff = h->ff;
+            void *opaque = h->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            ff(opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(h);
+    }
+}
+
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventEpollRunOnce(void)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX_EVENTS];
+    int ret, timeout;
+
+    virMutexLock(&eventLoop.lock);
+    eventLoop.running = 1;
+    virThreadSelf(&eventLoop.leader);
+
+    virEventEpollCleanupTimeouts();
+    virEventEpollCleanupHandles();
+
+    if (virEventEpollCalculateTimeout(&timeout) < 0)
+        goto error;
+
+    virMutexUnlock(&eventLoop.lock);
+
+ retry:
+    PROBE(EVENT_POLL_RUN,
+          "nhandles=%zd timeout=%d",
+          virHashSize(eventLoop.handles), timeout);
+    ret = epoll_wait(eventLoop.epollfd, events,
+                     EVENT_EPOLL_MAX_EVENTS, timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("epoll_wait got error event %d", errno);
+        if (errno == EINTR || errno == EAGAIN)
+            goto retry;
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        return -1;
+    }
+    EVENT_DEBUG("epoll_wait got %d event(s)", ret);
+
+    virMutexLock(&eventLoop.lock);
+    if (virEventEpollDispatchTimeouts() < 0)
+        goto error;
+
+    virEventEpollDispatchHandles(ret, events);
+
+    virEventEpollCleanupTimeouts();
+    virEventEpollCleanupHandles();
+
+    eventLoop.running = 0;
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+
+ error:
+    virMutexUnlock(&eventLoop.lock);
+    return -1;
+}
+
+
+static void virEventEpollHandleWakeup(int watch ATTRIBUTE_UNUSED,
+                                      int fd,
+                                      int events ATTRIBUTE_UNUSED,
+                                      void *opaque ATTRIBUTE_UNUSED)
+{
+    char c;
+    virMutexLock(&eventLoop.lock);
+    ignore_value(saferead(fd, &c, sizeof(c)));
+    virMutexUnlock(&eventLoop.lock);
+}
+
+
+bool virEventEpollAvailable(void)
+{
+    return true;
+}
+
+
+int virEventEpollInit(void)
+{
+    if (virMutexInit(&eventLoop.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if (!(eventLoop.handles = virHashCreateFull(EVENT_EPOLL_MAX_EVENTS,
+                                                NULL,
+                                                virEventEpollIDCode,
+                                                virEventEpollIDEqual,
+                                                virEventEpollIDCopy,
+                                                NULL)) ||
+        !(eventLoop.timeouts = virHashCreateFull(EVENT_EPOLL_MAX_EVENTS,
+                                                 NULL,
+                                                 virEventEpollIDCode,
+                                                 virEventEpollIDEqual,
+                                                 virEventEpollIDCopy,
+                                                 NULL)))
+        goto error;
+
+    if ((eventLoop.epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll instance"));
+        goto error;
+    }
+
+    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        goto error;
+    }
+
+    if (virEventEpollAddHandle(eventLoop.wakeupfd[0],
+                               VIR_EVENT_HANDLE_READABLE,
+                               virEventEpollHandleWakeup, NULL, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to add handle %d to event loop"),
+                       eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+        goto error;
+    }
+
+    return 0;
+
+ error:
+    VIR_FORCE_CLOSE(eventLoop.epollfd);
+    VIR_FREE(eventLoop.fds);
+    eventLoop.nfds = 0;
+    eventLoop.nnonpollable = 0;
+    virHashFree(eventLoop.handles);
+    virHashFree(eventLoop.timeouts);
+    eventLoop.handles = eventLoop.timeouts = NULL;
+    virMutexDestroy(&eventLoop.lock);
+    return -1;
+}
+
+
+static int virEventEpollInterruptLocked(void)
+{
+    char c = '\0';
+
+    if (!eventLoop.running ||
+        virThreadIsSelf(&eventLoop.leader)) {
+        VIR_DEBUG("Skip interrupt, %d %llu", eventLoop.running,
+                  virThreadID(&eventLoop.leader));
+        return 0;
+    }
+
+    VIR_DEBUG("Interrupting");
+    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+        return -1;
+    return 0;
+}
+
+
+int virEventEpollInterrupt(void)
+{
+    int ret;
+    virMutexLock(&eventLoop.lock);
+    ret = virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+#else /* !HAVE_SYS_EPOLL_H */
+
+static const char *unsupported = N_("epoll is not supported on this platform");
+
+bool virEventEpollAvailable(void)
+{
+    return false;
+}
+
+int virEventEpollAddHandle(int fd ATTRIBUTE_UNUSED,
+                           int events ATTRIBUTE_UNUSED,
+                           virEventHandleCallback cb ATTRIBUTE_UNUSED,
+                           void *opaque ATTRIBUTE_UNUSED,
+                           virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s", _(unsupported));
+    return -1;
+}
+
+void virEventEpollUpdateHandle(int watch ATTRIBUTE_UNUSED,
+                               int events ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveHandle(int watch ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollAddTimeout(int frequency ATTRIBUTE_UNUSED,
+                            virEventTimeoutCallback cb ATTRIBUTE_UNUSED,
+                            void *opaque ATTRIBUTE_UNUSED,
+                            virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s", _(unsupported));
+    return -1;
+}
+
+void virEventEpollUpdateTimeout(int timer ATTRIBUTE_UNUSED,
+                                int frequency ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveTimeout(int timer ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollInit(void)
+{
+    virReportSystemError(ENOSYS, "%s", _(unsupported));
+    return -1;
+}
+
+int virEventEpollRunOnce(void)
+{
+    virReportSystemError(ENOSYS, "%s", _(unsupported));
+    return -1;
+}
+
+int virEventEpollInterrupt(void)
+{
+    return -1;
+}
+
+#endif /* !HAVE_SYS_EPOLL_H */
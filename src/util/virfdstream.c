@@ -49,6 +49,12 @@
 
 VIR_LOG_INIT("fdstream");
 
+/* Number of messages the worker thread reads ahead of the stream */
+#define VIR_FDSTREAM_READ_AHEAD 4
+
+/* Number of data messages kept for reuse once consumed */
+#define VIR_FDSTREAM_MSG_CACHE 8
+
 typedef enum {
     VIR_FDSTREAM_MSG_TYPE_DATA,
     VIR_FDSTREAM_MSG_TYPE_HOLE,
@@ -64,6 +70,7 @@ struct _virFDStreamMsg {
     union {
         struct {
             char *buf;
+            size_t size; /* allocated size of @buf */
             size_t len;
             size_t offset;
         } data;
@@ -111,6 +118,11 @@ struct virFDStreamData {
     bool threadAbort;
     bool threadDoRead;
     virFDStreamMsgPtr msg;
+    size_t nmsgs;
+
+    /* Consumed data messages whose buffers can be reused */
+    virFDStreamMsgPtr msgCache;
+    size_t nmsgCache;
 };
 
 static virClassPtr virFDStreamDataClass;
@@ -125,6 +137,7 @@ virFDStreamDataDispose(void *obj)
     VIR_DEBUG("obj=%p", fdst);
     virFreeError(fdst->threadErr);
     virFDStreamMsgQueueFree(&fdst->msg);
+    virFDStreamMsgQueueFree(&fdst->msgCache);
 }
 
 static int virFDStreamDataOnceInit(void)
@@ -154,7 +167,8 @@ virFDStreamMsgQueuePush(virFDStreamDataPtr fdst,
         tmp = &(*tmp)->next;
 
     *tmp = msg;
-    virCondSignal(&fdst->threadCond);
+    fdst->nmsgs++;
+    virCondBroadcast(&fdst->threadCond);
 
     if (safewrite(fd, &c, sizeof(c)) != sizeof(c)) {
         virReportSystemError(errno,
@@ -178,9 +192,10 @@ virFDStreamMsgQueuePop(virFDStreamDataPtr fdst,
     if (tmp) {
         fdst->msg = tmp->next;
         tmp->next = NULL;
+        fdst->nmsgs--;
     }
 
-    virCondSignal(&fdst->threadCond);
+    virCondBroadcast(&fdst->threadCond);
 
     if (saferead(fd, &c, sizeof(c)) != sizeof(c)) {
         virReportSystemError(errno,
@@ -227,6 +242,97 @@ virFDStreamMsgQueueFree(virFDStreamMsgPtr *queue)
 }
 
 
+/**
+ * virFDStreamMsgNewData:
+ * @fdst: locked stream data
+ * @len: number of bytes the message must be able to hold
+ *
+ * Returns a data message with room for @len bytes, reusing the buffer
+ * of a consumed message if there is one, or NULL on error.
+ */
+static virFDStreamMsgPtr
+virFDStreamMsgNewData(virFDStreamDataPtr fdst,
+                      size_t len)
+{
+    virFDStreamMsgPtr msg;
+
+    if ((msg = fdst->msgCache)) {
+        fdst->msgCache = msg->next;
+        fdst->nmsgCache--;
+        msg->next = NULL;
+    } else if (VIR_ALLOC(msg) < 0) {
+        return NULL;
+    }
+
+    msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
+    msg->stream.data.len = 0;
+    msg->stream.data.offset = 0;
+
+    if (msg->stream.data.size < len) {
+        VIR_FREE(msg->stream.data.buf);
+        msg->stream.data.size = 0;
+        if (VIR_ALLOC_N(msg->stream.data.buf, len) < 0) {
+            virFDStreamMsgFree(msg);
+            return NULL;
+        }
+        msg->stream.data.size = len;
+    }
+
+    return msg;
+}
+
+
+/**
+ * virFDStreamMsgRelease:
+ * @fdst: locked stream data
+ * @msg: consumed message
+ *
+ * Keeps @msg for reuse by virFDStreamMsgNewData if it's a data message
+ * and the cache isn't full, frees it otherwise.
+ */
+static void
+virFDStreamMsgRelease(virFDStreamDataPtr fdst,
+                      virFDStreamMsgPtr msg)
+{
+    if (!msg)
+        return;
+
+    if (msg->type == VIR_FDSTREAM_MSG_TYPE_DATA &&
+        fdst->nmsgCache < VIR_FDSTREAM_MSG_CACHE) {
+        msg->next = fdst->msgCache;
+        fdst->msgCache = msg;
+        fdst->nmsgCache++;
+        return;
+    }
+
+    virFDStreamMsgFree(msg);
+}
+
+
+/**
+ * virFDStreamWaitMsg:
+ * @fdst: locked stream data
+ *
+ * Waits for the worker thread to queue a message.
+ *
+ * Returns the message at the head of the queue, or NULL if the worker
+ * thread quit or failed.
+ */
+static virFDStreamMsgPtr
+virFDStreamWaitMsg(virFDStreamDataPtr fdst)
+{
+    while (!fdst->msg && !fdst->threadQuit && !fdst->threadErr) {
+        if (virCondWait(&fdst->threadCond, &fdst->parent.lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait on condition"));
+            return NULL;
+        }
+    }
+
+    return fdst->msg;
+}
+
+
 static int virFDStreamRemoveCallback(virStreamPtr stream)
 {
     virFDStreamDataPtr fdst = stream->privateData;
@@ -419,6 +525,7 @@ virFDStreamThreadDataFree(virFDStreamThreadDataPtr data)
 }
 
 
+/* Called with @fdst locked; the lock is released for the actual I/O */
 static ssize_t
 virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
                         bool sparse,
@@ -434,11 +541,14 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
     virFDStreamMsgPtr msg = NULL;
     int inData = 0;
     long long sectionLen = 0;
-    char *buf = NULL;
     ssize_t got;
+    int rc;
 
     if (sparse && *dataLen == 0) {
-        if (virFileInData(fdin, &inData, &sectionLen) < 0)
+        virObjectUnlock(fdst);
+        rc = virFileInData(fdin, &inData, &sectionLen);
+        virObjectLock(fdst);
+        if (rc < 0)
             goto error;
 
         if (length &&
@@ -453,10 +563,10 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
         buflen > length - total)
         buflen = length - total;
 
-    if (VIR_ALLOC(msg) < 0)
-        goto error;
-
     if (sparse && *dataLen == 0) {
+        if (VIR_ALLOC(msg) < 0)
+            goto error;
+
         msg->type = VIR_FDSTREAM_MSG_TYPE_HOLE;
         msg->stream.hole.len = sectionLen;
         got = sectionLen;
@@ -475,20 +585,21 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
             buflen > *dataLen)
             buflen = *dataLen;
 
-        if (VIR_ALLOC_N(buf, buflen) < 0)
+        if (!(msg = virFDStreamMsgNewData(fdst, buflen)))
             goto error;
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
+        virObjectUnlock(fdst);
+        got = saferead(fdin, msg->stream.data.buf, buflen);
+        virObjectLock(fdst);
+
+        if (got < 0) {
             virReportSystemError(errno,
                                  _("Unable to read %s"),
                                  fdinname);
             goto error;
         }
 
-        msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
-        msg->stream.data.buf = buf;
         msg->stream.data.len = got;
-        buf = NULL;
         if (sparse)
             *dataLen -= got;
     }
@@ -499,12 +610,14 @@ virFDStreamThreadDoRead(virFDStreamDataPtr fdst,
     return got;
 
  error:
-    VIR_FREE(buf);
     virFDStreamMsgFree(msg);
     return -1;
 }
 
 
+/* Called with @fdst locked; the lock is released for the actual I/O.
+ * The message at the queue head stays in place meanwhile, as only
+ * this thread pops messages of a write stream. */
 static ssize_t
 virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
                          bool sparse,
@@ -516,13 +629,16 @@ virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
     ssize_t got = 0;
     virFDStreamMsgPtr msg = fdst->msg;
     off_t off;
+    int rc;
     bool pop = false;
 
     switch (msg->type) {
     case VIR_FDSTREAM_MSG_TYPE_DATA:
+        virObjectUnlock(fdst);
         got = safewrite(fdout,
                         msg->stream.data.buf + msg->stream.data.offset,
                         msg->stream.data.len - msg->stream.data.offset);
+        virObjectLock(fdst);
         if (got < 0) {
             virReportSystemError(errno,
                                  _("Unable to write %s"),
@@ -543,15 +659,19 @@ virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
         }
 
         got = msg->stream.hole.len;
+        virObjectUnlock(fdst);
         off = lseek(fdout, got, SEEK_CUR);
         if (off == (off_t) -1) {
             virReportSystemError(errno,
                                  _("unable to seek in %s"),
                                  fdoutname);
+            virObjectLock(fdst);
             return -1;
         }
 
-        if (ftruncate(fdout, off) < 0) {
+        rc = ftruncate(fdout, off);
+        virObjectLock(fdst);
+        if (rc < 0) {
             virReportSystemError(errno,
                                  _("unable to truncate %s"),
                                  fdoutname);
@@ -564,7 +684,7 @@ virFDStreamThreadDoWrite(virFDStreamDataPtr fdst,
 
     if (pop) {
         virFDStreamMsgQueuePop(fdst, fdin, fdinname);
-        virFDStreamMsgFree(msg);
+        virFDStreamMsgRelease(fdst, msg);
     }
 
     return got;
@@ -594,7 +714,9 @@ virFDStreamThread(void *opaque)
     while (1) {
         ssize_t got;
 
-        while (doRead == (fdst->msg != NULL) &&
+        /* Readers stay up to VIR_FDSTREAM_READ_AHEAD messages ahead,
+         * writers wait for messages to write */
+        while ((doRead ? fdst->nmsgs >= VIR_FDSTREAM_READ_AHEAD : !fdst->msg) &&
                !fdst->threadQuit) {
             if (virCondWait(&fdst->threadCond, &fdst->parent.lock)) {
                 virReportSystemError(errno, "%s",
@@ -635,6 +757,7 @@ virFDStreamThread(void *opaque)
 
  cleanup:
     fdst->threadQuit = true;
+    virCondBroadcast(&fdst->threadCond);
     virObjectUnlock(fdst);
     if (!virObjectUnref(fdst))
         st->privateData = NULL;
@@ -659,7 +782,7 @@ virFDStreamJoinWorker(virFDStreamDataPtr fdst,
 
     fdst->threadAbort = streamAbort;
     fdst->threadQuit = true;
-    virCondSignal(&fdst->threadCond);
+    virCondBroadcast(&fdst->threadCond);
 
     /* Give the thread a chance to lock the FD stream object. */
     virObjectUnlock(fdst);
@@ -795,21 +918,16 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
     }
 
     if (fdst->thread) {
-        char *buf;
-
         if (fdst->threadQuit || fdst->threadErr) {
             virReportSystemError(EBADF, "%s",
                                  _("cannot write to stream"));
             goto cleanup;
         }
 
-        if (VIR_ALLOC(msg) < 0 ||
-            VIR_ALLOC_N(buf, nbytes) < 0)
+        if (!(msg = virFDStreamMsgNewData(fdst, nbytes)))
             goto cleanup;
 
-        memcpy(buf, bytes, nbytes);
-        msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
-        msg->stream.data.buf = buf;
+        memcpy(msg->stream.data.buf, bytes, nbytes);
         msg->stream.data.len = nbytes;
 
         virFDStreamMsgQueuePush(fdst, msg, fdst->fd, "pipe");
@@ -875,20 +993,14 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
     if (fdst->thread) {
         virFDStreamMsgPtr msg = NULL;
 
-        while (!(msg = fdst->msg)) {
-            if (fdst->threadQuit || fdst->threadErr) {
-                if (nbytes) {
-                    virReportSystemError(EBADF, "%s",
-                                         _("stream is not open"));
-                } else {
-                    ret = 0;
-                }
-                goto cleanup;
+        if (!(msg = virFDStreamWaitMsg(fdst))) {
+            if (nbytes) {
+                virReportSystemError(EBADF, "%s",
+                                     _("stream is not open"));
             } else {
-                virObjectUnlock(fdst);
-                virCondSignal(&fdst->threadCond);
-                virObjectLock(fdst);
+                ret = 0;
             }
+            goto cleanup;
         }
 
         /* Shortcut, if the stream is in the trailing hole,
@@ -916,7 +1028,7 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
         msg->stream.data.offset += nbytes;
         if (msg->stream.data.offset == msg->stream.data.len) {
             virFDStreamMsgQueuePop(fdst, fdst->fd, "pipe");
-            virFDStreamMsgFree(msg);
+            virFDStreamMsgRelease(fdst, msg);
         }
 
         ret = nbytes;
@@ -1041,16 +1153,12 @@ virFDStreamInData(virStreamPtr st,
         if (fdst->threadErr)
             goto cleanup;
 
-        while (!(msg = fdst->msg)) {
-            if (fdst->threadQuit) {
-                *inData = *length = 0;
-                ret = 0;
+        if (!(msg = virFDStreamWaitMsg(fdst))) {
+            if (fdst->threadErr)
                 goto cleanup;
-            } else {
-                virObjectUnlock(fdst);
-                virCondSignal(&fdst->threadCond);
-                virObjectLock(fdst);
-            }
+            *inData = *length = 0;
+            ret = 0;
+            goto cleanup;
         }
 
         if (msg->type == VIR_FDSTREAM_MSG_TYPE_DATA) {
@@ -34,6 +34,8 @@
 #include "virlog.h"
 #include "virobject.h"
 #include "virstring.h"
+#include "virthreadpool.h"
+#include "virtime.h"
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -214,8 +216,12 @@ virFileCacheNewData(virFileCachePtr cache,
                     const char *name)
 {
     void *data = NULL;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
     int rv;
 
+    ignore_value(virTimeMillisNow(&start));
+
     if ((rv = virFileCacheLoad(cache, name, &data)) < 0)
         return NULL;
 
@@ -229,6 +235,11 @@ virFileCacheNewData(virFileCachePtr cache,
         }
     }
 
+    ignore_value(virTimeMillisNow(&end));
+    if (data)
+        VIR_INFO("%s data for '%s' in %llu ms",
+                 rv == 0 ? "Created" : "Loaded cached", name, end - start);
+
     return data;
 }
 
@@ -366,6 +377,120 @@ virFileCacheLookupByFunc(virFileCachePtr cache,
 }
 
 
+typedef struct _virFileCachePrefetchJob virFileCachePrefetchJob;
+typedef virFileCachePrefetchJob *virFileCachePrefetchJobPtr;
+struct _virFileCachePrefetchJob {
+    const char *name;
+    void *data;
+};
+
+typedef struct _virFileCachePrefetchBatch virFileCachePrefetchBatch;
+typedef virFileCachePrefetchBatch *virFileCachePrefetchBatchPtr;
+struct _virFileCachePrefetchBatch {
+    virFileCachePtr cache;
+    virFileCachePrefetchJobPtr jobs;
+};
+
+
+static void
+virFileCachePrefetchWorker(size_t idx,
+                           void *opaque)
+{
+    virFileCachePrefetchBatchPtr batch = opaque;
+    virFileCachePrefetchJobPtr job = &batch->jobs[idx];
+
+    /* Errors are reported again by virFileCacheLookup */
+    if (!(job->data = virFileCacheNewData(batch->cache, job->name)))
+        virResetLastError();
+}
+
+
+/**
+ * virFileCachePrefetch:
+ * @cache: existing cache object
+ * @names: names of the data to prefetch
+ * @nnames: number of items in @names
+ *
+ * Makes sure the data for all @names is present in the cache. Missing
+ * or outdated entries are loaded from their files or created using up
+ * to one thread per host CPU, without holding the cache lock, so that
+ * expensive newData() handlers run in parallel rather than one after
+ * another on the first virFileCacheLookup() of each name. The
+ * handlers must be safe to call concurrently for different names.
+ *
+ * Data which could not be created is not an error, it will be tried
+ * again, and reported, by virFileCacheLookup().
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virFileCachePrefetch(virFileCachePtr cache,
+                     const char *const *names,
+                     size_t nnames)
+{
+    virFileCachePrefetchBatch batch = { .cache = cache };
+    virFileCachePrefetchJobPtr jobs = NULL;
+    size_t njobs = 0;
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(jobs, nnames) < 0)
+        return -1;
+
+    virObjectLock(cache);
+    for (i = 0; i < nnames; i++) {
+        void *data = virHashLookup(cache->table, names[i]);
+
+        if (data) {
+            if (cache->handlers.isValid(data, cache->priv))
+                continue;
+            virHashRemoveEntry(cache->table, names[i]);
+        }
+
+        for (j = 0; j < njobs; j++) {
+            if (STREQ(jobs[j].name, names[i]))
+                break;
+        }
+        if (j == njobs)
+            jobs[njobs++].name = names[i];
+    }
+    virObjectUnlock(cache);
+
+    if (njobs == 0) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Prefetching %zu entries", njobs);
+
+    batch.jobs = jobs;
+    virThreadPoolRunBatch(NULL, 0, njobs, virFileCachePrefetchWorker, &batch);
+
+    /* Another thread may have looked up some of the names meanwhile */
+    virObjectLock(cache);
+    for (i = 0; i < njobs; i++) {
+        if (!jobs[i].data || virHashLookup(cache->table, jobs[i].name))
+            continue;
+
+        if (virHashAddEntry(cache->table, jobs[i].name, jobs[i].data) < 0) {
+            virObjectUnlock(cache);
+            goto cleanup;
+        }
+        jobs[i].data = NULL;
+    }
+    virObjectUnlock(cache);
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < njobs; i++)
+        virObjectUnref(jobs[i].data);
+    VIR_FREE(jobs);
+    return ret;
+}
+
+
 /**
  * virFileCacheGetPriv:
  * @cache: existing cache object
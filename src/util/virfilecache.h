@@ -122,6 +122,11 @@ virFileCacheLookupByFunc(virFileCachePtr cache,
                          virHashSearcher iter,
                          const void *iterData);
 
+int
+virFileCachePrefetch(virFileCachePtr cache,
+                     const char *const *names,
+                     size_t nnames);
+
 void *
 virFileCacheGetPriv(virFileCachePtr cache);
 
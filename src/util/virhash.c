@@ -1,7 +1,7 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: open addressing hash tables
  *
- * Reference: Your favorite introductory book on algorithms
+ * Reference: Pedro Celis, "Robin Hood Hashing", 1986
  *
  * Copyright (C) 2005-2014 Red Hat, Inc.
  * Copyright (C) 2000 Bjorn Reese and Daniel Veillard.
@@ -37,9 +37,9 @@
 
 VIR_LOG_INIT("util.hash");
 
-#define MAX_HASH_LEN 8
-
-/* #define DEBUG_GROW */
+/* Table sizes are powers of two, grow once 4/5 of the slots are used */
+#define VIR_HASH_MIN_SIZE 8
+#define VIR_HASH_MAX_LOAD(size) ((size) / 5 * 4)
 
 #define virHashIterationError(ret)                                      \
     do {                                                                \
@@ -48,28 +48,37 @@ VIR_LOG_INIT("util.hash");
     } while (0)
 
 /*
- * A single entry in the hash table
+ * A single slot in the hash table. Entries are stored inline and
+ * collisions are resolved by linear probing, keeping entries ordered
+ * by their distance from the home slot (Robin Hood hashing). That
+ * bounds probe sequences and lets lookups of missing keys stop early.
+ * The full hash code is kept so that probing rarely has to call
+ * keyEqual on a mismatching key.
  */
 typedef struct _virHashEntry virHashEntry;
 typedef virHashEntry *virHashEntryPtr;
 struct _virHashEntry {
-    struct _virHashEntry *next;
-    void *name;
+    void *name;         /* NULL if the slot is free */
     void *payload;
+    uint32_t code;
+    /* Removed while iterating, the slot is reclaimed afterwards so
+     * that iteration doesn't see entries move around */
+    bool deleted;
 };
 
 /*
  * The entire hash table
  */
 struct _virHashTable {
-    virHashEntryPtr *table;
+    virHashEntryPtr table;
     uint32_t seed;
     size_t size;
     size_t nbElems;
+    size_t nbDeleted;
     /* True iff we are iterating over hash entries. */
     bool iterating;
-    /* Pointer to the current entry during iteration. */
-    virHashEntryPtr current;
+    /* Index of the current entry during iteration, or -1. */
+    ssize_t current;
     virHashDataFree dataFree;
     virHashKeyCode keyCode;
     virHashKeyEqual keyEqual;
@@ -129,11 +138,160 @@ virHashValueFree(void *value, const void *name ATTRIBUTE_UNUSED)
 }
 
 
+/* Distance of the entry at @pos from the slot its hash code points to */
 static size_t
-virHashComputeKey(const virHashTable *table, const void *name)
+virHashProbeDistance(const virHashTable *table, size_t pos)
+{
+    return (pos - (table->table[pos].code & (table->size - 1))) &
+        (table->size - 1);
+}
+
+
+static bool
+virHashSlotUsed(const virHashEntry *entry)
+{
+    return entry->name || entry->deleted;
+}
+
+
+/**
+ * virHashFind:
+ * @table: the hash table
+ * @name: the name of the userdata
+ * @code: hash code of @name
+ *
+ * Returns the index of the slot holding @name, or -1 if not found.
+ */
+static ssize_t
+virHashFind(const virHashTable *table, const void *name, uint32_t code)
+{
+    size_t mask = table->size - 1;
+    size_t pos = code & mask;
+    size_t dist;
+
+    for (dist = 0; dist < table->size; dist++) {
+        virHashEntryPtr entry = table->table + pos;
+
+        if (!virHashSlotUsed(entry) ||
+            dist > virHashProbeDistance(table, pos))
+            return -1;
+
+        if (entry->name && entry->code == code &&
+            table->keyEqual(entry->name, name))
+            return pos;
+
+        pos = (pos + 1) & mask;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Put @entry into a table which is known not to contain its key and
+ * to have at least one free slot. Entries closer to their home slot
+ * than the one being inserted are pushed further down.
+ */
+static void
+virHashInsert(virHashTablePtr table, virHashEntry entry)
+{
+    size_t mask = table->size - 1;
+    size_t pos = entry.code & mask;
+    size_t dist = 0;
+
+    for (;;) {
+        virHashEntryPtr slot = table->table + pos;
+        size_t slotdist;
+
+        if (!virHashSlotUsed(slot)) {
+            *slot = entry;
+            return;
+        }
+
+        slotdist = virHashProbeDistance(table, pos);
+        if (slotdist < dist) {
+            virHashEntry tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+            dist = slotdist;
+        }
+
+        pos = (pos + 1) & mask;
+        dist++;
+    }
+}
+
+
+/*
+ * Free the slot at @pos, moving the entries which follow it one slot
+ * back towards their home slot so that no lookup stops prematurely.
+ */
+static void
+virHashShiftBack(virHashTablePtr table, size_t pos)
+{
+    size_t mask = table->size - 1;
+    size_t next = (pos + 1) & mask;
+
+    while (virHashSlotUsed(table->table + next) &&
+           virHashProbeDistance(table, next) > 0) {
+        table->table[pos] = table->table[next];
+        pos = next;
+        next = (next + 1) & mask;
+    }
+
+    memset(table->table + pos, 0, sizeof(table->table[pos]));
+}
+
+
+/* Reclaim the slots of entries removed during iteration */
+static void
+virHashPurgeDeleted(virHashTablePtr table)
+{
+    size_t i;
+
+    if (table->nbDeleted == 0)
+        return;
+
+    for (i = 0; i < table->size; i++) {
+        while (table->table[i].deleted)
+            virHashShiftBack(table, i);
+    }
+
+    table->nbDeleted = 0;
+}
+
+
+/* Release the key and payload of the entry at @pos */
+static void
+virHashEntryClear(virHashTablePtr table, size_t pos)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    virHashEntryPtr entry = table->table + pos;
+
+    if (table->dataFree)
+        table->dataFree(entry->payload, entry->name);
+    if (table->keyFree)
+        table->keyFree(entry->name);
+    entry->name = NULL;
+    entry->payload = NULL;
+}
+
+
+/*
+ * Remove the entry at @pos. While iterating, the slot is only marked
+ * as deleted so that entries don't move under the iterator's feet.
+ */
+static void
+virHashRemoveSlot(virHashTablePtr table, size_t pos)
+{
+    virHashEntryClear(table, pos);
+    table->nbElems--;
+
+    if (table->iterating) {
+        table->table[pos].deleted = true;
+        table->nbDeleted++;
+    } else {
+        virHashShiftBack(table, pos);
+    }
 }
 
 /**
@@ -157,15 +315,20 @@ virHashTablePtr virHashCreateFull(ssize_t size,
                                   virHashKeyFree keyFree)
 {
     virHashTablePtr table = NULL;
+    size_t slots = VIR_HASH_MIN_SIZE;
 
     if (size <= 0)
         size = 256;
 
+    while (slots < size)
+        slots <<= 1;
+
     if (VIR_ALLOC(table) < 0)
         return NULL;
 
     table->seed = virRandomBits(32);
-    table->size = size;
+    table->size = slots;
+    table->current = -1;
     table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
@@ -173,7 +336,7 @@ virHashTablePtr virHashCreateFull(ssize_t size,
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (VIR_ALLOC_N(table->table, slots) < 0) {
         VIR_FREE(table);
         return NULL;
     }
@@ -234,7 +397,7 @@ virHashAtomicDispose(void *obj)
 /**
  * virHashGrow:
  * @table: the hash table
- * @size: the new size of the hash table
+ * @size: the new size of the hash table, a power of two
  *
  * resize the hash table
  *
@@ -244,52 +407,26 @@ static int
 virHashGrow(virHashTablePtr table, size_t size)
 {
     size_t oldsize, i;
-    virHashEntryPtr *oldtable;
-
-#ifdef DEBUG_GROW
-    size_t nbElem = 0;
-#endif
-
-    if (table == NULL)
-        return -1;
-    if (size < 8)
-        return -1;
-    if (size > 8 * 2048)
-        return -1;
+    virHashEntryPtr oldtable;
 
     oldsize = table->size;
     oldtable = table->table;
-    if (oldtable == NULL)
-        return -1;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (VIR_ALLOC_N_QUIET(table->table, size) < 0) {
         table->table = oldtable;
         return -1;
     }
     table->size = size;
 
     for (i = 0; i < oldsize; i++) {
-        virHashEntryPtr iter = oldtable[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
-
-            iter->next = table->table[key];
-            table->table[key] = iter;
-
-#ifdef DEBUG_GROW
-            nbElem++;
-#endif
-            iter = next;
-        }
+        if (oldtable[i].name)
+            virHashInsert(table, oldtable[i]);
     }
 
     VIR_FREE(oldtable);
 
-#ifdef DEBUG_GROW
-    VIR_DEBUG("virHashGrow : from %d to %d, %ld elems", oldsize,
-              size, nbElem);
-#endif
+    VIR_DEBUG("grown table %p from %zu to %zu slots, %zu elems",
+              table, oldsize, size, table->nbElems);
 
     return 0;
 }
@@ -310,17 +447,8 @@ virHashFree(virHashTablePtr table)
         return;
 
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr iter = table->table[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-
-            if (table->dataFree)
-                table->dataFree(iter->payload, iter->name);
-            if (table->keyFree)
-                table->keyFree(iter->name);
-            VIR_FREE(iter);
-            iter = next;
-        }
+        if (table->table[i].name)
+            virHashEntryClear(table, i);
     }
 
     VIR_FREE(table->table);
@@ -332,9 +460,9 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
                         bool is_update)
 {
-    size_t key, len = 0;
-    virHashEntryPtr entry;
-    void *new_name;
+    virHashEntry entry = { NULL };
+    uint32_t code;
+    ssize_t pos;
 
     if ((table == NULL) || (name == NULL))
         return -1;
@@ -342,40 +470,41 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    code = table->keyCode(name, table->seed);
 
     /* Check for duplicate entry */
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (is_update) {
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                entry->payload = userdata;
-                return 0;
-            } else {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("Duplicate key"));
-                return -1;
-            }
+    if ((pos = virHashFind(table, name, code)) >= 0) {
+        if (is_update) {
+            if (table->dataFree)
+                table->dataFree(table->table[pos].payload,
+                                table->table[pos].name);
+            table->table[pos].payload = userdata;
+            return 0;
+        } else {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Duplicate key"));
+            return -1;
         }
-        len++;
     }
 
-    if (VIR_ALLOC(entry) < 0 || !(new_name = table->keyCopy(name))) {
-        VIR_FREE(entry);
+    /* A failure to grow only makes probing slower, as long as there
+     * is a free slot left */
+    if (table->nbElems + 1 > VIR_HASH_MAX_LOAD(table->size) &&
+        virHashGrow(table, table->size * 2) < 0 &&
+        table->nbElems + 1 >= table->size) {
+        virReportOOMError();
         return -1;
     }
 
-    entry->name = new_name;
-    entry->payload = userdata;
-    entry->next = table->table[key];
-    table->table[key] = entry;
+    if (!(entry.name = table->keyCopy(name)))
+        return -1;
+
+    entry.payload = userdata;
+    entry.code = code;
+    virHashInsert(table, entry);
 
     table->nbElems++;
 
-    if (len > MAX_HASH_LEN)
-        virHashGrow(table, MAX_HASH_LEN * table->size);
-
     return 0;
 }
 
@@ -442,18 +571,16 @@ virHashAtomicUpdate(virHashAtomicPtr table,
 void *
 virHashLookup(const virHashTable *table, const void *name)
 {
-    size_t key;
-    virHashEntryPtr entry;
+    ssize_t pos;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
-            return entry->payload;
-    }
-    return NULL;
+    pos = virHashFind(table, name, table->keyCode(name, table->seed));
+    if (pos < 0)
+        return NULL;
+
+    return table->table[pos].payload;
 }
 
 
@@ -514,7 +641,7 @@ virHashSize(const virHashTable *table)
  * virHashTableSize:
  * @table: the hash table
  *
- * Query the size of the hash @table, i.e., number of buckets in the table.
+ * Query the size of the hash @table, i.e., number of slots in the table.
  *
  * Returns the number of keys in the hash table or
  * -1 in case of error
@@ -542,31 +669,20 @@ virHashTableSize(const virHashTable *table)
 int
 virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
-    virHashEntryPtr entry;
-    virHashEntryPtr *nextptr;
+    ssize_t pos;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
-    for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (table->iterating && table->current != entry)
-                virHashIterationError(-1);
+    pos = virHashFind(table, name, table->keyCode(name, table->seed));
+    if (pos < 0)
+        return -1;
 
-            if (table->dataFree)
-                table->dataFree(entry->payload, entry->name);
-            if (table->keyFree)
-                table->keyFree(entry->name);
-            *nextptr = entry->next;
-            VIR_FREE(entry);
-            table->nbElems--;
-            return 0;
-        }
-        nextptr = &entry->next;
-    }
+    if (table->iterating && table->current != pos)
+        virHashIterationError(-1);
 
-    return -1;
+    virHashRemoveSlot(table, pos);
+    return 0;
 }
 
 
@@ -597,25 +713,25 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
         virHashIterationError(-1);
 
     table->iterating = true;
-    table->current = NULL;
+    table->current = -1;
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry = table->table[i];
-        while (entry) {
-            virHashEntryPtr next = entry->next;
-            table->current = entry;
-            ret = iter(entry->payload, entry->name, data);
-            table->current = NULL;
+        virHashEntryPtr entry = table->table + i;
 
-            if (ret < 0)
-                goto cleanup;
+        if (!entry->name)
+            continue;
 
-            entry = next;
-        }
+        table->current = i;
+        ret = iter(entry->payload, entry->name, data);
+        table->current = -1;
+
+        if (ret < 0)
+            goto cleanup;
     }
 
     ret = 0;
  cleanup:
     table->iterating = false;
+    virHashPurgeDeleted(table);
     return ret;
 }
 
@@ -647,27 +763,17 @@ virHashRemoveSet(virHashTablePtr table,
         virHashIterationError(-1);
 
     table->iterating = true;
-    table->current = NULL;
+    table->current = -1;
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr *nextptr = table->table + i;
-
-        while (*nextptr) {
-            virHashEntryPtr entry = *nextptr;
-            if (!iter(entry->payload, entry->name, data)) {
-                nextptr = &entry->next;
-            } else {
-                count++;
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                if (table->keyFree)
-                    table->keyFree(entry->name);
-                *nextptr = entry->next;
-                VIR_FREE(entry);
-                table->nbElems--;
-            }
+        virHashEntryPtr entry = table->table + i;
+
+        if (entry->name && iter(entry->payload, entry->name, data)) {
+            count++;
+            virHashRemoveSlot(table, i);
         }
     }
     table->iterating = false;
+    virHashPurgeDeleted(table);
 
     return count;
 }
@@ -727,16 +833,15 @@ void *virHashSearch(const virHashTable *ctable,
         virHashIterationError(NULL);
 
     table->iterating = true;
-    table->current = NULL;
+    table->current = -1;
     for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry;
-        for (entry = table->table[i]; entry; entry = entry->next) {
-            if (iter(entry->payload, entry->name, data)) {
-                table->iterating = false;
-                if (name)
-                    *name = table->keyCopy(entry->name);
-                return entry->payload;
-            }
+        virHashEntryPtr entry = table->table + i;
+
+        if (entry->name && iter(entry->payload, entry->name, data)) {
+            table->iterating = false;
+            if (name)
+                *name = table->keyCopy(entry->name);
+            return entry->payload;
         }
     }
     table->iterating = false;
@@ -1,5 +1,5 @@
 /*
- * Summary: Chained hash tables and domain/connections handling
+ * Summary: Hash tables and domain/connections handling
  * Description: This module implements the hash table and allocation and
  *              deallocation of domains and connections
  *
@@ -26,6 +26,7 @@
 #include "virjson.h"
 #include "viralloc.h"
 #include "virerror.h"
+#include "virhashcode.h"
 #include "virlog.h"
 #include "virstring.h"
 #include "virutil.h"
@@ -355,6 +356,7 @@ virJSONValueFree(virJSONValuePtr value)
             virJSONValueFree(value->data.object.pairs[i].value);
         }
         VIR_FREE(value->data.object.pairs);
+        virHashFree(value->data.object.index);
         break;
     case VIR_JSON_TYPE_ARRAY:
         for (i = 0; i < value->data.array.nvalues; i++)
@@ -567,6 +569,133 @@ virJSONValueNewObject(void)
 }
 
 
+/* Objects with at least this many keys get a hash index mapping
+ * keys to their position, so that repeated lookups on large
+ * objects such as QMP replies don't degrade into linear scans.
+ * The pairs array stays authoritative and keeps insertion order. */
+#define VIR_JSON_OBJECT_INDEX_THRESHOLD 16
+
+
+static uint32_t
+virJSONObjectIndexCode(const void *name, uint32_t seed)
+{
+    return virHashCodeGen(name, strlen(name), seed);
+}
+
+
+static bool
+virJSONObjectIndexEqual(const void *namea, const void *nameb)
+{
+    return STREQ(namea, nameb);
+}
+
+
+/* Keys are owned by the pairs array, which outlives the index */
+static void *
+virJSONObjectIndexCopy(const void *name)
+{
+    return (void *)name;
+}
+
+
+static void
+virJSONObjectIndexDrop(virJSONObjectPtr object)
+{
+    virHashFree(object->index);
+    object->index = NULL;
+}
+
+
+/* Index values are stored offset by one, since a NULL payload
+ * can't be told apart from a missing key */
+static int
+virJSONObjectIndexAdd(virJSONObjectPtr object,
+                      size_t pos)
+{
+    return virHashAddEntry(object->index, object->pairs[pos].key,
+                           (void *)(uintptr_t)(pos + 1));
+}
+
+
+/* Builds the index of @object from scratch if it is large enough.
+ * Failure to build the index is not fatal, lookups fall back to a
+ * linear scan. */
+static void
+virJSONObjectIndexBuild(virJSONObjectPtr object)
+{
+    size_t i;
+
+    if (object->npairs < VIR_JSON_OBJECT_INDEX_THRESHOLD)
+        return;
+
+    object->index = virHashCreateFull(object->npairs, NULL,
+                                      virJSONObjectIndexCode,
+                                      virJSONObjectIndexEqual,
+                                      virJSONObjectIndexCopy,
+                                      NULL);
+
+    for (i = 0; object->index && i < object->npairs; i++) {
+        if (virJSONObjectIndexAdd(object, i) < 0)
+            virJSONObjectIndexDrop(object);
+    }
+}
+
+
+/**
+ * virJSONObjectFindPair:
+ * @object: JSON object
+ * @key: key to look up
+ *
+ * Returns the position of @key in the pairs of @object or -1 if it is not
+ * present. The index is only ever modified together with the pairs, so
+ * lookups don't modify @object and are safe to run concurrently.
+ */
+static ssize_t
+virJSONObjectFindPair(virJSONObjectPtr object,
+                      const char *key)
+{
+    size_t i;
+    uintptr_t pos;
+
+    if (object->index) {
+        if ((pos = (uintptr_t)virHashLookup(object->index, key)) == 0)
+            return -1;
+        return pos - 1;
+    }
+
+    for (i = 0; i < object->npairs; i++) {
+        if (STREQ(object->pairs[i].key, key))
+            return i;
+    }
+
+    return -1;
+}
+
+
+/* Removes the pair at @pos and frees its key, but not its value. The
+ * following pairs shift down by one, so only their index entries need
+ * updating. */
+static void
+virJSONObjectDeletePair(virJSONObjectPtr object,
+                        size_t pos)
+{
+    size_t i;
+
+    if (object->index &&
+        virHashRemoveEntry(object->index, object->pairs[pos].key) < 0)
+        virJSONObjectIndexDrop(object);
+
+    VIR_FREE(object->pairs[pos].key);
+    VIR_DELETE_ELEMENT(object->pairs, pos, object->npairs);
+
+    for (i = pos; object->index && i < object->npairs; i++) {
+        if (virHashUpdateEntry(object->index, object->pairs[i].key,
+                               (void *)(uintptr_t)(i + 1)) < 0)
+            virJSONObjectIndexDrop(object);
+    }
+}
+
+
 int
 virJSONValueObjectAppend(virJSONValuePtr object,
                          const char *key,
@@ -593,6 +722,12 @@ virJSONValueObjectAppend(virJSONValuePtr object,
     object->data.object.pairs[object->data.object.npairs].value = value;
     object->data.object.npairs++;
 
+    if (!object->data.object.index)
+        virJSONObjectIndexBuild(&object->data.object);
+    else if (virJSONObjectIndexAdd(&object->data.object,
+                                   object->data.object.npairs - 1) < 0)
+        virJSONObjectIndexDrop(&object->data.object);
+
     return 0;
 }
 
@@ -746,17 +881,10 @@ int
 virJSONValueObjectHasKey(virJSONValuePtr object,
                          const char *key)
 {
-    size_t i;
-
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return 1;
-    }
-
-    return 0;
+    return virJSONObjectFindPair(&object->data.object, key) >= 0;
 }
 
 
@@ -764,17 +892,15 @@ virJSONValuePtr
 virJSONValueObjectGet(virJSONValuePtr object,
                       const char *key)
 {
-    size_t i;
+    ssize_t pos;
 
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return NULL;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return object->data.object.pairs[i].value;
-    }
+    if ((pos = virJSONObjectFindPair(&object->data.object, key)) < 0)
+        return NULL;
 
-    return NULL;
+    return object->data.object.pairs[pos].value;
 }
 
 
@@ -782,21 +908,17 @@ static virJSONValuePtr
 virJSONValueObjectSteal(virJSONValuePtr object,
                         const char *key)
 {
-    size_t i;
+    ssize_t pos;
     virJSONValuePtr obj = NULL;
 
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return NULL;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key)) {
-            VIR_STEAL_PTR(obj, object->data.object.pairs[i].value);
-            VIR_FREE(object->data.object.pairs[i].key);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
-            break;
-        }
-    }
+    if ((pos = virJSONObjectFindPair(&object->data.object, key)) < 0)
+        return NULL;
+
+    VIR_STEAL_PTR(obj, object->data.object.pairs[pos].value);
+    virJSONObjectDeletePair(&object->data.object, pos);
 
     return obj;
 }
@@ -864,7 +986,7 @@ virJSONValueObjectRemoveKey(virJSONValuePtr object,
                             const char *key,
                             virJSONValuePtr *value)
 {
-    size_t i;
+    ssize_t pos;
 
     if (value)
         *value = NULL;
@@ -872,21 +994,16 @@ virJSONValueObjectRemoveKey(virJSONValuePtr object,
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    for (i = 0; i < object->data.object.npairs; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key)) {
-            if (value) {
-                *value = object->data.object.pairs[i].value;
-                object->data.object.pairs[i].value = NULL;
-            }
-            VIR_FREE(object->data.object.pairs[i].key);
-            virJSONValueFree(object->data.object.pairs[i].value);
-            VIR_DELETE_ELEMENT(object->data.object.pairs, i,
-                               object->data.object.npairs);
-            return 1;
-        }
-    }
+    if ((pos = virJSONObjectFindPair(&object->data.object, key)) < 0)
+        return 0;
 
-    return 0;
+    if (value) {
+        *value = object->data.object.pairs[pos].value;
+        object->data.object.pairs[pos].value = NULL;
+    }
+    virJSONValueFree(object->data.object.pairs[pos].value);
+    virJSONObjectDeletePair(&object->data.object, pos);
+    return 1;
 }
 
 
@@ -1801,6 +1918,373 @@ virJSONValueFromString(const char *jsonstring)
 }
 
 
+typedef struct _virJSONStreamParser virJSONStreamParser;
+typedef virJSONStreamParser *virJSONStreamParserPtr;
+struct _virJSONStreamParser {
+    const virJSONStreamCallbacks *cb;
+    void *opaque;
+
+    size_t depth;   /* number of currently open containers */
+    size_t base;    /* containers opened by ourselves (yajl 1 wrapping) */
+    size_t skip;    /* depth of the subtree being skipped, 0 if none */
+
+    char *key;      /* key of the next value if inside an object */
+    size_t nkey;
+    bool haveKey;
+
+    char *scratch;  /* NUL terminated copy of the current scalar */
+    size_t nscratch;
+
+    bool failed;    /* a callback reported an error */
+    bool stopped;   /* a callback asked to stop parsing */
+};
+
+
+static int
+virJSONStreamParserCopy(char **buf,
+                        size_t *nbuf,
+                        const char *s,
+                        size_t len)
+{
+    if (VIR_RESIZE_N(*buf, *nbuf, 0, len + 1) < 0)
+        return -1;
+
+    memcpy(*buf, s, len);
+    (*buf)[len] = '\0';
+    return 0;
+}
+
+
+static const char *
+virJSONStreamParserTakeKey(virJSONStreamParserPtr parser)
+{
+    if (!parser->haveKey)
+        return NULL;
+
+    parser->haveKey = false;
+    return parser->key;
+}
+
+
+static int
+virJSONStreamParserScalar(virJSONStreamParserPtr parser,
+                          virJSONType type,
+                          const char *value)
+{
+    const char *key = virJSONStreamParserTakeKey(parser);
+    int rc;
+
+    if (parser->skip || !parser->cb->value)
+        return 1;
+
+    if ((rc = parser->cb->value(key, parser->depth - parser->base,
+                                type, value, parser->opaque)) < 0) {
+        parser->failed = true;
+        return 0;
+    }
+
+    if (rc == VIR_JSON_STREAM_STOP) {
+        parser->stopped = true;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static int
+virJSONStreamParserHandleNull(void *ctx)
+{
+    return virJSONStreamParserScalar(ctx, VIR_JSON_TYPE_NULL, NULL);
+}
+
+
+static int
+virJSONStreamParserHandleBoolean(void *ctx,
+                                 int boolean_)
+{
+    return virJSONStreamParserScalar(ctx, VIR_JSON_TYPE_BOOLEAN,
+                                     boolean_ ? "true" : "false");
+}
+
+
+static int
+virJSONStreamParserHandleNumber(void *ctx,
+                                const char *s,
+                                yajl_size_t l)
+{
+    virJSONStreamParserPtr parser = ctx;
+
+    if (parser->skip) {
+        parser->haveKey = false;
+        return 1;
+    }
+
+    if (virJSONStreamParserCopy(&parser->scratch, &parser->nscratch, s, l) < 0)
+        return 0;
+
+    return virJSONStreamParserScalar(parser, VIR_JSON_TYPE_NUMBER,
+                                     parser->scratch);
+}
+
+
+static int
+virJSONStreamParserHandleString(void *ctx,
+                                const unsigned char *stringVal,
+                                yajl_size_t stringLen)
+{
+    virJSONStreamParserPtr parser = ctx;
+
+    if (parser->skip) {
+        parser->haveKey = false;
+        return 1;
+    }
+
+    if (virJSONStreamParserCopy(&parser->scratch, &parser->nscratch,
+                                (const char *)stringVal, stringLen) < 0)
+        return 0;
+
+    return virJSONStreamParserScalar(parser, VIR_JSON_TYPE_STRING,
+                                     parser->scratch);
+}
+
+
+static int
+virJSONStreamParserHandleMapKey(void *ctx,
+                                const unsigned char *stringVal,
+                                yajl_size_t stringLen)
+{
+    virJSONStreamParserPtr parser = ctx;
+
+    if (parser->skip)
+        return 1;
+
+    if (virJSONStreamParserCopy(&parser->key, &parser->nkey,
+                                (const char *)stringVal, stringLen) < 0)
+        return 0;
+
+    parser->haveKey = true;
+    return 1;
+}
+
+
+static int
+virJSONStreamParserStart(virJSONStreamParserPtr parser,
+                         virJSONType type)
+{
+    const char *key = virJSONStreamParserTakeKey(parser);
+    int rc = 0;
+
+    parser->depth++;
+
+    if (parser->skip || parser->depth <= parser->base)
+        return 1;
+
+    if (parser->cb->start &&
+        (rc = parser->cb->start(key, parser->depth - parser->base - 1,
+                                type, parser->opaque)) < 0) {
+        parser->failed = true;
+        return 0;
+    }
+
+    if (rc == VIR_JSON_STREAM_STOP) {
+        parser->stopped = true;
+        return 0;
+    }
+
+    if (rc == VIR_JSON_STREAM_SKIP)
+        parser->skip = parser->depth;
+
+    return 1;
+}
+
+
+static int
+virJSONStreamParserEnd(virJSONStreamParserPtr parser,
+                       virJSONType type)
+{
+    size_t depth = parser->depth;
+    int rc;
+
+    if (!depth)
+        return 0;
+
+    parser->depth--;
+    parser->haveKey = false;
+
+    if (parser->skip) {
+        if (parser->skip == depth)
+            parser->skip = 0;
+        return 1;
+    }
+
+    if (depth <= parser->base || !parser->cb->end)
+        return 1;
+
+    if ((rc = parser->cb->end(depth - parser->base - 1,
+                              type, parser->opaque)) < 0) {
+        parser->failed = true;
+        return 0;
+    }
+
+    if (rc == VIR_JSON_STREAM_STOP) {
+        parser->stopped = true;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static int
+virJSONStreamParserHandleStartMap(void *ctx)
+{
+    return virJSONStreamParserStart(ctx, VIR_JSON_TYPE_OBJECT);
+}
+
+
+static int
+virJSONStreamParserHandleEndMap(void *ctx)
+{
+    return virJSONStreamParserEnd(ctx, VIR_JSON_TYPE_OBJECT);
+}
+
+
+static int
+virJSONStreamParserHandleStartArray(void *ctx)
+{
+    return virJSONStreamParserStart(ctx, VIR_JSON_TYPE_ARRAY);
+}
+
+
+static int
+virJSONStreamParserHandleEndArray(void *ctx)
+{
+    return virJSONStreamParserEnd(ctx, VIR_JSON_TYPE_ARRAY);
+}
+
+
+static const yajl_callbacks streamParserCallbacks = {
+    virJSONStreamParserHandleNull,
+    virJSONStreamParserHandleBoolean,
+    NULL,
+    NULL,
+    virJSONStreamParserHandleNumber,
+    virJSONStreamParserHandleString,
+    virJSONStreamParserHandleStartMap,
+    virJSONStreamParserHandleMapKey,
+    virJSONStreamParserHandleEndMap,
+    virJSONStreamParserHandleStartArray,
+    virJSONStreamParserHandleEndArray
+};
+
+
+/**
+ * virJSONValueStreamParse:
+ * @jsonstring: JSON document to parse
+ * @cb: callbacks to invoke
+ * @opaque: data passed to the callbacks
+ *
+ * Parses @jsonstring without building a virJSONValue tree. Instead the
+ * callbacks in @cb are invoked for every container and scalar in document
+ * order. Any of the callbacks may be NULL. The @key passed to the callbacks
+ * is the member name if the value is part of an object and NULL otherwise;
+ * @depth is 0 for the outermost value. Scalars are passed as their textual
+ * representation (NULL for JSON null) which is valid only for the duration
+ * of the callback.
+ *
+ * The @start callback may return VIR_JSON_STREAM_SKIP to skip the whole
+ * container including its end callback. Any callback may return
+ * VIR_JSON_STREAM_STOP once it has seen all it needs, the rest of the
+ * document is then neither parsed nor validated. A negative return value
+ * from any callback aborts the parsing; the callback is expected to report
+ * an error in that case.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virJSONValueStreamParse(const char *jsonstring,
+                        const virJSONStreamCallbacks *cb,
+                        void *opaque)
+{
+    yajl_handle hand;
+    virJSONStreamParser parser;
+    int ret = -1;
+    int rc;
+    size_t len = strlen(jsonstring);
+# ifndef WITH_YAJL2
+    yajl_parser_config cfg = { 0, 1 }; /* Match yajl 2 default behavior */
+# endif
+
+    memset(&parser, 0, sizeof(parser));
+    parser.cb = cb;
+    parser.opaque = opaque;
+
+# ifdef WITH_YAJL2
+    hand = yajl_alloc(&streamParserCallbacks, NULL, &parser);
+# else
+    hand = yajl_alloc(&streamParserCallbacks, &cfg, NULL, &parser);
+# endif
+    if (!hand) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to create JSON parser"));
+        goto cleanup;
+    }
+
+    /* See virJSONValueFromString for the reason of wrapping the
+     * document into an array with yajl 1 */
+# ifdef WITH_YAJL2
+    rc = yajl_parse(hand, (const unsigned char *)jsonstring, len);
+# else
+    parser.base = 1;
+    rc = yajl_parse(hand, (const unsigned char *)"[", 1);
+    if (VIR_YAJL_STATUS_OK(rc))
+        rc = yajl_parse(hand, (const unsigned char *)jsonstring, len);
+    if (VIR_YAJL_STATUS_OK(rc))
+        rc = yajl_parse(hand, (const unsigned char *)"]", 1);
+# endif
+    if (VIR_YAJL_STATUS_OK(rc))
+        rc = yajl_complete_parse(hand);
+
+    /* the callback has reported the error already */
+    if (parser.failed)
+        goto cleanup;
+
+    if (parser.stopped) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc != yajl_status_ok) {
+        unsigned char *errstr = yajl_get_error(hand, 1,
+                                               (const unsigned char*)jsonstring,
+                                               len);
+
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot parse json %s: %s"),
+                       jsonstring, (const char*) errstr);
+        yajl_free_error(hand, errstr);
+        goto cleanup;
+    }
+
+    if (parser.depth != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("cannot parse json %s: unterminated string/map/array"),
+                       jsonstring);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    if (hand)
+        yajl_free(hand);
+    VIR_FREE(parser.key);
+    VIR_FREE(parser.scratch);
+    return ret;
+}
+
+
 static int
 virJSONValueToStringOne(virJSONValuePtr object,
                         yajl_gen g)
@@ -1927,6 +2411,17 @@ virJSONValueFromString(const char *jsonstring ATTRIBUTE_UNUSED)
 }
 
 
+int
+virJSONValueStreamParse(const char *jsonstring ATTRIBUTE_UNUSED,
+                        const virJSONStreamCallbacks *cb ATTRIBUTE_UNUSED,
+                        void *opaque ATTRIBUTE_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("No JSON parser implementation is available"));
+    return -1;
+}
+
+
 char *
 virJSONValueToString(virJSONValuePtr object ATTRIBUTE_UNUSED,
                      bool pretty ATTRIBUTE_UNUSED)
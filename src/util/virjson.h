@@ -26,6 +26,7 @@
 
 # include "internal.h"
 # include "virbitmap.h"
+# include "virhash.h"
 
 # include <stdarg.h>
 
@@ -60,6 +61,7 @@ struct _virJSONObjectPair {
 struct _virJSONObject {
     size_t npairs;
     virJSONObjectPairPtr pairs;
+    virHashTablePtr index; /* key -> position in @pairs */
 };
 
 struct _virJSONArray {
@@ -171,6 +173,39 @@ int virJSONValueObjectRemoveKey(virJSONValuePtr object, const char *key,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
 virJSONValuePtr virJSONValueFromString(const char *jsonstring);
+
+/* Return values of the stream callbacks other than 0 and -1 */
+enum {
+    VIR_JSON_STREAM_SKIP = 1, /* skip the container, start callback only */
+    VIR_JSON_STREAM_STOP = 2, /* stop parsing, ignore the rest */
+};
+
+typedef struct _virJSONStreamCallbacks virJSONStreamCallbacks;
+typedef virJSONStreamCallbacks *virJSONStreamCallbacksPtr;
+
+typedef int (*virJSONStreamStartFunc)(const char *key,
+                                      size_t depth,
+                                      virJSONType type,
+                                      void *opaque);
+typedef int (*virJSONStreamEndFunc)(size_t depth,
+                                    virJSONType type,
+                                    void *opaque);
+typedef int (*virJSONStreamValueFunc)(const char *key,
+                                      size_t depth,
+                                      virJSONType type,
+                                      const char *value,
+                                      void *opaque);
+
+struct _virJSONStreamCallbacks {
+    virJSONStreamStartFunc start;
+    virJSONStreamEndFunc end;
+    virJSONStreamValueFunc value;
+};
+
+int virJSONValueStreamParse(const char *jsonstring,
+                            const virJSONStreamCallbacks *cb,
+                            void *opaque)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 char *virJSONValueToString(virJSONValuePtr object,
                            bool pretty);
 
@@ -47,6 +47,7 @@
 #include "virutil.h"
 #include "virbuffer.h"
 #include "virthread.h"
+#include "viratomic.h"
 #include "virfile.h"
 #include "virtime.h"
 #include "intprops.h"
@@ -118,6 +119,26 @@ static virLogPriority virLogDefaultPriority = VIR_LOG_DEFAULT;
 
 static void virLogResetFilters(void);
 static void virLogResetOutputs(void);
+static void virLogOutputMessage(virLogSourcePtr source,
+                                virLogPriority priority,
+                                const char *filename,
+                                int linenr,
+                                const char *funcname,
+                                const char *timestamp,
+                                virLogMetadataPtr metadata,
+                                unsigned int filterflags,
+                                const char *str,
+                                const char *msg);
+static int virLogAsyncPush(virLogSourcePtr source,
+                           virLogPriority priority,
+                           const char *filename,
+                           int linenr,
+                           const char *funcname,
+                           const char *timestamp,
+                           virLogMetadataPtr metadata,
+                           unsigned int flags,
+                           char **str,
+                           char **msg);
 static void virLogOutputToFd(virLogSourcePtr src,
                              virLogPriority priority,
                              const char *filename,
@@ -150,6 +171,60 @@ virLogUnlock(void)
 }
 
 
+/*
+ * In async mode messages are formatted by the thread emitting them and
+ * pushed as records into a bounded ring buffer. Producers never block:
+ * slots are claimed with a compare and swap on the head position and
+ * each slot carries a sequence number telling whether it is free or
+ * filled. A single writer thread drains the ring to the outputs. If the
+ * ring is full the message is dropped and counted.
+ */
+#define VIR_LOG_ASYNC_METADATA_MAX 5
+
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+struct _virLogRecord {
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogMetadata metadata[VIR_LOG_ASYNC_METADATA_MAX + 1];
+    char *metadataStr[VIR_LOG_ASYNC_METADATA_MAX]; /* Owned copies of .s */
+    bool hasMetadata;
+    unsigned int flags;
+    char *str;
+    char *msg;
+};
+
+typedef struct _virLogRingSlot virLogRingSlot;
+struct _virLogRingSlot {
+    volatile int seq;
+    virLogRecordPtr rec;
+};
+
+static struct {
+    volatile int active;       /* Producers push to the ring */
+    volatile int producers;    /* Producers currently pushing */
+    bool running;              /* Writer thread exists */
+    bool quit;
+    virThread thread;
+
+    virLogRingSlot *slots;
+    unsigned int mask;
+    volatile int head;         /* Next position to fill */
+    int tail;                  /* Next position to drain, writer only */
+
+    volatile int dropped;      /* Messages lost due to a full ring */
+    int droppedReported;
+
+    virMutex lock;             /* Only protects sleeping/wakeup */
+    virCond cond;
+    volatile int sleeping;
+} virLogAsync;
+
+
 static int
 virLogSetDefaultOutputToStderr(void)
 {
@@ -263,6 +338,12 @@ virLogOnceInit(void)
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
 
+    if (virMutexInit(&virLogAsync.lock) < 0)
+        return -1;
+
+    if (virCondInit(&virLogAsync.cond) < 0)
+        return -1;
+
     virLogLock();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
 
@@ -296,6 +377,11 @@ virLogReset(void)
     virLogResetOutputs();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
     virLogUnlock();
+
+    /* A forked child has no writer thread, so make sure it goes back
+     * to logging synchronously. A parent stopping async mode
+     * is expected to use virLogSetAsync. */
+    virAtomicIntSet(&virLogAsync.active, 0);
     return 0;
 }
 
@@ -567,12 +653,10 @@ virLogVMessage(virLogSourcePtr source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logInitMessageStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
     int ret;
-    size_t i;
     int saved_errno = errno;
     unsigned int filterflags = 0;
 
@@ -609,12 +693,44 @@ virLogVMessage(virLogSourcePtr source,
     if (virTimeStringNowRaw(timestamp) < 0)
         timestamp[0] = '\0';
 
+    /* A stack trace has to be taken by the thread emitting the message */
+    if (virAtomicIntGet(&virLogAsync.active) &&
+        !(filterflags & VIR_LOG_STACK_TRACE) &&
+        virLogAsyncPush(source, priority, filename, linenr, funcname,
+                        timestamp, metadata, filterflags, &str, &msg) == 0)
+        goto cleanup;
+
     virLogLock();
+    virLogOutputMessage(source, priority, filename, linenr, funcname,
+                        timestamp, metadata, filterflags, str, msg);
+    virLogUnlock();
+
+ cleanup:
+    VIR_FREE(str);
+    VIR_FREE(msg);
+    errno = saved_errno;
+}
+
+
+/*
+ * Push the message to the outputs defined, if none exist then
+ * use stderr. Must be called with virLogLock held.
+ */
+static void
+virLogOutputMessage(virLogSourcePtr source,
+                    virLogPriority priority,
+                    const char *filename,
+                    int linenr,
+                    const char *funcname,
+                    const char *timestamp,
+                    virLogMetadataPtr metadata,
+                    unsigned int filterflags,
+                    const char *str,
+                    const char *msg)
+{
+    static bool logInitMessageStderr = true;
+    size_t i;
 
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
     for (i = 0; i < virLogNbOutputs; i++) {
         if (priority >= virLogOutputs[i]->priority) {
             if (virLogOutputs[i]->logInitMessage) {
@@ -667,12 +783,314 @@ virLogVMessage(virLogSourcePtr source,
                          timestamp, metadata, filterflags,
                          str, msg, (void *) STDERR_FILENO);
     }
+}
+
+
+static void
+virLogRecordFree(virLogRecordPtr rec)
+{
+    size_t i;
+
+    if (!rec)
+        return;
+
+    for (i = 0; i < VIR_LOG_ASYNC_METADATA_MAX; i++)
+        VIR_FREE(rec->metadataStr[i]);
+    VIR_FREE(rec->str);
+    VIR_FREE(rec->msg);
+    VIR_FREE(rec);
+}
+
+
+/* Claim the next free slot of the ring, returns -1 if it is full */
+static int
+virLogAsyncEnqueue(virLogRecordPtr rec)
+{
+    virLogRingSlot *slot;
+    unsigned int pos = virAtomicIntGet(&virLogAsync.head);
+
+    for (;;) {
+        int diff;
+
+        slot = &virLogAsync.slots[pos & virLogAsync.mask];
+        diff = (int) ((unsigned int) virAtomicIntGet(&slot->seq) - pos);
+
+        if (diff == 0) {
+            if (virAtomicIntCompareExchange(&virLogAsync.head,
+                                            pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        }
+
+        pos = virAtomicIntGet(&virLogAsync.head);
+    }
+
+    slot->rec = rec;
+    virAtomicIntSet(&slot->seq, pos + 1);
+    return 0;
+}
+
+
+/* Whether the oldest slot is yet to be filled, called by the writer only */
+static bool
+virLogAsyncIsEmpty(void)
+{
+    unsigned int pos = virLogAsync.tail;
+    virLogRingSlot *slot = &virLogAsync.slots[pos & virLogAsync.mask];
+
+    return (int) ((unsigned int) virAtomicIntGet(&slot->seq) - (pos + 1)) < 0;
+}
+
+
+/* Take the oldest record from the ring, called by the writer only */
+static virLogRecordPtr
+virLogAsyncDequeue(void)
+{
+    unsigned int pos = virLogAsync.tail;
+    virLogRingSlot *slot = &virLogAsync.slots[pos & virLogAsync.mask];
+    virLogRecordPtr rec;
+
+    if (virLogAsyncIsEmpty())
+        return NULL;
+
+    rec = slot->rec;
+    slot->rec = NULL;
+    virAtomicIntSet(&slot->seq, pos + virLogAsync.mask + 1);
+    virLogAsync.tail = pos + 1;
+    return rec;
+}
+
+
+/*
+ * Queue a message for the writer thread, taking ownership of @str
+ * and @msg. Returns -1 if async mode was turned off in the meantime
+ * and the message has to be written synchronously.
+ */
+static int
+virLogAsyncPush(virLogSourcePtr source,
+                virLogPriority priority,
+                const char *filename,
+                int linenr,
+                const char *funcname,
+                const char *timestamp,
+                virLogMetadataPtr metadata,
+                unsigned int flags,
+                char **str,
+                char **msg)
+{
+    virLogRecordPtr rec = NULL;
+    size_t i;
+
+    /* Announce ourselves so that virLogSetAsync doesn't free the ring
+     * under our feet */
+    virAtomicIntInc(&virLogAsync.producers);
+    if (!virAtomicIntGet(&virLogAsync.active)) {
+        ignore_value(virAtomicIntDecAndTest(&virLogAsync.producers));
+        return -1;
+    }
+
+    if (VIR_ALLOC_QUIET(rec) < 0)
+        goto drop;
+
+    rec->source = source;
+    rec->priority = priority;
+    rec->filename = filename;
+    rec->linenr = linenr;
+    rec->funcname = funcname;
+    ignore_value(virStrcpyStatic(rec->timestamp, timestamp));
+    rec->flags = flags;
+
+    /* Metadata usually lives on the caller's stack, so take a copy */
+    for (i = 0; metadata && metadata[i].key &&
+         i < VIR_LOG_ASYNC_METADATA_MAX; i++) {
+        rec->metadata[i].key = metadata[i].key;
+        rec->metadata[i].iv = metadata[i].iv;
+        if (VIR_STRDUP_QUIET(rec->metadataStr[i], metadata[i].s) < 0)
+            goto drop;
+        rec->metadata[i].s = rec->metadataStr[i];
+        rec->hasMetadata = true;
+    }
+
+    rec->str = *str;
+    rec->msg = *msg;
+    *str = *msg = NULL;
+
+    if (virLogAsyncEnqueue(rec) < 0)
+        goto drop;
+
+    if (virAtomicIntGet(&virLogAsync.sleeping)) {
+        virMutexLock(&virLogAsync.lock);
+        virCondSignal(&virLogAsync.cond);
+        virMutexUnlock(&virLogAsync.lock);
+    }
+    ignore_value(virAtomicIntDecAndTest(&virLogAsync.producers));
+    return 0;
+
+ drop:
+    virLogRecordFree(rec);
+    virAtomicIntInc(&virLogAsync.dropped);
+    ignore_value(virAtomicIntDecAndTest(&virLogAsync.producers));
+    return 0;
+}
+
+
+static void
+virLogAsyncReportDropped(void)
+{
+    int dropped = virAtomicIntGet(&virLogAsync.dropped);
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    char *str = NULL;
+    char *msg = NULL;
+
+    if (dropped == virLogAsync.droppedReported)
+        return;
+
+    if (virAsprintfQuiet(&str, "%u log messages dropped, output is too slow",
+                         (unsigned int) (dropped - virLogAsync.droppedReported)) < 0 ||
+        virLogFormatString(&msg, __LINE__, __func__, VIR_LOG_WARN, str) < 0)
+        goto cleanup;
+
+    if (virTimeStringNowRaw(timestamp) < 0)
+        timestamp[0] = '\0';
+
+    virLogLock();
+    virLogOutputMessage(&virLogSelf, VIR_LOG_WARN, __FILE__, __LINE__,
+                        __func__, timestamp, NULL, 0, str, msg);
     virLogUnlock();
 
+    virLogAsync.droppedReported = dropped;
+
  cleanup:
     VIR_FREE(str);
     VIR_FREE(msg);
-    errno = saved_errno;
+}
+
+
+static void
+virLogAsyncWriter(void *opaque ATTRIBUTE_UNUSED)
+{
+    virLogRecordPtr rec;
+    bool quit;
+
+    for (;;) {
+        while ((rec = virLogAsyncDequeue())) {
+            virLogLock();
+            virLogOutputMessage(rec->source, rec->priority,
+                                rec->filename, rec->linenr, rec->funcname,
+                                rec->timestamp,
+                                rec->hasMetadata ? rec->metadata : NULL,
+                                rec->flags, rec->str, rec->msg);
+            virLogUnlock();
+            virLogRecordFree(rec);
+        }
+
+        virLogAsyncReportDropped();
+
+        virMutexLock(&virLogAsync.lock);
+        /* Re-check after announcing we sleep so a producer either sees
+         * the flag and signals us, or its record is seen here */
+        virAtomicIntSet(&virLogAsync.sleeping, 1);
+        while (!virLogAsync.quit && virLogAsyncIsEmpty())
+            ignore_value(virCondWait(&virLogAsync.cond, &virLogAsync.lock));
+        virAtomicIntSet(&virLogAsync.sleeping, 0);
+        quit = virLogAsync.quit;
+        virMutexUnlock(&virLogAsync.lock);
+
+        if (quit && virLogAsyncIsEmpty())
+            break;
+    }
+}
+
+
+/**
+ * virLogSetAsync:
+ * @nrecords: number of messages to buffer, 0 to log synchronously
+ *
+ * In async mode, threads emitting a message only format it and queue
+ * it, a dedicated thread writes it to the outputs. If the writer can't
+ * keep up, messages which don't fit into the buffer of @nrecords
+ * entries (rounded up to a power of two) are dropped and the number of
+ * dropped messages is logged later. Messages requesting a stack trace
+ * are always written synchronously.
+ *
+ * Turning async mode off writes out all queued messages before
+ * returning.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetAsync(size_t nrecords)
+{
+    size_t size = 1;
+    size_t i;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    if (virLogAsync.running) {
+        virAtomicIntSet(&virLogAsync.active, 0);
+        while (virAtomicIntGet(&virLogAsync.producers) > 0)
+            usleep(100);
+
+        virMutexLock(&virLogAsync.lock);
+        virLogAsync.quit = true;
+        virCondSignal(&virLogAsync.cond);
+        virMutexUnlock(&virLogAsync.lock);
+
+        virThreadJoin(&virLogAsync.thread);
+        virLogAsync.running = false;
+        VIR_FREE(virLogAsync.slots);
+    }
+
+    if (nrecords == 0)
+        return 0;
+
+    if (nrecords > INT_MAX / 2) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Log buffer of %zu messages is too large"), nrecords);
+        return -1;
+    }
+
+    while (size < nrecords)
+        size <<= 1;
+
+    if (VIR_ALLOC_N(virLogAsync.slots, size) < 0)
+        return -1;
+
+    for (i = 0; i < size; i++)
+        virLogAsync.slots[i].seq = i;
+    virLogAsync.mask = size - 1;
+    virLogAsync.head = 0;
+    virLogAsync.tail = 0;
+    virLogAsync.quit = false;
+    virLogAsync.sleeping = 0;
+    virLogAsync.droppedReported = virAtomicIntGet(&virLogAsync.dropped);
+
+    if (virThreadCreate(&virLogAsync.thread, true,
+                        virLogAsyncWriter, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create log writer thread"));
+        VIR_FREE(virLogAsync.slots);
+        return -1;
+    }
+
+    virLogAsync.running = true;
+    virAtomicIntSet(&virLogAsync.active, 1);
+    return 0;
+}
+
+
+/**
+ * virLogGetAsyncDropped:
+ *
+ * Returns the number of messages dropped so far because the async
+ * log buffer was full.
+ */
+unsigned int
+virLogGetAsyncDropped(void)
+{
+    return virAtomicIntGet(&virLogAsync.dropped);
 }
 
 
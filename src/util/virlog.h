@@ -191,6 +191,8 @@ int virLogSetOutputs(const char *outputs);
 int virLogSetFilters(const char *filters);
 char *virLogGetDefaultOutput(void);
 int virLogSetDefaultOutput(const char *fname, bool godaemon, bool privileged);
+int virLogSetAsync(size_t nrecords);
+unsigned int virLogGetAsyncDropped(void);
 
 /*
  * Internal logging API
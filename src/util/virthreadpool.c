@@ -30,9 +30,14 @@
 #include "viralloc.h"
 #include "virthread.h"
 #include "virerror.h"
+#include "virhostcpu.h"
+#include "virlog.h"
+#include "virutil.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+VIR_LOG_INIT("util.threadpool");
+
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
@@ -41,6 +46,10 @@ struct _virThreadPoolJob {
     virThreadPoolJobPtr next;
     unsigned int priority;
 
+    /* Overrides the function of the pool if set */
+    virThreadPoolJobFunc func;
+    void *opaque;
+
     void *data;
 };
 
@@ -164,7 +173,10 @@ static void virThreadPoolWorker(void *opaque)
         pool->jobQueueDepth--;
 
         virMutexUnlock(&pool->mutex);
-        (pool->jobFunc)(job->data, pool->jobOpaque);
+        if (job->func)
+            (job->func)(job->data, job->opaque);
+        else
+            (pool->jobFunc)(job->data, pool->jobOpaque);
         VIR_FREE(job);
         virMutexLock(&pool->mutex);
     }
@@ -373,13 +385,12 @@ size_t virThreadPoolGetJobQueueDepth(virThreadPoolPtr pool)
     return ret;
 }
 
-/*
- * @priority - job priority
- * Return: 0 on success, -1 otherwise
- */
-int virThreadPoolSendJob(virThreadPoolPtr pool,
-                         unsigned int priority,
-                         void *jobData)
+static int
+virThreadPoolSendJobInternal(virThreadPoolPtr pool,
+                             unsigned int priority,
+                             virThreadPoolJobFunc func,
+                             void *opaque,
+                             void *jobData)
 {
     virThreadPoolJobPtr job;
 
@@ -387,6 +398,12 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
     if (pool->quit)
         goto error;
 
+    if (!func && !pool->jobFunc) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("thread pool has no job function"));
+        goto error;
+    }
+
     if (pool->freeWorkers - pool->jobQueueDepth <= 0 &&
         pool->nWorkers < pool->maxWorkers &&
         virThreadPoolExpand(pool, 1, false) < 0)
@@ -395,6 +412,8 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
     if (VIR_ALLOC(job) < 0)
         goto error;
 
+    job->func = func;
+    job->opaque = opaque;
     job->data = jobData;
     job->priority = priority;
 
@@ -423,6 +442,141 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
     return -1;
 }
 
+/*
+ * @priority - job priority
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendJob(virThreadPoolPtr pool,
+                         unsigned int priority,
+                         void *jobData)
+{
+    return virThreadPoolSendJobInternal(pool, priority, NULL, NULL, jobData);
+}
+
+
+typedef struct _virThreadPoolBatch virThreadPoolBatch;
+typedef virThreadPoolBatch *virThreadPoolBatchPtr;
+
+struct _virThreadPoolBatch {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+
+    virThreadPoolBatchFunc func;
+    void *opaque;
+};
+
+static void
+virThreadPoolBatchWorker(void *jobdata, void *opaque)
+{
+    virThreadPoolBatchPtr batch = opaque;
+
+    (batch->func)((uintptr_t)jobdata, batch->opaque);
+
+    virMutexLock(&batch->lock);
+    if (--batch->pending == 0)
+        virCondSignal(&batch->cond);
+    virMutexUnlock(&batch->lock);
+}
+
+/**
+ * virThreadPoolRunBatch:
+ * @pool: pool to run the items in, or NULL
+ * @maxWorkers: upper limit on the number of threads, if @pool is NULL
+ * @nitems: number of items
+ * @func: function processing a single item
+ * @opaque: data passed to @func
+ *
+ * Calls @func for every index from 0 to @nitems - 1 in parallel and
+ * waits for all of the calls to finish. If @pool is NULL a temporary
+ * pool of up to @maxWorkers threads is used, or one thread per host
+ * CPU if @maxWorkers is 0. Otherwise the items are queued on @pool,
+ * whose own job function is not used, and @maxWorkers is ignored.
+ * This must not be called from a worker of @pool.
+ *
+ * Items which can't be handed over to a worker, for example because
+ * threads can't be created, are processed in the calling thread, so
+ * @func is always called for every item.
+ */
+void
+virThreadPoolRunBatch(virThreadPoolPtr pool,
+                      size_t maxWorkers,
+                      size_t nitems,
+                      virThreadPoolBatchFunc func,
+                      void *opaque)
+{
+    virThreadPoolBatch batch = { .func = func, .opaque = opaque };
+    virThreadPoolPtr tmpPool = NULL;
+    int ncpus;
+    size_t i = 0;
+
+    if (nitems < 2)
+        goto sequential;
+
+    if (!pool) {
+        if (maxWorkers == 0) {
+            if ((ncpus = virHostCPUGetCount()) <= 0) {
+                virResetLastError();
+                ncpus = 1;
+            }
+            maxWorkers = ncpus;
+        }
+
+        if (MIN(maxWorkers, nitems) < 2)
+            goto sequential;
+
+        if (!(tmpPool = virThreadPoolNew(0, MIN(maxWorkers, nitems), 0,
+                                         virThreadPoolBatchWorker, &batch))) {
+            VIR_WARN("Failed to create batch workers, processing items "
+                     "one at a time: %s", virGetLastErrorMessage());
+            virResetLastError();
+            goto sequential;
+        }
+        pool = tmpPool;
+    }
+
+    if (virMutexInit(&batch.lock) < 0) {
+        VIR_WARN("cannot initialize mutex");
+        goto cleanup;
+    }
+
+    if (virCondInit(&batch.cond) < 0) {
+        VIR_WARN("cannot initialize condition");
+        virMutexDestroy(&batch.lock);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Running batch of %zu items", nitems);
+
+    virMutexLock(&batch.lock);
+    for (i = 0; i < nitems; i++) {
+        batch.pending++;
+        if (virThreadPoolSendJobInternal(pool, 0, virThreadPoolBatchWorker,
+                                         &batch, (void *)(uintptr_t)i) < 0) {
+            batch.pending--;
+            virResetLastError();
+            break;
+        }
+    }
+
+    /* the workers reference @batch so we must not return before
+     * all of them are finished */
+    while (batch.pending > 0)
+        ignore_value(virCondWait(&batch.cond, &batch.lock));
+    virMutexUnlock(&batch.lock);
+
+    virCondDestroy(&batch.cond);
+    virMutexDestroy(&batch.lock);
+
+ cleanup:
+    virThreadPoolFree(tmpPool);
+
+ sequential:
+    /* Whatever couldn't be handed over to a worker */
+    for (; i < nitems; i++)
+        func(i, opaque);
+}
+
 int
 virThreadPoolSetParameters(virThreadPoolPtr pool,
                            long long int minWorkers,
@@ -32,7 +32,10 @@ typedef struct _virThreadPool virThreadPool;
 typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
+typedef void (*virThreadPoolBatchFunc)(size_t idx, void *opaque);
 
+/* @func may be NULL for pools which only run batches,
+ * see virThreadPoolRunBatch */
 # define virThreadPoolNew(min, max, prio, func, opaque) \
     virThreadPoolNewFull(min, max, prio, func, #func, opaque)
 
@@ -41,7 +44,7 @@ virThreadPoolPtr virThreadPoolNewFull(size_t minWorkers,
                                       size_t prioWorkers,
                                       virThreadPoolJobFunc func,
                                       const char *funcName,
-                                      void *opaque) ATTRIBUTE_NONNULL(4);
+                                      void *opaque);
 
 size_t virThreadPoolGetMinWorkers(virThreadPoolPtr pool);
 size_t virThreadPoolGetMaxWorkers(virThreadPoolPtr pool);
@@ -57,6 +60,12 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+void virThreadPoolRunBatch(virThreadPoolPtr pool,
+                           size_t maxWorkers,
+                           size_t nitems,
+                           virThreadPoolBatchFunc func,
+                           void *opaque) ATTRIBUTE_NONNULL(4);
+
 int virThreadPoolSetParameters(virThreadPoolPtr pool,
                                long long int minWorkers,
                                long long int maxWorkers,
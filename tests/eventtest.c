@@ -38,6 +38,7 @@
 #include "virlog.h"
 #include "virutil.h"
 #include "vireventpoll.h"
+#include "vireventepoll.h"
 
 VIR_LOG_INIT("tests.eventtest");
 
@@ -60,6 +61,51 @@ static struct timerInfo {
     int delete;
 } timers[NUM_TIME];
 
+/* The event loop implementation being tested */
+struct testEventImpl {
+    const char *name;
+    int (*init)(void);
+    int (*runOnce)(void);
+    int (*addHandle)(int fd, int events,
+                     virEventHandleCallback cb,
+                     void *opaque,
+                     virFreeCallback ff);
+    void (*updateHandle)(int watch, int events);
+    int (*removeHandle)(int watch);
+    int (*addTimeout)(int frequency,
+                      virEventTimeoutCallback cb,
+                      void *opaque,
+                      virFreeCallback ff);
+    void (*updateTimeout)(int timer, int frequency);
+    int (*removeTimeout)(int timer);
+};
+
+static const struct testEventImpl pollImpl = {
+    "poll",
+    virEventPollInit,
+    virEventPollRunOnce,
+    virEventPollAddHandle,
+    virEventPollUpdateHandle,
+    virEventPollRemoveHandle,
+    virEventPollAddTimeout,
+    virEventPollUpdateTimeout,
+    virEventPollRemoveTimeout,
+};
+
+static const struct testEventImpl epollImpl = {
+    "epoll",
+    virEventEpollInit,
+    virEventEpollRunOnce,
+    virEventEpollAddHandle,
+    virEventEpollUpdateHandle,
+    virEventEpollRemoveHandle,
+    virEventEpollAddTimeout,
+    virEventEpollUpdateTimeout,
+    virEventEpollRemoveTimeout,
+};
+
+static const struct testEventImpl *impl;
+
 enum {
     EV_ERROR_NONE,
     EV_ERROR_WATCH,
@@ -90,17 +136,22 @@ testEventReport(const char *name, bool failed, const char *msg, ...)
     va_list vargs;
     va_start(vargs, msg);
     char *str = NULL;
+    char *fullname = NULL;
     struct testEventResultData data;
 
     if (msg && virVasprintfQuiet(&str, msg, vargs) != 0)
         failed = true;
+    if (virAsprintfQuiet(&fullname, "%s: %s", impl->name, name) < 0)
+        failed = true;
 
     data.failed = failed;
     data.msg = str;
-    ignore_value(virTestRun(name, testEventResultCallback, &data));
+    ignore_value(virTestRun(fullname ? fullname : name,
+                            testEventResultCallback, &data));
 
     va_end(vargs);
     VIR_FREE(str);
+    VIR_FREE(fullname);
 }
 
 static void
@@ -132,7 +183,7 @@ testPipeReader(int watch, int fd, int events, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveHandle(info->delete);
+        impl->removeHandle(info->delete);
 }
 
 
@@ -151,7 +202,22 @@ testTimer(int timer, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveTimeout(info->delete);
+        impl->removeTimeout(info->delete);
+}
+
+/* Watches in the order their callbacks ran */
+static int orderFired[2];
+static size_t norderFired;
+
+static void
+testOrderReader(int watch,
+                int fd ATTRIBUTE_UNUSED,
+                int events ATTRIBUTE_UNUSED,
+                void *data ATTRIBUTE_UNUSED)
+{
+    if (norderFired < ARRAY_CARDINALITY(orderFired))
+        orderFired[norderFired] = watch;
+    norderFired++;
 }
 
 static pthread_mutex_t eventThreadMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -169,7 +235,7 @@ ATTRIBUTE_NORETURN static void *eventThreadLoop(void *data ATTRIBUTE_UNUSED) {
         eventThreadRunOnce = 0;
         pthread_mutex_unlock(&eventThreadMutex);
 
-        virEventPollRunOnce();
+        impl->runOnce();
 
         pthread_mutex_lock(&eventThreadMutex);
         eventThreadJobDone = 1;
@@ -310,53 +376,49 @@ resetAll(void)
     }
 }
 
+/* Must be called with eventThreadMutex held and the
+ * event thread idle */
 static int
-mymain(void)
+testEventLoop(const struct testEventImpl *testImpl)
 {
     size_t i;
-    pthread_t eventThread;
     char one = '1';
+    int watches[2];
+
+    impl = testImpl;
 
     for (i = 0; i < NUM_FDS; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
             fprintf(stderr, "Cannot create pipe: %d", errno);
             return EXIT_FAILURE;
         }
+        handles[i].fired = 0;
+        handles[i].error = EV_ERROR_NONE;
     }
 
-    if (virThreadInitialize() < 0)
-        return EXIT_FAILURE;
-    char *debugEnv = getenv("LIBVIRT_DEBUG");
-    if (debugEnv && *debugEnv &&
-        (virLogSetDefaultPriority(virLogParseDefaultPriority(debugEnv)) < 0)) {
-        fprintf(stderr, "Invalid log level setting.\n");
+    if (impl->init() < 0) {
+        fprintf(stderr, "Cannot initialize %s event loop\n", impl->name);
         return EXIT_FAILURE;
     }
 
-    virEventPollInit();
-
     for (i = 0; i < NUM_FDS; i++) {
         handles[i].delete = -1;
         handles[i].watch =
-            virEventPollAddHandle(handles[i].pipeFD[0],
-                                  VIR_EVENT_HANDLE_READABLE,
-                                  testPipeReader,
-                                  &handles[i], NULL);
+            impl->addHandle(handles[i].pipeFD[0],
+                            VIR_EVENT_HANDLE_READABLE,
+                            testPipeReader,
+                            &handles[i], NULL);
     }
 
     for (i = 0; i < NUM_TIME; i++) {
         timers[i].delete = -1;
         timers[i].timeout = -1;
         timers[i].timer =
-            virEventPollAddTimeout(timers[i].timeout,
-                                   testTimer,
-                                   &timers[i], NULL);
+            impl->addTimeout(timers[i].timeout,
+                             testTimer,
+                             &timers[i], NULL);
     }
 
-    pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
-
-    pthread_mutex_lock(&eventThreadMutex);
-
     /* First time, is easy - just try triggering one of our
      * registered handles */
     startJob();
@@ -369,7 +431,7 @@ mymain(void)
 
     /* Now lets delete one before starting poll(), and
      * try triggering another handle */
-    virEventPollRemoveHandle(handles[0].watch);
+    impl->removeHandle(handles[0].watch);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
@@ -389,7 +451,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveHandle(handles[1].watch);
+    impl->removeHandle(handles[1].watch);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -425,22 +487,22 @@ mymain(void)
 
 
     /* Run a timer on its own */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
+    impl->updateTimeout(timers[1].timer, 100);
     startJob();
     if (finishJob("Firing a timer", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    impl->updateTimeout(timers[1].timer, -1);
 
     resetAll();
 
     /* Now lets delete one before starting poll(), and
      * try triggering another timer */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
-    virEventPollRemoveTimeout(timers[0].timer);
+    impl->updateTimeout(timers[1].timer, 100);
+    impl->removeTimeout(timers[0].timer);
     startJob();
     if (finishJob("Deleted before poll", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    impl->updateTimeout(timers[1].timer, -1);
 
     resetAll();
 
@@ -455,7 +517,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveTimeout(timers[1].timer);
+    impl->removeTimeout(timers[1].timer);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -468,27 +530,27 @@ mymain(void)
      * before poll() exits for the first safewrite(). We don't
      * see a hard failure in other cases, so nothing to worry
      * about */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
-    virEventPollUpdateTimeout(timers[3].timer, 100);
+    impl->updateTimeout(timers[2].timer, 100);
+    impl->updateTimeout(timers[3].timer, 100);
     startJob();
     timers[2].delete = timers[3].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[2].timer, -1);
+    impl->updateTimeout(timers[2].timer, -1);
 
     resetAll();
 
     /* Extreme fun, lets delete ourselves during dispatch */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
+    impl->updateTimeout(timers[2].timer, 100);
     startJob();
     timers[2].delete = timers[2].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
     for (i = 0; i < NUM_FDS - 1; i++)
-        virEventPollRemoveHandle(handles[i].watch);
+        impl->removeHandle(handles[i].watch);
     for (i = 0; i < NUM_TIME - 1; i++)
-        virEventPollRemoveTimeout(timers[i].timer);
+        impl->removeTimeout(timers[i].timer);
 
     resetAll();
 
@@ -509,20 +571,86 @@ mymain(void)
     handles[0].pipeFD[0] = handles[1].pipeFD[0];
     handles[0].pipeFD[1] = handles[1].pipeFD[1];
 
-    handles[0].watch = virEventPollAddHandle(handles[0].pipeFD[0],
-                                             0,
-                                             testPipeReader,
-                                             &handles[0], NULL);
-    handles[1].watch = virEventPollAddHandle(handles[1].pipeFD[0],
-                                             VIR_EVENT_HANDLE_READABLE,
-                                             testPipeReader,
-                                             &handles[1], NULL);
+    handles[0].watch = impl->addHandle(handles[0].pipeFD[0],
+                                       0,
+                                       testPipeReader,
+                                       &handles[0], NULL);
+    handles[1].watch = impl->addHandle(handles[1].pipeFD[0],
+                                       VIR_EVENT_HANDLE_READABLE,
+                                       testPipeReader,
+                                       &handles[1], NULL);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    resetAll();
+
+    /* Callbacks of handles watching the same FD must run in
+     * the order the handles were registered in */
+    impl->removeHandle(handles[0].watch);
+    impl->removeHandle(handles[1].watch);
+
+    norderFired = 0;
+    watches[0] = impl->addHandle(handles[2].pipeFD[0],
+                                 VIR_EVENT_HANDLE_READABLE,
+                                 testOrderReader, NULL, NULL);
+    watches[1] = impl->addHandle(handles[2].pipeFD[0],
+                                 VIR_EVENT_HANDLE_READABLE,
+                                 testOrderReader, NULL, NULL);
+    startJob();
+    if (safewrite(handles[2].pipeFD[1], &one, 1) != 1)
+        return EXIT_FAILURE;
+    if (finishJob("Write shared", -1, -1) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (norderFired != 2 ||
+        orderFired[0] != watches[0] || orderFired[1] != watches[1]) {
+        testEventReport("Dispatch order", 1,
+                        "Expected watches %d, %d to fire in order, "
+                        "got %zu callbacks starting with %d, %d\n",
+                        watches[0], watches[1], norderFired,
+                        orderFired[0], orderFired[1]);
+        return EXIT_FAILURE;
+    }
+    testEventReport("Dispatch order", 0, NULL);
+
+    if (saferead(handles[2].pipeFD[0], &one, 1) != 1)
+        return EXIT_FAILURE;
+    impl->removeHandle(watches[0]);
+    impl->removeHandle(watches[1]);
+
+    resetAll();
+
+    return EXIT_SUCCESS;
+}
+
+static int
+mymain(void)
+{
+    pthread_t eventThread;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+    char *debugEnv = getenv("LIBVIRT_DEBUG");
+    if (debugEnv && *debugEnv &&
+        (virLogSetDefaultPriority(virLogParseDefaultPriority(debugEnv)) < 0)) {
+        fprintf(stderr, "Invalid log level setting.\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
+
+    pthread_mutex_lock(&eventThreadMutex);
+
+    if (testEventLoop(&pollImpl) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (virEventEpollAvailable() &&
+        testEventLoop(&epollImpl) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
     /* pthread_kill(eventThread, SIGTERM); */
 
     return EXIT_SUCCESS;
@@ -0,0 +1,230 @@
+/*
+ * qemudomainjobtest.c: Test the control state of domains running jobs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "qemu/qemu_domain.h"
+#include "qemumonitortestutils.h"
+#include "testutils.h"
+#include "testutilsqemu.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static virQEMUDriver driver;
+
+#define QEMU_DOMAIN_JOB_TEST_DOMAIN_ID 7
+
+typedef enum {
+    TEST_JOB_NONE,
+    TEST_JOB_SHARED,
+    TEST_JOB_EXCLUSIVE,
+} testQemuDomainJobType;
+
+struct testQemuDomainJobData {
+    testQemuDomainJobType job;
+    bool monitor; /* whether the job enters the monitor */
+    int state;
+    int details;
+};
+
+
+static int
+testQemuDomainJobCheck(virDomainObjPtr vm,
+                       const struct testQemuDomainJobData *data,
+                       int state,
+                       int details)
+{
+    virDomainControlInfo info;
+
+    if (qemuDomainObjGetControlInfo(vm, &info) < 0)
+        return -1;
+
+    if (info.state != state || info.details != details) {
+        VIR_TEST_VERBOSE("job=%d monitor=%d: expected state %d/%d, "
+                         "got %d/%d\n", data->job, data->monitor,
+                         state, details, info.state, info.details);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testQemuDomainJob(const void *opaque)
+{
+    const struct testQemuDomainJobData *data = opaque;
+    virDomainObjPtr vm = NULL;
+    qemuDomainObjPrivatePtr priv = NULL;
+    qemuMonitorTestPtr test_mon = NULL;
+    char *domain_filename = NULL;
+    char *domain_xml = NULL;
+    bool inMonitor = false;
+    bool inJob = false;
+    int ret = -1;
+
+    if (virAsprintf(&domain_filename,
+                    "%s/qemuxml2argvdata/qemuxml2argv-minimal.xml",
+                    abs_srcdir) < 0)
+        goto cleanup;
+
+    if (virTestLoadFile(domain_filename, &domain_xml) < 0)
+        goto cleanup;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)))
+        goto cleanup;
+
+    if (!(vm->def = virDomainDefParseString(domain_xml, driver.caps,
+                                            driver.xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+        goto cleanup;
+
+    vm->def->id = QEMU_DOMAIN_JOB_TEST_DOMAIN_ID;
+
+    if (!(test_mon = qemuMonitorTestNew(true, driver.xmlopt, vm, &driver, NULL)))
+        goto cleanup;
+
+    priv = vm->privateData;
+    priv->mon = qemuMonitorTestGetMonitor(test_mon);
+    priv->monJSON = true;
+    virObjectUnlock(priv->mon);
+
+    if (testQemuDomainJobCheck(vm, data, VIR_DOMAIN_CONTROL_OK, 0) < 0)
+        goto cleanup;
+
+    switch (data->job) {
+    case TEST_JOB_SHARED:
+        if (qemuDomainObjBeginSharedJob(&driver, vm, 0) < 0)
+            goto cleanup;
+        break;
+    case TEST_JOB_EXCLUSIVE:
+        if (qemuDomainObjBeginJob(&driver, vm, QEMU_JOB_QUERY) < 0)
+            goto cleanup;
+        break;
+    case TEST_JOB_NONE:
+        break;
+    }
+    inJob = true;
+
+    if (data->monitor) {
+        /* A thread stuck inside the monitor holds the monitor lock and
+         * leaves the domain object unlocked */
+        qemuDomainObjEnterMonitor(&driver, vm);
+        virObjectLock(vm);
+        inMonitor = true;
+    }
+
+    if (testQemuDomainJobCheck(vm, data, data->state, data->details) < 0)
+        goto cleanup;
+
+    if (inMonitor) {
+        virObjectUnlock(vm);
+        inMonitor = false;
+        if (qemuDomainObjExitMonitor(&driver, vm) < 0)
+            goto cleanup;
+    }
+
+    switch (data->job) {
+    case TEST_JOB_SHARED:
+        qemuDomainObjEndSharedJob(&driver, vm);
+        break;
+    case TEST_JOB_EXCLUSIVE:
+        qemuDomainObjEndJob(&driver, vm);
+        break;
+    case TEST_JOB_NONE:
+        break;
+    }
+    inJob = false;
+
+    if (testQemuDomainJobCheck(vm, data, VIR_DOMAIN_CONTROL_OK, 0) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (inMonitor) {
+        virObjectUnlock(vm);
+        ignore_value(qemuDomainObjExitMonitor(&driver, vm));
+    }
+    if (inJob) {
+        if (data->job == TEST_JOB_SHARED)
+            qemuDomainObjEndSharedJob(&driver, vm);
+        else if (data->job == TEST_JOB_EXCLUSIVE)
+            qemuDomainObjEndJob(&driver, vm);
+    }
+    if (priv && priv->mon) {
+        /* the test monitor expects to get its monitor back locked */
+        virObjectLock(priv->mon);
+        priv->mon = NULL;
+    }
+    virObjectUnref(vm);
+    qemuMonitorTestFree(test_mon);
+    VIR_FREE(domain_xml);
+    VIR_FREE(domain_filename);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#if !WITH_YAJL
+    fputs("libvirt not compiled with yajl, skipping this test\n", stderr);
+    return EXIT_AM_SKIP;
+#endif
+
+    if (virThreadInitialize() < 0 ||
+        qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    virEventRegisterDefaultImpl();
+
+#define DO_TEST(name, jb, mon, st, det)                                     \
+    do {                                                                    \
+        struct testQemuDomainJobData data = {                               \
+            .job = jb, .monitor = mon, .state = st, .details = det,         \
+        };                                                                  \
+        if (virTestRun("control info " name, testQemuDomainJob,             \
+                       &data) < 0)                                          \
+            ret = -1;                                                       \
+    } while (0)
+
+    DO_TEST("no job", TEST_JOB_NONE, false,
+            VIR_DOMAIN_CONTROL_OK, 0);
+    DO_TEST("shared job", TEST_JOB_SHARED, false,
+            VIR_DOMAIN_CONTROL_OK, 0);
+    DO_TEST("shared job in monitor", TEST_JOB_SHARED, true,
+            VIR_DOMAIN_CONTROL_OCCUPIED, 0);
+    DO_TEST("exclusive job", TEST_JOB_EXCLUSIVE, false,
+            VIR_DOMAIN_CONTROL_ERROR,
+            VIR_DOMAIN_CONTROL_ERROR_REASON_INTERNAL);
+    DO_TEST("exclusive job in monitor", TEST_JOB_EXCLUSIVE, true,
+            VIR_DOMAIN_CONTROL_OCCUPIED, 0);
+
+#undef DO_TEST
+
+    qemuTestDriverFree(&driver);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -332,6 +332,85 @@ testQemuMonitorJSONGetVersion(const void *data)
     return ret;
 }
 
+/* Size of the package string in the large reply test */
+#define TEST_LARGE_REPLY_SIZE (4 * 1024 * 1024)
+
+static int
+testQemuMonitorJSONGetVersionLarge(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    qemuMonitorIOStats stats;
+    char *bigpackage = NULL;
+    char *reply = NULL;
+    int ret = -1;
+    int major;
+    int minor;
+    int micro;
+    char *package = NULL;
+
+    if (!test)
+        return -1;
+
+    if (VIR_ALLOC_N(bigpackage, TEST_LARGE_REPLY_SIZE + 1) < 0)
+        goto cleanup;
+    memset(bigpackage, 'x', TEST_LARGE_REPLY_SIZE);
+
+    if (virAsprintf(&reply,
+                    "{ \"return\":{ "
+                    "    \"qemu\":{ \"major\":1, \"minor\":2, \"micro\":3 },"
+                    "    \"package\":\"%s\""
+                    "} }", bigpackage) < 0)
+        goto cleanup;
+
+    if (qemuMonitorTestAddItem(test, "query-version", reply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorGetVersion(qemuMonitorTestGetMonitor(test),
+                              &major, &minor, &micro,
+                              &package) < 0)
+        goto cleanup;
+
+    if (major != 1 || minor != 2 || micro != 3) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Version %d.%d.%d was not 1.2.3", major, minor, micro);
+        goto cleanup;
+    }
+
+    if (STRNEQ(package, bigpackage)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "Package string was mangled");
+        goto cleanup;
+    }
+
+    qemuMonitorGetIOStats(qemuMonitorTestGetMonitor(test), &stats);
+
+    if (stats.rxMaxReply < TEST_LARGE_REPLY_SIZE ||
+        stats.rxBytes < stats.rxMaxReply) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Unexpected stats rxBytes=%llu rxMaxReply=%zu",
+                       stats.rxBytes, stats.rxMaxReply);
+        goto cleanup;
+    }
+
+    /* The receive buffer grows geometrically */
+    if (stats.rxReallocs > 20) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Too many buffer reallocations: %llu",
+                       stats.rxReallocs);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    VIR_FREE(package);
+    VIR_FREE(reply);
+    VIR_FREE(bigpackage);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONGetMachines(const void *data)
 {
@@ -1783,6 +1862,73 @@ testQemuMonitorJSONqemuMonitorJSONGetBlockStatsInfo(const void *data)
     return ret;
 }
 
+/*
+ * Replies to prefetched commands must be used by the functions issuing
+ * the same commands later, without any further monitor traffic.
+ */
+static int
+testQemuMonitorJSONPrefetch(const void *data)
+{
+    virDomainXMLOptionPtr xmlopt = (virDomainXMLOptionPtr)data;
+    qemuMonitorTestPtr test = qemuMonitorTestNewSimple(true, xmlopt);
+    virHashTablePtr blockstats = NULL;
+    qemuBlockStatsPtr stats;
+    int ret = -1;
+
+    const char *reply =
+        "{"
+        "    \"return\": ["
+        "        {"
+        "            \"device\": \"drive-virtio-disk0\","
+        "            \"stats\": {"
+        "                \"wr_bytes\": 2845696,"
+        "                \"rd_bytes\": 28505088,"
+        "                \"rd_operations\": 1279"
+        "            }"
+        "        }"
+        "    ]"
+        "}";
+
+    if (!test)
+        return -1;
+
+    if (qemuMonitorTestAddItem(test, "query-blockstats", reply) < 0 ||
+        qemuMonitorTestAddItem(test, "query-block", queryBlockReply) < 0)
+        goto cleanup;
+
+    if (qemuMonitorPrefetch(qemuMonitorTestGetMonitor(test), NULL,
+                            QEMU_MONITOR_PREFETCH_BLOCK) < 0)
+        goto cleanup;
+
+    /* Both replies are queued, any command sent from now on would fail */
+    if (qemuMonitorGetAllBlockStatsInfo(qemuMonitorTestGetMonitor(test),
+                                        &blockstats, false) < 0 ||
+        qemuMonitorBlockStatsUpdateCapacity(qemuMonitorTestGetMonitor(test),
+                                            blockstats, false) < 0)
+        goto cleanup;
+
+    if (!(stats = virHashLookup(blockstats, "virtio-disk0"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "block stats for device 'virtio-disk0' is missing");
+        goto cleanup;
+    }
+
+    if (stats->rd_req != 1279 || stats->rd_bytes != 28505088 ||
+        stats->wr_bytes != 2845696) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Invalid stats rd_req=%lld rd_bytes=%lld wr_bytes=%lld",
+                       stats->rd_req, stats->rd_bytes, stats->wr_bytes);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    qemuMonitorTestFree(test);
+    virHashFree(blockstats);
+    return ret;
+}
+
 static int
 testQemuMonitorJSONqemuMonitorJSONGetMigrationParams(const void *data)
 {
@@ -2836,6 +2982,7 @@ mymain(void)
 
     DO_TEST(GetStatus);
     DO_TEST(GetVersion);
+    DO_TEST(GetVersionLarge);
     DO_TEST(GetMachines);
     DO_TEST(GetCPUDefinitions);
     DO_TEST(GetCommands);
@@ -2891,6 +3038,7 @@ mymain(void)
     DO_TEST(qemuMonitorJSONGetBalloonInfo);
     DO_TEST(qemuMonitorJSONGetBlockInfo);
     DO_TEST(qemuMonitorJSONGetBlockStatsInfo);
+    DO_TEST(Prefetch);
     DO_TEST(qemuMonitorJSONGetMigrationCacheSize);
     DO_TEST(qemuMonitorJSONGetMigrationParams);
     DO_TEST(qemuMonitorJSONGetMigrationStats);
@@ -16,6 +16,7 @@
 # include "qemu/qemu_domain_address.h"
 # include "qemu/qemu_domain.h"
 # include "testutilsqemu.h"
+# include "virfile.h"
 # include "virstring.h"
 
 # define VIR_FROM_THIS VIR_FROM_NONE
@@ -141,6 +142,85 @@ testGetStatusXMLPrefix(const struct testInfo *data)
 }
 
 
+/*
+ * Save the status of @obj through the status journal a few times and
+ * check that replaying the journal restores the last saved status XML.
+ */
+static int
+testCompareStatusJournal(virDomainObjPtr obj)
+{
+    const char *stateDir = driver.config->stateDir;
+    char *statusFile = NULL;
+    char *journalFile = NULL;
+    char *expect = NULL;
+    char *status = NULL;
+    const char *actual;
+    int ret = -1;
+
+    if (!(statusFile = virDomainConfigFile(stateDir, obj->def->name)) ||
+        virAsprintf(&journalFile, "%s/%s.journal",
+                    stateDir, obj->def->name) < 0)
+        goto cleanup;
+
+    virDomainXMLOptionSetStatusJournal(driver.xmlopt, true);
+
+    if (virDomainSaveStatus(driver.xmlopt, stateDir, obj, driver.caps) < 0)
+        goto cleanup;
+
+    virDomainObjSetState(obj, VIR_DOMAIN_PAUSED, VIR_DOMAIN_PAUSED_USER);
+    if (virDomainSaveStatus(driver.xmlopt, stateDir, obj, driver.caps) < 0)
+        goto cleanup;
+
+    obj->pid = 1;
+    virDomainObjSetState(obj, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_UNPAUSED);
+    if (virDomainSaveStatus(driver.xmlopt, stateDir, obj, driver.caps) < 0)
+        goto cleanup;
+
+    if (!virFileExists(journalFile)) {
+        VIR_TEST_DEBUG("Status journal '%s' wasn't created", journalFile);
+        goto cleanup;
+    }
+
+    if (!(expect = virDomainObjFormat(driver.xmlopt, obj, driver.caps,
+                                      VIR_DOMAIN_DEF_FORMAT_SECURE |
+                                      VIR_DOMAIN_DEF_FORMAT_STATUS |
+                                      VIR_DOMAIN_DEF_FORMAT_ACTUAL_NET |
+                                      VIR_DOMAIN_DEF_FORMAT_PCI_ORIG_STATES |
+                                      VIR_DOMAIN_DEF_FORMAT_CLOCK_ADJUST)))
+        goto cleanup;
+
+    if (virDomainReplayStatusJournal(stateDir, obj->def->name) < 0 ||
+        virFileReadAll(statusFile, 1024 * 1024, &status) < 0)
+        goto cleanup;
+
+    if (virFileExists(journalFile)) {
+        VIR_TEST_DEBUG("Status journal '%s' wasn't removed", journalFile);
+        goto cleanup;
+    }
+
+    if (!(actual = strstr(status, "<domstatus")))
+        actual = status;
+
+    if (STRNEQ(expect, actual)) {
+        virTestDifference(stderr, expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virDomainXMLOptionSetStatusJournal(driver.xmlopt, false);
+    virDomainDropStatusJournal(stateDir, obj);
+    if (statusFile)
+        unlink(statusFile);
+    VIR_FREE(statusFile);
+    VIR_FREE(journalFile);
+    VIR_FREE(expect);
+    VIR_FREE(status);
+    return ret;
+}
+
+
 static int
 testCompareStatusXMLToXMLFiles(const void *opaque)
 {
@@ -215,6 +295,9 @@ testCompareStatusXMLToXMLFiles(const void *opaque)
         goto cleanup;
     }
 
+    if (testCompareStatusJournal(obj) < 0)
+        goto cleanup;
+
     ret = 0;
 
  cleanup:
@@ -1359,3 +1359,37 @@ const char
 
     return virtTestCounterStr;
 }
+
+
+/**
+ * virTestGenerateKeys:
+ * @count: number of keys to generate
+ * @offset: index of the first key
+ *
+ * Generates @count distinct UUID-like strings for filling large hash
+ * tables. Keys generated for the same index are always identical, so
+ * disjoint ranges of @offset can be used to get keys which are known
+ * not to be present.
+ *
+ * Returns a NULL terminated list to be freed by virStringListFree(),
+ * or NULL on error.
+ */
+char **
+virTestGenerateKeys(size_t count, size_t offset)
+{
+    char **keys;
+    size_t i;
+
+    if (VIR_ALLOC_N(keys, count + 1) < 0)
+        return NULL;
+
+    for (i = 0; i < count; i++) {
+        if (virAsprintf(&keys[i], "%08zx-c0de-4b1d-8a5e-%012zx",
+                        i + offset, (i + offset) * 2654435761U) < 0) {
+            virStringListFree(keys);
+            return NULL;
+        }
+    }
+
+    return keys;
+}
@@ -110,6 +110,8 @@ void virTestQuiesceLibvirtErrors(bool always);
 void virTestCounterReset(const char *prefix);
 const char *virTestCounterNext(void);
 
+char **virTestGenerateKeys(size_t count, size_t offset);
+
 int virTestMain(int argc,
                 char **argv,
                 int (*func)(void),
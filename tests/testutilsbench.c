@@ -0,0 +1,175 @@
+/*
+ * testutilsbench.c: microbenchmark helpers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "testutilsbench.h"
+#include "testutils.h"
+#include "virstring.h"
+
+/* Default time spent measuring each benchmark, in milliseconds */
+#define VIR_BENCH_TIME_DEFAULT 500
+
+/* Cap on the growth of the iteration count between two calibration runs */
+#define VIR_BENCH_GROWTH_MAX 100
+
+static unsigned long long virBenchAllocs;
+
+#ifdef __GLIBC__
+/* Count heap allocations done by the whole program by interposing the
+ * allocator. Benchmarks are run from a single thread, so the counter
+ * doesn't need to be atomic. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+    virBenchAllocs++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    virBenchAllocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    virBenchAllocs++;
+    return __libc_realloc(ptr, size);
+}
+
+# define VIR_BENCH_HAVE_ALLOCS 1
+#else /* !__GLIBC__ */
+# define VIR_BENCH_HAVE_ALLOCS 0
+#endif /* !__GLIBC__ */
+
+
+static unsigned long long
+virBenchNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static unsigned long long
+virBenchGetTime(void)
+{
+    const char *str = getenv("VIR_BENCH_TIME");
+    unsigned long long ms;
+
+    if (!str || virStrToLong_ull(str, NULL, 10, &ms) < 0 || ms == 0)
+        ms = VIR_BENCH_TIME_DEFAULT;
+
+    return ms * 1000 * 1000;
+}
+
+
+/* Peak resident set size of the process so far, in kiB */
+static long
+virBenchMaxRSS(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        return -1;
+
+    return ru.ru_maxrss;
+}
+
+
+/**
+ * virBenchRun:
+ * @name: name of the benchmark, printed in the report
+ * @func: function performing the measured operation
+ * @opaque: data passed to @func
+ *
+ * Calls @func with a growing number of iterations until a run takes
+ * at least VIR_BENCH_TIME milliseconds (500 by default), then prints
+ * the time and number of heap allocations per iteration of the last
+ * run together with the peak RSS of the process.
+ *
+ * Benchmarks whose name doesn't contain the VIR_BENCH_FILTER
+ * environment variable, if set, are skipped.
+ *
+ * Returns 0 on success or if skipped, -1 if @func failed.
+ */
+int
+virBenchRun(const char *name,
+            virBenchFunc func,
+            const void *opaque)
+{
+    const char *filter = getenv("VIR_BENCH_FILTER");
+    unsigned long long target = virBenchGetTime();
+    unsigned long long start;
+    unsigned long long elapsed;
+    unsigned long long allocs;
+    size_t niters = 1;
+
+    if (filter && !strstr(name, filter))
+        return 0;
+
+    for (;;) {
+        size_t next;
+
+        allocs = virBenchAllocs;
+        start = virBenchNow();
+        if (func(opaque, niters) < 0) {
+            fprintf(stderr, "%-40s FAILED\n", name);
+            return -1;
+        }
+        elapsed = virBenchNow() - start;
+        allocs = virBenchAllocs - allocs;
+
+        if (elapsed >= target || niters >= SIZE_MAX / VIR_BENCH_GROWTH_MAX)
+            break;
+
+        /* Aim a bit past the target to avoid stopping just short of it */
+        if (elapsed > 0 && target / elapsed < VIR_BENCH_GROWTH_MAX)
+            next = (double) niters * (target + target / 5) / elapsed;
+        else
+            next = niters * VIR_BENCH_GROWTH_MAX;
+
+        niters = MAX(next, niters + 1);
+    }
+
+    if (VIR_BENCH_HAVE_ALLOCS)
+        printf("%-40s %10zu %12.1f ns/op %10.1f allocs/op %8ld kiB maxrss\n",
+               name, niters, (double) elapsed / niters,
+               (double) allocs / niters, virBenchMaxRSS());
+    else
+        printf("%-40s %10zu %12.1f ns/op %8ld kiB maxrss\n",
+               name, niters, (double) elapsed / niters, virBenchMaxRSS());
+    fflush(stdout);
+
+    return 0;
+}
@@ -0,0 +1,37 @@
+/*
+ * testutilsbench.h: microbenchmark helpers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIR_TEST_UTILS_BENCH_H__
+# define __VIR_TEST_UTILS_BENCH_H__
+
+# include "internal.h"
+
+/**
+ * virBenchFunc:
+ * @opaque: data passed to virBenchRun
+ * @niters: number of times to perform the measured operation
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+typedef int (*virBenchFunc)(const void *opaque, size_t niters);
+
+int virBenchRun(const char *name,
+                virBenchFunc func,
+                const void *opaque);
+
+#endif /* __VIR_TEST_UTILS_BENCH_H__ */
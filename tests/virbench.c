@@ -0,0 +1,673 @@
+/*
+ * virbench.c: microbenchmarks of hot paths in libvirt core utilities
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <dirent.h>
+
+#include "testutils.h"
+#include "testutilsbench.h"
+#include "viralloc.h"
+#include "virbitmap.h"
+#include "virbuffer.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virjson.h"
+#include "virstring.h"
+
+#ifdef WITH_REMOTE
+# include "rpc/virnetmessage.h"
+# include "remote/remote_protocol.h"
+#endif
+
+#ifdef WITH_QEMU
+# include "testutilsqemu.h"
+# include "qemu/qemu_domain.h"
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Number of objects used by benchmarks of large collections */
+#define BENCH_OBJECTS 10000
+
+
+/* ------------------------------------------------------------------ */
+/* virHash                                                            */
+/* ------------------------------------------------------------------ */
+
+struct benchHashData {
+    virHashTablePtr hash;
+    char **keys;
+    char **missing;
+};
+
+static int
+benchHashLookup(const void *opaque, size_t niters)
+{
+    const struct benchHashData *data = opaque;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        const char *key = data->keys[i % BENCH_OBJECTS];
+
+        if (virHashLookup(data->hash, key) != key)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+benchHashLookupMissing(const void *opaque, size_t niters)
+{
+    const struct benchHashData *data = opaque;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (virHashLookup(data->hash, data->missing[i % BENCH_OBJECTS]))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+benchHashAddRemove(const void *opaque, size_t niters)
+{
+    const struct benchHashData *data = opaque;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        const char *key = data->missing[i % BENCH_OBJECTS];
+
+        if (virHashAddEntry(data->hash, key, (void *) key) < 0 ||
+            virHashRemoveEntry(data->hash, key) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+benchHashCreateFill(const void *opaque, size_t niters)
+{
+    const struct benchHashData *data = opaque;
+    virHashTablePtr hash;
+    size_t i, j;
+
+    for (i = 0; i < niters; i++) {
+        if (!(hash = virHashCreate(0, NULL)))
+            return -1;
+
+        for (j = 0; j < 100; j++) {
+            if (virHashAddEntry(hash, data->keys[j], data->keys[j]) < 0) {
+                virHashFree(hash);
+                return -1;
+            }
+        }
+
+        virHashFree(hash);
+    }
+
+    return 0;
+}
+
+static int
+benchHash(void)
+{
+    struct benchHashData data = { NULL };
+    size_t i;
+    int ret = -1;
+
+    if (!(data.keys = virTestGenerateKeys(BENCH_OBJECTS, 0)) ||
+        !(data.missing = virTestGenerateKeys(BENCH_OBJECTS, BENCH_OBJECTS)) ||
+        !(data.hash = virHashCreate(0, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < BENCH_OBJECTS; i++) {
+        if (virHashAddEntry(data.hash, data.keys[i], data.keys[i]) < 0)
+            goto cleanup;
+    }
+
+    if (virBenchRun("hash/lookup-10k", benchHashLookup, &data) < 0 ||
+        virBenchRun("hash/lookup-missing-10k",
+                    benchHashLookupMissing, &data) < 0 ||
+        virBenchRun("hash/add-remove-10k", benchHashAddRemove, &data) < 0 ||
+        virBenchRun("hash/create-fill-100", benchHashCreateFill, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(data.hash);
+    virStringListFree(data.keys);
+    virStringListFree(data.missing);
+    return ret;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* virJSON                                                            */
+/* ------------------------------------------------------------------ */
+
+struct benchJSONData {
+    char *str;
+    virJSONValuePtr value;
+};
+
+static int
+benchJSONParse(const void *opaque, size_t niters)
+{
+    const struct benchJSONData *data = opaque;
+    virJSONValuePtr value;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (!(value = virJSONValueFromString(data->str)))
+            return -1;
+        virJSONValueFree(value);
+    }
+
+    return 0;
+}
+
+static int
+benchJSONFormat(const void *opaque, size_t niters)
+{
+    const struct benchJSONData *data = opaque;
+    char *str;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (!(str = virJSONValueToString(data->value, false)))
+            return -1;
+        VIR_FREE(str);
+    }
+
+    return 0;
+}
+
+static int
+benchJSON(void)
+{
+    struct benchJSONData data = { NULL };
+    char *file = NULL;
+    int ret = -1;
+
+    /* A query-named-block-nodes reply, one of the larger ones
+     * processed regularly */
+    if (virAsprintf(&file, "%s/qemumonitorjsondata/"
+                    "qemumonitorjson-nodename-blockjob-named-nodes.json",
+                    abs_srcdir) < 0 ||
+        virTestLoadFile(file, &data.str) < 0 ||
+        !(data.value = virJSONValueFromString(data.str)))
+        goto cleanup;
+
+    if (virBenchRun("json/parse-named-nodes", benchJSONParse, &data) < 0 ||
+        virBenchRun("json/format-named-nodes", benchJSONFormat, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virJSONValueFree(data.value);
+    VIR_FREE(data.str);
+    VIR_FREE(file);
+    return ret;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* virBuffer                                                          */
+/* ------------------------------------------------------------------ */
+
+static int
+benchBufferFormat(const void *opaque ATTRIBUTE_UNUSED, size_t niters)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *str;
+    size_t i, j;
+
+    /* Resembles formatting a device element of domain XML */
+    for (i = 0; i < niters; i++) {
+        virBufferAddLit(&buf, "<disk type='file' device='disk'>\n");
+        virBufferAdjustIndent(&buf, 2);
+        for (j = 0; j < 8; j++) {
+            virBufferAsprintf(&buf, "<address type='pci' domain='0x%04x' "
+                              "bus='0x%02zx' slot='0x%02zx' function='0x0'/>\n",
+                              0, i % 256, j);
+            virBufferEscapeString(&buf, "<source file='%s'/>\n",
+                                  "/var/lib/libvirt/images/<guest>&.qcow2");
+        }
+        virBufferAdjustIndent(&buf, -2);
+        virBufferAddLit(&buf, "</disk>\n");
+
+        if (!(str = virBufferContentAndReset(&buf)))
+            return -1;
+        VIR_FREE(str);
+    }
+
+    return 0;
+}
+
+static int
+benchBuffer(void)
+{
+    return virBenchRun("buffer/format-disk", benchBufferFormat, NULL);
+}
+
+
+/* ------------------------------------------------------------------ */
+/* virBitmap                                                          */
+/* ------------------------------------------------------------------ */
+
+static int
+benchBitmapParseFormat(const void *opaque ATTRIBUTE_UNUSED, size_t niters)
+{
+    virBitmapPtr bitmap;
+    char *str;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (virBitmapParse("0-3,8-11,^9,16,18,20,64-127,^100", &bitmap,
+                           1024) < 0)
+            return -1;
+
+        str = virBitmapFormat(bitmap);
+        virBitmapFree(bitmap);
+        if (!str)
+            return -1;
+        VIR_FREE(str);
+    }
+
+    return 0;
+}
+
+static int
+benchBitmapIterate(const void *opaque, size_t niters)
+{
+    virBitmapPtr bitmap = (virBitmapPtr) opaque;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        ssize_t pos = -1;
+        size_t count = 0;
+
+        while ((pos = virBitmapNextSetBit(bitmap, pos)) >= 0)
+            count++;
+
+        if (count != virBitmapCountBits(bitmap))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+benchBitmap(void)
+{
+    virBitmapPtr bitmap;
+    size_t i;
+    int ret = -1;
+
+    if (!(bitmap = virBitmapNew(4096)))
+        return -1;
+
+    for (i = 0; i < 4096; i += 3)
+        ignore_value(virBitmapSetBit(bitmap, i));
+
+    if (virBenchRun("bitmap/parse-format", benchBitmapParseFormat, NULL) < 0 ||
+        virBenchRun("bitmap/iterate-4096", benchBitmapIterate, bitmap) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virBitmapFree(bitmap);
+    return ret;
+}
+
+
+/* ------------------------------------------------------------------ */
+/* XDR encoding of remote protocol messages                           */
+/* ------------------------------------------------------------------ */
+
+#ifdef WITH_REMOTE
+struct benchXDRData {
+    remote_connect_list_all_domains_ret ret;
+    char *wire;
+    size_t wireLen;
+};
+
+static virNetMessagePtr
+benchXDREncodeOne(const struct benchXDRData *data)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    msg->header.prog = REMOTE_PROGRAM;
+    msg->header.vers = REMOTE_PROTOCOL_VERSION;
+    msg->header.proc = REMOTE_PROC_CONNECT_LIST_ALL_DOMAINS;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 1;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_remote_connect_list_all_domains_ret,
+                                   (void *) &data->ret) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+static int
+benchXDREncode(const void *opaque, size_t niters)
+{
+    const struct benchXDRData *data = opaque;
+    virNetMessagePtr msg;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (!(msg = benchXDREncodeOne(data)))
+            return -1;
+        virNetMessageFree(msg);
+    }
+
+    return 0;
+}
+
+static int
+benchXDRDecode(const void *opaque, size_t niters)
+{
+    const struct benchXDRData *data = opaque;
+    remote_connect_list_all_domains_ret ret;
+    virNetMessagePtr msg;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (!(msg = virNetMessageNew(false)))
+            return -1;
+
+        /* Mimic the way a message is received from a socket */
+        msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+        if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
+            goto error;
+        memcpy(msg->buffer, data->wire, msg->bufferLength);
+
+        if (virNetMessageDecodeLength(msg) < 0 ||
+            msg->bufferLength != data->wireLen)
+            goto error;
+        memcpy(msg->buffer, data->wire, msg->bufferLength);
+
+        memset(&ret, 0, sizeof(ret));
+        if (virNetMessageDecodeHeader(msg) < 0 ||
+            virNetMessageDecodePayload(msg,
+                                       (xdrproc_t)xdr_remote_connect_list_all_domains_ret,
+                                       &ret) < 0)
+            goto error;
+
+        xdr_free((xdrproc_t)xdr_remote_connect_list_all_domains_ret,
+                 (char *) &ret);
+        virNetMessageFree(msg);
+    }
+
+    return 0;
+
+ error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+static int
+benchXDR(void)
+{
+    struct benchXDRData data;
+    remote_nonnull_domain *doms = NULL;
+    virNetMessagePtr msg = NULL;
+    size_t ndoms = 1000;
+    size_t i;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+
+    if (VIR_ALLOC_N(doms, ndoms) < 0)
+        return -1;
+
+    for (i = 0; i < ndoms; i++) {
+        if (virAsprintf(&doms[i].name, "guest-%zu", i) < 0)
+            goto cleanup;
+        memset(doms[i].uuid, i % 256, sizeof(doms[i].uuid));
+        doms[i].id = i + 1;
+    }
+
+    data.ret.domains.domains_val = doms;
+    data.ret.domains.domains_len = ndoms;
+    data.ret.ret = ndoms;
+
+    if (!(msg = benchXDREncodeOne(&data)) ||
+        VIR_ALLOC_N(data.wire, msg->bufferLength) < 0)
+        goto cleanup;
+    memcpy(data.wire, msg->buffer, msg->bufferLength);
+    data.wireLen = msg->bufferLength;
+
+    if (virBenchRun("xdr/encode-list-all-domains-1000",
+                    benchXDREncode, &data) < 0 ||
+        virBenchRun("xdr/decode-list-all-domains-1000",
+                    benchXDRDecode, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < ndoms; i++)
+        VIR_FREE(doms[i].name);
+    VIR_FREE(doms);
+    VIR_FREE(data.wire);
+    virNetMessageFree(msg);
+    return ret;
+}
+#endif /* WITH_REMOTE */
+
+
+/* ------------------------------------------------------------------ */
+/* Domain XML                                                         */
+/* ------------------------------------------------------------------ */
+
+#ifdef WITH_QEMU
+static virQEMUDriver driver;
+
+struct benchDomainData {
+    char **xmls;
+    virDomainDefPtr *defs;
+    size_t ndefs;
+};
+
+static int
+benchDomainParse(const void *opaque, size_t niters)
+{
+    const struct benchDomainData *data = opaque;
+    virDomainDefPtr def;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (!(def = virDomainDefParseString(data->xmls[i % data->ndefs],
+                                            driver.caps, driver.xmlopt, NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE)))
+            return -1;
+        virDomainDefFree(def);
+    }
+
+    return 0;
+}
+
+static int
+benchDomainFormat(const void *opaque, size_t niters)
+{
+    const struct benchDomainData *data = opaque;
+    char *xml;
+    size_t i;
+
+    for (i = 0; i < niters; i++) {
+        if (!(xml = virDomainDefFormat(data->defs[i % data->ndefs],
+                                       driver.caps,
+                                       VIR_DOMAIN_DEF_FORMAT_SECURE)))
+            return -1;
+        VIR_FREE(xml);
+    }
+
+    return 0;
+}
+
+/*
+ * Load all the qemuxml2argv input files which parse without any
+ * particular QEMU capabilities, the rest are skipped.
+ */
+static int
+benchDomainLoad(struct benchDomainData *data)
+{
+    char *dirname = NULL;
+    DIR *dir = NULL;
+    struct dirent *ent;
+    int rc;
+    int ret = -1;
+
+    if (virAsprintf(&dirname, "%s/qemuxml2argvdata", abs_srcdir) < 0 ||
+        virDirOpen(&dir, dirname) < 0)
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &ent, dirname)) > 0) {
+        char *file = NULL;
+        char *xml = NULL;
+        virDomainDefPtr def;
+
+        if (!STRPREFIX(ent->d_name, "qemuxml2argv-") ||
+            !virFileHasSuffix(ent->d_name, ".xml"))
+            continue;
+
+        if (virAsprintf(&file, "%s/%s", dirname, ent->d_name) < 0 ||
+            virTestLoadFile(file, &xml) < 0) {
+            VIR_FREE(file);
+            goto cleanup;
+        }
+        VIR_FREE(file);
+
+        if (!(def = virDomainDefParseString(xml, driver.caps, driver.xmlopt,
+                                            NULL,
+                                            VIR_DOMAIN_DEF_PARSE_INACTIVE))) {
+            virResetLastError();
+            VIR_FREE(xml);
+            continue;
+        }
+
+        if (VIR_REALLOC_N(data->xmls, data->ndefs + 1) < 0 ||
+            VIR_REALLOC_N(data->defs, data->ndefs + 1) < 0) {
+            virDomainDefFree(def);
+            VIR_FREE(xml);
+            goto cleanup;
+        }
+
+        data->xmls[data->ndefs] = xml;
+        data->defs[data->ndefs] = def;
+        data->ndefs++;
+    }
+
+    if (rc < 0 || data->ndefs == 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_DIR_CLOSE(dir);
+    VIR_FREE(dirname);
+    return ret;
+}
+
+static int
+benchDomain(void)
+{
+    struct benchDomainData data = { NULL };
+    virQEMUCapsPtr qemuCaps = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return -1;
+
+    if (!(qemuCaps = virQEMUCapsNew()) ||
+        qemuTestCapsCacheInsert(driver.qemuCapsCache, qemuCaps) < 0 ||
+        benchDomainLoad(&data) < 0)
+        goto cleanup;
+
+    printf("# domain XML corpus: %zu files from qemuxml2argvdata\n",
+           data.ndefs);
+
+    if (virBenchRun("domain/parse-corpus", benchDomainParse, &data) < 0 ||
+        virBenchRun("domain/format-corpus", benchDomainFormat, &data) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < data.ndefs; i++) {
+        virDomainDefFree(data.defs[i]);
+        VIR_FREE(data.xmls[i]);
+    }
+    VIR_FREE(data.defs);
+    VIR_FREE(data.xmls);
+    virObjectUnref(qemuCaps);
+    qemuTestDriverFree(&driver);
+    return ret;
+}
+#endif /* WITH_QEMU */
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    printf("# %-38s %10s %18s %20s %19s\n",
+           "benchmark", "iterations", "time", "allocations", "memory");
+
+    if (benchHash() < 0)
+        ret = -1;
+    if (benchJSON() < 0)
+        ret = -1;
+    if (benchBuffer() < 0)
+        ret = -1;
+    if (benchBitmap() < 0)
+        ret = -1;
+#ifdef WITH_REMOTE
+    if (benchXDR() < 0)
+        ret = -1;
+#endif
+#ifdef WITH_QEMU
+    if (benchDomain() < 0)
+        ret = -1;
+#endif
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -20,6 +20,7 @@
 #include <config.h>
 
 #include "testutils.h"
+#include "viratomic.h"
 #include "virfile.h"
 #include "virfilecache.h"
 
@@ -88,6 +89,7 @@ struct _testFileCachePriv {
     bool dataSaved;
     const char *newData;
     const char *expectData;
+    int newDataCalls;
 };
 typedef struct _testFileCachePriv testFileCachePriv;
 typedef testFileCachePriv *testFileCachePrivPtr;
@@ -110,6 +112,8 @@ testFileCacheNewData(const char *name ATTRIBUTE_UNUSED,
 {
     testFileCachePrivPtr testPriv = priv;
 
+    virAtomicIntInc(&testPriv->newDataCalls);
+
     return testFileCacheObjNew(testPriv->newData);
 }
 
@@ -202,6 +206,69 @@ testFileCache(const void *opaque)
 }
 
 
+static int
+testFileCachePrefetch(const void *opaque ATTRIBUTE_UNUSED)
+{
+    int ret = -1;
+    testFileCachePriv testPriv = {
+        .newData = "ddd\n",
+        .expectData = "ddd\n",
+    };
+    const char *names[] = {
+        "cacheValid", "cacheInvalid", "cacheMissing", "cacheMissing",
+    };
+    virFileCachePtr cache = NULL;
+    testFileCacheObjPtr obj = NULL;
+    size_t i;
+
+    if (!(cache = virFileCacheNew(abs_srcdir "/virfilecachedata",
+                                  "cache", &testFileCacheHandlers)))
+        return -1;
+
+    virFileCacheSetPriv(cache, &testPriv);
+
+    /* None of the cache files hold the expected data */
+    if (virFileCachePrefetch(cache, names, ARRAY_CARDINALITY(names)) < 0) {
+        fprintf(stderr, "Prefetching data failed.\n");
+        goto cleanup;
+    }
+
+    if (testPriv.newDataCalls != 3) {
+        fprintf(stderr, "Expected 3 data objects to be created, got %d.\n",
+                testPriv.newDataCalls);
+        goto cleanup;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+        if (!(obj = virFileCacheLookup(cache, names[i]))) {
+            fprintf(stderr, "Getting cached data failed.\n");
+            goto cleanup;
+        }
+
+        if (STRNEQ(obj->data, testPriv.expectData)) {
+            fprintf(stderr, "Expect data '%s', loaded data '%s'.\n",
+                    testPriv.expectData, obj->data);
+            goto cleanup;
+        }
+
+        virObjectUnref(obj);
+        obj = NULL;
+    }
+
+    if (testPriv.newDataCalls != 3) {
+        fprintf(stderr, "Prefetched data was created again.\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(obj);
+    virObjectUnref(cache);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -230,6 +297,9 @@ mymain(void)
     TEST_RUN("cacheInvalid", "bbb\n", "bbb\n", true);
     TEST_RUN("cacheMissing", "ccc\n", "ccc\n", true);
 
+    if (virTestRun("prefetch", testFileCachePrefetch, NULL) < 0)
+        ret = -1;
+
     virObjectUnref(cache);
 
     return ret != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
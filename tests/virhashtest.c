@@ -597,6 +597,67 @@ testHashEqual(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+/* Number of entries used by the large table tests */
+#define TEST_HASH_BIG_COUNT 20000
+
+static int
+testHashChurn(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr hash = NULL;
+    char **keys = NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(keys = virTestGenerateKeys(TEST_HASH_BIG_COUNT, 0)) ||
+        !(hash = virHashCreate(0, NULL)))
+        goto cleanup;
+
+    for (i = 0; i < TEST_HASH_BIG_COUNT; i++) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+    }
+
+    /* Removing entries moves the ones following them, make sure
+     * nothing gets lost on the way */
+    for (i = 0; i < TEST_HASH_BIG_COUNT; i += 3) {
+        if (virHashRemoveEntry(hash, keys[i]) < 0) {
+            VIR_TEST_VERBOSE("\nfailed to remove entry \"%s\"\n", keys[i]);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < TEST_HASH_BIG_COUNT; i++) {
+        void *payload = virHashLookup(hash, keys[i]);
+        void *expected = i % 3 ? keys[i] : NULL;
+
+        if (payload != expected) {
+            VIR_TEST_VERBOSE("\nunexpected lookup result for \"%s\"\n",
+                             keys[i]);
+            goto cleanup;
+        }
+    }
+
+    if (testHashCheckCount(hash, TEST_HASH_BIG_COUNT -
+                           (TEST_HASH_BIG_COUNT + 2) / 3) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_HASH_BIG_COUNT; i += 3) {
+        if (virHashAddEntry(hash, keys[i], keys[i]) < 0)
+            goto cleanup;
+    }
+
+    if (testHashCheckCount(hash, TEST_HASH_BIG_COUNT) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(hash);
+    virStringListFree(keys);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -635,6 +696,7 @@ mymain(void)
     DO_TEST("Search", Search);
     DO_TEST("GetItems", GetItems);
     DO_TEST("Equal", Equal);
+    DO_TEST("Churn", Churn);
 
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -6,6 +6,7 @@
 #include <time.h>
 
 #include "internal.h"
+#include "virbuffer.h"
 #include "virjson.h"
 #include "testutils.h"
 
@@ -429,6 +430,188 @@ testJSONEscapeObj(const void *data ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testJSONLargeObject(const void *data ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr value = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *key = NULL;
+    char *expect = NULL;
+    char *result = NULL;
+    unsigned int num;
+    size_t i;
+    int ret = -1;
+
+    if (!(json = virJSONValueNewObject()))
+        goto cleanup;
+
+    /* enough keys to make lookups use the hash index */
+    for (i = 0; i < 100; i++) {
+        if (virAsprintf(&key, "key%zu", i) < 0 ||
+            virJSONValueObjectAppendNumberUint(json, key, i) < 0)
+            goto cleanup;
+        VIR_FREE(key);
+    }
+
+    if (virJSONValueObjectAppendNumberUint(json, "key42", 0) == 0) {
+        VIR_TEST_VERBOSE("duplicate key was accepted\n");
+        goto cleanup;
+    }
+
+    /* remove every third key, which shifts the remaining ones */
+    for (i = 0; i < 100; i += 3) {
+        if (virAsprintf(&key, "key%zu", i) < 0)
+            goto cleanup;
+        if (virJSONValueObjectRemoveKey(json, key, &value) != 1 ||
+            virJSONValueGetNumberUint(value, &num) < 0 || num != i) {
+            VIR_TEST_VERBOSE("failed to remove '%s'\n", key);
+            goto cleanup;
+        }
+        virJSONValueFree(value);
+        value = NULL;
+        VIR_FREE(key);
+    }
+
+    virBufferAddLit(&buf, "{");
+    for (i = 0; i < 100; i++) {
+        if (virAsprintf(&key, "key%zu", i) < 0)
+            goto cleanup;
+
+        if (i % 3 == 0) {
+            if (virJSONValueObjectHasKey(json, key) != 0) {
+                VIR_TEST_VERBOSE("removed key '%s' still present\n", key);
+                goto cleanup;
+            }
+        } else {
+            if (virJSONValueObjectGetNumberUint(json, key, &num) < 0 ||
+                num != i) {
+                VIR_TEST_VERBOSE("lookup of '%s' failed\n", key);
+                goto cleanup;
+            }
+            virBufferAsprintf(&buf, "\"%s\":%zu,", key, i);
+        }
+        VIR_FREE(key);
+    }
+    virBufferTrim(&buf, ",", -1);
+    virBufferAddLit(&buf, "}");
+
+    if (!(expect = virBufferContentAndReset(&buf)) ||
+        !(result = virJSONValueToString(json, false)))
+        goto cleanup;
+
+    if (STRNEQ(expect, result)) {
+        virTestDifference(stderr, expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    virJSONValueFree(json);
+    virJSONValueFree(value);
+    VIR_FREE(key);
+    VIR_FREE(expect);
+    VIR_FREE(result);
+    return ret;
+}
+
+
+static int
+testJSONStreamStart(const char *key,
+                    size_t depth,
+                    virJSONType type,
+                    void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    if (STREQ_NULLABLE(key, "skip"))
+        return VIR_JSON_STREAM_SKIP;
+    if (STREQ_NULLABLE(key, "stop"))
+        return VIR_JSON_STREAM_STOP;
+
+    virBufferAsprintf(buf, "%s%c%zu ", key ? key : "-",
+                      type == VIR_JSON_TYPE_OBJECT ? '{' : '[', depth);
+    return 0;
+}
+
+
+static int
+testJSONStreamEnd(size_t depth,
+                  virJSONType type,
+                  void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    virBufferAsprintf(buf, "%c%zu ",
+                      type == VIR_JSON_TYPE_OBJECT ? '}' : ']', depth);
+    return 0;
+}
+
+
+static int
+testJSONStreamValue(const char *key,
+                    size_t depth,
+                    virJSONType type ATTRIBUTE_UNUSED,
+                    const char *value,
+                    void *opaque)
+{
+    virBufferPtr buf = opaque;
+
+    virBufferAsprintf(buf, "%s=%s@%zu ", key ? key : "-",
+                      NULLSTR(value), depth);
+    return 0;
+}
+
+
+static const virJSONStreamCallbacks testJSONStreamCallbacks = {
+    .start = testJSONStreamStart,
+    .end = testJSONStreamEnd,
+    .value = testJSONStreamValue,
+};
+
+
+static int
+testJSONStream(const void *data)
+{
+    const struct testInfo *info = data;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *result = NULL;
+    int ret = -1;
+
+    if (virJSONValueStreamParse(info->doc, &testJSONStreamCallbacks, &buf) < 0) {
+        if (info->pass) {
+            VIR_TEST_VERBOSE("Fail to parse %s\n", info->doc);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (!info->pass) {
+        VIR_TEST_VERBOSE("Should not have parsed %s\n", info->doc);
+        goto cleanup;
+    }
+
+    virBufferTrim(&buf, " ", -1);
+    if (!(result = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(info->expect, result)) {
+        virTestDifference(stderr, info->expect, result);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(result);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -588,6 +771,21 @@ mymain(void)
                  NULL, true);
     DO_TEST_FULL("create object with nested json in attribute", EscapeObj,
                  NULL, NULL, true);
+    DO_TEST_FULL("lookup and remove in large object", LargeObject,
+                 NULL, NULL, true);
+    DO_TEST_FULL("stream parse", Stream,
+                 "{\"return\": [{\"a\": 1, \"skip\": {\"b\": [2, 3]}, "
+                 "\"c\": \"str\"}, true, null], \"id\": \"libvirt-1\"}",
+                 "-{0 return[1 -{2 a=1@3 c=str@3 }2 -=true@2 -=<null>@2 ]1 "
+                 "id=libvirt-1@1 }0", true);
+    DO_TEST_FULL("stream parse scalar", Stream, "42", "-=42@0", true);
+    DO_TEST_FULL("stream parse trailing garbage", Stream,
+                 "{\"a\": 1} []", NULL, false);
+    DO_TEST_FULL("stream parse unterminated", Stream,
+                 "{\"a\": [1, 2}", NULL, false);
+    DO_TEST_FULL("stream parse stop", Stream,
+                 "{\"a\": 1, \"stop\": {\"b\": 2}, \"c\": [",
+                 "-{0 a=1@1", true);
 
 #define DO_TEST_DEFLATTEN(name, pass) \
     DO_TEST_FULL(name, Deflatten, name, NULL, pass)
@@ -22,6 +22,11 @@
 #include "testutils.h"
 
 #include "virlog.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.virlogtest");
 
 struct testLogData {
     const char *str;
@@ -107,6 +112,119 @@ testLogParseFilters(const void *opaque)
     return ret;
 }
 
+struct testLogAsyncData {
+    size_t nrecords;
+    int nmessages;
+    bool block;         /* Stall the output until all messages are sent */
+
+    virMutex gate;
+    int received;
+    int last;
+    bool ordered;
+};
+
+static void
+testLogAsyncOutput(virLogSourcePtr src ATTRIBUTE_UNUSED,
+                   virLogPriority priority ATTRIBUTE_UNUSED,
+                   const char *filename ATTRIBUTE_UNUSED,
+                   int linenr ATTRIBUTE_UNUSED,
+                   const char *funcname ATTRIBUTE_UNUSED,
+                   const char *timestamp ATTRIBUTE_UNUSED,
+                   virLogMetadataPtr metadata ATTRIBUTE_UNUSED,
+                   unsigned int flags ATTRIBUTE_UNUSED,
+                   const char *rawstr,
+                   const char *str ATTRIBUTE_UNUSED,
+                   void *opaque)
+{
+    struct testLogAsyncData *data = opaque;
+    int n;
+
+    if (sscanf(rawstr, "async message %d", &n) != 1)
+        return;
+
+    if (data->block) {
+        virMutexLock(&data->gate);
+        virMutexUnlock(&data->gate);
+    }
+
+    if (n <= data->last)
+        data->ordered = false;
+    data->last = n;
+    data->received++;
+}
+
+static int
+testLogAsync(const void *opaque)
+{
+    struct testLogAsyncData data = *(const struct testLogAsyncData *)opaque;
+    virLogOutputPtr *outputs = NULL;
+    unsigned int dropped;
+    int ret = -1;
+    int i;
+
+    data.last = -1;
+    data.ordered = true;
+    if (virMutexInit(&data.gate) < 0)
+        return -1;
+
+    if (VIR_ALLOC_N(outputs, 1) < 0 ||
+        !(outputs[0] = virLogOutputNew(testLogAsyncOutput, NULL, &data,
+                                       VIR_LOG_DEBUG, VIR_LOG_TO_STDERR,
+                                       NULL)))
+        goto cleanup;
+
+    if (virLogDefineOutputs(outputs, 1) < 0)
+        goto cleanup;
+    outputs = NULL;
+
+    /* Make sure the log source is up to date with the filters, updating
+     * it would otherwise wait for the stalled writer to drop virLogLock */
+    VIR_WARN("async test starting");
+
+    if (virLogSetAsync(data.nrecords) < 0)
+        goto cleanup;
+
+    dropped = virLogGetAsyncDropped();
+    if (data.block)
+        virMutexLock(&data.gate);
+
+    for (i = 0; i < data.nmessages; i++)
+        VIR_WARN("async message %d", i);
+
+    if (data.block)
+        virMutexUnlock(&data.gate);
+
+    /* Flushes everything queued */
+    if (virLogSetAsync(0) < 0)
+        goto cleanup;
+
+    dropped = virLogGetAsyncDropped() - dropped;
+
+    if (!data.ordered) {
+        VIR_TEST_DEBUG("Messages were written out of order\n");
+        goto cleanup;
+    }
+
+    if (data.received + dropped != data.nmessages) {
+        VIR_TEST_DEBUG("Expected %d messages, got %d and %u dropped\n",
+                       data.nmessages, data.received, dropped);
+        goto cleanup;
+    }
+
+    if (data.block ? dropped == 0 : dropped != 0) {
+        VIR_TEST_DEBUG("Unexpected number of dropped messages: %u\n",
+                       dropped);
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogOutputListFree(outputs, 1);
+    virLogReset();
+    virMutexDestroy(&data.gate);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -151,6 +269,19 @@ mymain(void)
     TEST_PARSE_FILTERS_FAIL(":foo", 1);
     TEST_PARSE_FILTERS_FAIL("1:+", 1);
 
+#define TEST_LOG_ASYNC(records, messages, blocked)                          \
+    do {                                                                    \
+        struct testLogAsyncData data = {                                    \
+            .nrecords = records, .nmessages = messages, .block = blocked,   \
+        };                                                                  \
+        if (virTestRun("testLogAsync " # records " " # messages,            \
+                       testLogAsync, &data) < 0)                            \
+            ret = -1;                                                       \
+    } while (0)
+
+    TEST_LOG_ASYNC(1024, 1000, false);
+    TEST_LOG_ASYNC(4, 1000, true);
+
     return ret;
 }
 
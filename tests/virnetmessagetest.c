@@ -522,6 +522,121 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
 }
 
 
+static int
+testMessagePoolCheckStats(virNetMessagePoolPtr pool,
+                          unsigned long long msgHits,
+                          unsigned long long msgMisses,
+                          unsigned long long bufHits,
+                          unsigned long long bufMisses,
+                          size_t nfreeMsgs,
+                          size_t nfreeBufs)
+{
+    virNetMessagePoolStats stats;
+
+    virNetMessagePoolGetStats(pool, &stats);
+
+    if (stats.msgHits != msgHits ||
+        stats.msgMisses != msgMisses ||
+        stats.bufHits != bufHits ||
+        stats.bufMisses != bufMisses ||
+        stats.nfreeMsgs != nfreeMsgs ||
+        stats.nfreeBufs != nfreeBufs) {
+        VIR_DEBUG("Expect msg %llu/%llu/%zu buf %llu/%llu/%zu "
+                  "got msg %llu/%llu/%zu buf %llu/%llu/%zu",
+                  msgHits, msgMisses, nfreeMsgs,
+                  bufHits, bufMisses, nfreeBufs,
+                  stats.msgHits, stats.msgMisses, stats.nfreeMsgs,
+                  stats.bufHits, stats.bufMisses, stats.nfreeBufs);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int testMessagePool(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessagePoolPtr pool = NULL;
+    virNetMessagePtr msg = NULL;
+    virNetMessagePtr other = NULL;
+    static const char length[] = {
+        0x00, 0x00, 0x00, 0x1c,  /* Length */
+    };
+    int ret = -1;
+
+    if (!(pool = virNetMessagePoolNew(1)))
+        return -1;
+
+    if (!(msg = virNetMessagePoolGet(pool, true)))
+        goto cleanup;
+
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
+        goto cleanup;
+    memcpy(msg->buffer, length, sizeof(length));
+
+    /* The whole call fits into the smallest buffer class */
+    if (virNetMessageDecodeLength(msg) < 0)
+        goto cleanup;
+
+    if (testMessagePoolCheckStats(pool, 0, 1, 0, 1, 0, 0) < 0)
+        goto cleanup;
+
+    /* Growing for the reply swaps the buffer for a larger one
+     * and returns the small one to the pool */
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (msg->bufferAlloc != VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX) {
+        VIR_DEBUG("Expect buffer size %d got %zu",
+                  VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX,
+                  msg->bufferAlloc);
+        goto cleanup;
+    }
+
+    if (testMessagePoolCheckStats(pool, 0, 1, 0, 2, 0, 1) < 0)
+        goto cleanup;
+
+    virNetMessageClear(msg);
+    if (msg->pool != pool || !msg->tracked || msg->buffer) {
+        VIR_DEBUG("Message not reset properly on clear");
+        goto cleanup;
+    }
+
+    /* Next receive reuses the small buffer */
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageResizeBuffer(msg, msg->bufferLength) < 0)
+        goto cleanup;
+
+    if (testMessagePoolCheckStats(pool, 0, 1, 1, 2, 0, 1) < 0)
+        goto cleanup;
+
+    virNetMessageFree(msg);
+    msg = NULL;
+
+    if (testMessagePoolCheckStats(pool, 0, 1, 1, 2, 1, 2) < 0)
+        goto cleanup;
+
+    /* Only one idle message is kept, the second one is freed */
+    if (!(msg = virNetMessagePoolGet(pool, false)) ||
+        !(other = virNetMessagePoolGet(pool, false)))
+        goto cleanup;
+
+    virNetMessageFree(msg);
+    virNetMessageFree(other);
+    msg = other = NULL;
+
+    if (testMessagePoolCheckStats(pool, 1, 2, 1, 2, 1, 2) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virNetMessageFree(msg);
+    virNetMessageFree(other);
+    virObjectUnref(pool);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -544,6 +659,9 @@ mymain(void)
     if (virTestRun("Message Payload Stream Encode", testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Message Pool", testMessagePool, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
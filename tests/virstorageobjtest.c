@@ -0,0 +1,222 @@
+/*
+ * virstorageobjtest.c: Test the volume indexes of storage pool objects
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "virerror.h"
+#include "virstring.h"
+
+#include "conf/virstorageobj.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+
+static virStorageVolDefPtr
+testStorageObjNewVol(const char *name,
+                     const char *key,
+                     const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (VIR_ALLOC(vol) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(vol->name, name) < 0 ||
+        VIR_STRDUP(vol->key, key) < 0 ||
+        VIR_STRDUP(vol->target.path, path) < 0) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+
+static int
+testStorageObjAddVol(virStoragePoolObjPtr obj,
+                     virStorageVolDefPtr *ret,
+                     const char *name,
+                     const char *key,
+                     const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (!(vol = testStorageObjNewVol(name, key, path)))
+        return -1;
+
+    if (virStoragePoolObjAddVol(obj, vol) < 0) {
+        virStorageVolDefFree(vol);
+        return -1;
+    }
+
+    if (ret)
+        *ret = vol;
+    return 0;
+}
+
+
+static int
+testStorageObjCheckVol(virStoragePoolObjPtr obj,
+                       virStorageVolDefPtr expect,
+                       const char *name,
+                       const char *key,
+                       const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if ((vol = virStorageVolDefFindByName(obj, name)) != expect) {
+        VIR_TEST_VERBOSE("name '%s': expected %p, got %p\n",
+                         name, expect, vol);
+        return -1;
+    }
+
+    if ((vol = virStorageVolDefFindByKey(obj, key)) != expect) {
+        VIR_TEST_VERBOSE("key '%s': expected %p, got %p\n",
+                         key, expect, vol);
+        return -1;
+    }
+
+    if ((vol = virStorageVolDefFindByPath(obj, path)) != expect) {
+        VIR_TEST_VERBOSE("path '%s': expected %p, got %p\n",
+                         path, expect, vol);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testStorageObjVolIndex(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjList pools = { 0 };
+    virStoragePoolObjPtr obj = NULL;
+    virStoragePoolDefPtr def = NULL;
+    virStorageVolDefPtr vol1 = NULL;
+    virStorageVolDefPtr vol2 = NULL;
+    virStorageVolDefPtr vol3 = NULL;
+    virStorageVolDefPtr dup = NULL;
+    int ret = -1;
+
+    if (!(def = virStoragePoolDefParseFile(abs_srcdir
+                                           "/storagepoolxml2xmlin/pool-dir.xml")))
+        goto cleanup;
+
+    if (!(obj = virStoragePoolObjAssignDef(&pools, def)))
+        goto cleanup;
+    def = NULL;
+
+    if (testStorageObjAddVol(obj, &vol1, "vol1", "/vol/key1", "/vol/path1") < 0 ||
+        testStorageObjAddVol(obj, &vol2, "vol2", "/vol/key2", "/vol/path2") < 0 ||
+        testStorageObjAddVol(obj, &vol3, "vol3", "/vol/key3", "/vol/path3") < 0)
+        goto cleanup;
+
+    if (testStorageObjCheckVol(obj, vol1, "vol1", "/vol/key1", "/vol/path1") < 0 ||
+        testStorageObjCheckVol(obj, vol2, "vol2", "/vol/key2", "/vol/path2") < 0 ||
+        testStorageObjCheckVol(obj, vol3, "vol3", "/vol/key3", "/vol/path3") < 0 ||
+        testStorageObjCheckVol(obj, NULL, "vol4", "/vol/key4", "/vol/path4") < 0)
+        goto cleanup;
+
+    /* Removing a volume from the middle moves the ones after it */
+    virStoragePoolObjRemoveVol(obj, vol2);
+    virStorageVolDefFree(vol2);
+
+    if (obj->volumes.count != 2 ||
+        testStorageObjCheckVol(obj, vol1, "vol1", "/vol/key1", "/vol/path1") < 0 ||
+        testStorageObjCheckVol(obj, NULL, "vol2", "/vol/key2", "/vol/path2") < 0 ||
+        testStorageObjCheckVol(obj, vol3, "vol3", "/vol/key3", "/vol/path3") < 0)
+        goto cleanup;
+
+    /* Names and keys are unique within the pool */
+    if (testStorageObjAddVol(obj, NULL, "vol4", "/vol/key1", "/vol/path4") == 0) {
+        VIR_TEST_VERBOSE("duplicate key was accepted\n");
+        goto cleanup;
+    }
+
+    if (testStorageObjAddVol(obj, NULL, "vol3", "/vol/key4", "/vol/path4") == 0) {
+        VIR_TEST_VERBOSE("duplicate name was accepted\n");
+        goto cleanup;
+    }
+
+    if (obj->volumes.count != 2 ||
+        testStorageObjCheckVol(obj, vol1, "vol1", "/vol/key1", "/vol/path1") < 0 ||
+        testStorageObjCheckVol(obj, vol3, "vol3", "/vol/key3", "/vol/path3") < 0 ||
+        testStorageObjCheckVol(obj, NULL, "vol4", "/vol/key4", "/vol/path4") < 0)
+        goto cleanup;
+
+    /* A path taken already resolves to the first volume added with it
+     * until that one is removed */
+    if (testStorageObjAddVol(obj, &dup, "vol4", "/vol/key4", "/vol/path1") < 0)
+        goto cleanup;
+
+    if (virStorageVolDefFindByPath(obj, "/vol/path1") != vol1 ||
+        virStorageVolDefFindByName(obj, "vol4") != dup)
+        goto cleanup;
+
+    virStoragePoolObjRemoveVol(obj, vol1);
+    virStorageVolDefFree(vol1);
+
+    if (testStorageObjCheckVol(obj, dup, "vol4", "/vol/key4", "/vol/path1") < 0 ||
+        virStorageVolDefFindByName(obj, "vol1") ||
+        virStorageVolDefFindByKey(obj, "/vol/key1"))
+        goto cleanup;
+
+    /* A refresh clears the volumes and adds them anew */
+    virStoragePoolObjClearVols(obj);
+
+    if (obj->volumes.count != 0 ||
+        testStorageObjCheckVol(obj, NULL, "vol3", "/vol/key3", "/vol/path3") < 0 ||
+        testStorageObjCheckVol(obj, NULL, "vol4", "/vol/key4", "/vol/path1") < 0)
+        goto cleanup;
+
+    if (testStorageObjAddVol(obj, &vol1, "vol1", "/vol/key1", "/vol/path1") < 0 ||
+        testStorageObjAddVol(obj, &vol3, "vol3", "/vol/key3", "/vol/path3") < 0)
+        goto cleanup;
+
+    if (obj->volumes.count != 2 ||
+        testStorageObjCheckVol(obj, vol1, "vol1", "/vol/key1", "/vol/path1") < 0 ||
+        testStorageObjCheckVol(obj, vol3, "vol3", "/vol/key3", "/vol/path3") < 0 ||
+        testStorageObjCheckVol(obj, NULL, "vol4", "/vol/key4", "/vol/path4") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (obj)
+        virStoragePoolObjUnlock(obj);
+    virStoragePoolObjListFree(&pools);
+    virStoragePoolDefFree(def);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virTestRun("volume index", testStorageObjVolIndex, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -17,10 +17,13 @@
 #include <config.h>
 
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "testutils.h"
 #include "virerror.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virstring.h"
 
@@ -74,9 +77,285 @@ testGlusterExtractPoolSources(const void *opaque)
 }
 
 
+/* mtime of images whose modification has to be noticed by a change
+ * of their mtime or inode rather than their size */
+#define TEST_REFRESH_LOCAL_MTIME 1000000000
+
+#define TEST_REFRESH_LOCAL_IMAGE_SIZE 4096
+
+static void
+testRefreshLocalWriteBufBE(char *buf,
+                           unsigned long long val,
+                           size_t size)
+{
+    while (size--) {
+        buf[size] = val & 0xff;
+        val >>= 8;
+    }
+}
+
+
+/* Writes @path as a qcow2 image of @capacity backed by @backing, or as
+ * a raw one if @capacity is 0. The file is padded to @size bytes and
+ * gets an mtime of TEST_REFRESH_LOCAL_MTIME if @oldMtime is set. */
+static int
+testRefreshLocalWriteImage(const char *path,
+                           size_t size,
+                           unsigned long long capacity,
+                           const char *backing,
+                           bool oldMtime)
+{
+    char *buf = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, size) < 0)
+        goto cleanup;
+
+    if (capacity) {
+        memcpy(buf, "QFI\xfb", 4);
+        testRefreshLocalWriteBufBE(buf + 4, 2, 4);
+        testRefreshLocalWriteBufBE(buf + 24, capacity, 8);
+        if (backing) {
+            testRefreshLocalWriteBufBE(buf + 8, 512, 8);
+            testRefreshLocalWriteBufBE(buf + 16, strlen(backing), 4);
+            memcpy(buf + 512, backing, strlen(backing));
+        }
+    }
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        safewrite(fd, buf, size) < 0) {
+        virReportSystemError(errno, "cannot write '%s'", path);
+        goto cleanup;
+    }
+
+    if (oldMtime) {
+        struct timespec times[2] = {
+            { .tv_sec = TEST_REFRESH_LOCAL_MTIME },
+            { .tv_sec = TEST_REFRESH_LOCAL_MTIME },
+        };
+
+        if (futimens(fd, times) < 0) {
+            virReportSystemError(errno, "cannot set times of '%s'", path);
+            goto cleanup;
+        }
+    }
+
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno, "cannot close '%s'", path);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(buf);
+    return ret;
+}
+
+
+struct testRefreshLocalVol {
+    const char *name;
+    int format;
+    unsigned long long capacity;
+    int backingFormat; /* -1 if the volume has no backing store */
+    bool cached;
+};
+
+static int
+testRefreshLocalCheck(virStoragePoolObjPtr obj,
+                      const struct testRefreshLocalVol *vols,
+                      size_t nvols)
+{
+    size_t i;
+
+    if (obj->volumes.count != nvols) {
+        VIR_TEST_VERBOSE("expected %zu volumes, got %zu\n",
+                         nvols, obj->volumes.count);
+        return -1;
+    }
+
+    for (i = 0; i < nvols; i++) {
+        const struct testRefreshLocalVol *exp = &vols[i];
+        virStorageVolDefPtr vol;
+        int backingFormat;
+        bool cached;
+
+        if (!(vol = virStorageVolDefFindByName(obj, exp->name))) {
+            VIR_TEST_VERBOSE("volume '%s' is missing\n", exp->name);
+            return -1;
+        }
+
+        backingFormat = vol->target.backingStore ?
+            vol->target.backingStore->format : -1;
+        cached = !!virHashLookup(obj->privateData, exp->name);
+
+        if (vol->target.format != exp->format ||
+            vol->target.capacity != exp->capacity ||
+            backingFormat != exp->backingFormat ||
+            cached != exp->cached) {
+            VIR_TEST_VERBOSE("volume '%s': expected format=%d capacity=%llu "
+                             "backing=%d cached=%d, got format=%d "
+                             "capacity=%llu backing=%d cached=%d\n",
+                             exp->name, exp->format, exp->capacity,
+                             exp->backingFormat, exp->cached,
+                             vol->target.format, vol->target.capacity,
+                             backingFormat, cached);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testRefreshLocalPool(virStoragePoolObjPtr obj,
+                     const struct testRefreshLocalVol *vols,
+                     size_t nvols)
+{
+    virStoragePoolObjClearVols(obj);
+
+    if (virStorageBackendRefreshLocal(NULL, obj) < 0)
+        return -1;
+
+    return testRefreshLocalCheck(obj, vols, nvols);
+}
+
+
+static int
+testRefreshLocal(const void *opaque)
+{
+    const char *dir = opaque;
+    virStoragePoolObjList pools = { 0 };
+    virStoragePoolObjPtr obj = NULL;
+    virStoragePoolDefPtr def = NULL;
+    char *xml = NULL;
+    char *unchanged = NULL;
+    char *size = NULL;
+    char *mtime = NULL;
+    char *ino = NULL;
+    char *inotmp = NULL;
+    char *overlay = NULL;
+    char *backing = NULL;
+    int ret = -1;
+    const struct testRefreshLocalVol before[] = {
+        { "unchanged.img", VIR_STORAGE_FILE_RAW,
+          TEST_REFRESH_LOCAL_IMAGE_SIZE, -1, true },
+        { "size.img", VIR_STORAGE_FILE_RAW,
+          TEST_REFRESH_LOCAL_IMAGE_SIZE, -1, true },
+        { "mtime.img", VIR_STORAGE_FILE_RAW,
+          TEST_REFRESH_LOCAL_IMAGE_SIZE, -1, true },
+        { "ino.img", VIR_STORAGE_FILE_RAW,
+          TEST_REFRESH_LOCAL_IMAGE_SIZE, -1, true },
+        /* the backing file can't be probed, so its format is faked and
+         * the overlay must be probed again by the next refresh */
+        { "overlay.qcow2", VIR_STORAGE_FILE_QCOW2,
+          1024 * 1024, VIR_STORAGE_FILE_RAW, false },
+    };
+    const struct testRefreshLocalVol after[] = {
+        { "unchanged.img", VIR_STORAGE_FILE_RAW,
+          TEST_REFRESH_LOCAL_IMAGE_SIZE, -1, true },
+        { "size.img", VIR_STORAGE_FILE_RAW,
+          2 * TEST_REFRESH_LOCAL_IMAGE_SIZE, -1, true },
+        { "mtime.img", VIR_STORAGE_FILE_QCOW2,
+          1024 * 1024, -1, true },
+        { "ino.img", VIR_STORAGE_FILE_QCOW2,
+          2 * 1024 * 1024, -1, true },
+        { "overlay.qcow2", VIR_STORAGE_FILE_QCOW2,
+          1024 * 1024, VIR_STORAGE_FILE_QCOW2, true },
+        { "backing.qcow2", VIR_STORAGE_FILE_QCOW2,
+          1024 * 1024, -1, true },
+    };
+
+    if (virAsprintf(&xml,
+                    "<pool type='dir'>"
+                    "  <name>refresh</name>"
+                    "  <target><path>%s</path></target>"
+                    "</pool>", dir) < 0)
+        goto cleanup;
+
+    if (!(def = virStoragePoolDefParseString(xml)))
+        goto cleanup;
+
+    if (!(obj = virStoragePoolObjAssignDef(&pools, def)))
+        goto cleanup;
+    def = NULL;
+
+    if (virAsprintf(&unchanged, "%s/unchanged.img", dir) < 0 ||
+        virAsprintf(&size, "%s/size.img", dir) < 0 ||
+        virAsprintf(&mtime, "%s/mtime.img", dir) < 0 ||
+        virAsprintf(&ino, "%s/ino.img", dir) < 0 ||
+        virAsprintf(&inotmp, "%s/ino.img.tmp", dir) < 0 ||
+        virAsprintf(&overlay, "%s/overlay.qcow2", dir) < 0 ||
+        virAsprintf(&backing, "%s/backing.qcow2", dir) < 0)
+        goto cleanup;
+
+    if (testRefreshLocalWriteImage(unchanged, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   0, NULL, false) < 0 ||
+        testRefreshLocalWriteImage(size, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   0, NULL, false) < 0 ||
+        testRefreshLocalWriteImage(mtime, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   0, NULL, true) < 0 ||
+        testRefreshLocalWriteImage(ino, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   0, NULL, true) < 0 ||
+        testRefreshLocalWriteImage(overlay, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   1024 * 1024, "backing.qcow2", false) < 0)
+        goto cleanup;
+
+    if (testRefreshLocalPool(obj, before, ARRAY_CARDINALITY(before)) < 0)
+        goto cleanup;
+
+    /* Nothing changed, everything but the overlay comes from the cache */
+    if (testRefreshLocalPool(obj, before, ARRAY_CARDINALITY(before)) < 0)
+        goto cleanup;
+
+    /* Grow one image, rewrite another in place keeping its size and
+     * replace a third with a file of the same size and mtime */
+    if (testRefreshLocalWriteImage(size, 2 * TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   0, NULL, false) < 0 ||
+        testRefreshLocalWriteImage(mtime, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   1024 * 1024, NULL, false) < 0 ||
+        testRefreshLocalWriteImage(inotmp, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   2 * 1024 * 1024, NULL, true) < 0 ||
+        testRefreshLocalWriteImage(backing, TEST_REFRESH_LOCAL_IMAGE_SIZE,
+                                   1024 * 1024, NULL, false) < 0)
+        goto cleanup;
+
+    if (rename(inotmp, ino) < 0) {
+        virReportSystemError(errno, "cannot rename '%s'", inotmp);
+        goto cleanup;
+    }
+
+    if (testRefreshLocalPool(obj, after, ARRAY_CARDINALITY(after)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    if (obj)
+        virStoragePoolObjUnlock(obj);
+    virStoragePoolObjListFree(&pools);
+    virStoragePoolDefFree(def);
+    VIR_FREE(xml);
+    VIR_FREE(unchanged);
+    VIR_FREE(size);
+    VIR_FREE(mtime);
+    VIR_FREE(ino);
+    VIR_FREE(inotmp);
+    VIR_FREE(overlay);
+    VIR_FREE(backing);
+    return ret;
+}
+
+
+#define SCRATCHDIRTEMPLATE abs_builddir "/storageutildir-XXXXXX"
+
 static int
 mymain(void)
 {
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
     int ret = 0;
 
 #define DO_TEST_GLUSTER_EXTRACT_POOL_SOURCES_FULL(testname, sffx, pooltype)    \
@@ -108,6 +387,17 @@ mymain(void)
 #undef DO_TEST_GLUSTER_EXTRACT_POOL_SOURCES_NETFS
 #undef DO_TEST_GLUSTER_EXTRACT_POOL_SOURCES_FULL
 
+    if (!mkdtemp(scratchdir)) {
+        virFilePrintf(stderr, "Cannot create storageutildir");
+        abort();
+    }
+
+    if (virTestRun("refresh local pool", testRefreshLocal, scratchdir) < 0)
+        ret = -1;
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -1989,6 +1989,10 @@ static const vshCmdOptDef opts_domstats[] = {
      .type = VSH_OT_BOOL,
      .help = N_("add backing chain information to block stats"),
     },
+    {.name = "sampled",
+     .type = VSH_OT_BOOL,
+     .help = N_("report the stats sampled in the background by the daemon"),
+    },
     {.name = "domain",
      .type = VSH_OT_ARGV,
      .flags = VSH_OFLAG_NONE,
@@ -2088,6 +2092,9 @@ cmdDomstats(vshControl *ctl, const vshCmd *cmd)
     if (vshCommandOptBool(cmd, "backing"))
         flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_BACKING;
 
+    if (vshCommandOptBool(cmd, "sampled"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_SAMPLED;
+
     if (vshCommandOptBool(cmd, "domain")) {
         if (VIR_ALLOC_N(domlist, 1) < 0)
             goto cleanup;
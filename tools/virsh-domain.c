@@ -5959,6 +5959,25 @@ cmdDomjobinfo(vshControl *ctl, const vshCmd *cmd)
         vshPrint(ctl, "%-17s %-13d\n", _("Auto converge throttle:"), ivalue);
     }
 
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_TUNNEL_BYTES,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc) {
+        val = vshPrettyCapacity(value, &unit);
+        vshPrint(ctl, "%-17s %-.3lf %s\n", _("Tunnel data:"), val, unit);
+    }
+
+    if ((rc = virTypedParamsGetULLong(params, nparams,
+                                      VIR_DOMAIN_JOB_TUNNEL_BPS,
+                                      &value)) < 0) {
+        goto save_error;
+    } else if (rc && value) {
+        val = vshPrettyCapacity(value, &unit);
+        vshPrint(ctl, "%-17s %-.3lf %s/s\n",
+                 _("Tunnel bandwidth:"), val, unit);
+    }
+
     ret = true;
 
  cleanup:
@@ -867,6 +867,68 @@ cmdSrvClientsInfo(vshControl *ctl, const vshCmd *cmd)
     return ret;
 }
 
+/* --------------------------------
+ * Command server-message-pool-info
+ * --------------------------------
+ */
+
+static const vshCmdInfo info_srv_message_pool_info[] = {
+    {.name = "help",
+     .data = N_("get server's RPC message pool statistics")
+    },
+    {.name = "desc",
+     .data = N_("Retrieve statistics of the pool server's RPC messages "
+                "and buffers are recycled through")
+    },
+    {.name = NULL}
+};
+
+static const vshCmdOptDef opts_srv_message_pool_info[] = {
+    {.name = "server",
+     .type = VSH_OT_DATA,
+     .flags = VSH_OFLAG_REQ,
+     .help = N_("Server to retrieve the message pool statistics from."),
+    },
+    {.name = NULL}
+};
+
+static bool
+cmdSrvMessagePoolInfo(vshControl *ctl, const vshCmd *cmd)
+{
+    bool ret = false;
+    virTypedParameterPtr params = NULL;
+    int nparams = 0;
+    size_t i;
+    const char *srvname = NULL;
+    virAdmServerPtr srv = NULL;
+    vshAdmControlPtr priv = ctl->privData;
+
+    if (vshCommandOptStringReq(ctl, cmd, "server", &srvname) < 0)
+        return false;
+
+    if (!(srv = virAdmConnectLookupServer(priv->conn, srvname, 0)))
+        goto cleanup;
+
+    if (virAdmServerGetMessagePoolStats(srv, &params, &nparams, 0) < 0) {
+        vshError(ctl, "%s", _("Unable to retrieve message pool statistics "
+                              "from server"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < nparams; i++) {
+        char *str = vshGetTypedParamValue(ctl, &params[i]);
+        vshPrint(ctl, "%-12s: %s\n", params[i].field, str);
+        VIR_FREE(str);
+    }
+
+    ret = true;
+
+ cleanup:
+    virTypedParamsFree(params, nparams);
+    virAdmServerFree(srv);
+    return ret;
+}
+
 /* -----------------------
  * Command srv-clients-set
  * -----------------------
@@ -1419,6 +1481,12 @@ static const vshCmdDef monitoringCmds[] = {
      .info = info_srv_clients_info,
      .flags = 0
     },
+    {.name = "server-message-pool-info",
+     .handler = cmdSrvMessagePoolInfo,
+     .opts = opts_srv_message_pool_info,
+     .info = info_srv_message_pool_info,
+     .flags = 0
+    },
     {.name = NULL}
 };
 